@@ -0,0 +1,99 @@
+-- -----------------------------------------------------------------------------
+-- Benchmark: cost of 64 bit labels (create_xmlindex_tables(wide_labels => true))
+-- compared to default int labels.
+--
+-- Run by psql in empty database, it doesn't need pgxml installed:
+--   psql -f bench/xmlindex_labels.sql
+--
+-- Both variants of element_table are filled by same synthetic documents (every
+-- document is a complete binary tree, so pre_order/size are consistent with
+-- what loader produce). They get the primary key and elem_tab_all_index
+-- (name, did, pre_order, size) of create_indexes_on_tables, which is the
+-- btree used by structural queries; the GiST indexes of create_indexes_on_tables
+-- need pgxml types and are left out.
+-- -----------------------------------------------------------------------------
+
+\set ndocs 2000
+\set depth 10
+\timing on
+
+DROP TABLE IF EXISTS bench_element_int;
+DROP TABLE IF EXISTS bench_element_bigint;
+
+CREATE TABLE bench_element_int
+	(name text, did int not null, pre_order int not null, size int not null,
+	 depth int, parent_id int, prev_id int, child_id int, attr_id int,
+	 PRIMARY KEY (did, pre_order, size));
+
+CREATE TABLE bench_element_bigint
+	(name text, did bigint not null, pre_order bigint not null, size bigint not null,
+	 depth int, parent_id bigint, prev_id bigint, child_id bigint, attr_id bigint,
+	 PRIMARY KEY (did, pre_order, size));
+
+-- node n (heap numbering, root = 1) of complete binary tree of given depth
+-- has pre_order computed from its path and size 2^(depth-level+1)-2
+CREATE TEMP VIEW bench_nodes AS
+WITH RECURSIVE t(n, lvl, pre_order, parent) AS (
+	SELECT 1, 1, 1, -1
+	UNION ALL
+	SELECT 2 * n + c, lvl + 1,
+		pre_order + 1 + c * ((1 << (:depth - lvl)) - 1),
+		pre_order
+	FROM t, (VALUES (0), (1)) AS ch(c)
+	WHERE lvl < :depth
+)
+SELECT 'tag' || (n % 50) AS name, pre_order,
+	(1 << (:depth - lvl + 1)) - 2 AS size, lvl AS depth, parent
+FROM t;
+
+\echo '=== load int labels'
+INSERT INTO bench_element_int
+SELECT name, d, pre_order, size, depth, parent, -1, -1, -1
+FROM generate_series(1, :ndocs) d, bench_nodes;
+
+\echo '=== load bigint labels'
+INSERT INTO bench_element_bigint
+SELECT name, d, pre_order, size, depth, parent, -1, -1, -1
+FROM generate_series(1, :ndocs) d, bench_nodes;
+
+\echo '=== build indexes int labels'
+CREATE INDEX bench_int_all_index ON bench_element_int (name, did, pre_order, size);
+
+\echo '=== build indexes bigint labels'
+CREATE INDEX bench_bigint_all_index ON bench_element_bigint (name, did, pre_order, size);
+
+VACUUM ANALYZE bench_element_int;
+VACUUM ANALYZE bench_element_bigint;
+
+\echo '=== sizes'
+SELECT c.relname,
+	pg_size_pretty(pg_relation_size(c.oid)) AS size,
+	pg_relation_size(c.oid) AS bytes
+FROM pg_class c
+WHERE c.relname IN ('bench_element_int', 'bench_element_int_pkey', 'bench_int_all_index',
+		'bench_element_bigint', 'bench_element_bigint_pkey', 'bench_bigint_all_index')
+ORDER BY c.relname;
+
+\echo '=== point lookup by name, did, pre_order'
+EXPLAIN (ANALYZE, BUFFERS)
+SELECT count(*) FROM bench_element_int e
+WHERE e.name = 'tag7' AND e.did BETWEEN 100 AND 200;
+
+EXPLAIN (ANALYZE, BUFFERS)
+SELECT count(*) FROM bench_element_bigint e
+WHERE e.name = 'tag7' AND e.did BETWEEN 100 AND 200;
+
+\echo '=== descendants of all tag3 nodes (pre_order, size containment)'
+EXPLAIN (ANALYZE, BUFFERS)
+SELECT count(*) FROM bench_element_int a, bench_element_int d
+WHERE a.name = 'tag3' AND a.did <= 50 AND d.did = a.did
+	AND d.pre_order > a.pre_order AND d.pre_order <= a.pre_order + a.size;
+
+EXPLAIN (ANALYZE, BUFFERS)
+SELECT count(*) FROM bench_element_bigint a, bench_element_bigint d
+WHERE a.name = 'tag3' AND a.did <= 50 AND d.did = a.did
+	AND d.pre_order > a.pre_order AND d.pre_order <= a.pre_order + a.size;
+
+DROP VIEW bench_nodes;
+DROP TABLE bench_element_int;
+DROP TABLE bench_element_bigint;
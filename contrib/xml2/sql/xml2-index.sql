@@ -1,3 +1,69 @@
 select build_xmlindex('<?xml version="1.0"?><doc at="jedna" bt="dve" ct="tri" d="4"><tag pp="neco"><pokus at="ctyri" /></tag></doc>', 'test');
 select build_xmlindex('<?xml version="1.0" encoding="ISO-8859-1"?><?xml-stylesheet href="latest_ob.xsl" type="text/xsl"?><current_observation version="1.0"	 xmlns:xsd="http://www.w3.org/2001/XMLSchema"	 xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"	 xsi:noNamespaceSchemaLocation="http://www.weather.gov/view/current_observation.xsd">	<credit>NOAAs National Weather Service</credit>	<credit_URL>http://weather.gov/</credit_URL>	<image>		<url>http://weather.gov/images/xml_logo.gif</url>		<title>NOAAs National Weather Service</title>		<link>http://weather.gov</link>	</image>	<suggested_pickup>15 minutes after the hour</suggested_pickup>	<suggested_pickup_period>60</suggested_pickup_period>	<location>Stratus</location>	<station_id>32ST0</station_id>	<latitude>-19.713</latitude>	<longitude>-85.585</longitude>	<observation_time>Last Updated on Aug 11 2011, 1:00 am ST </observation_time>        <observation_time_rfc822>Thu, 11 Aug 2011 01:00:00 +0000</observation_time_rfc822>	<temperature_string>61.3 F (16.3 C)</temperature_string>	<temp_f>61.3</temp_f>	<temp_c>16.3</temp_c>	<water_temp_f>64.8</water_temp_f>	<water_temp_c>18.2</water_temp_c>	<wind_string>Southeast at 15.7 MPH (13.6 KT)</wind_string>	<wind_dir>Southeast</wind_dir>	<wind_degrees>130</wind_degrees>	<wind_mph>15.7</wind_mph>	<wind_kt>13.6</wind_kt>	<pressure_string>1019.0 mb</pressure_string>	<pressure_mb>1019.0</pressure_mb>	<dewpoint_string>59.7 F (15.4 C)</dewpoint_string>	<dewpoint_f>59.7</dewpoint_f>	<dewpoint_c>15.4</dewpoint_c>	<windchill_string>59 F (15 C)</windchill_string>      	<windchill_f>59</windchill_f>      	<windchill_c>15</windchill_c>	<mean_wave_dir>South</mean_wave_dir>	<mean_wave_degrees></mean_wave_degrees>	<disclaimer_url>http://weather.gov/disclaimer.html</disclaimer_url>	<copyright_url>http://weather.gov/disclaimer.html</copyright_url>	<privacy_policy_url>http://weather.gov/notice.html</privacy_policy_url></current_observation>', 'pokus2');
-select build_xmlindex('<?xml version="1.0" encoding="ISO-8859-1"?><?xml-stylesheet href="latest_ob.xsl" type="text/xsl"?><current_observation version="1.0"	 xmlns:xsd="http://www.w3.org/2001/XMLSchema"	 xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"	 xsi:noNamespaceSchemaLocation="http://www.weather.gov/view/current_observation.xsd">	<credit>NOAAs National Weather Service</credit>	<credit_URL>http://weather.gov/</credit_URL>	<image>		<url>http://weather.gov/images/xml_logo.gif</url>		<title>NOAAs National Weather Service</title>		<link>http://weather.gov</link>	</image>	<suggested_pickup>15 minutes after the hour</suggested_pickup>	<suggested_pickup_period>60</suggested_pickup_period>	<location>San Antonio, Stinson Municipal Airport, TX</location>	<station_id>KSSF</station_id>	<latitude>29.33</latitude>	<longitude>-98.47</longitude>	<observation_time>Last Updated on Aug 11 2011, 3:53 am CDT</observation_time>        <observation_time_rfc822>Thu, 11 Aug 2011 03:53:00 -0500</observation_time_rfc822>	<weather>Mostly Cloudy</weather>	<temperature_string>84.0 F (28.9 C)</temperature_string>	<temp_f>84.0</temp_f>	<temp_c>28.9</temp_c>	<relative_humidity>74</relative_humidity>	<wind_string>from the Southeast at 17.3 gusting to 21.9 MPH (15 gusting to 19 KT)</wind_string>	<wind_dir>Southeast</wind_dir>	<wind_degrees>140</wind_degrees>	<wind_mph>17.3</wind_mph>	<wind_gust_mph>21.9</wind_gust_mph>	<wind_kt>15</wind_kt>	<wind_gust_kt>19</wind_gust_kt>	<pressure_string>1008.0 mb</pressure_string>	<pressure_mb>1008.0</pressure_mb>	<pressure_in>29.81</pressure_in>	<dewpoint_string>75.0 F (23.9 C)</dewpoint_string>	<dewpoint_f>75.0</dewpoint_f>	<dewpoint_c>23.9</dewpoint_c>	<heat_index_string>92 F (33 C)</heat_index_string>      	<heat_index_f>92</heat_index_f>      	<heat_index_c>33</heat_index_c>	<visibility_mi>10.00</visibility_mi> 	<icon_url_base>http://weather.gov/weather/images/fcicons/</icon_url_base>	<two_day_history_url>http://www.weather.gov/data/obhistory/KSSF.html</two_day_history_url>	<icon_url_name>nbkn.jpg</icon_url_name>	<ob_url>http://www.nws.noaa.gov/data/METAR/KSSF.1.txt</ob_url>	<disclaimer_url>http://weather.gov/disclaimer.html</disclaimer_url>	<copyright_url>http://weather.gov/disclaimer.html</copyright_url>	<privacy_policy_url>http://weather.gov/notice.html</privacy_policy_url></current_observation>', 'pokus3');
\ No newline at end of file
+select build_xmlindex('<?xml version="1.0" encoding="ISO-8859-1"?><?xml-stylesheet href="latest_ob.xsl" type="text/xsl"?><current_observation version="1.0"	 xmlns:xsd="http://www.w3.org/2001/XMLSchema"	 xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"	 xsi:noNamespaceSchemaLocation="http://www.weather.gov/view/current_observation.xsd">	<credit>NOAAs National Weather Service</credit>	<credit_URL>http://weather.gov/</credit_URL>	<image>		<url>http://weather.gov/images/xml_logo.gif</url>		<title>NOAAs National Weather Service</title>		<link>http://weather.gov</link>	</image>	<suggested_pickup>15 minutes after the hour</suggested_pickup>	<suggested_pickup_period>60</suggested_pickup_period>	<location>San Antonio, Stinson Municipal Airport, TX</location>	<station_id>KSSF</station_id>	<latitude>29.33</latitude>	<longitude>-98.47</longitude>	<observation_time>Last Updated on Aug 11 2011, 3:53 am CDT</observation_time>        <observation_time_rfc822>Thu, 11 Aug 2011 03:53:00 -0500</observation_time_rfc822>	<weather>Mostly Cloudy</weather>	<temperature_string>84.0 F (28.9 C)</temperature_string>	<temp_f>84.0</temp_f>	<temp_c>28.9</temp_c>	<relative_humidity>74</relative_humidity>	<wind_string>from the Southeast at 17.3 gusting to 21.9 MPH (15 gusting to 19 KT)</wind_string>	<wind_dir>Southeast</wind_dir>	<wind_degrees>140</wind_degrees>	<wind_mph>17.3</wind_mph>	<wind_gust_mph>21.9</wind_gust_mph>	<wind_kt>15</wind_kt>	<wind_gust_kt>19</wind_gust_kt>	<pressure_string>1008.0 mb</pressure_string>	<pressure_mb>1008.0</pressure_mb>	<pressure_in>29.81</pressure_in>	<dewpoint_string>75.0 F (23.9 C)</dewpoint_string>	<dewpoint_f>75.0</dewpoint_f>	<dewpoint_c>23.9</dewpoint_c>	<heat_index_string>92 F (33 C)</heat_index_string>      	<heat_index_f>92</heat_index_f>      	<heat_index_c>33</heat_index_c>	<visibility_mi>10.00</visibility_mi> 	<icon_url_base>http://weather.gov/weather/images/fcicons/</icon_url_base>	<two_day_history_url>http://www.weather.gov/data/obhistory/KSSF.html</two_day_history_url>	<icon_url_name>nbkn.jpg</icon_url_name>	<ob_url>http://www.nws.noaa.gov/data/METAR/KSSF.1.txt</ob_url>	<disclaimer_url>http://weather.gov/disclaimer.html</disclaimer_url>	<copyright_url>http://weather.gov/disclaimer.html</copyright_url>	<privacy_policy_url>http://weather.gov/notice.html</privacy_policy_url></current_observation>', 'pokus3');
+select xmlindex_needs_rebuild();
+select rebuild_xmlindex(true);
+select rebuild_xmlindex_part(2, 0);
+select build_xmlindex('<?xml version="1.0"?><doc at="jedna"><order id="1"><item>a</item><note>skip</note></order><misc><item>b</item></misc></doc>', 'selective', '{/doc/order}', '{//note}', true);
+select build_xmlindex('<?xml version="1.0"?><doc at="jedna"><order id="1"><item>a</item></order></doc>', 'selective-notext', '{//item}', '{}', false);
+select create_xmlindex_inlined('shop', '<xs:schema xmlns:xs="http://www.w3.org/2001/XMLSchema"><xs:complexType name="Item"><xs:sequence><xs:element name="price" type="xs:decimal"/><xs:element name="tag" type="xs:string" minOccurs="0" maxOccurs="unbounded"/></xs:sequence><xs:attribute name="id" type="xs:int"/></xs:complexType><xs:element name="order"><xs:complexType><xs:sequence><xs:element name="date" type="xs:date"/><xs:element name="item" type="Item" maxOccurs="unbounded"/></xs:sequence></xs:complexType></xs:element></xs:schema>');
+select build_xmlindex_inlined('shop', '<order><date>2011-08-11</date><item id="1"><price>3.50</price><tag>a</tag><tag>b</tag></item><item id="2"><price>12</price></item></order>', 'inlined');
+select o.date, i.id, i.price from shop_order o join shop_item i on i.did = o.did and i.parent_node = o.node_id where i.price > 10;
+select build_xmlindex('<?xml version="1.0"?><a><b>1</b><b>2</b></a>', 'validated', '<xs:schema xmlns:xs="http://www.w3.org/2001/XMLSchema"><xs:element name="a"><xs:complexType><xs:sequence><xs:element name="b" type="xs:int" maxOccurs="unbounded"/></xs:sequence></xs:complexType></xs:element></xs:schema>'::xsd);
+select build_xmlindex('<?xml version="1.0"?><a><b>1</b><b>x</b></a>', 'invalid', '<xs:schema xmlns:xs="http://www.w3.org/2001/XMLSchema"><xs:element name="a"><xs:complexType><xs:sequence><xs:element name="b" type="xs:int" maxOccurs="unbounded"/></xs:sequence></xs:complexType></xs:element></xs:schema>'::xsd);
+select build_xmlindex('<?xml version="1.0"?><a><b>1</b></a>', 'validated-rng', '<element name="a" xmlns="http://relaxng.org/ns/structure/1.0"><oneOrMore><element name="b"><text/></element></oneOrMore></element>'::rng);
+select * from xml_shred('<?xml version="1.0"?><doc at="jedna"><tag pp="neco">text</tag></doc>');
+select name, count(*) from xml_shred('<?xml version="1.0"?><doc><a/><a/><b/></doc>') where kind = 1 group by name;
+-- needs two local instances with pgxml installed (initdb, port 5433 and 5434)
+select create_xmlindex_shards('{port=5433 dbname=postgres, port=5434 dbname=postgres}');
+select build_xmlindex_sharded('<?xml version="1.0"?><doc><a><b/></a></doc>', 'sharded1');
+select build_xmlindex_sharded('<?xml version="1.0"?><doc><a/><b/></doc>', 'sharded2');
+select * from xmlindex_shard_query('select a.did, d.pre_order from element_table a join element_table d on d.did = a.did and d.pre_order > a.pre_order and d.pre_order <= a.pre_order + a.size where a.name = ''a'' and d.name = ''b''') as t(did int, pre_order int);
+select * from structural_join('select did, pre_order, size, depth from element_table where name = ''doc'' order by did, pre_order', 'select did, pre_order, size, depth from element_table where name = ''tag'' order by did, pre_order');
+select * from structural_join('select did, pre_order, size, depth from element_table order by did, pre_order', 'select did, pre_order, size, depth from element_table where name = ''item'' order by did, pre_order', 1, true);
+select * from twig_join('//order[@id]/item');
+select * from twig_join('//current_observation[station_id=''KSSF'']//image/url');
+select * from xpath_shredded('/doc/tag/pokus/@at', true);
+select * from xpath_shredded('//current_observation[temp_f > 80]/station_id', true);
+select * from xpath_shredded('//item[2]', true);
+select xpath_shredded_query('//order[@id][not(note)]//item[last()]');
+explain select d.did, d.pre_order from element_table d where node_interval(d.did, d.pre_order, d.size) <@ '(1,0,100)'::node_interval;
+select xml_axis_window(xml_plane_point(1, 2, 5, 1), 'descendant'), xml_plane_point(1, 3, 0, 2) <@ xml_axis_window(xml_plane_point(1, 2, 5, 1), 'child');
+select c.name, e.name, e.pre_order from element_table c, element_table e where c.did = 1 and c.depth = 1 and xml_plane_point(e.did, e.pre_order, e.size, e.depth) <@ xml_axis_window(xml_plane_point(c.did, c.pre_order, c.size, c.depth), 'following') order by c.pre_order, e.pre_order;
+select create_xmlindex_postings();
+select build_xmlindex('<?xml version="1.0"?><order><item/><item><item/></item></order>', 'postings');
+select * from tag_postings('item');
+select * from structural_join('select * from tag_postings(''order'')', 'select * from tag_postings(''item'')');
+select * from tag_join('order', 'item');
+select * from structural_join_stats();
+select e.name, j.* from tag_join('order', 'item', 1, true, 1, 100) j join element_table e on e.did = j.did and e.pre_order = j.ancestor;
+select analyze_xmlindex(100);
+select * from xml_index_stats;
+select * from xml_tag_stats order by nodes desc;
+select * from xml_path_stats order by path;
+explain select a.did, d.pre_order from element_table a, element_table d where a.name = 'order' and node_interval(a.did, a.pre_order, a.size) @> node_interval(d.did, d.pre_order, d.size);
+select serialize_subtree(did, pre_order) from element_table where depth = 0 order by did;
+select serialize_subtree(did, pre_order) from element_table where name = 'item';
+select xml_attribute_key('id', 'X123') = xml_attribute_key('id', 'X123'), xml_attribute_key('id', 'X123') = xml_attribute_key('idX', '123');
+select * from xpath_shredded('//order[@id=''1'']', true);
+select xpath_shredded_query('//*[@status=''open'']');
+select * from twig_join('//order[@id=''1'']/item');
+select build_xmlindex('<?xml version="1.0"?><list><item a="1"/><note/><item a="2">x</item><item/></list>', 'siblings');
+select name, pre_order, sibling_ord, prev_id, next_id from element_table where did = (select did from xml_documents_table where name = 'siblings') order by pre_order;
+select n.* from element_table e, xml_navigate(e.did, e.pre_order, 'child') n where e.name = 'list' and e.did = (select did from xml_documents_table where name = 'siblings');
+select n.* from element_table e, xml_navigate(e.did, e.pre_order, 'following-sibling') n where e.name = 'note';
+select n.* from element_table e, xml_navigate(e.did, e.pre_order, 'next-sibling') n where e.name = 'note';
+select n.* from element_table e, xml_navigate(e.did, e.pre_order, 'attribute') n where e.name = 'item';
+select * from xpath_shredded('/list/item[2]/@a', true);
+select * from xpath_shredded('/list/item[last()]', true);
+select xpath_shredded_query('//item[position() < 3]');
+select * from structural_semijoin('select did, pre_order, size, depth from element_table where name = ''order'' order by did, pre_order', 'select did, pre_order, size, depth from element_table where name = ''item'' order by did, pre_order');
+select * from structural_join_stats();
+select kernel, matches from containment_benchmark(10000, 100, 1);
+select create_xpath_view('order_view', array['//order/@id', '//order/item']);
+select * from order_view order by did, xpath, pre_order;
+select build_xmlindex('<?xml version="1.0"?><order id="7"><item>z</item></order>', 'view');
+select * from order_view where did = (select did from xml_documents_table where name = 'view') order by xpath, pre_order;
+delete from xml_documents_table where name = 'view';
+select count(*) from order_view where did not in (select did from xml_documents_table);
+select drop_xpath_view('order_view');
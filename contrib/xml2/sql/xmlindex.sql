@@ -0,0 +1,224 @@
+--
+-- indexing functions are defined by pgxml.sql, turn off echoing so that
+-- expected file does not depend on its contents
+--
+SET client_min_messages = warning;
+DROP EXTENSION IF EXISTS xml2;
+\set ECHO none
+\o /dev/null
+\i pgxml.sql
+\o
+\set ECHO all
+
+--
+-- materialised XPath views
+--
+-- shredding works before any view exists
+select build_xmlindex('<doc><item id="1"/><item id="2"/></doc>', 'views1');
+select create_xpath_view('item_ids', '{//item/@id}');
+select d.name, v.xpath, v.pre_order, v.value from item_ids v
+	left join xml_documents_table d on d.did = v.did order by v.value;
+-- loader adds rows of new document
+select build_xmlindex('<doc><item id="3"/></doc>', 'views2');
+select d.name, v.xpath, v.pre_order, v.value from item_ids v
+	left join xml_documents_table d on d.did = v.did order by v.value;
+-- trigger removes rows of deleted document
+delete from xml_documents_table where name = 'views1';
+select d.name, v.xpath, v.pre_order, v.value from item_ids v
+	left join xml_documents_table d on d.did = v.did order by v.value;
+select drop_xpath_view('item_ids');
+select drop_xpath_view('item_ids');
+select count(*) from pg_class where relname = 'item_ids';
+-- catalog of views stays, shredding works without views
+select build_xmlindex('<doc><item id="4"/></doc>', 'views3');
+
+--
+-- twig join, stream of one branch ends before nodes of other branch
+--
+select build_xmlindex('<a><b><x/></b><c/></a>', 'twig');
+select d.name, t.nodes from twig_join('//a[b/x]//c') t
+	join xml_documents_table d on d.did = t.did;
+select d.name, t.nodes from twig_join('//a[c]//b/x') t
+	join xml_documents_table d on d.did = t.did;
+
+--
+-- inlined document has no state of shredding, joins don't shred it into
+-- generic tables
+--
+select create_xmlindex_inlined('inl', '<xs:schema xmlns:xs="http://www.w3.org/2001/XMLSchema"><xs:element name="shop"><xs:complexType><xs:sequence><xs:element name="price" type="xs:int"/></xs:sequence></xs:complexType></xs:element></xs:schema>') > 0;
+select build_xmlindex_inlined('inl', '<shop><price>10</price></shop>', 'inlined');
+select price from inl_shop;
+select count(*) from twig_join('//shop/price');
+select count(*) from element_table e
+	join xml_documents_table d on d.did = e.did where d.name = 'inlined';
+select xmlindex_is_current(did) from xml_documents_table where name = 'inlined';
+
+--
+-- reshredded document replaces its postings in every block spanning its did
+--
+select create_xmlindex_postings() > 0;
+select build_xmlindex(('<r>' || repeat('<i/>', 200) || '</r>')::xml, 'postings');
+select count(*) from tag_postings('i');
+-- shredded rows are lost, rebuild shreds document again
+delete from element_table where did in
+	(select did from xml_documents_table where name = 'postings');
+delete from xml_shredded_documents where did in
+	(select did from xml_documents_table where name = 'postings');
+select rebuild_xmlindex_part(1, 0);
+select count(*), count(distinct pre_order) from tag_postings('i');
+
+--
+-- documents of query tests, nodes of library in document order:
+-- lib 1, book 2, @id 3, @lang 4, title 5, "XML" 6, author 7, "Xu" 8,
+-- book 9, @id 10, title 11, "SQL" 12, note 13
+--
+create function docid(text) returns bigint
+	as 'select did::bigint from xml_documents_table where name = $1'
+	language sql stable;
+select create_xmlindex_keywords() > 0;
+select build_xmlindex('<lib><book id="1" lang="en"><title>XML</title><author>Xu</author></book><book id="2"><title>SQL</title><note/></book></lib>', 'library');
+select build_xmlindex('<kw><b>alpha beta</b><c>alpha</c><d>beta</d></kw>', 'kw');
+
+--
+-- XPath compiled into queries of shredded tables
+--
+select pre_order, value from xpath_shredded('/lib/book/title', docid('library'), true) order by pre_order;
+select pre_order from xpath_shredded('//book[@id="2"]/title', docid('library'));
+select pre_order, value from xpath_shredded('//book[2]/@id', docid('library'), true);
+select pre_order from xpath_shredded('//book[last()]/title', docid('library'));
+select pre_order, value from xpath_shredded('//book[not(note)]/author', docid('library'), true);
+select pre_order, value from xpath_shredded('//title/text()', docid('library'), true) order by pre_order;
+select pre_order, value from xpath_shredded('//author/..', docid('library'), true);
+select pre_order from xpath_shredded('//book[@id > 1]/title', docid('library'));
+
+--
+-- structural joins, queries read all documents
+--
+select ancestor, descendant from structural_join(
+	'select did, pre_order, size, depth from element_table where name = ''lib'' order by did, pre_order',
+	'select did, pre_order, size, depth from element_table where name = ''title'' order by did, pre_order')
+	where did = docid('library') order by 1, 2;
+select ancestor, descendant from structural_join(
+	'select did, pre_order, size, depth from element_table order by did, pre_order',
+	'select did, pre_order, size, depth from element_table where name = ''title'' order by did, pre_order',
+	1, true) where did = docid('library') order by 1, 2;
+select pre_order from structural_semijoin(
+	'select did, pre_order, size, depth from element_table where name = ''book'' order by did, pre_order',
+	'select did, pre_order, size, depth from element_table order by did, pre_order')
+	where did = docid('library') order by 1;
+-- postings are enabled above
+select ancestor, descendant from tag_join('book', 'title', 1, true, docid('library'), docid('library')) order by 1, 2;
+select ancestor, descendant from tag_join('lib', 'note', 0, false, docid('library'), docid('library'));
+select nodes from twig_join('//book[title]/author', docid('library'), docid('library'));
+select nodes from twig_join('//lib//book[note]/title', docid('library'), docid('library'));
+
+--
+-- node intervals and pre/post plane, GiST indexes answer containment
+--
+select node_interval(1, 2, 5);
+select node_interval(1, 2, 5) @> '(1,3,4)'::node_interval, '(1,3,4)'::node_interval <@ node_interval(1, 2, 5), node_interval(2, 2, 5) @> '(1,3,4)'::node_interval;
+select '(1,5,9)'::node_interval && '(1,9,12)'::node_interval, '(1,5,8)'::node_interval && '(1,9,12)'::node_interval;
+select xml_plane_point(1, 2, 6, 1);
+set enable_seqscan = off;
+select pre_order from element_table
+	where node_interval(did, pre_order, size) <@ node_interval(docid('library'), 2, 6) order by 1;
+select pre_order from element_table
+	where node_interval(did, pre_order, size) @> node_interval(docid('library'), 11, 1) order by 1;
+select e.pre_order from element_table c, element_table e
+	where c.did = docid('library') and c.pre_order = 9 and xml_plane_point(e.did, e.pre_order, e.size, e.depth) <@
+		xml_axis_window(xml_plane_point(c.did, c.pre_order, c.size, c.depth), 'preceding') order by 1;
+select e.pre_order from element_table c, element_table e
+	where c.did = docid('library') and c.pre_order = 5 and xml_plane_point(e.did, e.pre_order, e.size, e.depth) <@
+		xml_axis_window(xml_plane_point(c.did, c.pre_order, c.size, c.depth), 'following') order by 1;
+select e.pre_order from element_table c, element_table e
+	where c.did = docid('library') and c.pre_order = 1 and xml_plane_point(e.did, e.pre_order, e.size, e.depth) <@
+		xml_axis_window(xml_plane_point(c.did, c.pre_order, c.size, c.depth), 'child') order by 1;
+select e.pre_order from element_table c, element_table e
+	where c.did = docid('library') and c.pre_order = 11 and xml_plane_point(e.did, e.pre_order, e.size, e.depth) <@
+		xml_axis_window(xml_plane_point(c.did, c.pre_order, c.size, c.depth), 'ancestor') order by 1;
+reset enable_seqscan;
+
+--
+-- serialization of subtree, attribute is its value
+--
+select serialize_subtree(docid('library'), 1);
+select serialize_subtree(docid('library'), 9);
+select serialize_subtree(docid('library'), 4);
+select serialize_subtree(docid('library'), 99) is null;
+
+--
+-- navigation along axes, context can be attribute or text node
+--
+select * from xml_navigate(docid('library'), 1, 'child');
+select * from xml_navigate(docid('library'), 2, 'attribute');
+select * from xml_navigate(docid('library'), 2, 'descendant');
+select * from xml_navigate(docid('library'), 11, 'ancestor');
+select * from xml_navigate(docid('library'), 12, 'parent');
+select * from xml_navigate(docid('library'), 5, 'following-sibling');
+select * from xml_navigate(docid('library'), 7, 'preceding-sibling');
+select * from xml_navigate(docid('library'), 2, 'next-sibling');
+select * from xml_navigate(docid('library'), 9, 'previous-sibling');
+select * from xml_navigate(docid('library'), 5, 'following');
+select * from xml_navigate(docid('library'), 9, 'preceding');
+select * from xml_navigate(docid('library'), 3, 'following-sibling');
+
+--
+-- keyword search
+--
+select xml_keyword_tokens('Hello, World-42 ok');
+select pre_order, name, depth from keyword_search('alpha beta') where did = docid('kw') order by pre_order;
+select pre_order, name, depth from keyword_search('alpha beta', 10, true) where did = docid('kw') order by pre_order;
+select pre_order, name from keyword_search('xu sql') where did = docid('library');
+
+--
+-- dump of shredded tables is imported back
+--
+create temp table separate_dump as select export_xmlindex('/tmp/xmlindex_regress.dump') as n;
+select import_xmlindex('/tmp/xmlindex_regress.dump') = n from separate_dump;
+select serialize_subtree(docid('library'), 9);
+select pre_order, value from xpath_shredded('/lib/book/title', docid('library'), true) order by pre_order;
+
+--
+-- lazy shredding, eviction of idle documents and queue
+--
+select register_xmldocument('<doc><lazy/></doc>', 'lazy') > 0;
+select xmlindex_is_current(docid('lazy'));
+select xmlindex_ensure_shredded(docid('lazy'));
+select xmlindex_ensure_shredded(docid('lazy'));
+select serialize_subtree(docid('lazy'), 1);
+update xml_shred_state set last_access = now() - interval '1 day' where did = docid('lazy');
+select evict_xmlindex('1 hour');
+select xmlindex_is_current(docid('lazy'));
+select pre_order from xpath_shredded('//lazy', docid('lazy'));
+select xmlindex_is_current(docid('lazy'));
+select enqueue_xmldocument('<doc><queued/></doc>', 'queued') > 0;
+select xmlindex_is_current(docid('queued'));
+select process_xmlindex_queue(10);
+select xmlindex_is_current(docid('queued'));
+
+--
+-- unified layout keeps all nodes in node_table
+--
+create schema unified;
+set search_path = unified, public;
+select create_xmlindex_tables(false, false, true);
+select build_xmlindex('<lib><book id="1" lang="en"><title>XML</title><author>Xu</author></book><book id="2"><title>SQL</title><note/></book></lib>', 'library');
+select pre_order, value from xpath_shredded('/lib/book/title', docid('library'), true) order by pre_order;
+select pre_order, value from xpath_shredded('//book[2]/@id', docid('library'), true);
+select pre_order, value from xpath_shredded('//title/text()', docid('library'), true) order by pre_order;
+select serialize_subtree(docid('library'), 1);
+select * from xml_navigate(docid('library'), 1, 'child');
+select * from xml_navigate(docid('library'), 2, 'attribute');
+select * from xml_navigate(docid('library'), 12, 'ancestor');
+select ancestor, descendant from tag_join('book', 'title', 1, true, docid('library'), docid('library')) order by 1, 2;
+select nodes from twig_join('//book[title]/author', docid('library'), docid('library'));
+select pre_order from node_table
+	where kind = 1 and node_interval(did, pre_order, size) <@ node_interval(docid('library'), 2, 6) order by 1;
+select register_xmldocument('<doc><lazy/></doc>', 'lazy') > 0;
+select xmlindex_is_current(docid('lazy'));
+select serialize_subtree(docid('lazy'), 1);
+select xmlindex_is_current(docid('lazy'));
+create temp table unified_dump as select export_xmlindex('/tmp/xmlindex_regress.dump') as n;
+select import_xmlindex('/tmp/xmlindex_regress.dump') = n from unified_dump;
+select serialize_subtree(docid('library'), 9);
+reset search_path;
@@ -38,6 +38,14 @@ DROP TYPE xsd CASCADE;
 
 DROP TYPE rng CASCADE;
 
+DROP TYPE node_interval CASCADE;
+
+DROP TYPE gnode_interval CASCADE;
+
+DROP TYPE xml_plane_point CASCADE;
+
+DROP TYPE xml_plane_window CASCADE;
+
 DROP FUNCTION xmlvalidate_xsd(xml, text);
 
 DROP FUNCTION xmlvalidate_rng(xml, text);
@@ -50,9 +58,106 @@ DROP FUNCTION xmlvalidate_dtd(xml, text);
 --
 DROP FUNCTION build_xmlindex(xml, text);
 
-DROP FUNCTION create_xmlindex_tables();
+DROP FUNCTION build_xmlindex(xml, text, text[], text[], boolean);
+
+-- build_xmlindex(xml, text, xsd|rng|dtd) are dropped with types
+
+DROP FUNCTION xml_shred(xml);
+
+DROP FUNCTION register_xmldocument(xml, text);
+
+DROP FUNCTION xmlindex_ensure_shredded(bigint);
+
+DROP FUNCTION evict_xmlindex(interval);
+
+DROP FUNCTION enqueue_xmldocument(xml, text);
+
+DROP FUNCTION process_xmlindex_queue(int);
+
+DROP FUNCTION xmlindex_is_current(bigint);
+
+DROP FUNCTION export_xmlindex(text);
+
+DROP FUNCTION import_xmlindex(text);
+
+DROP FUNCTION create_xmlindex_shards(text[]);
+
+DROP FUNCTION xmlindex_shard_of(bigint);
+
+DROP FUNCTION build_xmlindex_sharded(xml, text);
+
+DROP FUNCTION xmlindex_shard_query(text);
+
+DROP FUNCTION xmlindex_shard_query(text, bigint);
+
+DROP FUNCTION structural_join(text, text, int, boolean);
+
+DROP FUNCTION tag_join(text, text, int, boolean, bigint, bigint);
+
+DROP FUNCTION structural_join_stats();
+
+DROP FUNCTION twig_join(text);
+
+DROP FUNCTION xpath_shredded(text, boolean);
+
+DROP FUNCTION xpath_shredded(text, bigint, boolean);
+
+DROP FUNCTION xpath_shredded_query(text);
+
+DROP FUNCTION create_xmlindex_postings();
+
+DROP FUNCTION tag_postings(text);
+
+DROP FUNCTION analyze_xmlindex(int);
+
+DROP FUNCTION serialize_subtree(bigint, bigint);
+
+DROP FUNCTION xml_attribute_key(text, text) CASCADE;
+
+DROP FUNCTION xml_navigate(bigint, bigint, text);
+
+DROP FUNCTION structural_semijoin(text, text);
+
+DROP FUNCTION containment_benchmark(int, int, int);
+
+DROP FUNCTION create_xpath_view(text, text[]);
+
+DROP FUNCTION drop_xpath_view(text);
+
+DROP FUNCTION xpath_views_document_trigger() CASCADE;
+
+DROP FUNCTION keyword_search(text, int, boolean);
+
+DROP FUNCTION create_xmlindex_keywords();
+
+DROP FUNCTION xml_keyword_tokens(text) CASCADE;
+
+DROP FUNCTION create_xmlindex_tables(boolean, boolean, boolean);
+
+DROP FUNCTION xmlindex_needs_rebuild();
+
+DROP FUNCTION rebuild_xmlindex(boolean);
+
+DROP FUNCTION rebuild_xmlindex_part(int, int);
+
+-- create_xmlindex_inlined(text, xsd) is dropped with type xsd
+
+DROP FUNCTION build_xmlindex_inlined(text, xml, text);
 
-DROP TABLE attribute_table CASCADE;
-DROP TABLE element_table CASCADE;
-DROP TABLE text_table CASCADE;
+DROP TABLE IF EXISTS attribute_table CASCADE;
+DROP TABLE IF EXISTS element_table CASCADE;
+DROP TABLE IF EXISTS text_table CASCADE;
+DROP TABLE IF EXISTS node_table CASCADE;
+DROP TABLE IF EXISTS xml_index_settings CASCADE;
+DROP TABLE IF EXISTS xml_shred_state CASCADE;
+DROP TABLE IF EXISTS xml_shredded_documents CASCADE;
+DROP TABLE IF EXISTS xml_shred_queue CASCADE;
+DROP TABLE IF EXISTS xml_inline_schemas CASCADE;
+DROP TABLE IF EXISTS xml_index_shards CASCADE;
+DROP TABLE IF EXISTS xml_tag_postings CASCADE;
+DROP TABLE IF EXISTS xml_index_stats CASCADE;
+DROP TABLE IF EXISTS xml_tag_stats CASCADE;
+DROP TABLE IF EXISTS xml_path_stats CASCADE;
+DROP TABLE IF EXISTS xml_xpath_views CASCADE;
+DROP TABLE IF EXISTS xml_keywords CASCADE;
 DROP TABLE xml_documents_table CASCADE;
\ No newline at end of file
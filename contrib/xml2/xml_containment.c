@@ -0,0 +1,401 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_containment.c
+// desc:	Batch containment test: block of up to 64 nodes (did, pre_order)
+//			sorted in document order is tested against sorted disjoint
+//			intervals (did, low, high), result is bit mask of contained
+//			nodes. Vector of nodes is compared with all intervals which
+//			can overlap it, without branch per node. AVX2 tests 4 nodes,
+//			SSE4.2 2 nodes, other targets use scalar merge. SSE2 has no 64
+//			bit compare, its emulation by 32 bit lanes is slower than
+//			scalar merge and is built only with -DXML_CONTAIN_SSE2. Kernel
+//			is chosen at compile time (make XML_SIMD_CFLAGS=-mavx2).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_structural_join.h"
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "portability/instr_time.h"
+#include "utils/builtins.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define XML_CONTAIN_KERNEL "avx2"
+#define XML_CONTAIN_WIDTH 4
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define XML_CONTAIN_KERNEL "sse4.2"
+#define XML_CONTAIN_WIDTH 2
+#elif defined(__SSE2__) && defined(XML_CONTAIN_SSE2)
+#include <emmintrin.h>
+#define XML_CONTAIN_KERNEL "sse2"
+#define XML_CONTAIN_WIDTH 2
+#else
+#define XML_CONTAIN_KERNEL "scalar"
+#endif
+
+/* externally accessible functions */
+Datum	containment_benchmark(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(containment_benchmark);
+
+/*
+ * Node key (did, pre) is before interval, interval is before node key
+ */
+#define NODE_BEFORE_INTERVAL(d, p, iv) \
+	((d) < (iv)->did || ((d) == (iv)->did && (p) < (iv)->low))
+#define INTERVAL_BEFORE_NODE(iv, d, p) \
+	((iv)->did < (d) || ((iv)->did == (d) && (iv)->high < (p)))
+
+/*
+ * Scalar kernel, merge of nodes and intervals
+ */
+uint64
+xml_contain_block_scalar(const xml_label *dids, const xml_label *pres, int count,
+		const xml_join_interval *intervals, int nintervals)
+{
+	uint64		mask = 0;
+	int			i;
+	int			j = 0;
+
+	Assert(count <= XML_CONTAIN_BLOCK);
+
+	for (i = 0; i < count; i++)
+	{
+		while (j < nintervals && INTERVAL_BEFORE_NODE(&intervals[j], dids[i], pres[i]))
+		{
+			j++;
+		}
+		if (j == nintervals)
+		{
+			break;
+		}
+		if (intervals[j].did == dids[i] && intervals[j].low <= pres[i])
+		{
+			mask |= UINT64CONST(1) << i;
+		}
+	}
+
+	return mask;
+}
+
+#if defined(__AVX2__)
+
+/*
+ * Bits of 4 nodes of vector contained in interval
+ */
+static inline int
+contain_vector(__m256i did, __m256i pre, const xml_join_interval *interval)
+{
+	__m256i		same = _mm256_cmpeq_epi64(did, _mm256_set1_epi64x(interval->did));
+	__m256i		below = _mm256_cmpgt_epi64(_mm256_set1_epi64x(interval->low), pre);
+	__m256i		above = _mm256_cmpgt_epi64(pre, _mm256_set1_epi64x(interval->high));
+	__m256i		in = _mm256_andnot_si256(_mm256_or_si256(below, above), same);
+
+	return _mm256_movemask_pd(_mm256_castsi256_pd(in));
+}
+
+#define LOAD_VECTOR(p) _mm256_loadu_si256((const __m256i *) (p))
+typedef __m256i contain_vector_t;
+
+#elif defined(XML_CONTAIN_WIDTH)
+
+#ifdef __SSE4_2__
+#define sse2_cmpgt_epi64(a, b) _mm_cmpgt_epi64(a, b)
+#define sse2_cmpeq_epi64(a, b) _mm_cmpeq_epi64(a, b)
+#else
+
+/*
+ * Signed 64 bit a > b by 32 bit lanes: high halves signed, low halves
+ * unsigned (sign bit flipped)
+ */
+static inline __m128i
+sse2_cmpgt_epi64(__m128i a, __m128i b)
+{
+	__m128i		bias = _mm_set1_epi32((int) 0x80000000);
+	__m128i		high_gt = _mm_cmpgt_epi32(a, b);
+	__m128i		high_eq = _mm_cmpeq_epi32(a, b);
+	__m128i		low_gt = _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+	__m128i		gt;
+
+	gt = _mm_or_si128(high_gt,
+			_mm_and_si128(high_eq, _mm_shuffle_epi32(low_gt, _MM_SHUFFLE(2, 2, 0, 0))));
+	return _mm_shuffle_epi32(gt, _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+static inline __m128i
+sse2_cmpeq_epi64(__m128i a, __m128i b)
+{
+	__m128i		eq = _mm_cmpeq_epi32(a, b);
+
+	return _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+#endif
+
+static inline __m128i
+sse2_set1_epi64(xml_label value)
+{
+	return _mm_set_epi32((int) (value >> 32), (int) value,
+			(int) (value >> 32), (int) value);
+}
+
+/*
+ * Bits of 2 nodes of vector contained in interval
+ */
+static inline int
+contain_vector(__m128i did, __m128i pre, const xml_join_interval *interval)
+{
+	__m128i		same = sse2_cmpeq_epi64(did, sse2_set1_epi64(interval->did));
+	__m128i		below = sse2_cmpgt_epi64(sse2_set1_epi64(interval->low), pre);
+	__m128i		above = sse2_cmpgt_epi64(pre, sse2_set1_epi64(interval->high));
+	__m128i		in = _mm_andnot_si128(_mm_or_si128(below, above), same);
+
+	return _mm_movemask_pd(_mm_castsi128_pd(in));
+}
+
+#define LOAD_VECTOR(p) _mm_loadu_si128((const __m128i *) (p))
+typedef __m128i contain_vector_t;
+
+#endif
+
+/*
+ * Containment of block of nodes in intervals
+ * @param dids documents of nodes, sorted with pres in document order
+ * @param pres pre_orders of nodes
+ * @param count number of nodes, at most XML_CONTAIN_BLOCK
+ * @param intervals sorted disjoint intervals, low and high included
+ * @return bit i is set when node i is in some interval
+ */
+uint64
+xml_contain_block(const xml_label *dids, const xml_label *pres, int count,
+		const xml_join_interval *intervals, int nintervals)
+{
+#ifdef XML_CONTAIN_WIDTH
+	uint64		mask = 0;
+	int			i;
+	int			j = 0;
+
+	Assert(count <= XML_CONTAIN_BLOCK);
+
+	for (i = 0; i + XML_CONTAIN_WIDTH <= count; i += XML_CONTAIN_WIDTH)
+	{
+		contain_vector_t did = LOAD_VECTOR(dids + i);
+		contain_vector_t pre = LOAD_VECTOR(pres + i);
+		int			last = i + XML_CONTAIN_WIDTH - 1;
+		int			k;
+
+		// intervals ending before first node of vector are not needed again
+		while (j < nintervals && INTERVAL_BEFORE_NODE(&intervals[j], dids[i], pres[i]))
+		{
+			j++;
+		}
+		// every interval starting up to last node of vector can match
+		for (k = j; k < nintervals &&
+				!NODE_BEFORE_INTERVAL(dids[last], pres[last], &intervals[k]); k++)
+		{
+			mask |= (uint64) contain_vector(did, pre, &intervals[k]) << i;
+		}
+	}
+
+	// tail shorter than vector
+	if (i < count)
+	{
+		mask |= xml_contain_block_scalar(dids + i, pres + i, count - i,
+				intervals + j, nintervals - j) << i;
+	}
+
+	return mask;
+#else
+	return xml_contain_block_scalar(dids, pres, count, intervals, nintervals);
+#endif
+}
+
+/*
+ * Name of kernel used by xml_contain_block
+ */
+const char *
+xml_contain_kernel(void)
+{
+	return XML_CONTAIN_KERNEL;
+}
+
+/*
+ * Positions of set bits of mask in ascending order
+ * @return number of positions
+ */
+int
+xml_mask_positions(uint64 mask, int *positions)
+{
+	int			count = 0;
+
+	while (mask != 0)
+	{
+#ifdef __GNUC__
+		positions[count++] = __builtin_ctzll(mask);
+#else
+		int			bit = 0;
+
+		while ((mask & (UINT64CONST(1) << bit)) == 0)
+		{
+			bit++;
+		}
+		positions[count++] = bit;
+#endif
+		mask &= mask - 1;
+	}
+
+	return count;
+}
+
+typedef uint64 (*contain_kernel)(const xml_label *dids, const xml_label *pres,
+		int count, const xml_join_interval *intervals, int nintervals);
+
+/*
+ * Time of kernel over all blocks of nodes
+ */
+static double
+benchmark_kernel(contain_kernel kernel, const xml_label *dids, const xml_label *pres,
+		int nodes, const xml_join_interval *intervals, int nintervals, int loops,
+		int64 *matches)
+{
+	instr_time	start;
+	instr_time	duration;
+	int			loop;
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (loop = 0; loop < loops; loop++)
+	{
+		int			i;
+		int			j = 0;
+
+		*matches = 0;
+		for (i = 0; i < nodes; i += XML_CONTAIN_BLOCK)
+		{
+			int			count = Min(XML_CONTAIN_BLOCK, nodes - i);
+			uint64		mask;
+
+			// intervals before block are skipped as by the join
+			while (j < nintervals &&
+					INTERVAL_BEFORE_NODE(&intervals[j], dids[i], pres[i]))
+			{
+				j++;
+			}
+			mask = kernel(dids + i, pres + i, count, intervals + j, nintervals - j);
+			while (mask != 0)
+			{
+				(*matches)++;
+				mask &= mask - 1;
+			}
+		}
+	}
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	return INSTR_TIME_GET_MILLISEC(duration) / loops;
+}
+
+/*
+ * Microbenchmark of containment kernels on synthetic document order:
+ * nodes spread over documents of 1000 positions, intervals are disjoint
+ * subtrees covering about half of positions
+ * @param nodes number of tested nodes
+ * @param intervals number of intervals
+ * @param loops repetitions, time is average
+ * @return (kernel, milliseconds, matches) of scalar and compiled kernel
+ */
+Datum
+containment_benchmark(PG_FUNCTION_ARGS)
+{
+	int32		nodes = PG_GETARG_INT32(0);
+	int32		nintervals = PG_GETARG_INT32(1);
+	int32		loops = PG_GETARG_INT32(2);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext oldcontext;
+	xml_label  *dids;
+	xml_label  *pres;
+	xml_join_interval *intervals;
+	uint32		seed = 1;
+	xml_label	position = 0;
+	int			i;
+	int			k;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+			(rsinfo->allowedModes & SFRM_Materialize) == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+	if (nodes <= 0 || nintervals <= 0 || loops <= 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("nodes, intervals and loops must be positive")));
+	}
+
+	// global position p is node (p / 1000 + 1, p % 1000)
+	dids = (xml_label *) palloc(sizeof(xml_label) * nodes);
+	pres = (xml_label *) palloc(sizeof(xml_label) * nodes);
+	for (i = 0; i < nodes; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		position += 1 + (seed >> 16) % 8;
+		dids[i] = position / 1000 + 1;
+		pres[i] = position % 1000;
+	}
+
+	// every interval needs slot of at least two positions
+	nintervals = Min(nintervals, Max(position / 2, 1));
+	intervals = (xml_join_interval *) palloc(sizeof(xml_join_interval) * nintervals);
+	for (k = 0; k < nintervals; k++)
+	{
+		xml_label	width = position / nintervals;
+		xml_label	low = k * width;
+
+		intervals[k].did = low / 1000 + 1;
+		intervals[k].low = low % 1000;
+		// half of slot, cut at end of document
+		intervals[k].high = Min(intervals[k].low + Max(width / 2, 1) - 1, 999);
+	}
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	for (k = 0; k < 2; k++)
+	{
+		Datum		values[3];
+		bool		nulls[3] = {false, false, false};
+		int64		matches;
+		double		milliseconds;
+
+		milliseconds = benchmark_kernel(k == 0 ? xml_contain_block_scalar : xml_contain_block,
+				dids, pres, nodes, intervals, nintervals, loops, &matches);
+
+		values[0] = CStringGetTextDatum(k == 0 ? "scalar" : xml_contain_kernel());
+		values[1] = Float8GetDatum(milliseconds);
+		values[2] = Int64GetDatum(matches);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}
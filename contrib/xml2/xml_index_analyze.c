@@ -0,0 +1,327 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_index_analyze.c
+// desc:	Statistics of XML structure of shredded tables, collected by
+//			analyze_xmlindex(): summary of collection (xml_index_stats),
+//			per-tag counts, fan-out and depth histograms (xml_tag_stats)
+//			and per-path counts with equi-depth value histograms
+//			(xml_path_stats). Tag counts and depths are exact, fan-out and
+//			paths come from sample of documents and are scaled. Selectivity
+//			estimators of containment operators read the summary, which is
+//			cached per backend until xml_index_stats is invalidated.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include "catalog/namespace.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+#include "utils/inval.h"
+
+// number of buckets of value histograms
+#define XML_ANALYZE_BUCKETS 10
+// statistics target of name columns, rare tags get own MCV entry
+#define XML_ANALYZE_NAME_TARGET 1000
+// rows of xml_index_stats kept in cache, summary has six of them
+#define XML_STATS_CACHE_SIZE 16
+
+/* externally accessible functions */
+Datum	analyze_xmlindex(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(analyze_xmlindex);
+
+// summary of collection read by planner, loaded once per backend
+typedef struct stats_cache stats_cache;
+struct stats_cache {
+	bool		valid;
+	Oid			relid;			// xml_index_stats, InvalidOid if missing
+	int			count;
+	char		names[XML_STATS_CACHE_SIZE][NAMEDATALEN];
+	double		values[XML_STATS_CACHE_SIZE];
+};
+
+static stats_cache cache;
+static bool cache_callback_registered = false;
+
+static void
+execute_analyze_query(const char *query, int expected, const char *what)
+{
+	int			result = SPI_execute(query, false, 0);
+
+	if (result < 0 || (expected != 0 && result != expected))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not collect statistics of %s", what)));
+	}
+}
+
+/*
+ * Relcache callback. analyze_xmlindex truncates xml_index_stats, so every
+ * new summary (and creation or drop of the table) invalidates cache.
+ */
+static void
+stats_cache_invalidate(Datum arg, Oid relid)
+{
+	if (!OidIsValid(relid) || !OidIsValid(cache.relid) || relid == cache.relid)
+	{
+		cache.valid = false;
+	}
+}
+
+/*
+ * Read all rows of xml_index_stats to cache, table which doesn't exist
+ * (collection was not analyzed) gives empty cache
+ */
+static void
+stats_cache_load(void)
+{
+	int			i;
+
+	if (!cache_callback_registered)
+	{
+		CacheRegisterRelcacheCallback(stats_cache_invalidate, (Datum) 0);
+		cache_callback_registered = true;
+	}
+
+	cache.count = 0;
+	// name of missing table would fail already in parser
+	cache.relid = RelnameGetRelid("xml_index_stats");
+	if (OidIsValid(cache.relid))
+	{
+		SPI_connect();
+
+		if (SPI_execute("SELECT name, value FROM xml_index_stats",
+				true, XML_STATS_CACHE_SIZE) == SPI_OK_SELECT)
+		{
+			for (i = 0; i < SPI_processed; i++)
+			{
+				char	   *name = SPI_getvalue(SPI_tuptable->vals[i],
+						SPI_tuptable->tupdesc, 1);
+				bool		isnull;
+				Datum		value = SPI_getbinval(SPI_tuptable->vals[i],
+						SPI_tuptable->tupdesc, 2, &isnull);
+
+				if (name == NULL || isnull)
+				{
+					continue;
+				}
+				strlcpy(cache.names[cache.count], name, NAMEDATALEN);
+				cache.values[cache.count] = DatumGetFloat8(value);
+				cache.count++;
+			}
+		}
+
+		SPI_finish();
+	}
+
+	cache.valid = true;
+}
+
+/*
+ * Value of xml_index_stats, collected by analyze_xmlindex. Called by
+ * selectivity estimators during planning, so values are cached.
+ * @param name statistic (documents, elements, nodes, avg_depth, max_depth)
+ * @param default_value returned when collection was not analyzed
+ */
+double
+xml_index_statistic(const char *name, double default_value)
+{
+	int			i;
+
+	if (!cache.valid)
+	{
+		stats_cache_load();
+	}
+
+	for (i = 0; i < cache.count; i++)
+	{
+		if (strcmp(cache.names[i], name) == 0)
+		{
+			return cache.values[i];
+		}
+	}
+
+	return default_value;
+}
+
+/*
+ * Collect statistics of shredded tables
+ * @param sample number of documents sampled for fan-out and path statistics
+ * @return number of distinct tags
+ */
+Datum
+analyze_xmlindex(PG_FUNCTION_ARGS)
+{
+	int32		sample = PG_GETARG_INT32(0);
+	int			layout = get_index_layout();
+	const char *elements;
+	const char *attributes;
+	const char *texts;
+	StringInfoData query;
+	double		documents = 0;
+	double		sampled = 0;
+	double		scale;
+	bool		isnull;
+	int32		tags;
+
+	if (sample <= 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("sample of analyze_xmlindex must be positive")));
+	}
+
+	if (layout == LAYOUT_UNIFIED)
+	{
+		elements = "(SELECT did, pre_order, size, name, depth, parent_id "
+				"FROM node_table WHERE kind = 1)";
+		attributes = "(SELECT did, name, parent_id, value "
+				"FROM node_table WHERE kind = 2)";
+		texts = "(SELECT did, parent_id, value FROM node_table WHERE kind = 3)";
+	} else
+	{
+		elements = "element_table";
+		attributes = "attribute_table";
+		texts = "text_table";
+	}
+
+	SPI_connect();
+
+	// planner statistics of tables, with long MCV list of names
+	initStringInfo(&query);
+	if (layout == LAYOUT_UNIFIED)
+	{
+		appendStringInfo(&query,
+				"ALTER TABLE node_table ALTER COLUMN name SET STATISTICS %d; "
+				"ANALYZE node_table;", XML_ANALYZE_NAME_TARGET);
+	} else
+	{
+		appendStringInfo(&query,
+				"ALTER TABLE element_table ALTER COLUMN name SET STATISTICS %d; "
+				"ALTER TABLE attribute_table ALTER COLUMN name SET STATISTICS %d; "
+				"ANALYZE element_table; ANALYZE attribute_table; ANALYZE text_table;",
+				XML_ANALYZE_NAME_TARGET, XML_ANALYZE_NAME_TARGET);
+	}
+	execute_analyze_query(query.data, 0, "shredded tables");
+
+	execute_analyze_query(
+			"CREATE TABLE IF NOT EXISTS xml_index_stats "
+							"(name text PRIMARY KEY, "
+							"value float8); "
+			"CREATE TABLE IF NOT EXISTS xml_tag_stats "
+							"(name text PRIMARY KEY, "
+							"nodes bigint, "
+							"documents bigint, "
+							"avg_fanout float8, "
+							"max_fanout bigint, "
+							"avg_depth float8, "
+							"depths int[], "
+							"depth_frequencies float8[]); "
+			"CREATE TABLE IF NOT EXISTS xml_path_stats "
+							"(path text PRIMARY KEY, "
+							"nodes bigint, "
+							"documents bigint, "
+							"value_histogram text[]); "
+			"TRUNCATE xml_index_stats, xml_tag_stats, xml_path_stats; "
+			"DROP TABLE IF EXISTS pg_temp.xml_analyze_sample;",
+			0, "statistics tables");
+
+	// documents are identified by their root
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+			"CREATE TEMP TABLE xml_analyze_sample ON COMMIT DROP AS "
+			"SELECT did FROM %s r WHERE depth = 0 ORDER BY random() LIMIT %d",
+			elements, sample);
+	execute_analyze_query(query.data, 0, "sample");
+
+	// summary of collection, size of root counts all nodes of document
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+			"INSERT INTO xml_index_stats "
+			"SELECT 'documents', count(*) FROM %s r WHERE depth = 0 "
+			"UNION ALL SELECT 'nodes', coalesce(sum(size + 1), 0) FROM %s r WHERE depth = 0 "
+			"UNION ALL SELECT 'elements', count(*) FROM %s e "
+			"UNION ALL SELECT 'avg_depth', coalesce(avg(depth), 0) FROM %s e "
+			"UNION ALL SELECT 'max_depth', coalesce(max(depth), 0) FROM %s e "
+			"UNION ALL SELECT 'sample', count(*) FROM xml_analyze_sample",
+			elements, elements, elements, elements, elements);
+	execute_analyze_query(query.data, SPI_OK_INSERT, "collection");
+
+	if (SPI_execute("SELECT (SELECT value FROM xml_index_stats WHERE name = 'documents'), "
+					"(SELECT value FROM xml_index_stats WHERE name = 'sample')",
+			true, 1) == SPI_OK_SELECT && SPI_processed > 0)
+	{
+		documents = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0],
+				SPI_tuptable->tupdesc, 1, &isnull));
+		sampled = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0],
+				SPI_tuptable->tupdesc, 2, &isnull));
+	}
+	scale = sampled > 0 ? documents / sampled : 1;
+
+	// per tag, counts and depths exact, fan-out from sample
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+			"INSERT INTO xml_tag_stats "
+			"WITH d AS (SELECT name, depth, count(*) AS c FROM %s e GROUP BY name, depth), "
+			"t AS (SELECT name, count(*) AS nodes, count(DISTINCT did) AS documents, "
+					"avg(depth) AS avg_depth FROM %s e GROUP BY name), "
+			"c AS (SELECT e.did, e.parent_id, count(*) AS children "
+					"FROM %s e JOIN xml_analyze_sample s ON s.did = e.did "
+					"GROUP BY e.did, e.parent_id), "
+			"f AS (SELECT p.name, avg(coalesce(c.children, 0)) AS avg_fanout, "
+					"max(coalesce(c.children, 0)) AS max_fanout "
+					"FROM %s p JOIN xml_analyze_sample s ON s.did = p.did "
+					"LEFT JOIN c ON c.did = p.did AND c.parent_id = p.pre_order "
+					"GROUP BY p.name) "
+			"SELECT t.name, t.nodes, t.documents, coalesce(f.avg_fanout, 0), "
+					"coalesce(f.max_fanout, 0), t.avg_depth, "
+					"(SELECT array_agg(d.depth ORDER BY d.depth) FROM d WHERE d.name = t.name), "
+					"(SELECT array_agg(d.c::float8 / t.nodes ORDER BY d.depth) FROM d "
+						"WHERE d.name = t.name) "
+			"FROM t LEFT JOIN f ON f.name = t.name WHERE t.name IS NOT NULL",
+			elements, elements, elements, elements);
+	execute_analyze_query(query.data, SPI_OK_INSERT, "tags");
+	tags = SPI_processed;
+
+	// per path from sample, values of text children and attributes
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+			"INSERT INTO xml_path_stats "
+			"WITH RECURSIVE p(did, pre_order, path) AS ("
+				"SELECT e.did, e.pre_order, '/' || e.name FROM %s e "
+					"JOIN xml_analyze_sample s ON s.did = e.did WHERE e.depth = 0 "
+				"UNION ALL "
+				"SELECT e.did, e.pre_order, p.path || '/' || e.name FROM %s e "
+					"JOIN p ON e.did = p.did AND e.parent_id = p.pre_order), "
+			"n AS (SELECT path, did, NULL::text AS value FROM p "
+				"UNION ALL "
+				"SELECT p.path || '/@' || a.name, a.did, a.value FROM p "
+					"JOIN %s a ON a.did = p.did AND a.parent_id = p.pre_order), "
+			"counts AS (SELECT path, count(*) AS nodes, count(DISTINCT did) AS documents "
+				"FROM n GROUP BY path), "
+			"vals AS (SELECT p.path, t.value FROM p "
+					"JOIN %s t ON t.did = p.did AND t.parent_id = p.pre_order "
+				"UNION ALL "
+				"SELECT path, value FROM n WHERE value IS NOT NULL), "
+			"buckets AS (SELECT path, value, "
+				"ntile(%d) OVER (PARTITION BY path ORDER BY value) AS bucket FROM vals), "
+			"hist AS (SELECT path, array_agg(bound ORDER BY bucket) AS histogram "
+				"FROM (SELECT path, bucket, max(value) AS bound FROM buckets "
+					"GROUP BY path, bucket) b GROUP BY path) "
+			"SELECT c.path, round(c.nodes * %.6f), round(c.documents * %.6f), h.histogram "
+			"FROM counts c LEFT JOIN hist h ON h.path = c.path",
+			elements, elements, attributes, texts, XML_ANALYZE_BUCKETS, scale, scale);
+	execute_analyze_query(query.data, SPI_OK_INSERT, "paths");
+
+	SPI_finish();
+
+	PG_RETURN_INT32(tags);
+}
@@ -0,0 +1,926 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_index_dump.c
+// desc:	Binary dump and restore of shredded tables. Rows are sorted by
+//			(did, pre_order) and stored in blocks, every block column by
+//			column: integers as zigzag varint deltas, texts with dictionary
+//			of short repeated values (tag names).
+//
+// format:	"XISSDUMP" varint(version) varint(layout) varint(ntables)
+//			table:	string(name) varint(ncols) {string(column) byte(kind)}
+//					{varint(nrows) {null bitmap, varint(len), payload}}
+//					varint(0)
+//			string is varint(length) and bytes
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#define DUMP_MAGIC "XISSDUMP"
+#define DUMP_VERSION 1
+#define DUMP_BLOCK_ROWS 10000	// same as BUFFER_SIZE of loader
+
+#define DUMP_COLUMN_INTEGER 0	// int2, int4, int8 as zigzag varint deltas
+#define DUMP_COLUMN_TEXT 1		// text representation with dictionary
+
+#define DUMP_DICTIONARY_SIZE 4096	// slots of hash table, power of 2
+#define DUMP_DICTIONARY_MAX_LEN 64	// longer texts are never in dictionary
+#define DUMP_INTEGER_LEN 32			// text form of int8
+
+/* externally accessible functions */
+Datum	export_xmlindex(PG_FUNCTION_ARGS);
+Datum	import_xmlindex(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(export_xmlindex);
+PG_FUNCTION_INFO_V1(import_xmlindex);
+
+// dictionary of short texts of one column in one block
+typedef struct dump_dictionary dump_dictionary;
+struct dump_dictionary {
+	char	  **values;			// by index
+	int			count;
+	int			slots[DUMP_DICTIONARY_SIZE];	// index + 1, 0 is empty
+};
+
+// reader of decoded payload
+typedef struct dump_buffer dump_buffer;
+struct dump_buffer {
+	char	   *data;
+	int			len;
+	int			pos;
+};
+
+static const char *const separate_tables[] = {
+	"element_table", "attribute_table", "text_table"
+};
+static const char *const unified_tables[] = {
+	"node_table"
+};
+// state of documents, dumped when the tables exist
+static const char *const state_tables[] = {
+	"xml_shred_state", "xml_shredded_documents"
+};
+
+/*
+ * Is table one of state tables, they have no pre_order
+ */
+static bool
+is_state_table(const char *table)
+{
+	int			i;
+
+	for (i = 0; i < lengthof(state_tables); i++)
+	{
+		if (strcmp(state_tables[i], table) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Only superuser can read and write server files
+ */
+static void
+check_dump_privileges(void)
+{
+	if (!superuser())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to export or import shredded tables")));
+	}
+}
+
+static void
+append_varint(StringInfo buf, uint64 value)
+{
+	while (value >= 0x80)
+	{
+		appendStringInfoChar(buf, (char) ((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	appendStringInfoChar(buf, (char) value);
+}
+
+static void
+append_string(StringInfo buf, const char *value, int len)
+{
+	append_varint(buf, len);
+	appendBinaryStringInfo(buf, value, len);
+}
+
+static uint64
+zigzag_encode(int64 value)
+{
+	return ((uint64) value << 1) ^ (uint64) (value >> 63);
+}
+
+static int64
+zigzag_decode(uint64 value)
+{
+	return (int64) (value >> 1) ^ -((int64) (value & 1));
+}
+
+static uint64
+buffer_varint(dump_buffer *buf)
+{
+	uint64		result = 0;
+	int			shift = 0;
+	unsigned char c;
+
+	do
+	{
+		if (buf->pos >= buf->len || shift > 63)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("corrupted dump of shredded tables")));
+		}
+		c = (unsigned char) buf->data[buf->pos++];
+		result |= (uint64) (c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return result;
+}
+
+static uint64
+file_varint(FILE *file)
+{
+	uint64		result = 0;
+	int			shift = 0;
+	int			c;
+
+	do
+	{
+		c = fgetc(file);
+		if (c == EOF || shift > 63)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("unexpected end of dump of shredded tables")));
+		}
+		result |= (uint64) (c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return result;
+}
+
+static char *
+file_bytes(FILE *file, uint64 len)
+{
+	char	   *result;
+
+	if (len >= MaxAllocSize)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("corrupted dump of shredded tables")));
+	}
+
+	result = (char *) palloc(len + 1);
+	if (len > 0 && fread(result, 1, len, file) != len)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read dump of shredded tables: %m")));
+	}
+	result[len] = '\0';
+
+	return result;
+}
+
+static void
+write_buffer(FILE *file, StringInfo buf)
+{
+	if (fwrite(buf->data, 1, buf->len, file) != buf->len)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write dump of shredded tables: %m")));
+	}
+	resetStringInfo(buf);
+}
+
+static uint32
+dictionary_hash(const char *value, int len)
+{
+	uint32		hash = 2166136261u;
+	int			i;
+
+	// FNV-1a
+	for (i = 0; i < len; i++)
+	{
+		hash = (hash ^ (unsigned char) value[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+ * Find value in dictionary, if it isn't there, add it
+ * @return index of value, -1 if it was added (or can't be added)
+ */
+static int
+dictionary_lookup(dump_dictionary *dict, char *value, bool add)
+{
+	int			len = strlen(value);
+	uint32		slot;
+	int			probes;
+
+	if (len > DUMP_DICTIONARY_MAX_LEN)
+	{
+		return -1;
+	}
+
+	slot = dictionary_hash(value, len) & (DUMP_DICTIONARY_SIZE - 1);
+	for (probes = 0; probes < DUMP_DICTIONARY_SIZE; probes++)
+	{
+		if (dict->slots[slot] == 0)
+		{
+			// dictionary is at most half full, so probing is short
+			if (add && dict->count < DUMP_DICTIONARY_SIZE / 2)
+			{
+				dict->values[dict->count] = value;
+				dict->slots[slot] = ++dict->count;
+			}
+			return -1;
+		}
+		if (strcmp(dict->values[dict->slots[slot] - 1], value) == 0)
+		{
+			return dict->slots[slot] - 1;
+		}
+		slot = (slot + 1) & (DUMP_DICTIONARY_SIZE - 1);
+	}
+
+	return -1;
+}
+
+static dump_dictionary *
+new_dictionary(void)
+{
+	dump_dictionary *dict = (dump_dictionary *) palloc0(sizeof(dump_dictionary));
+
+	dict->values = (char **) palloc(sizeof(char *) * DUMP_DICTIONARY_SIZE / 2);
+
+	return dict;
+}
+
+/*
+ * Encode one column of fetched rows
+ * @param buf output, null bitmap, varint(length of payload) and payload
+ */
+static void
+encode_column(StringInfo buf, SPITupleTable *tuptable, int nrows, int column,
+		int kind)
+{
+	StringInfoData payload;
+	char	   *bitmap = (char *) palloc0((nrows + 7) / 8);
+	dump_dictionary *dict = NULL;
+	int64		previous = 0;
+	int64		value;
+	char	   *text;
+	bool		isnull;
+	int			index;
+	int			i;
+
+	initStringInfo(&payload);
+	if (kind == DUMP_COLUMN_TEXT)
+	{
+		dict = new_dictionary();
+	}
+
+	for (i = 0; i < nrows; i++)
+	{
+		if (kind == DUMP_COLUMN_INTEGER)
+		{
+			Datum		datum = SPI_getbinval(tuptable->vals[i], tuptable->tupdesc,
+					column, &isnull);
+
+			if (isnull)
+			{
+				continue;
+			}
+			switch (SPI_gettypeid(tuptable->tupdesc, column))
+			{
+				case INT2OID:
+					value = DatumGetInt16(datum);
+					break;
+				case INT4OID:
+					value = DatumGetInt32(datum);
+					break;
+				default:
+					value = DatumGetInt64(datum);
+					break;
+			}
+			// rows are sorted, so deltas are small
+			append_varint(&payload, zigzag_encode(value - previous));
+			previous = value;
+		}
+		else
+		{
+			text = SPI_getvalue(tuptable->vals[i], tuptable->tupdesc, column);
+			if (text == NULL)
+			{
+				continue;
+			}
+			// 0 is followed by new text, n is n-th text of dictionary
+			index = dictionary_lookup(dict, text, true);
+			if (index >= 0)
+			{
+				append_varint(&payload, index + 1);
+			}
+			else
+			{
+				append_varint(&payload, 0);
+				append_string(&payload, text, strlen(text));
+			}
+		}
+		bitmap[i / 8] |= 1 << (i % 8);
+	}
+
+	appendBinaryStringInfo(buf, bitmap, (nrows + 7) / 8);
+	append_string(buf, payload.data, payload.len);
+
+	pfree(bitmap);
+	pfree(payload.data);
+}
+
+/*
+ * Decode column of block into text representations (NULL for null)
+ */
+static void
+decode_column(char **values, int nrows, char *bitmap, dump_buffer *payload,
+		int kind)
+{
+	dump_dictionary *dict = NULL;
+	int64		previous = 0;
+	uint64		index;
+	uint64		len;
+	char	   *text;
+	int			i;
+
+	if (kind == DUMP_COLUMN_TEXT)
+	{
+		dict = new_dictionary();
+	}
+
+	for (i = 0; i < nrows; i++)
+	{
+		if ((bitmap[i / 8] & (1 << (i % 8))) == 0)
+		{
+			values[i] = NULL;
+			continue;
+		}
+
+		if (kind == DUMP_COLUMN_INTEGER)
+		{
+			previous += zigzag_decode(buffer_varint(payload));
+			values[i] = (char *) palloc(DUMP_INTEGER_LEN);
+			snprintf(values[i], DUMP_INTEGER_LEN, INT64_FORMAT, previous);
+			continue;
+		}
+
+		index = buffer_varint(payload);
+		if (index > 0)
+		{
+			if (index > dict->count)
+			{
+				ereport(ERROR,
+						(errcode(ERRCODE_DATA_CORRUPTED),
+						 errmsg("corrupted dump of shredded tables")));
+			}
+			values[i] = dict->values[index - 1];
+			continue;
+		}
+
+		len = buffer_varint(payload);
+		if (len > payload->len - payload->pos)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("corrupted dump of shredded tables")));
+		}
+		text = (char *) palloc(len + 1);
+		memcpy(text, payload->data + payload->pos, len);
+		text[len] = '\0';
+		payload->pos += len;
+
+		// same rule as encoder, dictionaries stay identical
+		dictionary_lookup(dict, text, true);
+		values[i] = text;
+	}
+}
+
+/*
+ * Write one table into dump
+ * @return number of rows
+ */
+static int64
+export_table(FILE *file, const char *table, MemoryContext blockcontext)
+{
+	StringInfoData query;
+	StringInfoData buf;
+	Portal		portal;
+	TupleDesc	tupdesc;
+	MemoryContext oldcontext;
+	int		   *kinds;
+	int			ncols;
+	int			nrows;
+	int			i;
+	int64		count = 0;
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT * FROM %s ORDER BY %s",
+			quote_identifier(table),
+			is_state_table(table) ? "did" : "did, pre_order");
+	initStringInfo(&buf);
+
+	SPI_connect();
+
+	portal = SPI_cursor_open_with_args(NULL, query.data, 0, NULL, NULL, NULL,
+			true, 0);
+
+	// header of table from result description
+	tupdesc = portal->tupDesc;
+	ncols = tupdesc->natts;
+	kinds = (int *) palloc(sizeof(int) * ncols);
+
+	append_string(&buf, table, strlen(table));
+	append_varint(&buf, ncols);
+	for (i = 0; i < ncols; i++)
+	{
+		append_string(&buf, SPI_fname(tupdesc, i + 1),
+				strlen(SPI_fname(tupdesc, i + 1)));
+		switch (SPI_gettypeid(tupdesc, i + 1))
+		{
+			case INT2OID:
+			case INT4OID:
+			case INT8OID:
+				kinds[i] = DUMP_COLUMN_INTEGER;
+				break;
+			default:
+				kinds[i] = DUMP_COLUMN_TEXT;
+				break;
+		}
+		appendStringInfoChar(&buf, (char) kinds[i]);
+	}
+	write_buffer(file, &buf);
+
+	for (;;)
+	{
+		SPI_cursor_fetch(portal, true, DUMP_BLOCK_ROWS);
+		nrows = SPI_processed;
+		if (nrows == 0 || SPI_tuptable == NULL)
+		{
+			break;
+		}
+
+		oldcontext = MemoryContextSwitchTo(blockcontext);
+
+		append_varint(&buf, nrows);
+		for (i = 0; i < ncols; i++)
+		{
+			encode_column(&buf, SPI_tuptable, nrows, i + 1, kinds[i]);
+		}
+		write_buffer(file, &buf);
+
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(blockcontext);
+
+		SPI_freetuptable(SPI_tuptable);
+		count += nrows;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	// end of table
+	append_varint(&buf, 0);
+	write_buffer(file, &buf);
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+
+	return count;
+}
+
+/*
+ * Table of dump must be shredded (or state) table of current layout and
+ * its columns must be columns of the table, checked before it is truncated
+ */
+static void
+check_import_table(const char *table, char **columns, int ncols, int layout)
+{
+	const char *const *tables = layout == LAYOUT_UNIFIED ? unified_tables :
+			separate_tables;
+	int			ntables = layout == LAYOUT_UNIFIED ? lengthof(unified_tables) :
+			lengthof(separate_tables);
+	Oid			oids[1] = {TEXTOID};
+	Datum		data[1];
+	bool		known = is_state_table(table);
+	char	   *name;
+	int			i;
+	int			j;
+
+	for (i = 0; i < ntables && !known; i++)
+	{
+		known = strcmp(tables[i], table) == 0;
+	}
+	if (!known)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("dump contains table \"%s\" which is not shredded table", table)));
+	}
+
+	SPI_connect();
+
+	if (!xml_index_table_exists(table))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_TABLE),
+				 errmsg("table \"%s\" of dump does not exist", table),
+				 errhint("Create tables by create_xmlindex_tables() first.")));
+	}
+
+	data[0] = CStringGetTextDatum(table);
+	if (SPI_execute_with_args("SELECT a.attname::text FROM pg_catalog.pg_attribute a "
+			"WHERE a.attrelid = $1::regclass AND a.attnum > 0 AND NOT a.attisdropped",
+			1, oids, data, NULL, true, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read columns of %s", table)));
+	}
+	if (SPI_processed != ncols)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("dump of table \"%s\" has %d columns, table has %d",
+						table, ncols, (int) SPI_processed)));
+	}
+	for (i = 0; i < ncols; i++)
+	{
+		for (j = 0; j < SPI_processed; j++)
+		{
+			name = SPI_getvalue(SPI_tuptable->vals[j], SPI_tuptable->tupdesc, 1);
+			if (strcmp(name, columns[i]) == 0)
+			{
+				break;
+			}
+		}
+		if (j == SPI_processed)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("column \"%s\" of dump is not in table \"%s\"",
+							columns[i], table)));
+		}
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Load rows of one table from dump, multi row INSERT per block
+ * @param name (out) name of loaded table
+ * @return number of rows
+ */
+static int64
+import_table(FILE *file, int layout, MemoryContext blockcontext, char **name)
+{
+	char	   *table;
+	char	  **columns;
+	int		   *kinds;
+	int			ncols;
+	uint64		nrows;
+	char	   *bitmap;
+	char	 ***values;
+	dump_buffer payload;
+	StringInfoData query;
+	MemoryContext oldcontext;
+	int			i;
+	int			j;
+	int64		count = 0;
+
+	table = file_bytes(file, file_varint(file));
+	ncols = file_varint(file);
+	columns = (char **) palloc(sizeof(char *) * (ncols + 1));
+	kinds = (int *) palloc(sizeof(int) * (ncols + 1));
+	for (i = 0; i < ncols; i++)
+	{
+		columns[i] = file_bytes(file, file_varint(file));
+		kinds[i] = fgetc(file);
+		if (kinds[i] != DUMP_COLUMN_INTEGER && kinds[i] != DUMP_COLUMN_TEXT)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("corrupted dump of shredded tables")));
+		}
+	}
+	*name = table;
+
+	check_import_table(table, columns, ncols, layout);
+
+	SPI_connect();
+	initStringInfo(&query);
+	appendStringInfo(&query, "TRUNCATE %s", quote_identifier(table));
+	if (SPI_execute(query.data, false, 0) != SPI_OK_UTILITY)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not truncate %s", table)));
+	}
+	SPI_finish();
+
+	while ((nrows = file_varint(file)) > 0)
+	{
+		if (nrows > DUMP_BLOCK_ROWS)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("corrupted dump of shredded tables")));
+		}
+
+		oldcontext = MemoryContextSwitchTo(blockcontext);
+
+		values = (char ***) palloc(sizeof(char **) * ncols);
+		for (i = 0; i < ncols; i++)
+		{
+			bitmap = file_bytes(file, (nrows + 7) / 8);
+			payload.len = file_varint(file);
+			payload.data = file_bytes(file, payload.len);
+			payload.pos = 0;
+			values[i] = (char **) palloc(sizeof(char *) * nrows);
+			decode_column(values[i], nrows, bitmap, &payload, kinds[i]);
+		}
+
+		initStringInfo(&query);
+		appendStringInfo(&query, "INSERT INTO %s (", quote_identifier(table));
+		for (i = 0; i < ncols; i++)
+		{
+			appendStringInfo(&query, "%s%s", i > 0 ? ", " : "",
+					quote_identifier(columns[i]));
+		}
+		appendStringInfo(&query, ") VALUES ");
+		for (j = 0; j < nrows; j++)
+		{
+			appendStringInfo(&query, "%s(", j > 0 ? ", " : "");
+			for (i = 0; i < ncols; i++)
+			{
+				appendStringInfo(&query, "%s%s", i > 0 ? ", " : "",
+						values[i][j] == NULL ? "NULL" :
+						kinds[i] == DUMP_COLUMN_INTEGER ? values[i][j] :
+						quote_literal_cstr(values[i][j]));
+			}
+			appendStringInfoChar(&query, ')');
+		}
+
+		MemoryContextSwitchTo(oldcontext);
+
+		SPI_connect();
+		if (SPI_execute(query.data, false, 0) != SPI_OK_INSERT)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not insert values into %s", table)));
+		}
+		SPI_finish();
+
+		MemoryContextReset(blockcontext);
+		count += nrows;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return count;
+}
+
+/*
+ * Fill xml_shredded_documents from shredded tables, for dumps which don't
+ * contain it
+ */
+static void
+restore_shredded_documents(int layout)
+{
+	StringInfoData query;
+
+	SPI_connect();
+
+	if (xml_index_table_exists("xml_shredded_documents"))
+	{
+		initStringInfo(&query);
+		appendStringInfo(&query,
+				"TRUNCATE xml_shredded_documents; "
+				"INSERT INTO xml_shredded_documents SELECT DISTINCT did FROM %s",
+				layout == LAYOUT_UNIFIED ? "node_table" : "element_table");
+		if (SPI_execute(query.data, false, 0) != SPI_OK_INSERT)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not restore xml_shredded_documents")));
+		}
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Write shredded tables of current layout and state tables into server file
+ * @param path file name
+ * @return number of written rows
+ */
+Datum
+export_xmlindex(PG_FUNCTION_ARGS)
+{
+	char	   *path = text_to_cstring(PG_GETARG_TEXT_P(0));
+	int			layout;
+	const char *tables[lengthof(separate_tables) + lengthof(state_tables)];
+	int			ntables = 0;
+	FILE	   *file;
+	StringInfoData buf;
+	MemoryContext blockcontext;
+	int64		count = 0;
+	int			i;
+
+	check_dump_privileges();
+
+	layout = get_index_layout();
+	if (layout == LAYOUT_UNIFIED)
+	{
+		for (i = 0; i < lengthof(unified_tables); i++)
+		{
+			tables[ntables++] = unified_tables[i];
+		}
+	} else
+	{
+		for (i = 0; i < lengthof(separate_tables); i++)
+		{
+			tables[ntables++] = separate_tables[i];
+		}
+	}
+
+	// state of lazy shredding and shredded documents is restored with rows
+	SPI_connect();
+	for (i = 0; i < lengthof(state_tables); i++)
+	{
+		if (xml_index_table_exists(state_tables[i]))
+		{
+			tables[ntables++] = state_tables[i];
+		}
+	}
+	SPI_finish();
+
+	file = AllocateFile(path, PG_BINARY_W);
+	if (file == NULL)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for writing: %m", path)));
+	}
+
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, DUMP_MAGIC, strlen(DUMP_MAGIC));
+	append_varint(&buf, DUMP_VERSION);
+	append_varint(&buf, layout);
+	append_varint(&buf, ntables);
+	write_buffer(file, &buf);
+
+	blockcontext = AllocSetContextCreate(CurrentMemoryContext,
+			"xmlindex dump block",
+			ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE,
+			ALLOCSET_DEFAULT_MAXSIZE);
+
+	for (i = 0; i < ntables; i++)
+	{
+		count += export_table(file, tables[i], blockcontext);
+	}
+
+	MemoryContextDelete(blockcontext);
+
+	if (FreeFile(file))
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", path)));
+	}
+
+	PG_RETURN_INT64(count);
+}
+
+/*
+ * Replace content of shredded and state tables by dump made by
+ * export_xmlindex. Secondary indexes are dropped during load and created
+ * again at the end.
+ * @param path file name
+ * @return number of loaded rows
+ */
+Datum
+import_xmlindex(PG_FUNCTION_ARGS)
+{
+	char	   *path = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char		magic[sizeof(DUMP_MAGIC)];
+	FILE	   *file;
+	uint64		version;
+	int			layout;
+	int			ntables;
+	MemoryContext blockcontext;
+	char	   *table;
+	bool		marked = false;
+	int64		count = 0;
+	int			i;
+
+	check_dump_privileges();
+
+	file = AllocateFile(path, PG_BINARY_R);
+	if (file == NULL)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for reading: %m", path)));
+	}
+
+	if (fread(magic, 1, strlen(DUMP_MAGIC), file) != strlen(DUMP_MAGIC) ||
+			memcmp(magic, DUMP_MAGIC, strlen(DUMP_MAGIC)) != 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("file \"%s\" is not dump of shredded tables", path)));
+	}
+	version = file_varint(file);
+	if (version != DUMP_VERSION)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("unsupported version %d of dump of shredded tables",
+						(int) version)));
+	}
+
+	layout = file_varint(file);
+	if (layout != get_index_layout())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("dump was made from %s layout of shredded tables",
+						layout == LAYOUT_UNIFIED ? "unified" : "separate")));
+	}
+	ntables = file_varint(file);
+
+	// bulk load without secondary indexes, same as rebuild_xmlindex
+	drop_indexes_on_tables(layout);
+
+	blockcontext = AllocSetContextCreate(CurrentMemoryContext,
+			"xmlindex dump block",
+			ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE,
+			ALLOCSET_DEFAULT_MAXSIZE);
+
+	for (i = 0; i < ntables; i++)
+	{
+		count += import_table(file, layout, blockcontext, &table);
+		marked = marked || strcmp(table, "xml_shredded_documents") == 0;
+	}
+
+	MemoryContextDelete(blockcontext);
+	FreeFile(file);
+
+	// older dump without markers, documents with rows are shredded
+	if (!marked)
+	{
+		restore_shredded_documents(layout);
+	}
+
+	create_indexes_on_tables(layout);
+
+	if (xml_postings_enabled())
+	{
+		xml_postings_rebuild(layout);
+	}
+	if (xml_keywords_enabled())
+	{
+		xml_keywords_rebuild(layout);
+	}
+	if (xml_xpath_views_enabled())
+	{
+		xml_xpath_views_rebuild(layout);
+	}
+
+	PG_RETURN_INT64(count);
+}
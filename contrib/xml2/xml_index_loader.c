@@ -38,17 +38,124 @@
 #include "utils/xml.h"
 #include <assert.h>
 
+#ifdef USE_LIBXML
+	#include <libxml/relaxng.h>
+	#include <libxml/valid.h>
+	#include <libxml/xmlschemas.h>
+#endif   /* USE_LIBXML */
+
+//Buffers
+element_node		element_node_buffer[BUFFER_SIZE];
+text_node			text_node_buffer[BUFFER_SIZE];
+attribute_node		attribute_node_buffer[BUFFER_SIZE];
+
+//Reference to buffered node, used for merging buffers in pre order
+typedef struct node_ref node_ref;
+struct node_ref{
+	xml_label order;
+	int kind;
+	int index;
+};
+
+
+static int run_loader(const char *xml_document, int length,
+		xml_index_globals_ptr globals, xml_validation_spec_ptr validation);
+static int compare_node_rows(const void *a, const void *b);
 
 /**
  * Entry point of loader
  * @param xml_document
+ * @param spec selective shredding specification, NULL for full shredding
+ * @param validation schema to validate document against, NULL for none
  * @return true/false if all XML shredding
  */
 int extern
-xml_index_entry(const char *xml_document, int length, int4 did)
+xml_index_entry(const char *xml_document, int length, xml_label did,
+		xml_shred_spec_ptr spec, xml_validation_spec_ptr validation)
 {
 	xml_index_globals		globals;
-	int preorder_result;
+	int result;
+
+	init_values(&globals);
+	globals.global_doc_id = did;
+	globals.layout = get_index_layout();
+	globals.spec = spec;
+	if(spec != NULL && spec->ninclude > 0)
+	{
+		// root is shredded only if some include pattern match it
+		globals.current_scope = SCOPE_PATH;
+	}
+
+	result = run_loader(xml_document, length, &globals, validation);
+
+	// shredded tables can't tell document without stored node from lost one
+	if(result == XML_INDEX_LOADER_SUCCES)
+	{
+		mark_document_shredded(did);
+	}
+
+	// posting lists are read from just stored elements
+	if(result == XML_INDEX_LOADER_SUCCES && xml_postings_enabled())
+	{
+		xml_postings_add_document(did, globals.layout);
+	}
+	if(result == XML_INDEX_LOADER_SUCCES && xml_keywords_enabled())
+	{
+		xml_keywords_add_document(did, globals.layout);
+	}
+	// results of materialised XPaths are replaced for this did only
+	if(result == XML_INDEX_LOADER_SUCCES && xml_xpath_views_enabled())
+	{
+		xml_xpath_views_add_document(did, globals.layout);
+	}
+
+	return result;
+}
+
+/**
+ * Shred document into memory instead of tables, nothing is written into
+ * database. Strings of rows are allocated in current memory context.
+ * @param xml_document
+ * @param length length of document
+ * @param rows collected nodes in pre order
+ * @return XML_INDEX_LOADER_SUCCES or LIBXML_ERR
+ */
+int extern
+xml_index_collect(const char *xml_document, int length, xml_node_rows_ptr rows)
+{
+	xml_index_globals		globals;
+	int result;
+
+	init_values(&globals);
+	globals.global_doc_id = NO_VALUE;
+	globals.layout = LAYOUT_COLLECT;
+	globals.rows = rows;
+
+	result = run_loader(xml_document, length, &globals, NULL);
+
+	// elements are finished after their descendants
+	if(rows->count > 1)
+	{
+		qsort(rows->rows, rows->count, sizeof(xml_node_row), compare_node_rows);
+	}
+
+	return result;
+}
+
+/**
+ * Read whole document by reader and flush buffers
+ * @param xml_document
+ * @param length length of document
+ * @param globals initialized variables used for global handling
+ * @param validation schema to validate document against, NULL for none
+ * @return XML_INDEX_LOADER_SUCCES or LIBXML_ERR
+ */
+static int
+run_loader(const char *xml_document, int length, xml_index_globals_ptr globals,
+		xml_validation_spec_ptr validation)
+{
+	xml_label preorder_result;
+	int i;
 
 	//globals.reader
 	xmlTextReaderPtr reader		= xmlReaderForMemory(xml_document, length,
@@ -60,18 +167,50 @@ xml_index_entry(const char *xml_document, int length, int4 did)
 		return LIBXML_ERR;
     }
 
-	init_values(&globals);
-	globals.global_doc_id = did;
+	globals->reader = reader;
+	if(validation != NULL)
+	{
+		// schema must be attached before first read
+		globals->validation = validation;
+		prepare_validation(reader, xml_document, length, globals);
+	}
 
 	xmlTextReaderRead(reader);
 	// parse and compute whole shredding
-	preorder_result = preorder_traverse(NO_VALUE, NO_VALUE, reader, &globals);
+	preorder_result = preorder_traverse(NO_VALUE, NO_VALUE, 1, reader, globals);
+
+	if(globals->validation != NULL)
+	{
+		// content of root is checked when reader leaves it, nothing is
+		// flushed from last buffers until whole document is valid
+		while(xmlTextReaderRead(reader) == 1);
+		check_validity(globals);
+		release_validation(globals);
+	}
 
 	xmlFreeTextReader(reader);    // clean up document in memmory
 
-	flush_element_node_buffer(&globals);
-	flush_attribute_node_buffer(&globals);
-	flush_text_node_buffer(&globals);
+	for(i = 0; i < globals->path_size; i++)
+	{
+		if(globals->path[i] != NULL)
+		{
+			pfree(globals->path[i]);
+		}
+	}
+	if(globals->path != NULL)
+	{
+		pfree(globals->path);
+	}
+
+	if(preorder_result == LIBXML_ERR)
+	{
+		// rows of malformed document are not written
+		return LIBXML_ERR;
+	}
+
+	flush_element_node_buffer(globals);
+	flush_attribute_node_buffer(globals);
+	flush_text_node_buffer(globals);
 
 	return XML_INDEX_LOADER_SUCCES;
 }
@@ -91,6 +230,16 @@ init_values(xml_index_globals_ptr globals)
 	globals->attribute_node_buffer_count	= 0;
 	globals->text_node_count				= 0;
 	globals->text_node_buffer_count			= 0;
+	globals->layout							= LAYOUT_SEPARATE;
+	globals->spec							= NULL;
+	globals->current_scope					= SCOPE_FULL;
+	globals->path							= NULL;
+	globals->path_size						= 0;
+	globals->validation						= NULL;
+	globals->reader							= NULL;
+	globals->schema							= NULL;
+	globals->validation_error				= NULL;
+	globals->rows							= NULL;
 }
 
 
@@ -105,12 +254,18 @@ read_next_node(xmlTextReaderPtr reader, xml_index_globals_ptr globals)
 {
 	int err_val = xmlTextReaderRead(reader);
 
-	elog(INFO, "reading next node");
+	elog(DEBUG2, "reading next node");
+
+	if(globals->validation != NULL)
+	{
+		// reject document before buffers with invalid content are flushed
+		check_validity(globals);
+	}
 
 //TODO better handling
 	if(err_val == LIBXML_ERR)
 	{
-		elog(INFO, "Error reading node, at order = %d", globals->global_order);
+		elog(INFO, "Error reading node, at order = " XML_LABEL_FORMAT, globals->global_order);
 	}
 	
 	return err_val;
@@ -139,7 +294,7 @@ create_new_element(xml_index_globals_ptr globals)
 
 	if (DEBUG == TRUE)
 	{
-		elog(INFO, ">> creating new element at index: %d", my_ind);
+		elog(DEBUG2, ">> creating new element at index: %d", my_ind);
 	}
 
 	element_node_buffer[my_ind].did = NO_VALUE;
@@ -157,6 +312,8 @@ create_new_element(xml_index_globals_ptr globals)
 	element_node_buffer[my_ind].child_id = NO_VALUE;
 	element_node_buffer[my_ind].prev_id = NO_VALUE;
 	element_node_buffer[my_ind].first_attr_id = NO_VALUE;
+	element_node_buffer[my_ind].next_id = NO_VALUE;
+	element_node_buffer[my_ind].sibling_ord = NO_VALUE;
 	globals->element_node_buffer_count++;
 
 
@@ -165,33 +322,126 @@ create_new_element(xml_index_globals_ptr globals)
 
 }
 
+/**
+ * Position of next element child with given name among its siblings of the
+ * same name, so name[n] is answered by lookup of sibling_ord
+ * @param counter counts of names of children seen so far
+ * @param name name of the child
+ * @return ordinal starting with 1
+ */
+int
+sibling_ordinal(sibling_counter* counter, const char* name)
+{
+	int i;
+
+	if(name == NULL)
+	{
+		name = DOCUMENT_ROOT;
+	}
+
+	//children usually have few distinct names
+	for(i = 0; i < counter->count; i++)
+	{
+		if(strcmp(counter->names[i], name) == 0)
+		{
+			return ++(counter->ordinals[i]);
+		}
+	}
+
+	if(counter->count == counter->max)
+	{
+		counter->max = counter->max == 0 ? 8 : counter->max * 2;
+		counter->names = counter->names == NULL ?
+				(char **) palloc(sizeof(char *) * counter->max) :
+				(char **) repalloc(counter->names, sizeof(char *) * counter->max);
+		counter->ordinals = counter->ordinals == NULL ?
+				(int *) palloc(sizeof(int) * counter->max) :
+				(int *) repalloc(counter->ordinals, sizeof(int) * counter->max);
+	}
+	counter->names[counter->count] = pstrdup(name);
+	counter->ordinals[counter->count] = 1;
+	counter->count++;
+
+	return 1;
+}
+
+/**
+ * Link element to its next element sibling. Element is created when its
+ * subtree ends, so previous sibling is usually the last element in buffer,
+ * unless buffer was flushed by text nodes between siblings.
+ * @param order order of previous sibling
+ * @param next_id order of starting element
+ * @param globals variables used for global handling
+ */
+void
+set_next_sibling(xml_label order, xml_label next_id,
+		xml_index_globals_ptr globals)
+{
+	int last = globals->element_node_buffer_count - 1;
+	StringInfoData query;
+
+	if(last >= 0 && element_node_buffer[last].order == order)
+	{
+		element_node_buffer[last].next_id = next_id;
+		return;
+	}
+
+	//LAYOUT_COLLECT rows have no sibling links
+	if(globals->layout != LAYOUT_UNIFIED || DO_FLUSH != TRUE)
+	{
+		return;
+	}
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"UPDATE node_table SET next_id = " XML_LABEL_FORMAT " "
+			"WHERE did = " XML_LABEL_FORMAT " AND pre_order = " XML_LABEL_FORMAT,
+			next_id, globals->global_doc_id, order);
+
+	SPI_connect();
+
+	if (SPI_execute(query.data, false, 0) != SPI_OK_UPDATE)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not link sibling of element " XML_LABEL_FORMAT, order)));
+
+	SPI_finish();
+
+	pfree(query.data);
+}
+
 /**
  * Executes a preorder traversal of the document tree. It processes elements(and
  * in turn attributes and text elements)
  * @param parent_id parent node's order
  * @param sibling_id Order of this node's nearest sibling
+ * @param sibling_ord position among element siblings of the same name
  * @param reader pointer to LibXML stream reader
  * @param globals variables used for global handling
  * @return
  */
-int 
-preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
-		xml_index_globals_ptr globals)
+xml_label
+preorder_traverse(xml_label parent_id, xml_label sibling_id, int sibling_ord,
+		xmlTextReaderPtr reader, xml_index_globals_ptr globals)
 {
 
 	int my_ind;
-	int size_res;
-	int prev_child = NO_VALUE;
-	int recent_child = NO_VALUE;
+	xml_label size_res;
+	xml_label prev_child = NO_VALUE;
+	xml_label recent_child = NO_VALUE;
+	bool prev_child_stored = false;
+	sibling_counter children = {0, 0, NULL, NULL};
 	int err_val;
 	int node_type;
 	xmlChar* my_tag_name;
+	int parent_scope;
+	int my_scope;
 
 	//this elements xiss values
-	int my_order = -1,
+	xml_label my_order = -1,
 		 my_size = -1,
-		 my_depth = -1,
 		 my_first_attr_id = -1;
+	int my_depth = -1;
 
 	//Get Order, and Size
 	my_order = ++(globals->global_order);
@@ -203,10 +453,15 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 	//Get Depth
 	my_depth = xmlTextReaderDepth(reader);
 
+	//Out of scope subtree is traversed same way, only nothing is stored,
+	//so pre/size numbering is same as with full shredding
+	parent_scope = globals->current_scope;
+	my_scope = element_scope((char *)my_tag_name, my_depth, globals);
+	globals->current_scope = my_scope;
 
 	if(DEBUG == TRUE)
 	{
-		elog(INFO, "--PREORDER-- Parsing %d:%s at depth %d\n", my_order, my_tag_name, my_depth);
+		elog(DEBUG2, "--PREORDER-- Parsing " XML_LABEL_FORMAT ":%s at depth %d\n", my_order, my_tag_name, my_depth);
 	}
 
 	//Process all attributes
@@ -223,7 +478,7 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 	{
 		if(DEBUG == TRUE)
 		{
-			elog(INFO, "Node %d:%s at depth %d, does not have a closing tag.\n", my_order, my_tag_name, my_depth);
+			elog(DEBUG2, "Node " XML_LABEL_FORMAT ":%s at depth %d, does not have a closing tag.\n", my_order, my_tag_name, my_depth);
 		}
 		//Possibly implement error code here
 	}
@@ -242,16 +497,16 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 
 	if(DEBUG == TRUE && node_type == ELEMENT_END)
 	{
-		elog(INFO, "Found end of %d:%s with no non-attribute children at depth %d returning to %d.\n",my_order, my_tag_name,  my_depth, parent_id);
+		elog(DEBUG2, "Found end of " XML_LABEL_FORMAT ":%s with no non-attribute children at depth %d returning to " XML_LABEL_FORMAT ".\n",my_order, my_tag_name,  my_depth, parent_id);
 	}
 
 	while(node_type != ELEMENT_END)  //While we have unvisited children
 	{
-		elog(INFO, "while (node_type != ELEMENT_END)");
+		elog(DEBUG2, "while (node_type != ELEMENT_END)");
 
 		if(node_type == TEXT_NODE || node_type == CDATA_SEC) //Visit text nodes
 		{
-			elog(INFO, "je to text node");
+			elog(DEBUG2, "je to text node");
 
 			err_val = process_text_node(my_order, prev_child, reader, globals);
 			if(err_val == REAL_TEXT_NODE)
@@ -261,10 +516,24 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 
 		} else if(node_type == ELEMENT_START) //Recurse on elements
 		{
-			elog(INFO, "je to element_start");
+			elog(DEBUG2, "je to element_start");
 
 			recent_child = (globals->global_order) + 1; //Next time we have a child it will know this as its nearest sibling
-			size_res = preorder_traverse(my_order,  prev_child, reader, globals);
+			if(prev_child_stored)
+			{
+				set_next_sibling(prev_child, recent_child, globals);
+			}
+			size_res = preorder_traverse(my_order,  prev_child,
+					sibling_ordinal(&children, (const char *) xmlTextReaderConstName(reader)),
+					reader, globals);
+			if(size_res == LIBXML_ERR)
+			{
+				// malformed descendant makes whole document malformed
+				return(LIBXML_ERR);
+			}
+			//stored child is the last created element
+			prev_child_stored = globals->element_node_buffer_count > 0 &&
+					element_node_buffer[globals->element_node_buffer_count - 1].order == recent_child;
 
 
 			my_size += size_res;
@@ -273,7 +542,7 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 			{
 				if(DEBUG)
 				{
-					elog(INFO, "Node %d:%s at depth %d is done, its child has no closing tag.\n", my_order, my_tag_name, my_depth);
+					elog(DEBUG2, "Node " XML_LABEL_FORMAT ":%s at depth %d is done, its child has no closing tag.\n", my_order, my_tag_name, my_depth);
 				}
 				break;
 			}
@@ -294,13 +563,13 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 			return(LIBXML_ERR);
 		}
 
-		elog(INFO, "je to v pisi reader:%d  X my_depth:%d, is",
+		elog(DEBUG2, "je to v pisi reader:%d  X my_depth:%d, is",
 				xmlTextReaderDepth(reader), my_depth);
 
 		node_type = xmlTextReaderNodeType(reader);
 		if(DEBUG == TRUE && node_type == ELEMENT_END)
 		{
-			elog(INFO,"Found end of %d:%s with %d children at depth %d returning to %d.\n",
+			elog(DEBUG2, "Found end of " XML_LABEL_FORMAT ":%s with " XML_LABEL_FORMAT " children at depth %d returning to " XML_LABEL_FORMAT ".\n",
 					my_order, my_tag_name, my_size, my_depth, parent_id );
 		}
 
@@ -308,14 +577,29 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 		{
 			if(DEBUG == TRUE)
 			{
-				elog(INFO,"Node %d:%s with %d children at depth %d has no end "
-						"tag, now returning to %d\n",my_order, my_tag_name,
+				elog(DEBUG2, "Node " XML_LABEL_FORMAT ":%s with " XML_LABEL_FORMAT " children at depth %d has no end "
+						"tag, now returning to " XML_LABEL_FORMAT "\n",my_order, my_tag_name,
 						my_size, my_depth, parent_id );
 			}
 			break;
 		}
 	}
 	//We have visited each child
+	globals->current_scope = parent_scope;
+	if(children.names != NULL)
+	{
+		pfree(children.names);
+		pfree(children.ordinals);
+	}
+
+	if(my_scope != SCOPE_FULL)
+	{
+		if(my_tag_name != NULL)
+		{
+			xmlFree(my_tag_name);
+		}
+		return my_size + 1;
+	}
 
 	//Create new queue entry for this element, initialized with null or no_value entries
 	my_ind = create_new_element(globals);
@@ -327,6 +611,7 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 	element_node_buffer[my_ind].first_attr_id = my_first_attr_id;
 	element_node_buffer[my_ind].child_id = recent_child;
 	element_node_buffer[my_ind].parent_id = parent_id;
+	element_node_buffer[my_ind].sibling_ord = sibling_ord;
 
 	//Tag name
 	if(my_tag_name == NULL && my_order == 1  && parent_id == NO_VALUE)
@@ -345,8 +630,8 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
 
 	if (DEBUG == true)
 	{
-		elog(INFO, "== CREATE == element[%d] values did:%d, order:%d, size:%d "
-				"depth:%d, first_attr_id:%d, , child_id:%d, parent_id:%d",
+		elog(DEBUG2, "== CREATE == element[%d] values did:" XML_LABEL_FORMAT ", order:" XML_LABEL_FORMAT ", size:" XML_LABEL_FORMAT " "
+				"depth:%d, first_attr_id:" XML_LABEL_FORMAT ", , child_id:" XML_LABEL_FORMAT ", parent_id:" XML_LABEL_FORMAT,
 				my_ind,
 				element_node_buffer[my_ind].did,
 				element_node_buffer[my_ind].order,
@@ -377,7 +662,7 @@ preorder_traverse(int parent_id, int sibling_id, xmlTextReaderPtr reader,
  * @return  Returns the number of attributes processed.
  */
 int 
-process_attributes(int parent_id, xmlTextReaderPtr reader,
+process_attributes(xml_label parent_id, xmlTextReaderPtr reader,
 		xml_index_globals_ptr globals)
 {
 
@@ -385,17 +670,24 @@ process_attributes(int parent_id, xmlTextReaderPtr reader,
 	int i, my_ind, err;
 	int num_attributes;
 	xmlChar * text;
-	int last_attr = NO_VALUE;
+	xml_label last_attr = NO_VALUE;
 
 	num_attributes = xmlTextReaderAttributeCount(reader);
 
-	elog(INFO, "processing attributes it is there %d", num_attributes);
+	elog(DEBUG2, "processing attributes it is there %d", num_attributes);
 
 	if(num_attributes == LIBXML_ERR || num_attributes == 0)
 	{
 		return 0;
 	}
 
+	if(globals->current_scope != SCOPE_FULL)
+	{
+		//attributes of not shredded element only get their order
+		globals->global_order += num_attributes;
+		return num_attributes;
+	}
+
 	i = 0;
 	for(; i < num_attributes; i++)
 	{
@@ -436,8 +728,8 @@ process_attributes(int parent_id, xmlTextReaderPtr reader,
 
 		if (DEBUG)
 		{
-			elog(INFO, "== CREATE == attribute[%d] values depth:%d, did:%d, order:%d, parent_id:%d, "
-					"prev_id:%d, size:%d, att_name:%s, value:%s", my_ind,
+			elog(DEBUG2, "== CREATE == attribute[%d] values depth:%d, did:" XML_LABEL_FORMAT ", order:" XML_LABEL_FORMAT ", parent_id:" XML_LABEL_FORMAT ", "
+					"prev_id:" XML_LABEL_FORMAT ", size:" XML_LABEL_FORMAT ", att_name:%s, value:%s", my_ind,
 					attribute_node_buffer[my_ind].depth,
 					attribute_node_buffer[my_ind].did,
 					attribute_node_buffer[my_ind].order,
@@ -484,7 +776,7 @@ create_new_text_node(xml_index_globals_ptr globals)
 	}
 	my_ind = globals->text_node_buffer_count;
 
-	elog(INFO, "creating new text node at index: %d", my_ind);
+	elog(DEBUG2, "creating new text node at index: %d", my_ind);
 
 	text_node_buffer[my_ind].did = NO_VALUE;
 	text_node_buffer[my_ind].order = NO_VALUE;
@@ -526,7 +818,7 @@ create_new_attribute(xml_index_globals_ptr globals)
 	
 	my_ind = globals->attribute_node_buffer_count;
 
-	elog(INFO, "creating new attribute at index: %d", my_ind);
+	elog(DEBUG2, "creating new attribute at index: %d", my_ind);
 
 	attribute_node_buffer[my_ind].did = NO_VALUE;
 	attribute_node_buffer[my_ind].order = NO_VALUE;
@@ -562,12 +854,19 @@ create_new_attribute(xml_index_globals_ptr globals)
  * @return
  */
 int
-process_text_node(int parent_id, int prev_id, xmlTextReaderPtr reader,
+process_text_node(xml_label parent_id, xml_label prev_id, xmlTextReaderPtr reader,
 		xml_index_globals_ptr globals)
 {
 	int my_ind;
+	char* value;
 
-	char* value = get_text_from_node(reader);
+	if(globals->current_scope != SCOPE_FULL ||
+			(globals->spec != NULL && globals->spec->keep_text == FALSE))
+	{
+		return count_text_node(reader, globals);
+	}
+
+	value = get_text_from_node(reader);
 
 	// If the text node is nothing but white space, returning a value of FAKE_TEXT_NODE
 	// will cause this text node to be ignored.  Disable this if statement if you want
@@ -597,8 +896,8 @@ process_text_node(int parent_id, int prev_id, xmlTextReaderPtr reader,
 
 	 //Replace any characters that the DBMS has problems with.
 	text_node_buffer[my_ind].value = replace_bad_chars(value);
-	elog(INFO, "== CREATE == text node[%d] depth:%d, did:%d, order:%d, parent_id:%d, "
-			"prev_id:%d, size:%d, value:%s", my_ind,
+	elog(DEBUG2, "== CREATE == text node[%d] depth:%d, did:" XML_LABEL_FORMAT ", order:" XML_LABEL_FORMAT ", parent_id:" XML_LABEL_FORMAT ", "
+			"prev_id:" XML_LABEL_FORMAT ", size:" XML_LABEL_FORMAT ", value:%s", my_ind,
 			text_node_buffer[my_ind].depth,
 			text_node_buffer[my_ind].did,
 			text_node_buffer[my_ind].order,
@@ -609,6 +908,32 @@ process_text_node(int parent_id, int prev_id, xmlTextReaderPtr reader,
 	return REAL_TEXT_NODE;
 }
 
+/**
+ * Numbers text node which is not stored. Same nodes as in process_text_node
+ * are counted, but value is not copied out of reader.
+ * @param reader pointer to LibXML stream reader
+ * @param globals variables used for global handling
+ * @return REAL_TEXT_NODE or FAKE_TEXT_NODE for white space only text
+ */
+int
+count_text_node(xmlTextReaderPtr reader, xml_index_globals_ptr globals)
+{
+	const xmlChar* value;
+
+	// CDATA is never ignored, see get_text_from_node
+	if(xmlTextReaderNodeType(reader) == TEXT_NODE)
+	{
+		value = xmlTextReaderConstValue(reader);
+		if(value == NULL || is_all_whitespace((char *)value))
+		{
+			return FAKE_TEXT_NODE;
+		}
+	}
+
+	++(globals->global_order);
+	return REAL_TEXT_NODE;
+}
+
 /**
  * Retrieves the proper text from a text node
  * @param reader pointer to LibXML stream reader
@@ -711,6 +1036,302 @@ replace_bad_chars(char* value)
 	return value;
 }
 
+/**
+ * Check if table is visible in search path. Query naming missing table
+ * fails already in parser, so optional tables are checked by separate
+ * statement before they are read. Caller has to be connected to SPI.
+ * @param name name of table
+ * @return true if table exists
+ */
+bool
+xml_index_table_exists(const char *name)
+{
+	Oid types[1] = {TEXTOID};
+	Datum args[1];
+
+	args[0] = CStringGetTextDatum(name);
+
+	return SPI_execute_with_args("SELECT 1 FROM pg_catalog.pg_class c "
+					"WHERE c.relname = $1 AND c.relkind = 'r' "
+					"AND pg_catalog.pg_table_is_visible(c.oid)",
+			1, types, args, NULL, true, 1) == SPI_OK_SELECT && SPI_processed > 0;
+}
+
+/**
+ * Read value of xml_index_settings. Tables created before
+ * xml_index_settings existed have no settings.
+ * @param name setting (layout, labels, unlogged, postings, keywords)
+ * @return value allocated in context of caller, NULL if it is not set
+ */
+char *
+xml_index_setting(const char *name)
+{
+	char *result = NULL;
+	char *value;
+	Oid types[1] = {TEXTOID};
+	Datum args[1];
+
+	SPI_connect();
+
+	args[0] = CStringGetTextDatum(name);
+	if (xml_index_table_exists("xml_index_settings") &&
+			SPI_execute_with_args("SELECT value FROM xml_index_settings WHERE name = $1",
+				1, types, args, NULL, true, 1) == SPI_OK_SELECT && SPI_processed > 0)
+	{
+		value = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+		if (value != NULL)
+		{
+			// SPI memory is released by SPI_finish
+			result = SPI_palloc(strlen(value) + 1);
+			strcpy(result, value);
+		}
+	}
+
+	SPI_finish();
+
+	return result;
+}
+
+/**
+ * Read layout of shredded tables chosen by create_xmlindex_tables. Tables
+ * created before xml_index_settings existed use separate tables.
+ * @return LAYOUT_SEPARATE or LAYOUT_UNIFIED
+ */
+int
+get_index_layout(void)
+{
+	char *value = xml_index_setting("layout");
+
+	if (value != NULL && strcmp(value, "unified") == 0)
+	{
+		return LAYOUT_UNIFIED;
+	}
+
+	return LAYOUT_SEPARATE;
+}
+
+static int
+compare_node_refs(const void *a, const void *b)
+{
+	xml_label order_a = ((const node_ref *) a)->order;
+	xml_label order_b = ((const node_ref *) b)->order;
+
+	return (order_a > order_b) - (order_a < order_b);
+}
+
+/**
+ * Flush all three buffers into node_table at once. Rows are merged by
+ * pre_order, so attributes and text are stored next to their element. Only
+ * elements still open at flush time (ancestors of current node) are stored
+ * later, at beginning of next batch.
+ * @param globals variables used for global handling
+ */
+void
+flush_node_buffers(xml_index_globals_ptr globals)
+{
+	int i, n, total;
+	node_ref *refs;
+	element_node_ptr element;
+	attribute_node_ptr attribute;
+	text_node_ptr text;
+	StringInfoData query;
+
+	total = globals->element_node_buffer_count +
+			globals->attribute_node_buffer_count +
+			globals->text_node_buffer_count;
+
+	if (globals->layout == LAYOUT_COLLECT)
+	{
+		collect_node_buffers(globals);
+		return;
+	}
+
+	elog(DEBUG2, "flushing %d nodes into node_table", total);
+
+	if ((DO_FLUSH == TRUE) && (total > 0))
+	{
+		refs = (node_ref *) palloc(sizeof(node_ref) * total);
+		n = 0;
+		for(i = 0; i < globals->element_node_buffer_count; i++, n++)
+		{
+			refs[n].order = element_node_buffer[i].order;
+			refs[n].kind = NODE_KIND_ELEMENT;
+			refs[n].index = i;
+		}
+		for(i = 0; i < globals->attribute_node_buffer_count; i++, n++)
+		{
+			refs[n].order = attribute_node_buffer[i].order;
+			refs[n].kind = NODE_KIND_ATTRIBUTE;
+			refs[n].index = i;
+		}
+		for(i = 0; i < globals->text_node_buffer_count; i++, n++)
+		{
+			refs[n].order = text_node_buffer[i].order;
+			refs[n].kind = NODE_KIND_TEXT;
+			refs[n].index = i;
+		}
+
+		qsort(refs, total, sizeof(node_ref), compare_node_refs);
+
+		initStringInfo(&query);
+		appendStringInfo(&query,
+						"INSERT INTO node_table(did, pre_order, size, kind, name, depth, "
+						"parent_id, prev_id, child_id, attr_id, value, next_id, sibling_ord) VALUES ");
+
+		for(i = 0; i < total; i++)
+		{
+			switch (refs[i].kind)
+			{
+				case NODE_KIND_ELEMENT:
+					element = &element_node_buffer[refs[i].index];
+					appendStringInfo(&query,
+							" (" XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", %d, %s, %d, "
+							XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", NULL, "
+							XML_LABEL_FORMAT ", %d)",
+							element->did,
+							element->order,
+							element->size,
+							NODE_KIND_ELEMENT,
+							quote_literal_cstr(element->tag_name),
+							element->depth,
+							element->parent_id,
+							element->prev_id,
+							element->child_id,
+							element->first_attr_id,
+							element->next_id,
+							element->sibling_ord);
+					break;
+				case NODE_KIND_ATTRIBUTE:
+					attribute = &attribute_node_buffer[refs[i].index];
+					appendStringInfo(&query,
+							" (" XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", %d, %s, %d, "
+							XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", NULL, NULL, %s, NULL, NULL)",
+							attribute->did,
+							attribute->order,
+							attribute->size,
+							NODE_KIND_ATTRIBUTE,
+							quote_literal_cstr(attribute->tag_name),
+							attribute->depth,
+							attribute->parent_id,
+							attribute->prev_id,
+							attribute->value != NULL ?
+								quote_literal_cstr(attribute->value) : "''");
+					break;
+				default:
+					text = &text_node_buffer[refs[i].index];
+					appendStringInfo(&query,
+							" (" XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", 0, %d, NULL, %d, "
+							XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", NULL, NULL, %s, NULL, NULL)",
+							text->did,
+							text->order,
+							NODE_KIND_TEXT,
+							text->depth,
+							text->parent_id,
+							text->prev_id,
+							text->value != NULL ?
+								quote_literal_cstr(text->value) : "NULL");
+					break;
+			}
+
+			appendStringInfo(&query, ((i + 1) < total) ? "," : ";");
+		}
+
+		SPI_connect();
+
+		if (SPI_execute(query.data, false, 0) == SPI_ERROR_ARGUMENT)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("invalid query")));
+
+		SPI_finish();
+
+		pfree(query.data);
+		pfree(refs);
+	}
+
+	globals->element_node_buffer_count = 0;
+	globals->attribute_node_buffer_count = 0;
+	globals->text_node_buffer_count = 0;
+}
+
+/**
+ * Append buffered nodes to rows of xml_index_collect
+ * @param globals variables used for global handling
+ */
+void
+collect_node_buffers(xml_index_globals_ptr globals)
+{
+	xml_node_rows_ptr rows = globals->rows;
+	xml_node_row *row;
+	int64 total;
+	int i;
+
+	total = rows->count + globals->element_node_buffer_count +
+			globals->attribute_node_buffer_count +
+			globals->text_node_buffer_count;
+
+	if(total > rows->max)
+	{
+		rows->max = Max(total, rows->max * 2);
+		rows->rows = rows->rows == NULL ?
+				(xml_node_row *) palloc(sizeof(xml_node_row) * rows->max) :
+				(xml_node_row *) repalloc(rows->rows,
+						sizeof(xml_node_row) * rows->max);
+	}
+
+	for(i = 0; i < globals->element_node_buffer_count; i++)
+	{
+		row = &rows->rows[rows->count++];
+		row->kind = NODE_KIND_ELEMENT;
+		row->order = element_node_buffer[i].order;
+		row->size = element_node_buffer[i].size;
+		row->depth = element_node_buffer[i].depth;
+		row->parent_id = element_node_buffer[i].parent_id;
+		row->prev_id = element_node_buffer[i].prev_id;
+		row->name = pstrdup(element_node_buffer[i].tag_name);
+		row->value = NULL;
+	}
+	for(i = 0; i < globals->attribute_node_buffer_count; i++)
+	{
+		row = &rows->rows[rows->count++];
+		row->kind = NODE_KIND_ATTRIBUTE;
+		row->order = attribute_node_buffer[i].order;
+		row->size = attribute_node_buffer[i].size;
+		row->depth = attribute_node_buffer[i].depth;
+		row->parent_id = attribute_node_buffer[i].parent_id;
+		row->prev_id = attribute_node_buffer[i].prev_id;
+		row->name = pstrdup(attribute_node_buffer[i].tag_name);
+		row->value = attribute_node_buffer[i].value != NULL ?
+				pstrdup(attribute_node_buffer[i].value) : pstrdup("");
+	}
+	for(i = 0; i < globals->text_node_buffer_count; i++)
+	{
+		row = &rows->rows[rows->count++];
+		row->kind = NODE_KIND_TEXT;
+		row->order = text_node_buffer[i].order;
+		row->size = 0;
+		row->depth = text_node_buffer[i].depth;
+		row->parent_id = text_node_buffer[i].parent_id;
+		row->prev_id = text_node_buffer[i].prev_id;
+		row->name = NULL;
+		row->value = text_node_buffer[i].value != NULL ?
+				pstrdup(text_node_buffer[i].value) : NULL;
+	}
+
+	globals->element_node_buffer_count = 0;
+	globals->attribute_node_buffer_count = 0;
+	globals->text_node_buffer_count = 0;
+}
+
+static int
+compare_node_rows(const void *a, const void *b)
+{
+	xml_label order_a = ((const xml_node_row *) a)->order;
+	xml_label order_b = ((const xml_node_row *) b)->order;
+
+	return (order_a > order_b) - (order_a < order_b);
+}
+
 /**
  * Flush the element buffer to element_table
  * @param globals variables used for global handling
@@ -722,11 +1343,17 @@ flush_element_node_buffer(xml_index_globals_ptr globals)
 
 	StringInfoData query;
 
-	elog(INFO, "flushing element_nodes");
+	if (globals->layout != LAYOUT_SEPARATE)
+	{
+		flush_node_buffers(globals);
+		return;
+	}
+
+	elog(DEBUG2, "flushing element_nodes");
 
 	initStringInfo(&query);
 	appendStringInfo(&query,
-						"INSERT INTO element_table(did, pre_order, size, name, depth, child_id, prev_id, attr_id, parent_id) VALUES ");
+						"INSERT INTO element_table(did, pre_order, size, name, depth, child_id, prev_id, attr_id, parent_id, next_id, sibling_ord) VALUES ");
 
 	if ((DO_FLUSH == TRUE) && (globals->element_node_buffer_count > 0))
 	{
@@ -742,7 +1369,9 @@ flush_element_node_buffer(xml_index_globals_ptr globals)
 			}
 
 			appendStringInfo(&query,
-							" (%d, %d, %d, '%s', %d, %d, %d, %d, %d)",
+							" (" XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", '%s', %d, "
+							XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", "
+							XML_LABEL_FORMAT ", %d)",
 							element_node_buffer[i].did,
 							element_node_buffer[i].order,
 							element_node_buffer[i].size,
@@ -751,7 +1380,9 @@ flush_element_node_buffer(xml_index_globals_ptr globals)
 							element_node_buffer[i].child_id,
 							element_node_buffer[i].prev_id,
 							element_node_buffer[i].first_attr_id,
-							element_node_buffer[i].parent_id
+							element_node_buffer[i].parent_id,
+							element_node_buffer[i].next_id,
+							element_node_buffer[i].sibling_ord
 				);
 
 			if ((i+1) < globals->element_node_buffer_count)
@@ -763,7 +1394,7 @@ flush_element_node_buffer(xml_index_globals_ptr globals)
 			}
 		}
 
-		elog(INFO, "flush element: %s\n", query.data);
+		elog(DEBUG2, "flush element: %s\n", query.data);
 
 		SPI_connect();
 
@@ -788,7 +1419,13 @@ flush_attribute_node_buffer(xml_index_globals_ptr globals)
 	int i, val_len;
 	StringInfoData query;
 
-	elog(INFO, "flushing attribute_nodes");
+	if (globals->layout != LAYOUT_SEPARATE)
+	{
+		flush_node_buffers(globals);
+		return;
+	}
+
+	elog(DEBUG2, "flushing attribute_nodes");
 
 	initStringInfo(&query);
 	appendStringInfo(&query,
@@ -808,7 +1445,8 @@ flush_attribute_node_buffer(xml_index_globals_ptr globals)
 			}
 
 			appendStringInfo(&query,
-							" (%d, %d, %d, '%s', %d, %d, %d, '%s')",
+							" (" XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", '%s', %d, "
+							XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", '%s')",
 							attribute_node_buffer[i].did,
 							attribute_node_buffer[i].order,
 							attribute_node_buffer[i].size,
@@ -828,7 +1466,7 @@ flush_attribute_node_buffer(xml_index_globals_ptr globals)
 			}
 		}
 
-		elog(INFO, "flush attributes: %s\n", query.data);
+		elog(DEBUG2, "flush attributes: %s\n", query.data);
 
 		SPI_connect();
 
@@ -840,7 +1478,7 @@ flush_attribute_node_buffer(xml_index_globals_ptr globals)
 		SPI_finish();
 	}
 
-	elog(INFO, "flushed attribute_nodes");
+	elog(DEBUG2, "flushed attribute_nodes");
 }
 
 /**
@@ -853,7 +1491,13 @@ flush_text_node_buffer(xml_index_globals_ptr globals)
 	int i, val_len;
 	StringInfoData query;
 
-	elog(INFO, "flushing text_nodes");
+	if (globals->layout != LAYOUT_SEPARATE)
+	{
+		flush_node_buffers(globals);
+		return;
+	}
+
+	elog(DEBUG2, "flushing text_nodes");
 
 	initStringInfo(&query);
 	appendStringInfo(&query,
@@ -866,7 +1510,8 @@ flush_text_node_buffer(xml_index_globals_ptr globals)
 			if (text_node_buffer[i].value != NULL)
 			{
 				appendStringInfo(&query,
-							" (%d, %d, %d, %d, %d, '%s')",
+							" (" XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", %d, " XML_LABEL_FORMAT ", "
+							XML_LABEL_FORMAT ", '%s')",
 						text_node_buffer[i].did,
 						text_node_buffer[i].order,
 						text_node_buffer[i].depth,
@@ -877,7 +1522,8 @@ flush_text_node_buffer(xml_index_globals_ptr globals)
 			} else
 			{
 				appendStringInfo(&query,
-							" (%d, %d, %d, %d, %d, NULL)",
+							" (" XML_LABEL_FORMAT ", " XML_LABEL_FORMAT ", %d, " XML_LABEL_FORMAT ", "
+							XML_LABEL_FORMAT ", NULL)",
 						text_node_buffer[i].did,
 						text_node_buffer[i].order,
 						text_node_buffer[i].depth,
@@ -902,7 +1548,7 @@ flush_text_node_buffer(xml_index_globals_ptr globals)
 			}
 		}
 
-		elog(INFO, "flush text nodes: %s\n", query.data);
+		elog(DEBUG2, "flush text nodes: %s\n", query.data);
 
 		SPI_connect();
 
@@ -913,7 +1559,7 @@ flush_text_node_buffer(xml_index_globals_ptr globals)
 
 		SPI_finish();
 	}
-	elog(INFO, "flushed text_nodes");
+	elog(DEBUG2, "flushed text_nodes");
 }
 /**
  * Prints a report 
@@ -924,8 +1570,487 @@ report(xml_index_globals_ptr globals)
 {
 
 	elog(INFO, "Final report for loading XML into database");
-	elog(INFO, "total number of nodes = %d", globals->global_order);
-	elog(INFO, "total number of elements = %d", globals->element_node_count);
-	elog(INFO, "total number attribute = %d", globals->attribute_node_count);
-	elog(INFO, "total number of text nodes = %d", globals->text_node_count);
-}
\ No newline at end of file
+	elog(INFO, "total number of nodes = " XML_LABEL_FORMAT, globals->global_order);
+	elog(INFO, "total number of elements = " INT64_FORMAT, globals->element_node_count);
+	elog(INFO, "total number attribute = " INT64_FORMAT, globals->attribute_node_count);
+	elog(INFO, "total number of text nodes = " INT64_FORMAT, globals->text_node_count);
+}
+
+/**
+ * Build shredding specification from lists of include and exclude paths.
+ * Path is list of tag names (or *) separated by / or // like in XPath, path
+ * without leading / can start anywhere in document.
+ * @param include paths of shredded subtrees, nothing means whole document
+ * @param exclude paths of subtrees which are never shredded
+ * @param keep_text if FALSE text nodes are not stored
+ * @return specification for xml_index_entry
+ */
+xml_shred_spec_ptr
+create_shred_spec(char** include, int ninclude, char** exclude, int nexclude,
+		bool keep_text)
+{
+	xml_shred_spec_ptr spec;
+	int i;
+
+	spec = (xml_shred_spec_ptr) palloc(sizeof(xml_shred_spec));
+	spec->ninclude = ninclude;
+	spec->nexclude = nexclude;
+	spec->keep_text = keep_text;
+	spec->include = (path_pattern *) palloc(sizeof(path_pattern) * (ninclude + 1));
+	spec->exclude = (path_pattern *) palloc(sizeof(path_pattern) * (nexclude + 1));
+
+	for(i = 0; i < ninclude; i++)
+	{
+		compile_path_pattern(include[i], &(spec->include[i]));
+	}
+	for(i = 0; i < nexclude; i++)
+	{
+		compile_path_pattern(exclude[i], &(spec->exclude[i]));
+	}
+
+	return spec;
+}
+
+/**
+ * Split path like /a/b//c or //item into steps
+ * @param pattern text of path
+ * @param result compiled path
+ */
+void
+compile_path_pattern(const char* pattern, path_pattern* result)
+{
+	int len, i, start;
+	bool descendant;
+	char* name;
+
+	len = strlen(pattern);
+	if(len == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("empty shredding path")));
+	}
+
+	result->nsteps = 0;
+	result->steps = (path_step *) palloc(sizeof(path_step) * (len + 1));
+
+	i = 0;
+	descendant = TRUE;					// relative path match anywhere
+	if(pattern[0] == '/')
+	{
+		descendant = (pattern[1] == '/');
+		i = descendant ? 2 : 1;
+	}
+
+	while(i < len)
+	{
+		start = i;
+		while(i < len && pattern[i] != '/')
+		{
+			i++;
+		}
+
+		if(i == start)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid shredding path \"%s\"", pattern)));
+		}
+
+		name = pnstrdup(pattern + start, i - start);
+		if(strpbrk(name, "@[]()=") != NULL)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid shredding path \"%s\"", pattern),
+					 errdetail("Only element names, * and / or // are supported.")));
+		}
+
+		result->steps[result->nsteps].name = name;
+		result->steps[result->nsteps].descendant = descendant;
+		result->nsteps++;
+
+		descendant = FALSE;
+		if(i < len)
+		{
+			i++;
+			if(i < len && pattern[i] == '/')
+			{
+				descendant = TRUE;
+				i++;
+			}
+			if(i == len)
+			{
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("invalid shredding path \"%s\"", pattern)));
+			}
+		}
+	}
+
+	if(result->nsteps == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid shredding path \"%s\"", pattern)));
+	}
+}
+
+static bool
+step_matches(path_step* step, const char* name)
+{
+	return strcmp(step->name, "*") == 0 || strcmp(step->name, name) == 0;
+}
+
+/*
+ * Recursive matching of steps from step_no against names from path_no
+ */
+static bool
+match_steps(path_pattern* pattern, int step_no, char** path, int path_no,
+		int npath, bool prefix)
+{
+	int i;
+	path_step* step;
+
+	if(step_no == pattern->nsteps)
+	{
+		// whole pattern is used, for prefix test path must continue
+		return !prefix && path_no == npath;
+	}
+	if(path_no == npath)
+	{
+		// rest of pattern can match names below path
+		return prefix;
+	}
+
+	step = &(pattern->steps[step_no]);
+	if(step->descendant)
+	{
+		if(prefix)
+		{
+			// step can skip all remaining names and match below path
+			return TRUE;
+		}
+		for(i = path_no; i < npath; i++)
+		{
+			if(step_matches(step, path[i]) &&
+					match_steps(pattern, step_no + 1, path, i + 1, npath, prefix))
+			{
+				return TRUE;
+			}
+		}
+		return FALSE;
+	}
+
+	return step_matches(step, path[path_no]) &&
+			match_steps(pattern, step_no + 1, path, path_no + 1, npath, prefix);
+}
+
+/**
+ * Check if path of element (names from root) is matched by pattern
+ * @return TRUE/FALSE
+ */
+bool
+path_pattern_matches(path_pattern* pattern, char** path, int npath)
+{
+	return match_steps(pattern, 0, path, 0, npath, FALSE);
+}
+
+/**
+ * Check if pattern can match some descendant of element with given path
+ * @return TRUE/FALSE
+ */
+bool
+path_pattern_can_match_below(path_pattern* pattern, char** path, int npath)
+{
+	return match_steps(pattern, 0, path, 0, npath, TRUE);
+}
+
+/**
+ * Decide scope of element by shredding specification. Excluded subtree and
+ * subtree where no include pattern can match are only counted.
+ * @param name tag name of element
+ * @param depth depth of element
+ * @param globals variables used for global handling, current_scope is scope
+ *		of parent element
+ * @return SCOPE_FULL, SCOPE_PATH or SCOPE_NONE
+ */
+int
+element_scope(const char* name, int depth, xml_index_globals_ptr globals)
+{
+	xml_shred_spec_ptr spec = globals->spec;
+	int i, new_size;
+
+	if(spec == NULL)
+	{
+		return SCOPE_FULL;
+	}
+	if(globals->current_scope == SCOPE_NONE)
+	{
+		return SCOPE_NONE;
+	}
+
+	// remember name on path, depth of reader is index into path
+	if(depth >= globals->path_size)
+	{
+		new_size = Max(16, 2 * (depth + 1));
+		if(globals->path == NULL)
+		{
+			globals->path = (char **) palloc0(sizeof(char *) * new_size);
+		}
+		else
+		{
+			globals->path = (char **) repalloc(globals->path, sizeof(char *) * new_size);
+			memset(globals->path + globals->path_size, 0,
+					sizeof(char *) * (new_size - globals->path_size));
+		}
+		globals->path_size = new_size;
+	}
+	if(globals->path[depth] != NULL)
+	{
+		pfree(globals->path[depth]);
+	}
+	globals->path[depth] = pstrdup(name != NULL ? name : DOCUMENT_ROOT);
+
+	for(i = 0; i < spec->nexclude; i++)
+	{
+		if(path_pattern_matches(&(spec->exclude[i]), globals->path, depth + 1))
+		{
+			return SCOPE_NONE;
+		}
+	}
+
+	if(globals->current_scope == SCOPE_FULL)
+	{
+		return SCOPE_FULL;
+	}
+
+	for(i = 0; i < spec->ninclude; i++)
+	{
+		if(path_pattern_matches(&(spec->include[i]), globals->path, depth + 1))
+		{
+			return SCOPE_FULL;
+		}
+	}
+	for(i = 0; i < spec->ninclude; i++)
+	{
+		if(path_pattern_can_match_below(&(spec->include[i]), globals->path, depth + 1))
+		{
+			return SCOPE_PATH;
+		}
+	}
+
+	return SCOPE_NONE;
+}
+
+
+/**
+ * Copy message of libxml2 error without trailing newline
+ * @param error error reported by libxml2, can be NULL
+ * @return palloc'd message, NULL if error has no message
+ */
+static char *
+libxml_error_message(xmlErrorPtr error)
+{
+	char *message;
+	int length;
+
+	if(error == NULL || error->message == NULL)
+	{
+		return NULL;
+	}
+
+	message = pstrdup(error->message);
+	length = strlen(message);
+	while(length > 0 && message[length - 1] == '\n')
+	{
+		message[--length] = '\0';
+	}
+
+	return message;
+}
+
+/**
+ * Remember first validation error reported by reader
+ */
+static void
+validation_error_handler(void *arg, xmlErrorPtr error)
+{
+	xml_index_globals_ptr globals = (xml_index_globals_ptr) arg;
+
+	if(globals->validation_error == NULL && error->level >= XML_ERR_ERROR)
+	{
+		globals->validation_error = libxml_error_message(error);
+	}
+}
+
+/**
+ * Attach schema to reader, so document is validated in the same pass as it
+ * is shredded. Reader can't validate against DTD which isn't declared by
+ * document, so DTD is checked by xmlValidateDtd before shredding.
+ * @param reader reader which wasn't read yet
+ * @param xml_document document (for DTD validation)
+ * @param length length of document
+ * @param globals variables used for global handling, validation is set
+ */
+void
+prepare_validation(xmlTextReaderPtr reader, const char *xml_document,
+		int length, xml_index_globals_ptr globals)
+{
+	xml_validation_spec_ptr validation = globals->validation;
+	xmlSchemaParserCtxtPtr xsd_ctxt;
+	xmlRelaxNGParserCtxtPtr rng_ctxt;
+	xmlDtdPtr dtd;
+	xmlDocPtr doc;
+	xmlValidCtxtPtr valid_ctxt;
+	int ret = -1;
+	const char *failure = NULL;
+	char *detail;
+
+	// message of failed parsing or validation is read after it
+	xmlResetLastError();
+
+	switch(validation->kind)
+	{
+		case VALIDATE_XSD:
+			xsd_ctxt = xmlSchemaNewMemParserCtxt(validation->schema,
+					validation->length);
+			if(xsd_ctxt != NULL)
+			{
+				globals->schema = xmlSchemaParse(xsd_ctxt);
+				xmlSchemaFreeParserCtxt(xsd_ctxt);
+			}
+			if(globals->schema != NULL)
+			{
+				ret = xmlTextReaderSetSchema(reader, (xmlSchemaPtr) globals->schema);
+			}
+			break;
+
+		case VALIDATE_RNG:
+			rng_ctxt = xmlRelaxNGNewMemParserCtxt(validation->schema,
+					validation->length);
+			if(rng_ctxt != NULL)
+			{
+				globals->schema = xmlRelaxNGParse(rng_ctxt);
+				xmlRelaxNGFreeParserCtxt(rng_ctxt);
+			}
+			if(globals->schema != NULL)
+			{
+				ret = xmlTextReaderRelaxNGSetSchema(reader,
+						(xmlRelaxNGPtr) globals->schema);
+			}
+			break;
+
+		case VALIDATE_DTD:
+			dtd = xmlIOParseDTD(NULL,
+					xmlParserInputBufferCreateMem(validation->schema,
+							validation->length, XML_CHAR_ENCODING_NONE),
+					XML_CHAR_ENCODING_NONE);
+			if(dtd == NULL)
+			{
+				break;
+			}
+			doc = xmlReadMemory(xml_document, length, "include.xml", NULL, 0);
+			valid_ctxt = xmlNewValidCtxt();
+			if(doc == NULL)
+			{
+				failure = "document is not well-formed XML";
+			} else if(valid_ctxt != NULL)
+			{
+				ret = xmlValidateDtd(valid_ctxt, doc, dtd) == 1 ? 0 : 1;
+			}
+			if(valid_ctxt != NULL)
+			{
+				xmlFreeValidCtxt(valid_ctxt);
+			}
+			if(doc != NULL)
+			{
+				xmlFreeDoc(doc);
+			}
+			xmlFreeDtd(dtd);
+			if(ret == 1)
+			{
+				failure = "document is not valid against DTD";
+			}
+			globals->validation = NULL;
+			break;
+	}
+
+	if(ret != 0)
+	{
+		if(failure == NULL)
+		{
+			// schema itself can't be parsed
+			failure = validation->kind == VALIDATE_XSD ?
+					"document can not be validated, XML Schema is not valid" :
+					validation->kind == VALIDATE_RNG ?
+					"document can not be validated, RelaxNG is not valid" :
+					"document can not be validated, DTD is not valid";
+		}
+		detail = libxml_error_message(xmlGetLastError());
+		if(globals->validation != NULL)
+		{
+			release_validation(globals);
+		}
+		xmlFreeTextReader(reader);
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_XML_DOCUMENT),
+				 errmsg("%s", failure),
+				 detail != NULL ? errdetail("%s", detail) : 0));
+	}
+
+	if(globals->validation != NULL)
+	{
+		xmlTextReaderSetStructuredErrorHandler(reader, validation_error_handler,
+				globals);
+	}
+}
+
+/**
+ * Raise ERROR if reader found document invalid so far. Called for every read
+ * node, so invalid document is rejected before next flush of buffers.
+ * @param globals variables used for global handling
+ */
+void
+check_validity(xml_index_globals_ptr globals)
+{
+	if(xmlTextReaderIsValid(globals->reader) == 1)
+	{
+		return;
+	}
+
+	release_validation(globals);
+	xmlFreeTextReader(globals->reader);
+	globals->reader = NULL;
+
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_XML_DOCUMENT),
+			 errmsg("document is not valid against %s",
+					 globals->validation->kind == VALIDATE_XSD ? "XML Schema" : "RelaxNG"),
+			 globals->validation_error != NULL ?
+				 errdetail("%s", globals->validation_error) : 0));
+}
+
+/**
+ * Free parsed schema, reader must not be used for validation anymore
+ * @param globals variables used for global handling
+ */
+void
+release_validation(xml_index_globals_ptr globals)
+{
+	if(globals->schema == NULL)
+	{
+		return;
+	}
+
+	if(globals->validation->kind == VALIDATE_XSD)
+	{
+		xmlTextReaderSetSchema(globals->reader, NULL);
+		xmlSchemaFree((xmlSchemaPtr) globals->schema);
+	} else
+	{
+		xmlTextReaderRelaxNGSetSchema(globals->reader, NULL);
+		xmlRelaxNGFree((xmlRelaxNGPtr) globals->schema);
+	}
+	globals->schema = NULL;
+}
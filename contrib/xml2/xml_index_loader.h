@@ -18,6 +18,7 @@ extern "C" {
 #endif
 
 #include "postgres.h"
+#include "lib/stringinfo.h"
 
 #ifdef USE_LIBXML
 	#include <libxml/chvalid.h>
@@ -78,34 +79,62 @@ extern "C" {
 
 #define BUFFER_SIZE 10000		//Size of Buffer for Element, Attribute and Text Node queues
 
+//Layout of shredded tables, stored in xml_index_settings by create_xmlindex_tables
+#define LAYOUT_SEPARATE 0		//element_table, attribute_table and text_table
+#define LAYOUT_UNIFIED 1		//single node_table ordered by pre_order
+#define LAYOUT_COLLECT 2		//nodes are only collected in memory (xml_shred)
 
+//Value of kind column in node_table, same numbers as LibXML reader node types
+#define NODE_KIND_ELEMENT 1
+#define NODE_KIND_ATTRIBUTE 2
+#define NODE_KIND_TEXT 3
+
+
+
+//Node labels (document id, order, size and links to other nodes) are always
+//64 bit in loader; width of stored columns is chosen by create_xmlindex_tables
+typedef int64 xml_label;
+#define XML_LABEL_FORMAT INT64_FORMAT
+#define XML_LABEL_MIN (-INT64CONST(0x7FFFFFFFFFFFFFFF) - 1)
+#define XML_LABEL_MAX INT64CONST(0x7FFFFFFFFFFFFFFF)
 
 //Structs
 typedef struct element_node element_node;
 typedef struct element_node *element_node_ptr;
 struct element_node{
-	int did;
-	int order;
-	int size;
+	xml_label did;
+	xml_label order;
+	xml_label size;
 	char* tag_name;
 	int depth;
-	int child_id;
-	int prev_id;
-	int first_attr_id;
-	int parent_id;
+	xml_label child_id;
+	xml_label prev_id;
+	xml_label first_attr_id;
+	xml_label parent_id;
+	xml_label next_id;		//next element sibling, set when it starts
+	int sibling_ord;		//position among element siblings of the same name
+};
+
+//Counts element children of one element by name, for sibling_ord
+typedef struct sibling_counter sibling_counter;
+struct sibling_counter{
+	int count;
+	int max;
+	char** names;
+	int* ordinals;
 };
 
 
 typedef struct attribute_node attribute_node;
 typedef struct attribute_node *attribute_node_ptr;
 struct attribute_node{
-	int did;
-	int order;
-	int size;
+	xml_label did;
+	xml_label order;
+	xml_label size;
 	char* tag_name;
 	int depth;
-	int parent_id;
-	int prev_id;
+	xml_label parent_id;
+	xml_label prev_id;
 	char* value;
 };
 
@@ -113,40 +142,131 @@ struct attribute_node{
 typedef struct text_node text_node;
 typedef struct text_node *text_node_ptr;
 struct text_node{
-	int did;
-	int order;
-	int size;
+	xml_label did;
+	xml_label order;
+	xml_label size;
 	int depth;
-	int parent_id;
-	int prev_id;
+	xml_label parent_id;
+	xml_label prev_id;
 	char* value;
 };
 
+//Selective shredding, scope of element is decided from path of names
+#define SCOPE_FULL 1		//element and its subtree are shredded
+#define SCOPE_PATH 0		//element isn't shredded, its descendant can be
+#define SCOPE_NONE -1		//subtree is only counted to keep pre/size numbering
+
+typedef struct path_step path_step;
+struct path_step{
+	char* name;				//tag name or "*"
+	bool descendant;		//step was preceded by "//"
+};
+
+typedef struct path_pattern path_pattern;
+struct path_pattern{
+	int nsteps;
+	path_step* steps;
+};
+
+typedef struct xml_shred_spec xml_shred_spec;
+typedef struct xml_shred_spec *xml_shred_spec_ptr;
+struct xml_shred_spec{
+	int ninclude;
+	path_pattern* include;	//if empty, everything not excluded is shredded
+	int nexclude;
+	path_pattern* exclude;
+	bool keep_text;			//store text nodes into text_table
+};
+
+//Validation during shredding
+#define VALIDATE_NONE 0
+#define VALIDATE_XSD 1		//XML Schema, validated by reader while streaming
+#define VALIDATE_RNG 2		//RelaxNG, validated by reader while streaming
+#define VALIDATE_DTD 3		//DTD, reader can't use external DTD, own pass
+
+typedef struct xml_validation_spec xml_validation_spec;
+typedef struct xml_validation_spec *xml_validation_spec_ptr;
+struct xml_validation_spec{
+	int kind;
+	char* schema;			//text of schema
+	int length;
+};
+
+//Node collected by LAYOUT_COLLECT, same values as row of node_table
+typedef struct xml_node_row xml_node_row;
+struct xml_node_row{
+	int kind;
+	xml_label order;
+	xml_label size;
+	int depth;
+	xml_label parent_id;
+	xml_label prev_id;
+	char* name;
+	char* value;
+};
+
+typedef struct xml_node_rows xml_node_rows;
+typedef struct xml_node_rows *xml_node_rows_ptr;
+struct xml_node_rows{
+	int64 count;
+	int64 max;
+	xml_node_row* rows;		//sorted by order after loader ends
+};
+
 typedef struct xml_index_globals xml_index_globals;
 typedef struct xml_index_globals *xml_index_globals_ptr;
 struct xml_index_globals {
-	int global_order;
-	int global_doc_id;
-	int element_node_count;
+	xml_label global_order;
+	xml_label global_doc_id;
+	int64 element_node_count;
 	int element_node_buffer_count;
-	int attribute_node_count;
+	int64 attribute_node_count;
 	int attribute_node_buffer_count;
-	int text_node_count;
+	int64 text_node_count;
 	int text_node_buffer_count;
+	int layout;					//LAYOUT_SEPARATE, LAYOUT_UNIFIED or LAYOUT_COLLECT
+	xml_shred_spec_ptr spec;	//NULL means full shredding
+	int current_scope;
+	char** path;				//names of ancestors indexed by depth
+	int path_size;
+	xml_validation_spec_ptr validation;	//NULL means no validation
+	xmlTextReaderPtr reader;
+	void* schema;				//parsed xmlSchema or xmlRelaxNG
+	char* validation_error;		//first message reported by reader
+	xml_node_rows_ptr rows;		//target of LAYOUT_COLLECT
 };
 
 
-//Buffers
-element_node		element_node_buffer[BUFFER_SIZE];
-text_node			text_node_buffer[BUFFER_SIZE];
-attribute_node		attribute_node_buffer[BUFFER_SIZE];
+//Buffers, defined in xml_index_loader.c
+extern element_node		element_node_buffer[BUFFER_SIZE];
+extern text_node		text_node_buffer[BUFFER_SIZE];
+extern attribute_node	attribute_node_buffer[BUFFER_SIZE];
 
 ////////////////////////////////////////////////////////////////////////////////
 
-int extern xml_index_entry(const char *xml_document, int length, int4 did);
-
-static int preorder_traverse(int parent_id, int sibling_id,	
-		xmlTextReaderPtr reader, xml_index_globals_ptr globals);
+int extern xml_index_entry(const char *xml_document, int length, xml_label did,
+		xml_shred_spec_ptr spec, xml_validation_spec_ptr validation);
+
+int extern xml_index_collect(const char *xml_document, int length,
+		xml_node_rows_ptr rows);
+
+xml_shred_spec_ptr create_shred_spec(char** include, int ninclude,
+		char** exclude, int nexclude, bool keep_text);
+void compile_path_pattern(const char* pattern, path_pattern* result);
+bool path_pattern_matches(path_pattern* pattern, char** path, int npath);
+bool path_pattern_can_match_below(path_pattern* pattern, char** path, int npath);
+int element_scope(const char* name, int depth, xml_index_globals_ptr globals);
+int count_text_node(xmlTextReaderPtr reader, xml_index_globals_ptr globals);
+void prepare_validation(xmlTextReaderPtr reader, const char *xml_document,
+		int length, xml_index_globals_ptr globals);
+void check_validity(xml_index_globals_ptr globals);
+void release_validation(xml_index_globals_ptr globals);
+
+static xml_label preorder_traverse(xml_label parent_id, xml_label sibling_id,
+		int sibling_ord, xmlTextReaderPtr reader, xml_index_globals_ptr globals);
+int sibling_ordinal(sibling_counter* counter, const char* name);
+void set_next_sibling(xml_label order, xml_label next_id,
+		xml_index_globals_ptr globals);
 
 void init_values(xml_index_globals_ptr globals);
 
@@ -154,14 +274,14 @@ int read_next_node(xmlTextReaderPtr reader, xml_index_globals_ptr globals);
 
 int create_new_element(xml_index_globals_ptr globals);
 
-int process_attributes(int parent_id, xmlTextReaderPtr reader,
+int process_attributes(xml_label parent_id, xmlTextReaderPtr reader,
 		xml_index_globals_ptr globals);
 
 int create_new_attribute(xml_index_globals_ptr globals);
 
 int create_new_text_node(xml_index_globals_ptr globals);
 
-int process_text_node(int parent_id, int prev_id, xmlTextReaderPtr reader,
+int process_text_node(xml_label parent_id, xml_label prev_id, xmlTextReaderPtr reader,
 		xml_index_globals_ptr globals);
 
 char* get_text_from_node(xmlTextReaderPtr reader);
@@ -170,8 +290,49 @@ int is_all_whitespace(char * text);
 
 void flush_text_node_buffer(xml_index_globals_ptr globals);
 void flush_attribute_node_buffer(xml_index_globals_ptr globals);
+int get_index_layout(void);
+bool xml_index_table_exists(const char *name);
+char *xml_index_setting(const char *name);
+void flush_node_buffers(xml_index_globals_ptr globals);
+void collect_node_buffers(xml_index_globals_ptr globals);
 void flush_element_node_buffer(xml_index_globals_ptr globals);
 void report(xml_index_globals_ptr globals);
+
+//Implemented in xmlindex.c
+xml_label insert_xmldata(char* xmldata, char* name);
+xml_label insert_xmldata_into_table(char* xmldata, char* name, bool shredded);
+bool ensure_document_shredded(xml_label did);
+int ensure_documents_shredded(xml_label did_from, xml_label did_to);
+void mark_document_shredded(xml_label did);
+bool create_indexes_on_tables(int layout);
+bool drop_indexes_on_tables(int layout);
+
+//Implemented in xml_postings.c
+bool xml_postings_enabled(void);
+int64 xml_postings_rebuild(int layout);
+void xml_postings_add_document(xml_label did, int layout);
+void xml_postings_remove_document(xml_label did);
+
+//Implemented in xml_xpath_views.c
+bool xml_xpath_views_enabled(void);
+int64 xml_xpath_views_rebuild(int layout);
+void xml_xpath_views_add_document(xml_label did, int layout);
+void xml_xpath_views_remove_document(xml_label did);
+
+//Implemented in xml_keyword_search.c
+bool xml_keywords_enabled(void);
+int64 xml_keywords_rebuild(int layout);
+void xml_keywords_add_document(xml_label did, int layout);
+void xml_keywords_remove_document(xml_label did);
+
+//Implemented in xml_index_analyze.c
+double xml_index_statistic(const char *name, double default_value);
+
+//Implemented in xml_xpath_shredded.c
+char *compile_xpath_shredded(const char *xpath, bool has_did, bool with_values,
+		int layout);
+void append_attribute_key(StringInfo buf, const char *alias, const char *name,
+		const char *literal);
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,582 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_index_shard.c
+// desc:	Shredded store distributed over several PostgreSQL instances
+//			(shards) with pgxml installed. Document with did lives with all
+//			its nodes on shard did % nshards, sequence of did on every shard
+//			generates only its own residue. Every document is shredded
+//			locally on its shard, so structural joins (which never cross
+//			documents) run on shards unchanged and coordinator only
+//			concatenates results. Queries are sent to all shards at once by
+//			asynchronous libpq calls and shards evaluate them in parallel.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include <sys/time.h>
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+
+#include "libpq-fe.h"
+
+#include "access/hash.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+/* externally accessible functions */
+Datum	create_xmlindex_shards(PG_FUNCTION_ARGS);
+Datum	xmlindex_shard_of(PG_FUNCTION_ARGS);
+Datum	build_xmlindex_sharded(PG_FUNCTION_ARGS);
+Datum	xmlindex_shard_query(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(create_xmlindex_shards);
+PG_FUNCTION_INFO_V1(xmlindex_shard_of);
+PG_FUNCTION_INFO_V1(build_xmlindex_sharded);
+PG_FUNCTION_INFO_V1(xmlindex_shard_query);
+
+// implemented in xmlindex.c
+char** text_array_to_cstrings(ArrayType* array, int* count);
+
+// open connections of one call, closed on success and on error
+typedef struct shard_connections shard_connections;
+struct shard_connections {
+	PGconn	  **conns;
+	int			count;
+};
+
+/*
+ * Only superuser can give connection strings, they may contain passwords
+ * and connect as any role (same rule as dblink for non password auth)
+ */
+static void
+check_shard_privileges(void)
+{
+	if (!superuser())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to manage shards of shredded tables")));
+	}
+}
+
+static void
+close_shards(shard_connections *shards)
+{
+	int			i;
+
+	for (i = 0; i < shards->count; i++)
+	{
+		if (shards->conns[i] != NULL)
+		{
+			PQfinish(shards->conns[i]);
+			shards->conns[i] = NULL;
+		}
+	}
+}
+
+/*
+ * Cancel queries still running on shards and close connections, used when
+ * coordinator stops reading results
+ */
+static void
+cancel_shards(shard_connections *shards)
+{
+	char		errbuf[256];
+	int			i;
+
+	for (i = 0; i < shards->count; i++)
+	{
+		PGcancel   *cancel;
+
+		if (shards->conns[i] == NULL || !PQisBusy(shards->conns[i]))
+		{
+			continue;
+		}
+		cancel = PQgetCancel(shards->conns[i]);
+		if (cancel != NULL)
+		{
+			PQcancel(cancel, errbuf, sizeof(errbuf));
+			PQfreeCancel(cancel);
+		}
+	}
+	close_shards(shards);
+}
+
+/*
+ * Report error of shard, connections must be closed before ereport
+ */
+static void
+shard_error(shard_connections *shards, int shard, const char *what)
+{
+	char	   *message = pstrdup(PQerrorMessage(shards->conns[shard]));
+
+	close_shards(shards);
+	ereport(ERROR,
+			(errcode(ERRCODE_CONNECTION_FAILURE),
+			 errmsg("%s on shard %d failed", what, shard),
+			 errdetail("%s", message)));
+}
+
+static PGconn *
+connect_shard(shard_connections *shards, int shard, const char *conninfo)
+{
+	PGconn	   *conn = PQconnectdb(conninfo);
+
+	shards->conns[shard] = conn;
+	if (PQstatus(conn) != CONNECTION_OK)
+	{
+		shard_error(shards, shard, "connection");
+	}
+
+	return conn;
+}
+
+/*
+ * Run command on shard, result is returned only for tuples
+ */
+static PGresult *
+shard_exec(shard_connections *shards, int shard, const char *command,
+		int nparams, const char *const *params)
+{
+	PGresult   *res = PQexecParams(shards->conns[shard], command, nparams,
+			NULL, params, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_COMMAND_OK &&
+			PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		PQclear(res);
+		shard_error(shards, shard, command);
+	}
+
+	return res;
+}
+
+/*
+ * Wait until result of shard can be read without blocking, so that query
+ * cancel or termination of coordinator backend is handled while shards
+ * evaluate long query
+ */
+static void
+wait_shard_result(shard_connections *shards, int shard)
+{
+	PGconn	   *conn = shards->conns[shard];
+
+	while (PQisBusy(conn))
+	{
+		fd_set		input_mask;
+		struct timeval timeout;
+		int			sock = PQsocket(conn);
+
+		CHECK_FOR_INTERRUPTS();
+
+		FD_ZERO(&input_mask);
+		FD_SET(sock, &input_mask);
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		if (select(sock + 1, &input_mask, NULL, NULL, &timeout) < 0 &&
+				errno != EINTR)
+		{
+			shard_error(shards, shard, "waiting for result");
+		}
+		if (!PQconsumeInput(conn))
+		{
+			shard_error(shards, shard, "query");
+		}
+	}
+}
+
+/*
+ * Read connection strings of shards from xml_index_shards, ordered by shard
+ * @param count (out) number of shards
+ * @return palloc'd array of connection strings
+ */
+static char **
+read_shards(int *count)
+{
+	char	  **result;
+	int			i;
+
+	SPI_connect();
+
+	if (SPI_execute("SELECT conninfo FROM xml_index_shards ORDER BY shard",
+			true, 0) != SPI_OK_SELECT || SPI_processed == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("shards of shredded tables are not defined"),
+				 errhint("Use create_xmlindex_shards().")));
+	}
+
+	*count = SPI_processed;
+	result = (char **) SPI_palloc(*count * sizeof(char *));
+	for (i = 0; i < *count; i++)
+	{
+		char	   *conninfo = SPI_getvalue(SPI_tuptable->vals[i],
+				SPI_tuptable->tupdesc, 1);
+
+		result[i] = SPI_palloc(strlen(conninfo) + 1);
+		strcpy(result[i], conninfo);
+	}
+
+	SPI_finish();
+
+	return result;
+}
+
+/*
+ * Register shards and prepare their did sequences: shard i (counted from 0)
+ * generates dids nshards + i, 2 * nshards + i, ... so did % nshards is
+ * always number of shard holding the document. Shards must have pgxml
+ * installed with the same layout and must be empty.
+ * @param conninfos libpq connection strings, one per shard
+ * @return number of shards
+ */
+Datum
+create_xmlindex_shards(PG_FUNCTION_ARGS)
+{
+	char	  **conninfos;
+	int			nshards;
+	shard_connections shards;
+	StringInfoData query;
+	Oid			oids[2];
+	Datum		data[2];
+	int			i;
+
+	check_shard_privileges();
+
+	conninfos = text_array_to_cstrings(PG_GETARG_ARRAYTYPE_P(0), &nshards);
+	if (nshards == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("at least one shard is required")));
+	}
+
+	shards.conns = (PGconn **) palloc0(nshards * sizeof(PGconn *));
+	shards.count = nshards;
+
+	// check all shards first, nothing is changed if one is unusable
+	for (i = 0; i < nshards; i++)
+	{
+		PGresult   *res;
+
+		connect_shard(&shards, i, conninfos[i]);
+		res = shard_exec(&shards, i,
+				"SELECT count(*) FROM xml_documents_table", 0, NULL);
+		if (strcmp(PQgetvalue(res, 0, 0), "0") != 0)
+		{
+			PQclear(res);
+			close_shards(&shards);
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("shard %d already contains documents", i)));
+		}
+		PQclear(res);
+	}
+
+	// shards are registered first, remote sequences are changed only when
+	// local registration can't fail anymore (altering empty shard again
+	// after failure is harmless)
+	PG_TRY();
+	{
+		SPI_connect();
+
+		if (SPI_execute("CREATE TABLE xml_index_shards "
+								"(shard int PRIMARY KEY, "
+								"conninfo text not null)",
+				false, 0) != SPI_OK_UTILITY)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not create xml_index_shards")));
+		}
+
+		oids[0] = INT4OID;
+		oids[1] = TEXTOID;
+		for (i = 0; i < nshards; i++)
+		{
+			data[0] = Int32GetDatum(i);
+			data[1] = CStringGetTextDatum(conninfos[i]);
+			if (SPI_execute_with_args("INSERT INTO xml_index_shards VALUES ($1, $2)",
+					2, oids, data, NULL, false, 0) != SPI_OK_INSERT)
+			{
+				ereport(ERROR,
+						(errcode(ERRCODE_DATA_EXCEPTION),
+						 errmsg("Can not insert values into xml_index_shards")));
+			}
+		}
+
+		SPI_finish();
+	}
+	PG_CATCH();
+	{
+		close_shards(&shards);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	initStringInfo(&query);
+	for (i = 0; i < nshards; i++)
+	{
+		resetStringInfo(&query);
+		appendStringInfo(&query,
+				"ALTER SEQUENCE xml_documents_table_did_seq "
+				"INCREMENT BY %d MINVALUE 1 RESTART WITH %d",
+				nshards, nshards + i);
+		PQclear(shard_exec(&shards, i, query.data, 0, NULL));
+	}
+
+	close_shards(&shards);
+
+	PG_RETURN_INT32(nshards);
+}
+
+/*
+ * Shard of did, sequences of shards generate only positive dids
+ */
+static int
+shard_of_did(int64 did, int nshards)
+{
+	if (did < 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid document id " INT64_FORMAT, did)));
+	}
+
+	return (int) (did % nshards);
+}
+
+/*
+ * Shard holding document
+ * @param did document id
+ * @return number of shard, counted from 0
+ */
+Datum
+xmlindex_shard_of(PG_FUNCTION_ARGS)
+{
+	int64		did = PG_GETARG_INT64(0);
+	int			nshards;
+
+	read_shards(&nshards);
+
+	PG_RETURN_INT32(shard_of_did(did, nshards));
+}
+
+/*
+ * Store and shred document on one of shards. Shard is chosen by hash of
+ * document name, did assigned by its sequence then maps back to the shard.
+ * @param xml document
+ * @param name name of document
+ * @return did of document
+ */
+Datum
+build_xmlindex_sharded(PG_FUNCTION_ARGS)
+{
+	text	   *doc = PG_GETARG_TEXT_P(0);
+	text	   *name = PG_GETARG_TEXT_P(1);
+	char	  **conninfos;
+	int			nshards;
+	int			shard;
+	shard_connections shards;
+	const char *params[2];
+	PGresult   *res;
+	int64		did;
+
+	check_shard_privileges();
+
+	conninfos = read_shards(&nshards);
+	shard = (uint32) DatumGetInt32(hash_any((unsigned char *) VARDATA(name),
+			VARSIZE(name) - VARHDRSZ)) % nshards;
+
+	shards.conns = (PGconn **) palloc0(nshards * sizeof(PGconn *));
+	shards.count = nshards;
+
+	connect_shard(&shards, shard, conninfos[shard]);
+
+	// document is committed on shard as the last step, nothing stays there
+	// when shredding fails
+	params[0] = text_to_cstring(doc);
+	params[1] = text_to_cstring(name);
+	PQclear(shard_exec(&shards, shard, "BEGIN", 0, NULL));
+	// same transaction, so currval is did of the document just stored
+	res = shard_exec(&shards, shard,
+			"SELECT build_xmlindex($1::xml, $2), "
+			"currval('xml_documents_table_did_seq')", 2, params);
+	if (strcmp(PQgetvalue(res, 0, 0), "t") != 0)
+	{
+		PQclear(res);
+		close_shards(&shards);
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not shred XML document on shard %d", shard)));
+	}
+	did = strtoll(PQgetvalue(res, 0, 1), NULL, 10);
+	PQclear(res);
+	PQclear(shard_exec(&shards, shard, "COMMIT", 0, NULL));
+
+	close_shards(&shards);
+
+	PG_RETURN_INT64(did);
+}
+
+/*
+ * Run query on shards and return union of their results. Query runs on
+ * every shard unchanged, so it must not join nodes of different documents.
+ * Query is sent to all shards before any result is read, shards evaluate it
+ * in parallel. Caller gives column definition list:
+ *		SELECT * FROM xmlindex_shard_query('SELECT did, pre_order FROM ...')
+ *			AS t(did int, pre_order int);
+ * @param query SQL query run on shards
+ * @param did (optional) run only on shard holding this document
+ * @return set of records
+ */
+Datum
+xmlindex_shard_query(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	char	   *query = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char	  **conninfos;
+	int			nshards;
+	int			first;
+	int			last;
+	shard_connections shards;
+	TupleDesc	ret_tupdesc;
+	AttInMetadata *attinmeta;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	PGresult   *volatile res = NULL;
+	char	  **values;
+	int			i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+			rsinfo->expectedDesc == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("xmlindex_shard_query must be called as a table function")));
+	}
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("xmlindex_shard_query requires Materialize mode, but it "
+						"is not allowed in this context")));
+	}
+
+	check_shard_privileges();
+
+	conninfos = read_shards(&nshards);
+	first = 0;
+	last = nshards - 1;
+	if (PG_NARGS() > 1)
+	{
+		first = last = shard_of_did(PG_GETARG_INT64(1), nshards);
+	}
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+			false, work_mem);
+	ret_tupdesc = CreateTupleDescCopy(rsinfo->expectedDesc);
+	MemoryContextSwitchTo(oldcontext);
+
+	attinmeta = TupleDescGetAttInMetadata(ret_tupdesc);
+	values = (char **) palloc(ret_tupdesc->natts * sizeof(char *));
+
+	shards.conns = (PGconn **) palloc0(nshards * sizeof(PGconn *));
+	shards.count = nshards;
+
+	// start query everywhere, then collect
+	for (i = first; i <= last; i++)
+	{
+		connect_shard(&shards, i, conninfos[i]);
+		if (!PQsendQuery(shards.conns[i], query))
+		{
+			shard_error(&shards, i, "query");
+		}
+	}
+
+	// input functions of columns and cancel of query can fail, connections
+	// must not leak and shards must not keep evaluating the query
+	PG_TRY();
+	{
+		for (i = first; i <= last; i++)
+		{
+			for (;;)
+			{
+				int			row;
+				int			col;
+
+				wait_shard_result(&shards, i);
+				res = PQgetResult(shards.conns[i]);
+				if (res == NULL)
+				{
+					break;
+				}
+
+				if (PQresultStatus(res) != PGRES_TUPLES_OK)
+				{
+					PQclear(res);
+					res = NULL;
+					shard_error(&shards, i, "query");
+				}
+				if (PQnfields(res) != ret_tupdesc->natts)
+				{
+					int			nfields = PQnfields(res);
+
+					PQclear(res);
+					res = NULL;
+					ereport(ERROR,
+							(errcode(ERRCODE_DATATYPE_MISMATCH),
+							 errmsg("query on shard %d returned %d columns, expected %d",
+									i, nfields, ret_tupdesc->natts)));
+				}
+
+				for (row = 0; row < PQntuples(res); row++)
+				{
+					for (col = 0; col < ret_tupdesc->natts; col++)
+					{
+						values[col] = PQgetisnull(res, row, col) ? NULL :
+								PQgetvalue(res, row, col);
+					}
+					tuplestore_puttuple(tupstore,
+							BuildTupleFromCStrings(attinmeta, values));
+				}
+				PQclear(res);
+				res = NULL;
+			}
+		}
+	}
+	PG_CATCH();
+	{
+		if (res != NULL)
+		{
+			PQclear(res);
+		}
+		cancel_shards(&shards);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	close_shards(&shards);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = ret_tupdesc;
+
+	return (Datum) 0;
+}
@@ -0,0 +1,1448 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_inlining.c
+// desc:	Schema driven shredding. Complex types of XSD schema are mapped to
+//			relational tables, simple typed children and attributes are
+//			inlined as columns of native SQL types, so range predicates can
+//			use ordinary B-tree indexes.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/xml.h"
+
+#ifdef USE_LIBXML
+	/* libxml includes */
+	#include <libxml/parser.h>
+	#include <libxml/tree.h>
+	#include <libxml/xmlmemory.h>
+	#include <libxml/xmlschemas.h>
+#endif
+
+#define XSD_NAMESPACE "http://www.w3.org/2001/XMLSchema"
+#define XSI_NAMESPACE "http://www.w3.org/2001/XMLSchema-instance"
+
+// fixed columns of every inlined table
+#define INLINE_FIXED_COLUMNS "did, node_id, parent_node, ord"
+
+// rows of one table sent in one INSERT
+#define INLINE_BATCH_ROWS 1000
+
+////////////////////////////////////////////////////////////////////////////////
+// Mapping of schema to tables
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct inline_column inline_column;
+struct inline_column {
+	char	*name;				// SQL column name
+	char	*xml_name;			// name of element or attribute
+	const char *sql_type;
+	bool	attribute;
+};
+
+typedef struct inline_table inline_table;
+
+typedef struct inline_child inline_child;
+struct inline_child {
+	char	*xml_name;			// name of child element
+	int		column;				// inlined column, -1 if child has own table
+	inline_table *table;		// table of complex or repeated child
+};
+
+struct inline_table {
+	char	*table_name;
+	char	*type_name;			// named complex type shared by elements
+	xmlNodePtr decl;			// element declaration of anonymous type
+	inline_column *columns;
+	int		ncolumns;
+	int		maxcolumns;
+	inline_child *children;
+	int		nchildren;
+	int		maxchildren;
+	int		value_column;		// column for simple content, -1 if none
+	StringInfoData rows;		// INSERT of rows not flushed yet
+	int		nrows;
+};
+
+typedef struct inline_model inline_model;
+struct inline_model {
+	char	*prefix;
+	xmlDocPtr schema_doc;
+	xmlNodePtr schema_root;
+	inline_table **tables;
+	int		ntables;
+	int		maxtables;
+	char	**root_names;		// global elements, possible document roots
+	inline_table **root_tables;
+	int		nroots;
+};
+
+/* externally accessible functions */
+Datum	create_xmlindex_inlined(PG_FUNCTION_ARGS);
+Datum	build_xmlindex_inlined(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(create_xmlindex_inlined);
+PG_FUNCTION_INFO_V1(build_xmlindex_inlined);
+
+#ifdef USE_LIBXML
+
+/* ordinary internal (static) functions */
+static inline_model *build_inline_model(const char *prefix, const char *xsd);
+static void free_inline_model(inline_model *model);
+static inline_table *new_inline_table(inline_model *model, const char *name,
+		const char *type_name);
+static int add_inline_column(inline_table *table, const char *xml_name,
+		const char *sql_type, bool attribute);
+static void add_complex_content(inline_model *model, inline_table *table,
+		xmlNodePtr complex_type, int level);
+static void add_particles(inline_model *model, inline_table *table,
+		xmlNodePtr group, bool repeated, int level);
+static void add_attribute(inline_model *model, inline_table *table,
+		xmlNodePtr attribute);
+static void add_element_child(inline_model *model, inline_table *table,
+		xmlNodePtr element, bool repeated, int level);
+static inline_table *complex_type_table(inline_model *model,
+		xmlNodePtr complex_type, xmlNodePtr decl, const char *name,
+		const char *type_name, int level);
+static const char *simple_type_sql(inline_model *model, xmlNodePtr context,
+		const xmlChar *qname, int level);
+static char *load_inline_schema(const char *prefix);
+static void load_element(inline_model *model, inline_table *table,
+		xmlNodePtr node, xml_label did, int parent_node, int ord, int *node_id);
+static void flush_inline_rows(inline_table *table);
+
+/*
+ * Test if node is element of XML Schema namespace with given local name
+ */
+static bool
+is_xsd_node(xmlNodePtr node, const char *name)
+{
+	return node != NULL && node->type == XML_ELEMENT_NODE &&
+			node->ns != NULL &&
+			xmlStrEqual(node->ns->href, (const xmlChar *) XSD_NAMESPACE) &&
+			xmlStrEqual(node->name, (const xmlChar *) name);
+}
+
+/*
+ * Return local part of QName (text after colon)
+ */
+static const char *
+local_part(const xmlChar *qname)
+{
+	const char *colon = strchr((const char *) qname, ':');
+
+	return colon != NULL ? colon + 1 : (const char *) qname;
+}
+
+/*
+ * Test if QName used in schema node context is from XML Schema namespace,
+ * it means builtin type like xs:int
+ */
+static bool
+is_builtin_qname(xmlNodePtr context, const xmlChar *qname)
+{
+	const char *colon = strchr((const char *) qname, ':');
+	xmlChar	   *prefix = NULL;
+	xmlNsPtr	ns;
+
+	if (colon != NULL)
+	{
+		prefix = xmlStrndup(qname, colon - (const char *) qname);
+	}
+	ns = xmlSearchNs(context->doc, context, prefix);
+	if (prefix != NULL)
+	{
+		xmlFree(prefix);
+	}
+
+	return ns != NULL && xmlStrEqual(ns->href, (const xmlChar *) XSD_NAMESPACE);
+}
+
+/*
+ * Read attribute of schema node as palloced string, NULL if missing
+ */
+static char *
+xsd_attribute(xmlNodePtr node, const char *name)
+{
+	xmlChar    *value = xmlGetProp(node, (const xmlChar *) name);
+	char	   *result;
+
+	if (value == NULL)
+	{
+		return NULL;
+	}
+	result = pstrdup((const char *) value);
+	xmlFree(value);
+
+	return result;
+}
+
+/*
+ * True if particle can occur more than once
+ */
+static bool
+is_repeated(xmlNodePtr node)
+{
+	char	   *max_occurs = xsd_attribute(node, "maxOccurs");
+
+	return max_occurs != NULL &&
+			(strcmp(max_occurs, "unbounded") == 0 || atoi(max_occurs) > 1);
+}
+
+/*
+ * Find global declaration (direct child of xs:schema) by kind and name
+ */
+static xmlNodePtr
+find_global(inline_model *model, const char *kind, const char *name)
+{
+	xmlNodePtr	node;
+	char	   *node_name;
+
+	for (node = model->schema_root->children; node != NULL; node = node->next)
+	{
+		if (is_xsd_node(node, kind))
+		{
+			node_name = xsd_attribute(node, "name");
+			if (node_name != NULL && strcmp(node_name, name) == 0)
+			{
+				return node;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * First child of schema node with given local name
+ */
+static xmlNodePtr
+xsd_child(xmlNodePtr node, const char *name)
+{
+	xmlNodePtr	child;
+
+	for (child = node->children; child != NULL; child = child->next)
+	{
+		if (is_xsd_node(child, name))
+		{
+			return child;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Make SQL identifier from XML name: lower case, other chars than letters,
+ * digits and _ replaced by _, limited to NAMEDATALEN
+ */
+static char *
+sanitize_identifier(const char *prefix, const char *name)
+{
+	StringInfoData buf;
+	const char *c;
+
+	initStringInfo(&buf);
+	if (prefix != NULL)
+	{
+		appendStringInfo(&buf, "%s_", prefix);
+	}
+	for (c = name; *c != '\0'; c++)
+	{
+		if (isalnum((unsigned char) *c) || *c == '_')
+		{
+			appendStringInfoChar(&buf, tolower((unsigned char) *c));
+		}
+		else
+		{
+			appendStringInfoChar(&buf, '_');
+		}
+	}
+	if (buf.len >= NAMEDATALEN)
+	{
+		buf.data[NAMEDATALEN - 1] = '\0';
+	}
+
+	return buf.data;
+}
+
+/*
+ * Map builtin XML Schema type to SQL type
+ */
+static const char *
+builtin_type_sql(const char *type)
+{
+	static const char *const mapping[][2] = {
+		{"boolean", "boolean"},
+		{"int", "integer"},
+		{"unsignedShort", "integer"},
+		{"short", "smallint"},
+		{"byte", "smallint"},
+		{"unsignedByte", "smallint"},
+		{"long", "bigint"},
+		{"unsignedInt", "bigint"},
+		{"integer", "numeric"},
+		{"nonNegativeInteger", "numeric"},
+		{"positiveInteger", "numeric"},
+		{"nonPositiveInteger", "numeric"},
+		{"negativeInteger", "numeric"},
+		{"unsignedLong", "numeric"},
+		{"decimal", "numeric"},
+		{"float", "real"},
+		{"double", "double precision"},
+		{"date", "date"},
+		{"dateTime", "timestamp with time zone"},
+		{"time", "time"},
+		{"duration", "interval"},
+	};
+	int			i;
+
+	for (i = 0; i < lengthof(mapping); i++)
+	{
+		if (strcmp(mapping[i][0], type) == 0)
+		{
+			return mapping[i][1];
+		}
+	}
+
+	// strings, names, URIs, binary and g* types stay as text
+	return "text";
+}
+
+/*
+ * Resolve SQL type of simple type given by QName (builtin or global
+ * xs:simpleType, derived by restriction)
+ */
+static const char *
+simple_type_sql(inline_model *model, xmlNodePtr context, const xmlChar *qname,
+		int level)
+{
+	xmlNodePtr	simple_type;
+	xmlNodePtr	restriction;
+	char	   *base;
+
+	if (qname == NULL || level > 32)
+	{
+		return "text";
+	}
+	if (is_builtin_qname(context, qname))
+	{
+		return builtin_type_sql(local_part(qname));
+	}
+
+	simple_type = find_global(model, "simpleType", local_part(qname));
+	if (simple_type == NULL)
+	{
+		return "text";
+	}
+
+	// xs:list and xs:union are stored as text
+	restriction = xsd_child(simple_type, "restriction");
+	if (restriction == NULL)
+	{
+		return "text";
+	}
+	base = xsd_attribute(restriction, "base");
+
+	return simple_type_sql(model, restriction, (xmlChar *) base, level + 1);
+}
+
+/*
+ * SQL type of anonymous xs:simpleType child of node, NULL if there is none
+ */
+static const char *
+inline_simple_type_sql(inline_model *model, xmlNodePtr node, int level)
+{
+	xmlNodePtr	simple_type = xsd_child(node, "simpleType");
+	xmlNodePtr	restriction;
+
+	if (simple_type == NULL)
+	{
+		return NULL;
+	}
+	restriction = xsd_child(simple_type, "restriction");
+	if (restriction == NULL)
+	{
+		return "text";
+	}
+
+	return simple_type_sql(model, restriction,
+			(xmlChar *) xsd_attribute(restriction, "base"), level + 1);
+}
+
+/*
+ * Name of table for child element, made of name of type (or element) of
+ * parent and name of child
+ */
+static char *
+nested_name(inline_model *model, inline_table *parent, const char *name)
+{
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+	appendStringInfo(&buf, "%s_%s",
+			parent->type_name != NULL ? parent->type_name :
+				parent->table_name + strlen(model->prefix) + 1,
+			name);
+
+	return buf.data;
+}
+
+/*
+ * Table already created for declaration of element with anonymous type
+ */
+static inline_table *
+find_decl_table(inline_model *model, xmlNodePtr decl)
+{
+	int			i;
+
+	for (i = 0; i < model->ntables; i++)
+	{
+		if (model->tables[i]->decl == decl)
+		{
+			return model->tables[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * New table of model, name of table is unique in model (suffix is added
+ * when two names are sanitized to same identifier)
+ */
+static inline_table *
+new_inline_table(inline_model *model, const char *name, const char *type_name)
+{
+	inline_table *table = (inline_table *) palloc0(sizeof(inline_table));
+	char	   *base = sanitize_identifier(model->prefix, name);
+	char	   *unique = base;
+	StringInfoData buf;
+	int			i;
+	int			suffix = 1;
+	bool		collision;
+
+	do
+	{
+		collision = false;
+		for (i = 0; i < model->ntables && !collision; i++)
+		{
+			collision = strcmp(model->tables[i]->table_name, unique) == 0;
+		}
+		if (collision)
+		{
+			// keep room for suffix within NAMEDATALEN
+			initStringInfo(&buf);
+			appendStringInfo(&buf, "%.*s_%d", NAMEDATALEN - 12, base, ++suffix);
+			unique = buf.data;
+		}
+	} while (collision);
+
+	table->table_name = unique;
+	table->type_name = type_name != NULL ? pstrdup(type_name) : NULL;
+	table->value_column = -1;
+
+	if (model->ntables >= model->maxtables)
+	{
+		model->maxtables = Max(16, model->maxtables * 2);
+		model->tables = model->tables == NULL ?
+				(inline_table **) palloc(sizeof(inline_table *) * model->maxtables) :
+				(inline_table **) repalloc(model->tables,
+						sizeof(inline_table *) * model->maxtables);
+	}
+	model->tables[model->ntables++] = table;
+
+	return table;
+}
+
+/*
+ * Add typed column to table, name of column is unique in table and doesn't
+ * collide with fixed columns
+ * @return index of column
+ */
+static int
+add_inline_column(inline_table *table, const char *xml_name,
+		const char *sql_type, bool attribute)
+{
+	char	   *name = sanitize_identifier(NULL, xml_name);
+	char	   *unique = name;
+	StringInfoData buf;
+	int			i;
+	int			suffix = 1;
+	bool		collision;
+
+	do
+	{
+		collision = strcmp(unique, "did") == 0 || strcmp(unique, "node_id") == 0 ||
+				strcmp(unique, "parent_node") == 0 || strcmp(unique, "ord") == 0;
+		for (i = 0; i < table->ncolumns && !collision; i++)
+		{
+			collision = strcmp(table->columns[i].name, unique) == 0;
+		}
+		if (collision)
+		{
+			initStringInfo(&buf);
+			appendStringInfo(&buf, "%s_%d", name, ++suffix);
+			unique = buf.data;
+		}
+	} while (collision);
+
+	if (table->ncolumns >= table->maxcolumns)
+	{
+		table->maxcolumns = Max(8, table->maxcolumns * 2);
+		table->columns = table->columns == NULL ?
+				(inline_column *) palloc(sizeof(inline_column) * table->maxcolumns) :
+				(inline_column *) repalloc(table->columns,
+						sizeof(inline_column) * table->maxcolumns);
+	}
+
+	table->columns[table->ncolumns].name = unique;
+	table->columns[table->ncolumns].xml_name = pstrdup(xml_name);
+	table->columns[table->ncolumns].sql_type = sql_type;
+	table->columns[table->ncolumns].attribute = attribute;
+
+	return table->ncolumns++;
+}
+
+static void
+add_inline_child(inline_table *table, const char *xml_name, int column,
+		inline_table *child_table)
+{
+	if (table->nchildren >= table->maxchildren)
+	{
+		table->maxchildren = Max(8, table->maxchildren * 2);
+		table->children = table->children == NULL ?
+				(inline_child *) palloc(sizeof(inline_child) * table->maxchildren) :
+				(inline_child *) repalloc(table->children,
+						sizeof(inline_child) * table->maxchildren);
+	}
+
+	table->children[table->nchildren].xml_name = pstrdup(xml_name);
+	table->children[table->nchildren].column = column;
+	table->children[table->nchildren].table = child_table;
+	table->nchildren++;
+}
+
+/*
+ * Table for complex type, named types are shared by all elements using them,
+ * anonymous type by all references of its element declaration. Table is
+ * registered before its content is added, so recursive types end in it.
+ */
+static inline_table *
+complex_type_table(inline_model *model, xmlNodePtr complex_type,
+		xmlNodePtr decl, const char *name, const char *type_name, int level)
+{
+	inline_table *table;
+	int			i;
+
+	if (type_name != NULL)
+	{
+		for (i = 0; i < model->ntables; i++)
+		{
+			if (model->tables[i]->type_name != NULL &&
+					strcmp(model->tables[i]->type_name, type_name) == 0)
+			{
+				return model->tables[i];
+			}
+		}
+	} else if ((table = find_decl_table(model, decl)) != NULL)
+	{
+		return table;
+	}
+
+	table = new_inline_table(model, type_name != NULL ? type_name : name,
+			type_name);
+	if (type_name == NULL)
+	{
+		table->decl = decl;
+	}
+	add_complex_content(model, table, complex_type, level + 1);
+
+	return table;
+}
+
+/*
+ * Add columns and children of complex type into table
+ */
+static void
+add_complex_content(inline_model *model, inline_table *table,
+		xmlNodePtr complex_type, int level)
+{
+	xmlNodePtr	node;
+	xmlNodePtr	derivation;
+	xmlNodePtr	base_type;
+	char	   *base;
+
+	if (level > 64)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("XSD schema is nested too deeply for inlining")));
+	}
+
+	for (node = complex_type->children; node != NULL; node = node->next)
+	{
+		if (is_xsd_node(node, "sequence") || is_xsd_node(node, "choice") ||
+				is_xsd_node(node, "all"))
+		{
+			add_particles(model, table, node, is_repeated(node), level);
+		}
+		else if (is_xsd_node(node, "attribute"))
+		{
+			add_attribute(model, table, node);
+		}
+		else if (is_xsd_node(node, "simpleContent"))
+		{
+			// text value of element with attributes
+			derivation = xsd_child(node, "extension");
+			if (derivation == NULL)
+			{
+				derivation = xsd_child(node, "restriction");
+			}
+			if (derivation != NULL)
+			{
+				base = xsd_attribute(derivation, "base");
+				table->value_column = add_inline_column(table, "value",
+						simple_type_sql(model, derivation, (xmlChar *) base, level),
+						false);
+				add_complex_content(model, table, derivation, level + 1);
+			}
+		}
+		else if (is_xsd_node(node, "complexContent"))
+		{
+			// derived type contains content of its base type first
+			derivation = xsd_child(node, "extension");
+			if (derivation == NULL)
+			{
+				derivation = xsd_child(node, "restriction");
+			}
+			if (derivation != NULL)
+			{
+				base = xsd_attribute(derivation, "base");
+				base_type = base != NULL ?
+						find_global(model, "complexType", local_part((xmlChar *) base)) :
+						NULL;
+				if (base_type != NULL && xsd_child(node, "extension") != NULL)
+				{
+					add_complex_content(model, table, base_type, level + 1);
+				}
+				add_complex_content(model, table, derivation, level + 1);
+			}
+		}
+		// xs:group, xs:attributeGroup and xs:any are not inlined
+	}
+}
+
+/*
+ * Walk model group (sequence, choice, all) and add its elements
+ */
+static void
+add_particles(inline_model *model, inline_table *table, xmlNodePtr group,
+		bool repeated, int level)
+{
+	xmlNodePtr	node;
+
+	for (node = group->children; node != NULL; node = node->next)
+	{
+		if (is_xsd_node(node, "element"))
+		{
+			add_element_child(model, table, node, repeated, level);
+		}
+		else if (is_xsd_node(node, "sequence") || is_xsd_node(node, "choice") ||
+				is_xsd_node(node, "all"))
+		{
+			add_particles(model, table, node, repeated || is_repeated(node),
+					level + 1);
+		}
+	}
+}
+
+static void
+add_attribute(inline_model *model, inline_table *table, xmlNodePtr attribute)
+{
+	char	   *name = xsd_attribute(attribute, "name");
+	char	   *type = xsd_attribute(attribute, "type");
+	char	   *ref;
+	xmlNodePtr	global;
+	const char *sql_type;
+
+	if (name == NULL)
+	{
+		ref = xsd_attribute(attribute, "ref");
+		if (ref == NULL)
+		{
+			return;
+		}
+		name = pstrdup(local_part((xmlChar *) ref));
+		global = find_global(model, "attribute", name);
+		if (global != NULL)
+		{
+			attribute = global;
+			type = xsd_attribute(global, "type");
+		}
+	}
+
+	sql_type = inline_simple_type_sql(model, attribute, 0);
+	if (sql_type == NULL)
+	{
+		sql_type = simple_type_sql(model, attribute, (xmlChar *) type, 0);
+	}
+
+	add_inline_column(table, name, sql_type, true);
+}
+
+/*
+ * Add child element declaration. Simple typed single child becomes column,
+ * complex or repeated child gets its own table.
+ */
+static void
+add_element_child(inline_model *model, inline_table *table, xmlNodePtr element,
+		bool repeated, int level)
+{
+	char	   *name;
+	char	   *type;
+	char	   *ref;
+	xmlNodePtr	complex_type = NULL;
+	const char *sql_type = NULL;
+	char	   *type_name = NULL;
+	char	   *table_name;
+	inline_table *child_table;
+
+	repeated = repeated || is_repeated(element);
+
+	ref = xsd_attribute(element, "ref");
+	if (ref != NULL)
+	{
+		element = find_global(model, "element", local_part((xmlChar *) ref));
+		if (element == NULL)
+		{
+			return;
+		}
+	}
+
+	name = xsd_attribute(element, "name");
+	type = xsd_attribute(element, "type");
+	if (name == NULL)
+	{
+		return;
+	}
+
+	if ((complex_type = xsd_child(element, "complexType")) == NULL)
+	{
+		sql_type = inline_simple_type_sql(model, element, level);
+		if (sql_type == NULL && type != NULL)
+		{
+			if (is_builtin_qname(element, (xmlChar *) type))
+			{
+				sql_type = builtin_type_sql(local_part((xmlChar *) type));
+			}
+			else if ((complex_type = find_global(model, "complexType",
+							local_part((xmlChar *) type))) != NULL)
+			{
+				type_name = pstrdup(local_part((xmlChar *) type));
+			}
+			else
+			{
+				sql_type = simple_type_sql(model, element, (xmlChar *) type, level);
+			}
+		}
+		else if (sql_type == NULL)
+		{
+			// xs:anyType, stored as text
+			sql_type = "text";
+		}
+	}
+
+	// global element has one table for all references
+	table_name = ref != NULL ? name : nested_name(model, table, name);
+
+	if (complex_type != NULL)
+	{
+		child_table = complex_type_table(model, complex_type, element,
+				table_name, type_name, level);
+		add_inline_child(table, name, -1, child_table);
+	}
+	else if (repeated)
+	{
+		// repeated simple element, table with value column only
+		child_table = find_decl_table(model, element);
+		if (child_table == NULL)
+		{
+			child_table = new_inline_table(model, table_name, NULL);
+			child_table->decl = element;
+			child_table->value_column = add_inline_column(child_table, "value",
+					sql_type, false);
+		}
+		add_inline_child(table, name, -1, child_table);
+	}
+	else
+	{
+		add_inline_child(table, name,
+				add_inline_column(table, name, sql_type, false), NULL);
+	}
+}
+
+/*
+ * Build mapping of schema to tables. Every global element of complex type is
+ * possible document root.
+ * @param prefix prefix of created tables
+ * @param xsd text of XML Schema
+ * @return mapping
+ */
+static inline_model *
+build_inline_model(const char *prefix, const char *xsd)
+{
+	inline_model *model = (inline_model *) palloc0(sizeof(inline_model));
+	xmlNodePtr	node;
+	xmlNodePtr	complex_type;
+	char	   *name;
+	char	   *type;
+	int			nglobals = 0;
+
+	model->prefix = sanitize_identifier(NULL, prefix);
+	model->schema_doc = xmlReadMemory(xsd, strlen(xsd), "schema.xsd", NULL, 0);
+	if (model->schema_doc == NULL ||
+			!is_xsd_node(xmlDocGetRootElement(model->schema_doc), "schema"))
+	{
+		if (model->schema_doc != NULL)
+		{
+			xmlFreeDoc(model->schema_doc);
+		}
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_XML_DOCUMENT),
+				 errmsg("Invalid XSD content")));
+	}
+	model->schema_root = xmlDocGetRootElement(model->schema_doc);
+
+	for (node = model->schema_root->children; node != NULL; node = node->next)
+	{
+		if (is_xsd_node(node, "element"))
+		{
+			nglobals++;
+		}
+	}
+	model->root_names = (char **) palloc(sizeof(char *) * (nglobals + 1));
+	model->root_tables = (inline_table **) palloc(sizeof(inline_table *) * (nglobals + 1));
+
+	// too deeply nested schema raises error, parsed schema must not leak
+	PG_TRY();
+	{
+		for (node = model->schema_root->children; node != NULL; node = node->next)
+		{
+			if (!is_xsd_node(node, "element"))
+			{
+				continue;
+			}
+
+			name = xsd_attribute(node, "name");
+			type = xsd_attribute(node, "type");
+			complex_type = xsd_child(node, "complexType");
+			if (complex_type == NULL && type != NULL && !is_builtin_qname(node, (xmlChar *) type))
+			{
+				complex_type = find_global(model, "complexType", local_part((xmlChar *) type));
+			}
+			if (name == NULL || complex_type == NULL)
+			{
+				// simple typed document has nothing to inline
+				continue;
+			}
+
+			model->root_names[model->nroots] = name;
+			model->root_tables[model->nroots] = complex_type_table(model,
+					complex_type, node, name,
+					xsd_child(node, "complexType") == NULL ?
+						local_part((xmlChar *) type) : NULL,
+					0);
+			model->nroots++;
+		}
+	}
+	PG_CATCH();
+	{
+		free_inline_model(model);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return model;
+}
+
+static void
+free_inline_model(inline_model *model)
+{
+	if (model->schema_doc != NULL)
+	{
+		xmlFreeDoc(model->schema_doc);
+		model->schema_doc = NULL;
+	}
+}
+
+/*
+ * Read schema registered for prefix by create_xmlindex_inlined
+ */
+static char *
+load_inline_schema(const char *prefix)
+{
+	Oid			oids[1];
+	Datum		data[1];
+	char	   *result = NULL;
+	char	   *value;
+
+	oids[0] = TEXTOID;
+	data[0] = CStringGetTextDatum(prefix);
+
+	SPI_connect();
+
+	if (SPI_execute_with_args("SELECT schema::text FROM xml_inline_schemas WHERE prefix = $1",
+			1, oids, data, NULL, true, 1) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read schema of inlined tables")));
+	}
+
+	if (SPI_processed > 0)
+	{
+		value = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+		if (value != NULL)
+		{
+			// copy out of SPI memory context
+			result = SPI_palloc(strlen(value) + 1);
+			strcpy(result, value);
+		}
+	}
+
+	SPI_finish();
+
+	if (result == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_TABLE),
+				 errmsg("no inlined tables with prefix \"%s\"", prefix),
+				 errhint("Create them by create_xmlindex_inlined().")));
+	}
+
+	return result;
+}
+
+/*
+ * Append row of element to pending INSERT of its table, values are literals
+ * cast to column types. Rows are sent by flush_inline_rows.
+ * @param values values of columns, NULL for SQL NULL
+ */
+static void
+append_inline_row(inline_table *table, xml_label did, int node_id,
+		int parent_node, int ord, char **values)
+{
+	int			i;
+
+	if (table->nrows == 0)
+	{
+		if (table->rows.data == NULL)
+		{
+			initStringInfo(&table->rows);
+		} else
+		{
+			resetStringInfo(&table->rows);
+		}
+		appendStringInfo(&table->rows, "INSERT INTO %s (" INLINE_FIXED_COLUMNS,
+				quote_identifier(table->table_name));
+		for (i = 0; i < table->ncolumns; i++)
+		{
+			appendStringInfo(&table->rows, ", %s",
+					quote_identifier(table->columns[i].name));
+		}
+		appendStringInfo(&table->rows, ") VALUES ");
+	} else
+	{
+		appendStringInfoChar(&table->rows, ',');
+	}
+
+	appendStringInfo(&table->rows, " (" XML_LABEL_FORMAT ", %d, ", did, node_id);
+	if (parent_node > 0)
+	{
+		appendStringInfo(&table->rows, "%d, %d", parent_node, ord);
+	} else
+	{
+		appendStringInfo(&table->rows, "NULL, %d", ord);
+	}
+	for (i = 0; i < table->ncolumns; i++)
+	{
+		if (values[i] != NULL)
+		{
+			appendStringInfo(&table->rows, ", %s::%s",
+					quote_literal_cstr(values[i]), table->columns[i].sql_type);
+		} else
+		{
+			appendStringInfo(&table->rows, ", NULL");
+		}
+	}
+	appendStringInfoChar(&table->rows, ')');
+	table->nrows++;
+
+	if (table->nrows >= INLINE_BATCH_ROWS)
+	{
+		flush_inline_rows(table);
+	}
+}
+
+/*
+ * Send pending rows of table in one INSERT
+ */
+static void
+flush_inline_rows(inline_table *table)
+{
+	if (table->nrows == 0)
+	{
+		return;
+	}
+
+	SPI_connect();
+
+	if (SPI_execute(table->rows.data, false, 0) != SPI_OK_INSERT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not insert into %s", table->table_name)));
+	}
+
+	SPI_finish();
+
+	table->nrows = 0;
+}
+
+static int
+find_inline_child(inline_table *table, const xmlChar *name)
+{
+	int			i;
+
+	for (i = 0; i < table->nchildren; i++)
+	{
+		if (xmlStrEqual((const xmlChar *) table->children[i].xml_name, name))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Is element explicitly nil (xsi:nil="true")
+ */
+static bool
+is_nil(xmlNodePtr node)
+{
+	xmlChar    *nil = xmlGetNsProp(node, (const xmlChar *) "nil",
+			(const xmlChar *) XSI_NAMESPACE);
+	bool		result;
+
+	if (nil == NULL)
+	{
+		return false;
+	}
+	result = xmlStrEqual(nil, (const xmlChar *) "true") ||
+			xmlStrEqual(nil, (const xmlChar *) "1");
+	xmlFree(nil);
+
+	return result;
+}
+
+/*
+ * Value stored into column, empty value of typed column is NULL (empty
+ * string can't be cast to integer, date, ...)
+ * @param value palloced value, it is freed when NULL is stored
+ * @return value or NULL
+ */
+static char *
+column_value(inline_column *column, char *value)
+{
+	const char *c;
+
+	if (value == NULL)
+	{
+		return NULL;
+	}
+	if (strcmp(column->sql_type, "text") != 0)
+	{
+		for (c = value; *c != '\0' && isspace((unsigned char) *c); c++)
+			;
+		if (*c == '\0')
+		{
+			pfree(value);
+			return NULL;
+		}
+	}
+
+	return value;
+}
+
+/*
+ * Text content of node as palloced string
+ */
+static char *
+node_content(xmlNodePtr node)
+{
+	xmlChar    *content = xmlNodeGetContent(node);
+	char	   *result;
+
+	if (content == NULL)
+	{
+		return NULL;
+	}
+	result = pstrdup((const char *) content);
+	xmlFree(content);
+
+	return result;
+}
+
+/*
+ * Store element as row of its table, then its complex and repeated children
+ * into their tables. node_id is numbering of stored elements in pre order.
+ */
+static void
+load_element(inline_model *model, inline_table *table, xmlNodePtr node,
+		xml_label did, int parent_node, int ord, int *node_id)
+{
+	int			my_id = ++(*node_id);
+	char	  **values = (char **) palloc0(sizeof(char *) * (table->ncolumns + 1));
+	int		   *ords = (int *) palloc0(sizeof(int) * (table->nchildren + 1));
+	xmlNodePtr	child;
+	xmlChar    *value;
+	int			i;
+	int			c;
+
+	// attributes and simple content
+	for (i = 0; i < table->ncolumns; i++)
+	{
+		if (table->columns[i].attribute)
+		{
+			value = xmlGetProp(node, (const xmlChar *) table->columns[i].xml_name);
+			if (value != NULL)
+			{
+				values[i] = column_value(&table->columns[i],
+						pstrdup((char *) value));
+				xmlFree(value);
+			}
+		}
+	}
+	if (table->value_column >= 0 && !is_nil(node))
+	{
+		values[table->value_column] = column_value(
+				&table->columns[table->value_column], node_content(node));
+	}
+
+	// inlined simple children
+	for (child = node->children; child != NULL; child = child->next)
+	{
+		if (child->type != XML_ELEMENT_NODE)
+		{
+			continue;
+		}
+		c = find_inline_child(table, child->name);
+		if (c >= 0 && table->children[c].column >= 0 && !is_nil(child))
+		{
+			i = table->children[c].column;
+			values[i] = column_value(&table->columns[i], node_content(child));
+		}
+	}
+
+	append_inline_row(table, did, my_id, parent_node, ord, values);
+
+	// children with own tables
+	for (child = node->children; child != NULL; child = child->next)
+	{
+		if (child->type != XML_ELEMENT_NODE)
+		{
+			continue;
+		}
+		c = find_inline_child(table, child->name);
+		if (c >= 0 && table->children[c].table != NULL)
+		{
+			load_element(model, table->children[c].table, child, did, my_id,
+					++ords[c], node_id);
+		}
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	for (i = 0; i < table->ncolumns; i++)
+	{
+		if (values[i] != NULL)
+		{
+			pfree(values[i]);
+		}
+	}
+	pfree(values);
+	pfree(ords);
+}
+
+/*
+ * Store document into inlined tables, rows are sent in batches per table
+ */
+static void
+load_document(inline_model *model, inline_table *table, xmlNodePtr root,
+		xml_label did)
+{
+	int			node_id = 0;
+	int			i;
+
+	load_element(model, table, root, did, -1, 1, &node_id);
+
+	for (i = 0; i < model->ntables; i++)
+	{
+		flush_inline_rows(model->tables[i]);
+	}
+}
+
+#endif   /* USE_LIBXML */
+
+/*
+ * Create typed tables for complex types of XSD schema. Simple typed children
+ * and attributes are inlined as columns, B-tree index is created on every
+ * column which is not text. Schema is registered in xml_inline_schemas.
+ * @param prefix prefix of names of created tables
+ * @param schema XSD schema
+ * @return number of created tables
+ */
+Datum
+create_xmlindex_inlined(PG_FUNCTION_ARGS)
+{
+#ifdef USE_LIBXML
+	char	   *prefix = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char	   *xsd = text_to_cstring(PG_GETARG_TEXT_P(1));
+	inline_model *model;
+	inline_table *table;
+	StringInfoData query;
+	Oid			oids[2];
+	Datum		data[2];
+	int			i;
+	int			j;
+	int			ntables;
+
+	pg_xml_init();
+	xmlInitParser();
+
+	model = build_inline_model(prefix, xsd);
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"CREATE TABLE IF NOT EXISTS xml_inline_schemas "
+							"(prefix text PRIMARY KEY, "
+							"schema xsd not null); "
+			// rebuild of generic shredded tables skips these documents
+			"CREATE TABLE IF NOT EXISTS xml_inlined_documents "
+							"(did bigint PRIMARY KEY, "
+							"prefix text not null); ");
+
+	for (i = 0; i < model->ntables; i++)
+	{
+		table = model->tables[i];
+		appendStringInfo(&query,
+				"CREATE TABLE %s "
+							"(did bigint not null, "
+							"node_id int not null, "
+							"parent_node int, "
+							"ord int",
+				quote_identifier(table->table_name));
+		for (j = 0; j < table->ncolumns; j++)
+		{
+			appendStringInfo(&query, ", %s %s",
+					quote_identifier(table->columns[j].name),
+					table->columns[j].sql_type);
+		}
+		appendStringInfo(&query, ", PRIMARY KEY (did, node_id)); "
+				"CREATE INDEX ON %s (did, parent_node); ",
+				quote_identifier(table->table_name));
+
+		// native types get B-tree for range predicates
+		for (j = 0; j < table->ncolumns; j++)
+		{
+			if (strcmp(table->columns[j].sql_type, "text") != 0)
+			{
+				appendStringInfo(&query, "CREATE INDEX ON %s (%s); ",
+						quote_identifier(table->table_name),
+						quote_identifier(table->columns[j].name));
+			}
+		}
+	}
+
+	ntables = model->ntables;
+	free_inline_model(model);
+
+	SPI_connect();
+
+	if (SPI_execute(query.data, false, 0) == SPI_ERROR_ARGUMENT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("invalid query")));
+	}
+
+	oids[0] = TEXTOID;
+	oids[1] = TEXTOID;
+	data[0] = CStringGetTextDatum(prefix);
+	data[1] = CStringGetTextDatum(xsd);
+
+	if (SPI_execute_with_args("INSERT INTO xml_inline_schemas VALUES ($1, $2::text::xsd)",
+			2, oids, data, NULL, false, 0) != SPI_OK_INSERT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not register schema for prefix \"%s\"", prefix)));
+	}
+
+	SPI_finish();
+
+	PG_RETURN_INT32(ntables);
+#else
+	NO_XML_SUPPORT();
+	PG_RETURN_INT32(0);
+#endif
+}
+
+/*
+ * Record document stored in inlined tables of prefix
+ */
+static void
+register_inlined_document(xml_label did, const char *prefix)
+{
+	Oid			oids[2] = {INT8OID, TEXTOID};
+	Datum		data[2];
+
+	data[0] = Int64GetDatum(did);
+	data[1] = CStringGetTextDatum(prefix);
+
+	SPI_connect();
+
+	if (SPI_execute_with_args("INSERT INTO xml_inlined_documents VALUES ($1, $2)",
+			2, oids, data, NULL, false, 0) != SPI_OK_INSERT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not register inlined document")));
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Validate document against schema registered for prefix and load it into
+ * inlined tables. Document is stored also into xml_documents_table, its did
+ * is used in all inlined tables.
+ * @param prefix prefix used in create_xmlindex_inlined
+ * @param xml document
+ * @param name name of document
+ * @return true if document was loaded
+ */
+Datum
+build_xmlindex_inlined(PG_FUNCTION_ARGS)
+{
+#ifdef USE_LIBXML
+	char	   *prefix = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char	   *xmldoc = text_to_cstring((text *) PG_GETARG_XML_P(1));
+	char	   *name = text_to_cstring(PG_GETARG_TEXT_P(2));
+	char	   *xsd;
+	inline_model *volatile model = NULL;
+	inline_table *table = NULL;
+	xmlSchemaParserCtxtPtr ctxt;
+	xmlSchemaPtr schema;
+	xmlSchemaValidCtxtPtr validctxt;
+	xmlDocPtr	doc;
+	xmlNodePtr	root;
+	xml_label	did;
+	int			ret;
+	int			i;
+
+	pg_xml_init();
+	xmlInitParser();
+
+	xsd = load_inline_schema(prefix);
+
+	doc = xmlReadMemory(xmldoc, strlen(xmldoc), "include.xml", NULL, 0);
+	if (doc == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_XML_DOCUMENT),
+				 errmsg("Failed to parse XML document")));
+	}
+
+	// any error (cast of value, insert) must free parsed document
+	PG_TRY();
+	{
+		// only valid documents can be cast to column types
+		ctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+		schema = ctxt != NULL ? xmlSchemaParse(ctxt) : NULL;
+		if (ctxt != NULL)
+		{
+			xmlSchemaFreeParserCtxt(ctxt);
+		}
+		validctxt = schema != NULL ? xmlSchemaNewValidCtxt(schema) : NULL;
+		ret = validctxt != NULL ? xmlSchemaValidateDoc(validctxt, doc) : -1;
+		if (validctxt != NULL)
+		{
+			xmlSchemaFreeValidCtxt(validctxt);
+		}
+		if (schema != NULL)
+		{
+			xmlSchemaFree(schema);
+		}
+		if (ret != 0)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_XML_DOCUMENT),
+					 errmsg("document does not conform to schema of \"%s\"", prefix)));
+		}
+
+		model = build_inline_model(prefix, xsd);
+
+		root = xmlDocGetRootElement(doc);
+		for (i = 0; i < model->nroots; i++)
+		{
+			if (xmlStrEqual(root->name, (const xmlChar *) model->root_names[i]))
+			{
+				table = model->root_tables[i];
+			}
+		}
+		if (table == NULL)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_XML_DOCUMENT),
+					 errmsg("root element <%s> has no inlined table", (char *) root->name)));
+		}
+
+		// no state of shredding, joins and lazy shredding must not load
+		// the document into generic shredded tables
+		did = insert_xmldata(xmldoc, name);
+		register_inlined_document(did, prefix);
+
+		load_document(model, table, root, did);
+	}
+	PG_CATCH();
+	{
+		if (model != NULL)
+		{
+			free_inline_model(model);
+		}
+		xmlFreeDoc(doc);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	free_inline_model(model);
+	xmlFreeDoc(doc);
+
+	PG_RETURN_BOOL(true);
+#else
+	NO_XML_SUPPORT();
+	PG_RETURN_BOOL(false);
+#endif
+}
@@ -0,0 +1,870 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_keyword_search.c
+// desc:	Keyword search over shredded documents. xml_keywords is inverted
+//			index from tokens of text nodes and attribute values to element
+//			owning them (did, pre_order), loader keeps it up to date. Search
+//			returns smallest lowest common ancestors (SLCA) computed by
+//			indexed lookup: for every occurrence of the rarest keyword,
+//			closest occurrences of other keywords are probed in index and
+//			LCA is found on ancestor chain of the occurrence. Exclusive LCAs
+//			(ELCA) are ancestors of SLCAs verified by probes of index
+//			outside subtrees which contain all keywords.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+// longer tokens are not indexed
+#define XML_KEYWORD_MAX_LENGTH 64
+#define XML_KEYWORD_MAX_TERMS 16
+#define XML_KEYWORD_FETCH_SIZE 1000
+
+/* externally accessible functions */
+Datum	xml_keyword_tokens(PG_FUNCTION_ARGS);
+Datum	create_xmlindex_keywords(PG_FUNCTION_ARGS);
+Datum	keyword_search(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(xml_keyword_tokens);
+PG_FUNCTION_INFO_V1(create_xmlindex_keywords);
+PG_FUNCTION_INFO_V1(keyword_search);
+
+// element on ancestor chain of occurrence, or result of search
+typedef struct keyword_node keyword_node;
+struct keyword_node {
+	xml_label	did;
+	xml_label	pre_order;
+	xml_label	size;
+	int			depth;
+	char	   *name;
+	double		score;
+	keyword_node *chain;		// ancestors-or-self of SLCA, for ELCA
+	int			chain_length;
+};
+
+// prepared probes of xml_keywords and element_table
+typedef struct keyword_plans keyword_plans;
+struct keyword_plans {
+	SPIPlanPtr	preceding;		// closest occurrence at or before node
+	SPIPlanPtr	following;		// closest occurrence at or after node
+	SPIPlanPtr	range;			// some occurrence in interval
+	SPIPlanPtr	chain;			// ancestors-or-self of element
+};
+
+/*
+ * Split text into lower case tokens, letters and digits (and all non-ASCII
+ * bytes, so UTF-8 words stay whole) form tokens
+ * @param count (out) number of tokens
+ * @return palloced array of tokens
+ */
+static char **
+tokenize(const char *value, int *count)
+{
+	const char *c = value;
+	int			max = 8;
+	char	  **tokens = (char **) palloc(max * sizeof(char *));
+
+	*count = 0;
+	while (*c != '\0')
+	{
+		const char *start;
+		int			length;
+		int			i;
+
+		while (*c != '\0' && !(isalnum((unsigned char) *c) || IS_HIGHBIT_SET(*c)))
+		{
+			c++;
+		}
+		start = c;
+		while (*c != '\0' && (isalnum((unsigned char) *c) || IS_HIGHBIT_SET(*c)))
+		{
+			c++;
+		}
+		length = c - start;
+		if (length == 0 || length > XML_KEYWORD_MAX_LENGTH)
+		{
+			continue;
+		}
+
+		if (*count == max)
+		{
+			max *= 2;
+			tokens = (char **) repalloc(tokens, max * sizeof(char *));
+		}
+		tokens[*count] = pnstrdup(start, length);
+		for (i = 0; i < length; i++)
+		{
+			if (!IS_HIGHBIT_SET(tokens[*count][i]))
+			{
+				tokens[*count][i] = tolower((unsigned char) tokens[*count][i]);
+			}
+		}
+		(*count)++;
+	}
+
+	return tokens;
+}
+
+/*
+ * Tokens of text as they are stored in xml_keywords
+ * @param text value of text node or attribute
+ * @return text[] of tokens
+ */
+Datum
+xml_keyword_tokens(PG_FUNCTION_ARGS)
+{
+	char	   *value = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char	  **tokens;
+	Datum	   *elements;
+	int			count;
+	int			i;
+
+	tokens = tokenize(value, &count);
+	elements = (Datum *) palloc((count + 1) * sizeof(Datum));
+	for (i = 0; i < count; i++)
+	{
+		elements[i] = CStringGetTextDatum(tokens[i]);
+	}
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(elements, count, TEXTOID, -1, false, 'i'));
+}
+
+/*
+ * Is keyword index maintained, set by create_xmlindex_keywords
+ */
+bool
+xml_keywords_enabled(void)
+{
+	char	   *value = xml_index_setting("keywords");
+
+	return value != NULL && strcmp(value, "true") == 0;
+}
+
+/*
+ * Insert tokens of text nodes and attributes, caller has to be connected
+ * to SPI
+ * @param did document, -1 for all shredded documents
+ * @return number of inserted rows
+ */
+static int64
+insert_keywords(xml_label did, int layout)
+{
+	StringInfoData query;
+	const char *condition = did >= 0 ? "did = $1" : "true";
+	Oid			types[1] = {INT8OID};
+	Datum		args[1];
+
+	// every token is stored once per owning element
+	initStringInfo(&query);
+	appendStringInfoString(&query,
+			"INSERT INTO xml_keywords (token, did, pre_order) "
+			"SELECT DISTINCT token, did, parent_id FROM (");
+	if (layout == LAYOUT_UNIFIED)
+	{
+		appendStringInfo(&query,
+				"SELECT unnest(xml_keyword_tokens(value)) AS token, did::bigint, "
+				"parent_id::bigint FROM node_table WHERE kind IN (%d, %d) AND %s",
+				NODE_KIND_ATTRIBUTE, NODE_KIND_TEXT, condition);
+	} else
+	{
+		appendStringInfo(&query,
+				"SELECT unnest(xml_keyword_tokens(value)) AS token, did::bigint, "
+				"parent_id::bigint FROM text_table WHERE %s "
+				"UNION ALL "
+				"SELECT unnest(xml_keyword_tokens(value)), did::bigint, "
+				"parent_id::bigint FROM attribute_table WHERE %s",
+				condition, condition);
+	}
+	appendStringInfoString(&query, ") k WHERE parent_id IS NOT NULL");
+
+	args[0] = Int64GetDatum(did);
+	if (SPI_execute_with_args(query.data, did >= 0 ? 1 : 0, types, args,
+			NULL, false, 0) != SPI_OK_INSERT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not insert keywords of shredded documents")));
+	}
+
+	return SPI_processed;
+}
+
+/*
+ * Replace keyword index by tokens of current shredded documents
+ * @return number of rows
+ */
+int64
+xml_keywords_rebuild(int layout)
+{
+	int64		rows;
+
+	SPI_connect();
+
+	if (SPI_execute("TRUNCATE xml_keywords", false, 0) != SPI_OK_UTILITY)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not truncate xml_keywords")));
+	}
+	rows = insert_keywords(-1, layout);
+
+	SPI_finish();
+
+	return rows;
+}
+
+/*
+ * Remove tokens of document from keyword index
+ * @param did removed (evicted) document
+ */
+void
+xml_keywords_remove_document(xml_label did)
+{
+	Oid			types[1] = {INT8OID};
+	Datum		args[1];
+
+	SPI_connect();
+
+	args[0] = Int64GetDatum(did);
+	if (SPI_execute_with_args("DELETE FROM xml_keywords WHERE did = $1",
+			1, types, args, NULL, false, 0) != SPI_OK_DELETE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not delete keywords of document")));
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Add tokens of just shredded document, tokens of its previous version
+ * are replaced
+ * @param did shredded document
+ * @param layout LAYOUT_SEPARATE or LAYOUT_UNIFIED
+ */
+void
+xml_keywords_add_document(xml_label did, int layout)
+{
+	xml_keywords_remove_document(did);
+
+	SPI_connect();
+	insert_keywords(did, layout);
+	SPI_finish();
+}
+
+/*
+ * Create xml_keywords and fill it from shredded documents, loader keeps
+ * it up to date from then
+ * @return number of rows
+ */
+Datum
+create_xmlindex_keywords(PG_FUNCTION_ARGS)
+{
+	int64		rows;
+
+	SPI_connect();
+
+	if (SPI_execute("CREATE TABLE xml_keywords "
+							"(token text not null, "
+							"did bigint not null, "
+							"pre_order bigint not null, "
+							"PRIMARY KEY (token, did, pre_order)); "
+					"INSERT INTO xml_index_settings VALUES ('keywords', 'true');",
+			false, 0) < 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not create xml_keywords")));
+	}
+
+	SPI_finish();
+
+	rows = xml_keywords_rebuild(get_index_layout());
+
+	PG_RETURN_INT64(rows);
+}
+
+/*
+ * Prepare query of search, existence of xml_keywords is checked by
+ * keyword_search before (missing table fails already in parser)
+ */
+static SPIPlanPtr
+prepare_keyword_plan(const char *query, int nargs, Oid *types)
+{
+	SPIPlanPtr	plan = SPI_prepare(query, nargs, types);
+
+	if (plan == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not prepare query of keyword search: %s",
+						SPI_result_code_string(SPI_result))));
+	}
+
+	return plan;
+}
+
+static void
+prepare_keyword_plans(keyword_plans *plans, int layout)
+{
+	Oid			types[4] = {TEXTOID, INT8OID, INT8OID, INT8OID};
+	StringInfoData query;
+
+	plans->preceding = prepare_keyword_plan(
+			"SELECT pre_order FROM xml_keywords WHERE token = $1 AND did = $2 "
+			"AND pre_order <= $3 ORDER BY pre_order DESC LIMIT 1", 3, types);
+	plans->following = prepare_keyword_plan(
+			"SELECT pre_order FROM xml_keywords WHERE token = $1 AND did = $2 "
+			"AND pre_order >= $3 ORDER BY pre_order LIMIT 1", 3, types);
+	plans->range = prepare_keyword_plan(
+			"SELECT 1 FROM xml_keywords WHERE token = $1 AND did = $2 "
+			"AND pre_order BETWEEN $3 AND $4 LIMIT 1", 4, types);
+
+	// ancestors by node_interval GiST index, same as ancestor axis
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"SELECT pre_order::bigint, size::bigint, depth::int, name FROM %s "
+			"WHERE did = $1 AND node_interval(did, pre_order, size) @> "
+			"node_interval($1, $2, 0)%s ORDER BY pre_order",
+			layout == LAYOUT_UNIFIED ? "node_table" : "element_table",
+			layout == LAYOUT_UNIFIED ? " AND kind = 1" : "");
+	plans->chain = prepare_keyword_plan(query.data, 2, types + 1);
+}
+
+/*
+ * Closest occurrence of token in document at or before (after) node
+ * @param found (out) pre_order of owning element
+ * @return false if there is none in the document
+ */
+static bool
+probe_keyword(SPIPlanPtr plan, Datum token, xml_label did, xml_label pre_order,
+		xml_label *found)
+{
+	Datum		args[3];
+	bool		isnull;
+	bool		result = false;
+
+	args[0] = token;
+	args[1] = Int64GetDatum(did);
+	args[2] = Int64GetDatum(pre_order);
+	if (SPI_execute_plan(plan, args, NULL, true, 1) == SPI_OK_SELECT &&
+			SPI_processed > 0)
+	{
+		*found = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+				SPI_tuptable->tupdesc, 1, &isnull));
+		result = true;
+	}
+	SPI_freetuptable(SPI_tuptable);
+
+	return result;
+}
+
+/*
+ * Has token some occurrence with pre_order in [low, high]
+ */
+static bool
+probe_keyword_range(SPIPlanPtr plan, Datum token, xml_label did,
+		xml_label low, xml_label high)
+{
+	Datum		args[4];
+	bool		result;
+
+	if (low > high)
+	{
+		return false;
+	}
+	args[0] = token;
+	args[1] = Int64GetDatum(did);
+	args[2] = Int64GetDatum(low);
+	args[3] = Int64GetDatum(high);
+	result = SPI_execute_plan(plan, args, NULL, true, 1) == SPI_OK_SELECT &&
+			SPI_processed > 0;
+	SPI_freetuptable(SPI_tuptable);
+
+	return result;
+}
+
+/*
+ * Ancestors-or-self of element, from root
+ * @param count (out) length of chain
+ */
+static keyword_node *
+fetch_chain(SPIPlanPtr plan, xml_label did, xml_label pre_order, int *count)
+{
+	Datum		args[2];
+	keyword_node *chain;
+	int			i;
+
+	args[0] = Int64GetDatum(did);
+	args[1] = Int64GetDatum(pre_order);
+	if (SPI_execute_plan(plan, args, NULL, true, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read ancestors of element " XML_LABEL_FORMAT, pre_order)));
+	}
+
+	*count = SPI_processed;
+	chain = (keyword_node *) palloc0((*count + 1) * sizeof(keyword_node));
+	for (i = 0; i < *count; i++)
+	{
+		HeapTuple	tuple = SPI_tuptable->vals[i];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		bool		isnull;
+
+		chain[i].did = did;
+		chain[i].pre_order = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+		chain[i].size = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+		chain[i].depth = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+		chain[i].name = SPI_getvalue(tuple, tupdesc, 4);
+	}
+	SPI_freetuptable(SPI_tuptable);
+
+	return chain;
+}
+
+/*
+ * Position of lowest element of chain containing pre_order, chain of
+ * ancestors is containment ordered
+ */
+static int
+chain_lca(const keyword_node *chain, int count, xml_label pre_order)
+{
+	int			level = -1;
+	int			i;
+
+	for (i = 0; i < count && chain[i].pre_order <= pre_order &&
+			pre_order <= chain[i].pre_order + chain[i].size; i++)
+	{
+		level = i;
+	}
+
+	return level;
+}
+
+static int
+compare_keyword_labels(const void *a, const void *b)
+{
+	const keyword_node *x = (const keyword_node *) a;
+	const keyword_node *y = (const keyword_node *) b;
+
+	if (x->did != y->did)
+	{
+		return x->did < y->did ? -1 : 1;
+	}
+	if (x->pre_order != y->pre_order)
+	{
+		return x->pre_order < y->pre_order ? -1 : 1;
+	}
+	return 0;
+}
+
+static int
+compare_keyword_scores(const void *a, const void *b)
+{
+	const keyword_node *x = (const keyword_node *) a;
+	const keyword_node *y = (const keyword_node *) b;
+
+	if (x->score != y->score)
+	{
+		return x->score > y->score ? -1 : 1;
+	}
+	return compare_keyword_labels(a, b);
+}
+
+/*
+ * Sort nodes by label and drop duplicates
+ * @return number of distinct nodes
+ */
+static int
+unique_nodes(keyword_node *nodes, int count)
+{
+	int			result = 0;
+	int			i;
+
+	if (count == 0)
+	{
+		return 0;
+	}
+	qsort(nodes, count, sizeof(keyword_node), compare_keyword_labels);
+	for (i = 1; i < count; i++)
+	{
+		if (compare_keyword_labels(&nodes[result], &nodes[i]) != 0)
+		{
+			nodes[++result] = nodes[i];
+		}
+	}
+
+	return result + 1;
+}
+
+static void
+append_node(keyword_node **nodes, int *count, int *max, const keyword_node *node)
+{
+	if (*count == *max)
+	{
+		*max *= 2;
+		*nodes = (keyword_node *) repalloc(*nodes, *max * sizeof(keyword_node));
+	}
+	(*nodes)[(*count)++] = *node;
+}
+
+/*
+ * Is candidate ELCA: every token occurs in subtree outside children which
+ * contain all tokens (children on path to SLCAs inside candidate)
+ * @param slcas SLCAs with chains ordered by label
+ * @param first (in/out) cursor of slcas, first SLCA not before candidate;
+ *		candidates have to come in label order
+ * @param blocked_low, blocked_high buffers of nslcas intervals
+ */
+static bool
+is_elca(const keyword_node *candidate, const keyword_node *slcas, int nslcas,
+		int *first, xml_label *blocked_low, xml_label *blocked_high,
+		const Datum *tokens, int ntokens, const keyword_plans *plans)
+{
+	xml_label	high = candidate->pre_order + candidate->size;
+	int			nblocked = 0;
+	int			t;
+	int			i;
+
+	// SLCAs before candidate are before all next candidates too
+	while (*first < nslcas && compare_keyword_labels(&slcas[*first], candidate) <= 0)
+	{
+		(*first)++;
+	}
+
+	// SLCAs inside subtree of candidate follow the cursor
+	for (i = *first; i < nslcas && slcas[i].did == candidate->did &&
+			slcas[i].pre_order <= high; i++)
+	{
+		const keyword_node *s = &slcas[i];
+		const keyword_node *child;
+		int			level;
+
+		level = candidate->depth + 1 - s->chain[0].depth;
+		if (level < 0 || level >= s->chain_length)
+		{
+			continue;
+		}
+		child = &s->chain[level];
+		// SLCAs are ordered, children repeat only one after another
+		if (nblocked > 0 && blocked_low[nblocked - 1] == child->pre_order)
+		{
+			continue;
+		}
+		blocked_low[nblocked] = child->pre_order;
+		blocked_high[nblocked] = child->pre_order + child->size;
+		nblocked++;
+	}
+
+	for (t = 0; t < ntokens; t++)
+	{
+		xml_label	low = candidate->pre_order;
+		bool		found = false;
+
+		for (i = 0; i <= nblocked && !found; i++)
+		{
+			xml_label	gap_high = i < nblocked ? blocked_low[i] - 1 : high;
+
+			found = probe_keyword_range(plans->range, tokens[t], candidate->did,
+					low, gap_high);
+			if (i < nblocked)
+			{
+				low = blocked_high[i] + 1;
+			}
+		}
+		if (!found)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Elements containing all keywords, smallest (SLCA) or exclusive (ELCA)
+ * lowest common ancestors of keyword occurrences, ranked by compactness
+ * @param keywords text of keywords
+ * @param k number of results
+ * @param elca return ELCAs instead of SLCAs
+ * @return set of (did, pre_order, name, depth, score), best first
+ */
+Datum
+keyword_search(PG_FUNCTION_ARGS)
+{
+	char	   *keywords = text_to_cstring(PG_GETARG_TEXT_P(0));
+	int32		k = PG_GETARG_INT32(1);
+	bool		elca = PG_GETARG_BOOL(2);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	keyword_plans plans;
+	char	  **words;
+	Datum		tokens[XML_KEYWORD_MAX_TERMS];
+	int64		frequencies[XML_KEYWORD_MAX_TERMS];
+	int			nwords;
+	int			ntokens = 0;
+	keyword_node *results;
+	int			nresults = 0;
+	int			max_results = 64;
+	Oid			types[1] = {TEXTOID};
+	SPIPlanPtr	list_plan;
+	Portal		portal;
+	int			i;
+	int			j;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+			(rsinfo->allowedModes & SFRM_Materialize) == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+	if (k <= 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of results of keyword_search must be positive")));
+	}
+
+	// distinct tokens of query
+	words = tokenize(keywords, &nwords);
+	for (i = 0; i < nwords; i++)
+	{
+		for (j = 0; j < i && strcmp(words[i], words[j]) != 0; j++)
+			;
+		if (j < i)
+		{
+			continue;
+		}
+		if (ntokens == XML_KEYWORD_MAX_TERMS)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("keyword_search supports at most %d keywords",
+							XML_KEYWORD_MAX_TERMS)));
+		}
+		tokens[ntokens++] = CStringGetTextDatum(words[i]);
+	}
+	if (ntokens == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("no keyword in \"%s\"", keywords)));
+	}
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+			false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	SPI_connect();
+
+	if (!xml_index_table_exists("xml_keywords"))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_TABLE),
+				 errmsg("table xml_keywords does not exist"),
+				 errhint("Use create_xmlindex_keywords() first.")));
+	}
+	prepare_keyword_plans(&plans, get_index_layout());
+
+	// rarest keyword drives search, others are probed
+	for (i = 0; i < ntokens; i++)
+	{
+		bool		isnull;
+
+		if (SPI_execute_with_args("SELECT count(*) FROM xml_keywords WHERE token = $1",
+				1, types, &tokens[i], NULL, true, 1) != SPI_OK_SELECT)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not read xml_keywords")));
+		}
+		frequencies[i] = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+				SPI_tuptable->tupdesc, 1, &isnull));
+		SPI_freetuptable(SPI_tuptable);
+
+		for (j = i; j > 0 && frequencies[j] < frequencies[j - 1]; j--)
+		{
+			int64		frequency = frequencies[j];
+			Datum		token = tokens[j];
+
+			frequencies[j] = frequencies[j - 1];
+			tokens[j] = tokens[j - 1];
+			frequencies[j - 1] = frequency;
+			tokens[j - 1] = token;
+		}
+	}
+
+	results = (keyword_node *) palloc(max_results * sizeof(keyword_node));
+
+	list_plan = prepare_keyword_plan("SELECT did, pre_order FROM xml_keywords "
+			"WHERE token = $1 ORDER BY did, pre_order", 1, types);
+	portal = SPI_cursor_open(NULL, list_plan, &tokens[0], NULL, true);
+
+	// candidate of every occurrence v: lowest node containing v and closest
+	// occurrence of every other keyword
+	while (frequencies[0] > 0)
+	{
+		SPITupleTable *batch;
+		int			count;
+
+		SPI_cursor_fetch(portal, true, XML_KEYWORD_FETCH_SIZE);
+		if (SPI_processed == 0)
+		{
+			break;
+		}
+		batch = SPI_tuptable;
+		count = SPI_processed;
+
+		for (i = 0; i < count; i++)
+		{
+			bool		isnull;
+			xml_label	did = DatumGetInt64(SPI_getbinval(batch->vals[i],
+					batch->tupdesc, 1, &isnull));
+			xml_label	pre_order = DatumGetInt64(SPI_getbinval(batch->vals[i],
+					batch->tupdesc, 2, &isnull));
+			keyword_node *chain;
+			int			chain_length;
+			int			level;
+			int			t;
+
+			chain = fetch_chain(plans.chain, did, pre_order, &chain_length);
+			level = chain_length - 1;
+			for (t = 1; t < ntokens && level >= 0; t++)
+			{
+				xml_label	match;
+				int			best = -1;
+
+				if (probe_keyword(plans.preceding, tokens[t], did, pre_order, &match))
+				{
+					best = chain_lca(chain, chain_length, match);
+				}
+				if (probe_keyword(plans.following, tokens[t], did, pre_order, &match))
+				{
+					best = Max(best, chain_lca(chain, chain_length, match));
+				}
+				level = Min(level, best);
+			}
+
+			if (level >= 0)
+			{
+				append_node(&results, &nresults, &max_results, &chain[level]);
+			}
+
+			CHECK_FOR_INTERRUPTS();
+		}
+		SPI_freetuptable(batch);
+	}
+	SPI_cursor_close(portal);
+
+	// SLCA has no candidate below it, in label order the next one would be
+	nresults = unique_nodes(results, nresults);
+	for (i = 0, j = 0; i < nresults; i++)
+	{
+		if (i + 1 < nresults && results[i + 1].did == results[i].did &&
+				results[i + 1].pre_order <= results[i].pre_order + results[i].size)
+		{
+			continue;
+		}
+		results[j++] = results[i];
+	}
+	nresults = j;
+
+	// ELCAs are SLCAs or their ancestors
+	if (elca && nresults > 0)
+	{
+		keyword_node *candidates;
+		int			ncandidates = 0;
+		int			max_candidates = nresults * 4;
+		xml_label  *blocked_low = (xml_label *) palloc(nresults * sizeof(xml_label));
+		xml_label  *blocked_high = (xml_label *) palloc(nresults * sizeof(xml_label));
+		int			first = 0;
+
+		candidates = (keyword_node *) palloc(max_candidates * sizeof(keyword_node));
+		for (i = 0; i < nresults; i++)
+		{
+			results[i].chain = fetch_chain(plans.chain, results[i].did,
+					results[i].pre_order, &results[i].chain_length);
+			for (j = 0; j < results[i].chain_length; j++)
+			{
+				append_node(&candidates, &ncandidates, &max_candidates,
+						&results[i].chain[j]);
+			}
+		}
+		ncandidates = unique_nodes(candidates, ncandidates);
+
+		// candidates are in label order as the cursor of SLCAs requires
+		for (i = 0, j = 0; i < ncandidates; i++)
+		{
+			if (is_elca(&candidates[i], results, nresults, &first,
+					blocked_low, blocked_high, tokens, ntokens, &plans))
+			{
+				candidates[j++] = candidates[i];
+			}
+			CHECK_FOR_INTERRUPTS();
+		}
+		pfree(blocked_low);
+		pfree(blocked_high);
+		results = candidates;
+		nresults = j;
+	}
+
+	// smaller subtree is more specific answer
+	for (i = 0; i < nresults; i++)
+	{
+		results[i].score = 1.0 / (1.0 + log(1.0 + (double) results[i].size));
+	}
+	qsort(results, nresults, sizeof(keyword_node), compare_keyword_scores);
+
+	for (i = 0; i < nresults && i < k; i++)
+	{
+		Datum		values[5];
+		bool		nulls[5] = {false, false, false, false, false};
+
+		values[0] = Int64GetDatum(results[i].did);
+		values[1] = Int64GetDatum(results[i].pre_order);
+		values[2] = CStringGetTextDatum(results[i].name);
+		values[3] = Int32GetDatum(results[i].depth);
+		values[4] = Float8GetDatum(results[i].score);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	SPI_finish();
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}
@@ -0,0 +1,229 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_navigation.c
+// desc:	Navigation from one shredded node along XPath axis. Every axis
+//			is one index lookup on labels stored by loader: parent_id,
+//			prev_id and next_id for parent and siblings, (did, parent_id)
+//			for children and attributes, pre_order interval for descendants,
+//			node_interval GiST index for ancestors.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "utils/builtins.h"
+
+#define NAVIGATE_FETCH_SIZE 1000
+
+/* externally accessible functions */
+Datum	xml_navigate(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(xml_navigate);
+
+// condition on element e and context c of every axis
+typedef struct navigation_axis navigation_axis;
+struct navigation_axis {
+	const char *name;
+	const char *condition;
+};
+
+static const navigation_axis navigation_axes[] = {
+	{"self", "e.pre_order = c.pre_order"},
+	{"parent", "e.pre_order = c.parent_id"},
+	{"ancestor", "node_interval(e.did, e.pre_order, e.size) @> "
+			"node_interval(c.did, c.pre_order, 0) AND e.pre_order < c.pre_order"},
+	{"ancestor-or-self", "node_interval(e.did, e.pre_order, e.size) @> "
+			"node_interval(c.did, c.pre_order, 0)"},
+	{"child", "e.parent_id = c.pre_order"},
+	{"descendant", "e.pre_order > c.pre_order AND e.pre_order <= c.pre_order + c.size"},
+	{"descendant-or-self", "e.pre_order >= c.pre_order "
+			"AND e.pre_order <= c.pre_order + c.size"},
+	// attributes have no siblings
+	{"following-sibling", "e.parent_id = c.parent_id AND e.pre_order > c.pre_order "
+			"AND c.kind <> 2"},
+	{"preceding-sibling", "e.parent_id = c.parent_id AND e.pre_order < c.pre_order "
+			"AND c.kind <> 2"},
+	{"following", "e.pre_order > c.pre_order + c.size"},
+	{"preceding", "e.pre_order + e.size < c.pre_order"},
+	// following-sibling::*[1] and preceding-sibling::*[1] of element
+	{"next-sibling", "e.pre_order = c.next_id"},
+	{"previous-sibling", "e.pre_order = c.prev_id AND c.kind = 1"},
+	{"attribute", NULL},
+	{NULL, NULL}
+};
+
+/*
+ * Query of nodes on axis of context node ($1, $2), returning
+ * (pre_order, kind, name, sibling_ord) in document order
+ */
+static char *
+navigation_query(const char *axis, int layout)
+{
+	const navigation_axis *a;
+	StringInfoData query;
+
+	for (a = navigation_axes; a->name != NULL; a++)
+	{
+		if (strcmp(a->name, axis) == 0)
+		{
+			break;
+		}
+	}
+	if (a->name == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unknown axis \"%s\"", axis),
+				 errhint("Axis is one of parent, ancestor, ancestor-or-self, "
+						 "child, descendant, descendant-or-self, following-sibling, "
+						 "preceding-sibling, following, preceding, attribute, self, "
+						 "next-sibling or previous-sibling.")));
+	}
+
+	initStringInfo(&query);
+
+	// context can be element, attribute or text node
+	if (layout == LAYOUT_UNIFIED)
+	{
+		appendStringInfoString(&query,
+				"WITH c AS (SELECT did, pre_order, size, parent_id, prev_id, next_id, "
+				"kind FROM node_table WHERE did = $1 AND pre_order = $2) ");
+	} else
+	{
+		appendStringInfoString(&query,
+				"WITH c AS (SELECT did, pre_order, size, parent_id, prev_id, next_id, "
+					"1 AS kind FROM element_table WHERE did = $1 AND pre_order = $2 "
+				"UNION ALL SELECT did, pre_order, 0, parent_id, NULL, NULL, 2 "
+					"FROM attribute_table WHERE did = $1 AND pre_order = $2 "
+				"UNION ALL SELECT did, pre_order, 0, parent_id, NULL, NULL, 3 "
+					"FROM text_table WHERE did = $1 AND pre_order = $2) ");
+	}
+
+	if (a->condition == NULL)
+	{
+		appendStringInfo(&query,
+				"SELECT e.pre_order::bigint, %d, e.name, NULL::int FROM %s e, c "
+				"WHERE e.did = $1 AND e.parent_id = c.pre_order",
+				NODE_KIND_ATTRIBUTE,
+				layout == LAYOUT_UNIFIED ? "node_table" : "attribute_table");
+		if (layout == LAYOUT_UNIFIED)
+		{
+			appendStringInfo(&query, " AND e.kind = %d", NODE_KIND_ATTRIBUTE);
+		}
+	} else
+	{
+		appendStringInfo(&query,
+				"SELECT e.pre_order::bigint, %d, e.name, e.sibling_ord FROM %s e, c "
+				"WHERE e.did = $1 AND %s",
+				NODE_KIND_ELEMENT,
+				layout == LAYOUT_UNIFIED ? "node_table" : "element_table",
+				a->condition);
+		if (layout == LAYOUT_UNIFIED)
+		{
+			appendStringInfo(&query, " AND e.kind = %d", NODE_KIND_ELEMENT);
+		}
+	}
+	appendStringInfoString(&query, " ORDER BY 1");
+
+	return query.data;
+}
+
+/*
+ * Elements (attributes for attribute axis) on axis of shredded node,
+ * document registered for lazy shredding is shredded first
+ * @param did document
+ * @param context pre_order of context node
+ * @param axis XPath axis name, or next-sibling, previous-sibling
+ * @return set of (pre_order, kind, name, sibling_ord) in document order
+ */
+Datum
+xml_navigate(PG_FUNCTION_ARGS)
+{
+	char	   *axis = text_to_cstring(PG_GETARG_TEXT_P(2));
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Oid			argtypes[2] = {INT8OID, INT8OID};
+	Datum		args[2];
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	Portal		portal;
+	char	   *query;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+			(rsinfo->allowedModes & SFRM_Materialize) == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+
+	query = navigation_query(axis, get_index_layout());
+	args[0] = Int64GetDatum(PG_GETARG_INT64(0));
+	args[1] = Int64GetDatum(PG_GETARG_INT64(1));
+	ensure_document_shredded(PG_GETARG_INT64(0));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+			false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	SPI_connect();
+
+	portal = SPI_cursor_open_with_args(NULL, query, 2, argtypes, args,
+			NULL, true, 0);
+
+	// following and preceding can be large part of document
+	for (;;)
+	{
+		int			i;
+
+		SPI_cursor_fetch(portal, true, NAVIGATE_FETCH_SIZE);
+		if (SPI_processed == 0)
+		{
+			break;
+		}
+		for (i = 0; i < SPI_processed; i++)
+		{
+			Datum		values[4];
+			bool		nulls[4];
+			int			column;
+
+			for (column = 0; column < 4; column++)
+			{
+				values[column] = SPI_getbinval(SPI_tuptable->vals[i],
+						SPI_tuptable->tupdesc, column + 1, &nulls[column]);
+			}
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}
@@ -0,0 +1,622 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_node_interval.c
+// desc:	Fixed-width type node_interval (did, start, end) with operators
+//			@> (contains), <@ (contained by) and && (overlaps), GiST
+//			operator class and selectivity estimators. Node a is ancestor
+//			or self of node d when interval of a contains interval of d.
+//			GiST key is bounding box of (did, position) plane, so inner
+//			pages prune by document and by position together.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_node_interval.h"
+#include "xml_index_loader.h"
+
+#include "access/gist.h"
+#include "access/skey.h"
+#include "fmgr.h"
+#include "libpq/pqformat.h"
+#include "nodes/primnodes.h"
+#include "utils/builtins.h"
+#include "utils/selfuncs.h"
+
+#include <ctype.h>
+#include <errno.h>
+
+// estimate of number of ancestors of node, depth of usual documents, used
+// until analyze_xmlindex() collects average depth
+#define NODE_INTERVAL_ANCESTORS 10.0
+// selectivity when relation size or constant is unknown
+#define NODE_INTERVAL_DEFAULT_SEL 0.001
+
+/* externally accessible functions */
+Datum	node_interval_in(PG_FUNCTION_ARGS);
+Datum	node_interval_out(PG_FUNCTION_ARGS);
+Datum	node_interval_recv(PG_FUNCTION_ARGS);
+Datum	node_interval_send(PG_FUNCTION_ARGS);
+Datum	node_interval_make(PG_FUNCTION_ARGS);
+Datum	node_interval_contains(PG_FUNCTION_ARGS);
+Datum	node_interval_contained(PG_FUNCTION_ARGS);
+Datum	node_interval_overlaps(PG_FUNCTION_ARGS);
+Datum	node_interval_contains_sel(PG_FUNCTION_ARGS);
+Datum	node_interval_contained_sel(PG_FUNCTION_ARGS);
+Datum	node_interval_overlaps_sel(PG_FUNCTION_ARGS);
+Datum	node_interval_joinsel(PG_FUNCTION_ARGS);
+Datum	gnode_interval_in(PG_FUNCTION_ARGS);
+Datum	gnode_interval_out(PG_FUNCTION_ARGS);
+Datum	gnode_interval_consistent(PG_FUNCTION_ARGS);
+Datum	gnode_interval_union(PG_FUNCTION_ARGS);
+Datum	gnode_interval_compress(PG_FUNCTION_ARGS);
+Datum	gnode_interval_decompress(PG_FUNCTION_ARGS);
+Datum	gnode_interval_penalty(PG_FUNCTION_ARGS);
+Datum	gnode_interval_picksplit(PG_FUNCTION_ARGS);
+Datum	gnode_interval_same(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(node_interval_in);
+PG_FUNCTION_INFO_V1(node_interval_out);
+PG_FUNCTION_INFO_V1(node_interval_recv);
+PG_FUNCTION_INFO_V1(node_interval_send);
+PG_FUNCTION_INFO_V1(node_interval_make);
+PG_FUNCTION_INFO_V1(node_interval_contains);
+PG_FUNCTION_INFO_V1(node_interval_contained);
+PG_FUNCTION_INFO_V1(node_interval_overlaps);
+PG_FUNCTION_INFO_V1(node_interval_contains_sel);
+PG_FUNCTION_INFO_V1(node_interval_contained_sel);
+PG_FUNCTION_INFO_V1(node_interval_overlaps_sel);
+PG_FUNCTION_INFO_V1(node_interval_joinsel);
+PG_FUNCTION_INFO_V1(gnode_interval_in);
+PG_FUNCTION_INFO_V1(gnode_interval_out);
+PG_FUNCTION_INFO_V1(gnode_interval_consistent);
+PG_FUNCTION_INFO_V1(gnode_interval_union);
+PG_FUNCTION_INFO_V1(gnode_interval_compress);
+PG_FUNCTION_INFO_V1(gnode_interval_decompress);
+PG_FUNCTION_INFO_V1(gnode_interval_penalty);
+PG_FUNCTION_INFO_V1(gnode_interval_picksplit);
+PG_FUNCTION_INFO_V1(gnode_interval_same);
+
+// entry of picksplit sorted by center of key
+typedef struct box_split_item box_split_item;
+struct box_split_item {
+	OffsetNumber offset;
+	int64	   *key;
+};
+
+static int64
+parse_int64(char **pos, const char *input)
+{
+	char	   *end;
+	int64		value;
+
+	errno = 0;
+	value = strtoll(*pos, &end, 10);
+	if (end == *pos || errno != 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for node_interval: \"%s\"", input)));
+	}
+	*pos = end;
+
+	return value;
+}
+
+static void
+expect_char(char **pos, char c, const char *input)
+{
+	while (isspace((unsigned char) **pos))
+	{
+		(*pos)++;
+	}
+	if (**pos != c)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for node_interval: \"%s\"", input)));
+	}
+	(*pos)++;
+}
+
+static node_interval *
+new_interval(int64 did, int64 start, int64 end)
+{
+	node_interval *result;
+
+	if (end < start)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("end of node_interval must not be less than start")));
+	}
+
+	result = (node_interval *) palloc(sizeof(node_interval));
+	result->did = did;
+	result->start = start;
+	result->end = end;
+
+	return result;
+}
+
+/*
+ * Text form (did,start,end)
+ */
+Datum
+node_interval_in(PG_FUNCTION_ARGS)
+{
+	char	   *input = PG_GETARG_CSTRING(0);
+	char	   *pos = input;
+	int64		did;
+	int64		start;
+	int64		end;
+
+	expect_char(&pos, '(', input);
+	did = parse_int64(&pos, input);
+	expect_char(&pos, ',', input);
+	start = parse_int64(&pos, input);
+	expect_char(&pos, ',', input);
+	end = parse_int64(&pos, input);
+	expect_char(&pos, ')', input);
+	while (isspace((unsigned char) *pos))
+	{
+		pos++;
+	}
+	if (*pos != '\0')
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for node_interval: \"%s\"", input)));
+	}
+
+	PG_RETURN_NODE_INTERVAL_P(new_interval(did, start, end));
+}
+
+Datum
+node_interval_out(PG_FUNCTION_ARGS)
+{
+	node_interval *interval = PG_GETARG_NODE_INTERVAL_P(0);
+	char	   *result = (char *) palloc(3 * 21 + 4);
+
+	snprintf(result, 3 * 21 + 4, "(" INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT ")",
+			interval->did, interval->start, interval->end);
+
+	PG_RETURN_CSTRING(result);
+}
+
+Datum
+node_interval_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo	buf = (StringInfo) PG_GETARG_POINTER(0);
+	int64		did = pq_getmsgint64(buf);
+	int64		start = pq_getmsgint64(buf);
+	int64		end = pq_getmsgint64(buf);
+
+	PG_RETURN_NODE_INTERVAL_P(new_interval(did, start, end));
+}
+
+Datum
+node_interval_send(PG_FUNCTION_ARGS)
+{
+	node_interval *interval = PG_GETARG_NODE_INTERVAL_P(0);
+	StringInfoData buf;
+
+	pq_begintypsend(&buf);
+	pq_sendint64(&buf, interval->did);
+	pq_sendint64(&buf, interval->start);
+	pq_sendint64(&buf, interval->end);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Interval of shredded node
+ * @param did document
+ * @param pre_order node
+ * @param size number of descendants (attributes and text nodes included)
+ * @return (did, pre_order, pre_order + size)
+ */
+Datum
+node_interval_make(PG_FUNCTION_ARGS)
+{
+	int64		did = PG_GETARG_INT64(0);
+	int64		pre_order = PG_GETARG_INT64(1);
+	int64		size = PG_GETARG_INT64(2);
+
+	PG_RETURN_NODE_INTERVAL_P(new_interval(did, pre_order, pre_order + size));
+}
+
+Datum
+node_interval_contains(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(node_interval_contains_internal(PG_GETARG_NODE_INTERVAL_P(0),
+			PG_GETARG_NODE_INTERVAL_P(1)));
+}
+
+Datum
+node_interval_contained(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(node_interval_contains_internal(PG_GETARG_NODE_INTERVAL_P(1),
+			PG_GETARG_NODE_INTERVAL_P(0)));
+}
+
+Datum
+node_interval_overlaps(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(node_interval_overlaps_internal(PG_GETARG_NODE_INTERVAL_P(0),
+			PG_GETARG_NODE_INTERVAL_P(1)));
+}
+
+/*
+ * Restriction selectivity of column op constant. Column contained by
+ * constant are descendants of constant node, there are at most end - start
+ * of them (every node has own pre_order), relation holds its share of all
+ * nodes of collection. Column containing constant are ancestors, about
+ * average depth of documents.
+ */
+static float8
+interval_selectivity(PG_FUNCTION_ARGS, bool ancestors, bool descendants)
+{
+	PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+	List	   *args = (List *) PG_GETARG_POINTER(2);
+	int			varRelid = PG_GETARG_INT32(3);
+	VariableStatData vardata;
+	Node	   *other;
+	bool		varonleft;
+	node_interval *constant;
+	double		ntuples;
+	double		rows = 0;
+	float8		selectivity;
+
+	if (!get_restriction_variable(root, args, varRelid,
+			&vardata, &other, &varonleft))
+	{
+		return NODE_INTERVAL_DEFAULT_SEL;
+	}
+
+	if (!IsA(other, Const) || ((Const *) other)->constisnull ||
+			vardata.rel == NULL || vardata.rel->tuples <= 0)
+	{
+		ReleaseVariableStats(vardata);
+		return NODE_INTERVAL_DEFAULT_SEL;
+	}
+
+	// constant @> column is column <@ constant
+	if (!varonleft && ancestors != descendants)
+	{
+		ancestors = !ancestors;
+		descendants = !descendants;
+	}
+
+	constant = DatumGetNodeIntervalP(((Const *) other)->constvalue);
+	ntuples = vardata.rel->tuples;
+	ReleaseVariableStats(vardata);
+
+	if (ancestors)
+	{
+		rows += xml_index_statistic("avg_depth", NODE_INTERVAL_ANCESTORS - 1) + 1;
+	}
+	if (descendants)
+	{
+		double		nodes = xml_index_statistic("nodes", 0);
+		double		share = nodes > ntuples ? ntuples / nodes : 1;
+
+		rows += ((double) (constant->end - constant->start) + 1) * share;
+	}
+
+	selectivity = rows / ntuples;
+	CLAMP_PROBABILITY(selectivity);
+
+	return selectivity;
+}
+
+Datum
+node_interval_contains_sel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(interval_selectivity(fcinfo, true, false));
+}
+
+Datum
+node_interval_contained_sel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(interval_selectivity(fcinfo, false, true));
+}
+
+Datum
+node_interval_overlaps_sel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(interval_selectivity(fcinfo, true, true));
+}
+
+/*
+ * Join selectivity of containment. Random pair of nodes is in ancestor
+ * relation when one of about average depth + 1 ancestors-or-self of
+ * descendant is picked from all nodes of collection.
+ */
+Datum
+node_interval_joinsel(PG_FUNCTION_ARGS)
+{
+	double		nodes = xml_index_statistic("nodes", 0);
+	float8		selectivity;
+
+	if (nodes <= 0)
+	{
+		PG_RETURN_FLOAT8(NODE_INTERVAL_DEFAULT_SEL);
+	}
+
+	selectivity = (xml_index_statistic("avg_depth", NODE_INTERVAL_ANCESTORS - 1) + 1) / nodes;
+	CLAMP_PROBABILITY(selectivity);
+
+	PG_RETURN_FLOAT8(selectivity);
+}
+
+/*
+ * GiST key is internal, it can't be entered
+ */
+Datum
+gnode_interval_in(PG_FUNCTION_ARGS)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("gnode_interval_in not implemented")));
+
+	PG_RETURN_VOID();
+}
+
+Datum
+gnode_interval_out(PG_FUNCTION_ARGS)
+{
+	node_interval_key *key = (node_interval_key *) PG_GETARG_POINTER(0);
+	char	   *result = (char *) palloc(4 * 21 + 16);
+
+	snprintf(result, 4 * 21 + 16,
+			"[" INT64_FORMAT "," INT64_FORMAT "]x[" INT64_FORMAT "," INT64_FORMAT "]",
+			key->did_low, key->did_high, key->low, key->high);
+
+	PG_RETURN_CSTRING(result);
+}
+
+/*
+ * Extend box by other box
+ * @param ndims number of (low, high) pairs
+ */
+void
+xml_gist_box_extend(int64 *box, const int64 *other, int ndims)
+{
+	int			i;
+
+	for (i = 0; i < 2 * ndims; i += 2)
+	{
+		box[i] = Min(box[i], other[i]);
+		box[i + 1] = Max(box[i + 1], other[i + 1]);
+	}
+}
+
+Datum
+gnode_interval_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY  *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	node_interval *query = PG_GETARG_NODE_INTERVAL_P(1);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool	   *recheck = (bool *) PG_GETARG_POINTER(4);
+	node_interval_key *key = (node_interval_key *) DatumGetPointer(entry->key);
+
+	// keys are exact, leaf has did_low = did_high
+	*recheck = false;
+
+	if (query->did < key->did_low || query->did > key->did_high)
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	switch (strategy)
+	{
+		case NODE_INTERVAL_CONTAINS_STRATEGY:
+			// leaf or anything below inner key contains query
+			PG_RETURN_BOOL(key->low <= query->start && query->end <= key->high);
+		case NODE_INTERVAL_CONTAINED_STRATEGY:
+			if (GIST_LEAF(entry))
+			{
+				PG_RETURN_BOOL(query->start <= key->low && key->high <= query->end);
+			}
+			PG_RETURN_BOOL(key->low <= query->end && query->start <= key->high);
+		case NODE_INTERVAL_OVERLAP_STRATEGY:
+			PG_RETURN_BOOL(key->low <= query->end && query->start <= key->high);
+		default:
+			elog(ERROR, "unrecognized node_interval strategy number: %d", strategy);
+	}
+
+	PG_RETURN_BOOL(false);
+}
+
+Datum
+gnode_interval_union(PG_FUNCTION_ARGS)
+{
+	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	int		   *sizep = (int *) PG_GETARG_POINTER(1);
+	node_interval_key *result = (node_interval_key *) palloc(sizeof(node_interval_key));
+	int			i;
+
+	*result = *(node_interval_key *) DatumGetPointer(entryvec->vector[0].key);
+	for (i = 1; i < entryvec->n; i++)
+	{
+		xml_gist_box_extend((int64 *) result,
+				(int64 *) DatumGetPointer(entryvec->vector[i].key),
+				NODE_INTERVAL_KEY_DIMS);
+	}
+	*sizep = sizeof(node_interval_key);
+
+	PG_RETURN_POINTER(result);
+}
+
+Datum
+gnode_interval_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY  *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY  *retval = entry;
+
+	if (entry->leafkey)
+	{
+		node_interval *interval = DatumGetNodeIntervalP(entry->key);
+		node_interval_key *key = (node_interval_key *) palloc(sizeof(node_interval_key));
+
+		key->did_low = key->did_high = interval->did;
+		key->low = interval->start;
+		key->high = interval->end;
+
+		retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+		gistentryinit(*retval, PointerGetDatum(key),
+				entry->rel, entry->page, entry->offset, FALSE);
+	}
+
+	PG_RETURN_POINTER(retval);
+}
+
+Datum
+gnode_interval_decompress(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+}
+
+/*
+ * Growth of box, documents first: mixing documents spoils pruning more
+ * than longer intervals of one document
+ * @param nmeasured number of leading dimensions counted, later ones are
+ * ignored
+ */
+float
+xml_gist_box_penalty(const int64 *orig, const int64 *add, int nmeasured)
+{
+	float		result = 0;
+	int			i;
+
+	for (i = 0; i < 2 * nmeasured; i += 2)
+	{
+		float		growth = (float) (Max(orig[i + 1], add[i + 1]) -
+				Min(orig[i], add[i]) - orig[i + 1] + orig[i]);
+
+		result += i == 0 ? growth * 1.0e6f : growth;
+	}
+
+	return result;
+}
+
+static int
+compare_split_items(const void *a, const void *b)
+{
+	const int64 *x = ((const box_split_item *) a)->key;
+	const int64 *y = ((const box_split_item *) b)->key;
+	int			i;
+
+	// center of document, then of position
+	for (i = 0; i < 4; i += 2)
+	{
+		int64		cx = x[i] / 2 + x[i + 1] / 2;
+		int64		cy = y[i] / 2 + y[i + 1] / 2;
+
+		if (cx != cy)
+		{
+			return cx < cy ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Sort keys by center (document first, then position) and split in half,
+ * documents are kept together and pages cover neighbouring subtrees
+ * @param ndims number of (low, high) pairs of key, at least 2
+ */
+GIST_SPLITVEC *
+xml_gist_box_picksplit(GistEntryVector *entryvec, GIST_SPLITVEC *v, int ndims)
+{
+	OffsetNumber maxoff = entryvec->n - 1;
+	int			nitems = maxoff - FirstOffsetNumber + 1;
+	Size		size = 2 * ndims * sizeof(int64);
+	box_split_item *items;
+	int64	   *left;
+	int64	   *right;
+	OffsetNumber i;
+	int			k;
+
+	items = (box_split_item *) palloc(nitems * sizeof(box_split_item));
+	for (i = FirstOffsetNumber, k = 0; i <= maxoff; i = OffsetNumberNext(i), k++)
+	{
+		items[k].offset = i;
+		items[k].key = (int64 *) DatumGetPointer(entryvec->vector[i].key);
+	}
+	qsort(items, nitems, sizeof(box_split_item), compare_split_items);
+
+	v->spl_left = (OffsetNumber *) palloc((nitems + 1) * sizeof(OffsetNumber));
+	v->spl_right = (OffsetNumber *) palloc((nitems + 1) * sizeof(OffsetNumber));
+	v->spl_nleft = 0;
+	v->spl_nright = 0;
+	left = (int64 *) palloc(size);
+	right = (int64 *) palloc(size);
+
+	for (k = 0; k < nitems; k++)
+	{
+		if (k < nitems / 2)
+		{
+			if (v->spl_nleft == 0)
+			{
+				memcpy(left, items[k].key, size);
+			} else
+			{
+				xml_gist_box_extend(left, items[k].key, ndims);
+			}
+			v->spl_left[v->spl_nleft++] = items[k].offset;
+		} else
+		{
+			if (v->spl_nright == 0)
+			{
+				memcpy(right, items[k].key, size);
+			} else
+			{
+				xml_gist_box_extend(right, items[k].key, ndims);
+			}
+			v->spl_right[v->spl_nright++] = items[k].offset;
+		}
+	}
+
+	v->spl_ldatum = PointerGetDatum(left);
+	v->spl_rdatum = PointerGetDatum(right);
+	pfree(items);
+
+	return v;
+}
+
+Datum
+gnode_interval_penalty(PG_FUNCTION_ARGS)
+{
+	GISTENTRY  *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY  *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+	float	   *result = (float *) PG_GETARG_POINTER(2);
+
+	*result = xml_gist_box_penalty((int64 *) DatumGetPointer(origentry->key),
+			(int64 *) DatumGetPointer(newentry->key), NODE_INTERVAL_KEY_DIMS);
+
+	PG_RETURN_POINTER(result);
+}
+
+Datum
+gnode_interval_picksplit(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(xml_gist_box_picksplit(
+			(GistEntryVector *) PG_GETARG_POINTER(0),
+			(GIST_SPLITVEC *) PG_GETARG_POINTER(1), NODE_INTERVAL_KEY_DIMS));
+}
+
+Datum
+gnode_interval_same(PG_FUNCTION_ARGS)
+{
+	node_interval_key *a = (node_interval_key *) PG_GETARG_POINTER(0);
+	node_interval_key *b = (node_interval_key *) PG_GETARG_POINTER(1);
+	bool	   *result = (bool *) PG_GETARG_POINTER(2);
+
+	*result = memcmp(a, b, sizeof(node_interval_key)) == 0;
+
+	PG_RETURN_POINTER(result);
+}
@@ -0,0 +1,101 @@
+/*
+ * File:   xml_node_interval.h
+ * Author: Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+ *
+ * Node of shredded document as interval [pre_order, pre_order + size] of
+ * document did. Intervals of one document are nested or disjoint.
+ */
+
+#ifndef XML_NODE_INTERVAL_H
+#define	XML_NODE_INTERVAL_H
+
+#include "postgres.h"
+#include "access/gist.h"
+#include "fmgr.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct node_interval node_interval;
+struct node_interval {
+	int64		did;
+	int64		start;			// pre_order
+	int64		end;			// pre_order + size
+};
+
+// GiST key, bounding box of intervals of range of documents
+typedef struct node_interval_key node_interval_key;
+struct node_interval_key {
+	int64		did_low;
+	int64		did_high;
+	int64		low;
+	int64		high;
+};
+
+// GiST keys are boxes of (low, high) pairs, document is first dimension
+#define NODE_INTERVAL_KEY_DIMS 2
+
+#define DatumGetNodeIntervalP(X)	((node_interval *) DatumGetPointer(X))
+#define NodeIntervalPGetDatum(X)	PointerGetDatum(X)
+#define PG_GETARG_NODE_INTERVAL_P(n) DatumGetNodeIntervalP(PG_GETARG_DATUM(n))
+#define PG_RETURN_NODE_INTERVAL_P(x) PG_RETURN_POINTER(x)
+
+// strategies of GiST operator class, same numbers as geometric types
+#define NODE_INTERVAL_OVERLAP_STRATEGY 3		// &&
+#define NODE_INTERVAL_CONTAINS_STRATEGY 7		// @>
+#define NODE_INTERVAL_CONTAINED_STRATEGY 8		// <@
+
+// node as point of pre/post plane, implemented in xml_plane.c
+typedef struct xml_plane_point xml_plane_point;
+struct xml_plane_point {
+	int64		did;
+	int64		pre;
+	int64		post;			// pre + size - depth
+	int64		depth;
+};
+
+// axis window, bounds are inclusive; also GiST key of xml_plane_point
+typedef struct xml_plane_window xml_plane_window;
+struct xml_plane_window {
+	int64		did_low;
+	int64		did_high;
+	int64		pre_low;
+	int64		pre_high;
+	int64		post_low;
+	int64		post_high;
+	int64		depth_low;
+	int64		depth_high;
+};
+
+#define XML_PLANE_WINDOW_DIMS 4
+
+#define PG_GETARG_XML_PLANE_POINT_P(n) ((xml_plane_point *) PG_GETARG_POINTER(n))
+#define PG_GETARG_XML_PLANE_WINDOW_P(n) ((xml_plane_window *) PG_GETARG_POINTER(n))
+
+#define XML_PLANE_WITHIN_STRATEGY 8				// point <@ window
+
+// GiST support shared by node_interval and xml_plane_point operator classes,
+// key is array of ndims (low, high) pairs, implemented in xml_node_interval.c
+void xml_gist_box_extend(int64 *box, const int64 *other, int ndims);
+float xml_gist_box_penalty(const int64 *orig, const int64 *add, int nmeasured);
+GIST_SPLITVEC *xml_gist_box_picksplit(GistEntryVector *entryvec, GIST_SPLITVEC *v,
+		int ndims);
+
+static inline bool
+node_interval_contains_internal(const node_interval *a, const node_interval *b)
+{
+	return a->did == b->did && a->start <= b->start && b->end <= a->end;
+}
+
+static inline bool
+node_interval_overlaps_internal(const node_interval *a, const node_interval *b)
+{
+	return a->did == b->did && a->start <= b->end && b->start <= a->end;
+}
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* XML_NODE_INTERVAL_H */
@@ -0,0 +1,427 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_plane.c
+// desc:	Pre/post plane of shredded nodes (XPath accelerator). Node is
+//			point (did, pre, post, depth) with post = pre + size - depth,
+//			every axis step from context node is window of the plane:
+//
+//			post ^  ancestor  | following
+//			     |     -------c--------
+//			     | preceding  | descendant
+//			     +-----------------------> pre
+//
+//			Windows are shrinked by size of context (descendants end at
+//			pre + size, preceding nodes end before pre), so GiST does not
+//			visit empty parts of the plane. GiST key is box of 4 dimensions.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_node_interval.h"
+
+#include "access/gist.h"
+#include "access/skey.h"
+#include "fmgr.h"
+#include "utils/builtins.h"
+
+#include <ctype.h>
+#include <errno.h>
+
+#define XML_PLANE_MIN (-INT64CONST(0x7FFFFFFFFFFFFFFF) - 1)
+#define XML_PLANE_MAX INT64CONST(0x7FFFFFFFFFFFFFFF)
+
+/* externally accessible functions */
+Datum	xml_plane_point_in(PG_FUNCTION_ARGS);
+Datum	xml_plane_point_out(PG_FUNCTION_ARGS);
+Datum	xml_plane_point_make(PG_FUNCTION_ARGS);
+Datum	xml_plane_window_in(PG_FUNCTION_ARGS);
+Datum	xml_plane_window_out(PG_FUNCTION_ARGS);
+Datum	xml_plane_within(PG_FUNCTION_ARGS);
+Datum	xml_plane_window_contains(PG_FUNCTION_ARGS);
+Datum	xml_axis_window(PG_FUNCTION_ARGS);
+Datum	gxml_plane_consistent(PG_FUNCTION_ARGS);
+Datum	gxml_plane_union(PG_FUNCTION_ARGS);
+Datum	gxml_plane_compress(PG_FUNCTION_ARGS);
+Datum	gxml_plane_decompress(PG_FUNCTION_ARGS);
+Datum	gxml_plane_penalty(PG_FUNCTION_ARGS);
+Datum	gxml_plane_picksplit(PG_FUNCTION_ARGS);
+Datum	gxml_plane_same(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(xml_plane_point_in);
+PG_FUNCTION_INFO_V1(xml_plane_point_out);
+PG_FUNCTION_INFO_V1(xml_plane_point_make);
+PG_FUNCTION_INFO_V1(xml_plane_window_in);
+PG_FUNCTION_INFO_V1(xml_plane_window_out);
+PG_FUNCTION_INFO_V1(xml_plane_within);
+PG_FUNCTION_INFO_V1(xml_plane_window_contains);
+PG_FUNCTION_INFO_V1(xml_axis_window);
+PG_FUNCTION_INFO_V1(gxml_plane_consistent);
+PG_FUNCTION_INFO_V1(gxml_plane_union);
+PG_FUNCTION_INFO_V1(gxml_plane_compress);
+PG_FUNCTION_INFO_V1(gxml_plane_decompress);
+PG_FUNCTION_INFO_V1(gxml_plane_penalty);
+PG_FUNCTION_INFO_V1(gxml_plane_picksplit);
+PG_FUNCTION_INFO_V1(gxml_plane_same);
+
+/*
+ * Parse (n1,n2,...) with exactly count numbers
+ */
+static void
+parse_numbers(const char *input, const char *type_name, int64 *values, int count)
+{
+	const char *pos = input;
+	char	   *end;
+	int			i;
+
+	while (isspace((unsigned char) *pos))
+	{
+		pos++;
+	}
+	if (*pos++ != '(')
+	{
+		goto syntax_error;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		errno = 0;
+		values[i] = strtoll(pos, &end, 10);
+		if (end == pos || errno != 0)
+		{
+			goto syntax_error;
+		}
+		pos = end;
+		while (isspace((unsigned char) *pos))
+		{
+			pos++;
+		}
+		if (*pos++ != (i == count - 1 ? ')' : ','))
+		{
+			goto syntax_error;
+		}
+	}
+
+	while (isspace((unsigned char) *pos))
+	{
+		pos++;
+	}
+	if (*pos == '\0')
+	{
+		return;
+	}
+
+syntax_error:
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+			 errmsg("invalid input syntax for %s: \"%s\"", type_name, input)));
+}
+
+static bool
+window_contains_point(const xml_plane_window *w, const xml_plane_point *p)
+{
+	return w->did_low <= p->did && p->did <= w->did_high &&
+			w->pre_low <= p->pre && p->pre <= w->pre_high &&
+			w->post_low <= p->post && p->post <= w->post_high &&
+			w->depth_low <= p->depth && p->depth <= w->depth_high;
+}
+
+static bool
+windows_intersect(const xml_plane_window *a, const xml_plane_window *b)
+{
+	return a->did_low <= b->did_high && b->did_low <= a->did_high &&
+			a->pre_low <= b->pre_high && b->pre_low <= a->pre_high &&
+			a->post_low <= b->post_high && b->post_low <= a->post_high &&
+			a->depth_low <= b->depth_high && b->depth_low <= a->depth_high;
+}
+
+Datum
+xml_plane_point_in(PG_FUNCTION_ARGS)
+{
+	char	   *input = PG_GETARG_CSTRING(0);
+	xml_plane_point *point = (xml_plane_point *) palloc(sizeof(xml_plane_point));
+	int64		values[4];
+
+	parse_numbers(input, "xml_plane_point", values, 4);
+	point->did = values[0];
+	point->pre = values[1];
+	point->post = values[2];
+	point->depth = values[3];
+
+	PG_RETURN_POINTER(point);
+}
+
+Datum
+xml_plane_point_out(PG_FUNCTION_ARGS)
+{
+	xml_plane_point *point = PG_GETARG_XML_PLANE_POINT_P(0);
+	char	   *result = (char *) palloc(4 * 21 + 6);
+
+	snprintf(result, 4 * 21 + 6,
+			"(" INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT ")",
+			point->did, point->pre, point->post, point->depth);
+
+	PG_RETURN_CSTRING(result);
+}
+
+/*
+ * Point of shredded node
+ * @param did document
+ * @param pre_order node
+ * @param size number of descendants
+ * @param depth depth of node, root has 0
+ * @return (did, pre_order, pre_order + size - depth, depth)
+ */
+Datum
+xml_plane_point_make(PG_FUNCTION_ARGS)
+{
+	xml_plane_point *point = (xml_plane_point *) palloc(sizeof(xml_plane_point));
+
+	point->did = PG_GETARG_INT64(0);
+	point->pre = PG_GETARG_INT64(1);
+	point->depth = PG_GETARG_INT64(3);
+	point->post = point->pre + PG_GETARG_INT64(2) - point->depth;
+
+	PG_RETURN_POINTER(point);
+}
+
+Datum
+xml_plane_window_in(PG_FUNCTION_ARGS)
+{
+	char	   *input = PG_GETARG_CSTRING(0);
+	xml_plane_window *window = (xml_plane_window *) palloc(sizeof(xml_plane_window));
+	int64		values[8];
+
+	parse_numbers(input, "xml_plane_window", values, 8);
+	window->did_low = values[0];
+	window->did_high = values[1];
+	window->pre_low = values[2];
+	window->pre_high = values[3];
+	window->post_low = values[4];
+	window->post_high = values[5];
+	window->depth_low = values[6];
+	window->depth_high = values[7];
+
+	PG_RETURN_POINTER(window);
+}
+
+Datum
+xml_plane_window_out(PG_FUNCTION_ARGS)
+{
+	xml_plane_window *w = PG_GETARG_XML_PLANE_WINDOW_P(0);
+	char	   *result = (char *) palloc(8 * 21 + 10);
+
+	snprintf(result, 8 * 21 + 10,
+			"(" INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT ","
+			INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT ")",
+			w->did_low, w->did_high, w->pre_low, w->pre_high,
+			w->post_low, w->post_high, w->depth_low, w->depth_high);
+
+	PG_RETURN_CSTRING(result);
+}
+
+Datum
+xml_plane_within(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(window_contains_point(PG_GETARG_XML_PLANE_WINDOW_P(1),
+			PG_GETARG_XML_PLANE_POINT_P(0)));
+}
+
+Datum
+xml_plane_window_contains(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(window_contains_point(PG_GETARG_XML_PLANE_WINDOW_P(0),
+			PG_GETARG_XML_PLANE_POINT_P(1)));
+}
+
+/*
+ * Window of axis step from context node
+ * @param context point of context node
+ * @param axis XPath axis name (child, descendant, descendant-or-self, parent,
+ *		ancestor, ancestor-or-self, following, preceding, self)
+ * @return window, nodes of axis are exactly the points inside it
+ */
+Datum
+xml_axis_window(PG_FUNCTION_ARGS)
+{
+	xml_plane_point *c = PG_GETARG_XML_PLANE_POINT_P(0);
+	char	   *axis = text_to_cstring(PG_GETARG_TEXT_P(1));
+	xml_plane_window *w = (xml_plane_window *) palloc(sizeof(xml_plane_window));
+	int64		end = c->post + c->depth;		// pre + size
+
+	w->did_low = w->did_high = c->did;
+	w->pre_low = XML_PLANE_MIN;
+	w->pre_high = XML_PLANE_MAX;
+	w->post_low = XML_PLANE_MIN;
+	w->post_high = XML_PLANE_MAX;
+	w->depth_low = XML_PLANE_MIN;
+	w->depth_high = XML_PLANE_MAX;
+
+	if (strcmp(axis, "self") == 0)
+	{
+		w->pre_low = w->pre_high = c->pre;
+		w->post_low = w->post_high = c->post;
+		w->depth_low = w->depth_high = c->depth;
+	} else if (strcmp(axis, "child") == 0 || strcmp(axis, "descendant") == 0)
+	{
+		w->pre_low = c->pre + 1;
+		w->pre_high = end;
+		w->post_high = c->post - 1;
+		w->depth_low = c->depth + 1;
+		if (axis[0] == 'c')
+		{
+			w->depth_high = c->depth + 1;
+		}
+	} else if (strcmp(axis, "descendant-or-self") == 0)
+	{
+		w->pre_low = c->pre;
+		w->pre_high = end;
+		w->post_high = c->post;
+		w->depth_low = c->depth;
+	} else if (strcmp(axis, "parent") == 0 || strcmp(axis, "ancestor") == 0)
+	{
+		w->pre_high = c->pre - 1;
+		w->post_low = c->post + 1;
+		w->depth_high = c->depth - 1;
+		if (axis[0] == 'p')
+		{
+			w->depth_low = c->depth - 1;
+		}
+	} else if (strcmp(axis, "ancestor-or-self") == 0)
+	{
+		w->pre_high = c->pre;
+		w->post_low = c->post;
+		w->depth_high = c->depth;
+	} else if (strcmp(axis, "following") == 0)
+	{
+		// following nodes start after end of context subtree
+		w->pre_low = end + 1;
+		w->post_low = c->post + 1;
+	} else if (strcmp(axis, "preceding") == 0)
+	{
+		// preceding subtrees end before context, so also post < pre of context
+		w->pre_high = c->pre - 1;
+		w->post_high = Min(c->post, c->pre) - 1;
+	} else
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unsupported axis \"%s\"", axis),
+				 errdetail("Sibling axes need parent of context node, use parent_id.")));
+	}
+
+	pfree(axis);
+
+	PG_RETURN_POINTER(w);
+}
+
+Datum
+gxml_plane_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY  *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	xml_plane_window *query = PG_GETARG_XML_PLANE_WINDOW_P(1);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool	   *recheck = (bool *) PG_GETARG_POINTER(4);
+	xml_plane_window *key = (xml_plane_window *) DatumGetPointer(entry->key);
+
+	// leaf keys are points, test is exact
+	*recheck = false;
+
+	if (strategy != XML_PLANE_WITHIN_STRATEGY)
+	{
+		elog(ERROR, "unrecognized xml_plane_point strategy number: %d", strategy);
+	}
+
+	PG_RETURN_BOOL(windows_intersect(key, query));
+}
+
+Datum
+gxml_plane_union(PG_FUNCTION_ARGS)
+{
+	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	int		   *sizep = (int *) PG_GETARG_POINTER(1);
+	xml_plane_window *result = (xml_plane_window *) palloc(sizeof(xml_plane_window));
+	int			i;
+
+	*result = *(xml_plane_window *) DatumGetPointer(entryvec->vector[0].key);
+	for (i = 1; i < entryvec->n; i++)
+	{
+		xml_gist_box_extend((int64 *) result,
+				(int64 *) DatumGetPointer(entryvec->vector[i].key),
+				XML_PLANE_WINDOW_DIMS);
+	}
+	*sizep = sizeof(xml_plane_window);
+
+	PG_RETURN_POINTER(result);
+}
+
+Datum
+gxml_plane_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY  *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY  *retval = entry;
+
+	if (entry->leafkey)
+	{
+		xml_plane_point *point = (xml_plane_point *) DatumGetPointer(entry->key);
+		xml_plane_window *key = (xml_plane_window *) palloc(sizeof(xml_plane_window));
+
+		key->did_low = key->did_high = point->did;
+		key->pre_low = key->pre_high = point->pre;
+		key->post_low = key->post_high = point->post;
+		key->depth_low = key->depth_high = point->depth;
+
+		retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+		gistentryinit(*retval, PointerGetDatum(key),
+				entry->rel, entry->page, entry->offset, FALSE);
+	}
+
+	PG_RETURN_POINTER(retval);
+}
+
+Datum
+gxml_plane_decompress(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+}
+
+/*
+ * Growth of box, documents first, then perimeter in pre/post plane (depth
+ * is not counted)
+ */
+Datum
+gxml_plane_penalty(PG_FUNCTION_ARGS)
+{
+	GISTENTRY  *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY  *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+	float	   *result = (float *) PG_GETARG_POINTER(2);
+
+	*result = xml_gist_box_penalty((int64 *) DatumGetPointer(origentry->key),
+			(int64 *) DatumGetPointer(newentry->key), XML_PLANE_WINDOW_DIMS - 1);
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Split in document order, halves are neighbouring parts of documents
+ */
+Datum
+gxml_plane_picksplit(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(xml_gist_box_picksplit(
+			(GistEntryVector *) PG_GETARG_POINTER(0),
+			(GIST_SPLITVEC *) PG_GETARG_POINTER(1), XML_PLANE_WINDOW_DIMS));
+}
+
+Datum
+gxml_plane_same(PG_FUNCTION_ARGS)
+{
+	xml_plane_window *a = PG_GETARG_XML_PLANE_WINDOW_P(0);
+	xml_plane_window *b = PG_GETARG_XML_PLANE_WINDOW_P(1);
+	bool	   *result = (bool *) PG_GETARG_POINTER(2);
+
+	*result = memcmp(a, b, sizeof(xml_plane_window)) == 0;
+
+	PG_RETURN_POINTER(result);
+}
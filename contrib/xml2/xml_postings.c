@@ -0,0 +1,854 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_postings.c
+// desc:	Per-tag posting lists of elements (did, pre_order, size, depth)
+//			in document order, stored in xml_tag_postings as blocks of up to
+//			XML_POSTINGS_BLOCK_SIZE postings. Block row keeps its first
+//			(did, pre_order) and last did as skip pointers, data are four
+//			columns (did delta, pre_order delta or value in new document,
+//			size, depth), every column bit-packed with width of its
+//			largest value. Loader appends postings of every shredded
+//			document, eviction removes them.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_structural_join.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+
+#define XML_POSTINGS_COLUMNS 4
+
+/* externally accessible functions */
+Datum	create_xmlindex_postings(PG_FUNCTION_ARGS);
+Datum	tag_postings(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(create_xmlindex_postings);
+PG_FUNCTION_INFO_V1(tag_postings);
+
+// postings of one tag waiting for insert
+typedef struct postings_builder postings_builder;
+struct postings_builder {
+	SPIPlanPtr	insert_plan;
+	char	   *name;
+	xml_join_node nodes[XML_POSTINGS_BLOCK_SIZE];
+	int			count;
+	int64		blocks;
+};
+
+static int
+bit_width(uint64 value)
+{
+	int			width = 0;
+
+	while (value != 0)
+	{
+		width++;
+		value >>= 1;
+	}
+
+	return width;
+}
+
+static void
+put_bits(StringInfo buf, uint64 *acc, int *nbits, uint64 value, int width)
+{
+	if (width > 32)
+	{
+		put_bits(buf, acc, nbits, value & UINT64CONST(0xFFFFFFFF), 32);
+		value >>= 32;
+		width -= 32;
+	}
+
+	*acc |= value << *nbits;
+	*nbits += width;
+	while (*nbits >= 8)
+	{
+		appendStringInfoChar(buf, (char) (*acc & 0xFF));
+		*acc >>= 8;
+		*nbits -= 8;
+	}
+}
+
+static uint64
+get_bits(const unsigned char *data, uint64 *position, int width)
+{
+	uint64		result = 0;
+	int			got = 0;
+
+	while (got < width)
+	{
+		int			offset = (int) (*position & 7);
+		int			take = Min(8 - offset, width - got);
+		uint64		bits = (data[*position >> 3] >> offset) & ((1 << take) - 1);
+
+		result |= bits << got;
+		got += take;
+		*position += take;
+	}
+
+	return result;
+}
+
+/*
+ * Encode sorted nodes into block data, first node is stored in columns of
+ * block row
+ * @param nodes postings ordered by did, pre_order
+ * @param count number of nodes, at most XML_POSTINGS_BLOCK_SIZE
+ * @return data of block
+ */
+bytea *
+xml_postings_encode(const xml_join_node *nodes, int count)
+{
+	uint64		columns[XML_POSTINGS_COLUMNS][XML_POSTINGS_BLOCK_SIZE];
+	StringInfoData buf;
+	bytea	   *result;
+	int			c;
+	int			i;
+
+	Assert(count > 0 && count <= XML_POSTINGS_BLOCK_SIZE);
+
+	for (i = 0; i < count; i++)
+	{
+		xml_label	did_delta = i == 0 ? 0 : nodes[i].did - nodes[i - 1].did;
+		xml_label	pre = i == 0 ? 0 :
+				(did_delta == 0 ? nodes[i].pre_order - nodes[i - 1].pre_order :
+				 nodes[i].pre_order);
+
+		if (did_delta < 0 || pre < 0 || nodes[i].size < 0 || nodes[i].depth < 0 ||
+				(i > 0 && did_delta == 0 && pre == 0))
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("postings are not ordered by did, pre_order")));
+		}
+		columns[0][i] = (uint64) did_delta;
+		columns[1][i] = (uint64) pre;
+		columns[2][i] = (uint64) nodes[i].size;
+		columns[3][i] = (uint64) nodes[i].depth;
+	}
+
+	initStringInfo(&buf);
+	appendStringInfoSpaces(&buf, VARHDRSZ);
+	for (c = 0; c < XML_POSTINGS_COLUMNS; c++)
+	{
+		uint64		max = 0;
+		uint64		acc = 0;
+		int			nbits = 0;
+		int			width;
+
+		for (i = 0; i < count; i++)
+		{
+			max |= columns[c][i];
+		}
+		width = bit_width(max);
+		appendStringInfoChar(&buf, (char) width);
+		for (i = 0; i < count; i++)
+		{
+			put_bits(&buf, &acc, &nbits, columns[c][i], width);
+		}
+		if (nbits > 0)
+		{
+			appendStringInfoChar(&buf, (char) acc);
+		}
+	}
+
+	result = (bytea *) buf.data;
+	SET_VARSIZE(result, buf.len);
+
+	return result;
+}
+
+/*
+ * Decode block made by xml_postings_encode
+ * @param nodes (out) array of count nodes
+ */
+void
+xml_postings_decode(const bytea *data, xml_label first_did,
+		xml_label first_pre, int count, xml_join_node *nodes)
+{
+	const unsigned char *bytes = (const unsigned char *) VARDATA(data);
+	int			length = VARSIZE(data) - VARHDRSZ;
+	uint64		column_start = 0;		// in bits
+	uint64		position;
+	int			c;
+	int			i;
+
+	if (count <= 0 || count > XML_POSTINGS_BLOCK_SIZE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid number %d of postings in block", count)));
+	}
+
+	for (c = 0; c < XML_POSTINGS_COLUMNS; c++)
+	{
+		int			width;
+
+		if ((int) (column_start >> 3) >= length)
+		{
+			goto corrupted;
+		}
+		width = bytes[column_start >> 3];
+		position = column_start + 8;
+		if (width > 64 || (int) ((position + (uint64) width * count + 7) >> 3) > length)
+		{
+			goto corrupted;
+		}
+
+		for (i = 0; i < count; i++)
+		{
+			xml_label	value = (xml_label) get_bits(bytes, &position, width);
+
+			switch (c)
+			{
+				case 0:
+					nodes[i].did = i == 0 ? first_did : nodes[i - 1].did + value;
+					break;
+				case 1:
+					if (i == 0)
+					{
+						nodes[i].pre_order = first_pre;
+					} else
+					{
+						nodes[i].pre_order = nodes[i].did == nodes[i - 1].did ?
+								nodes[i - 1].pre_order + value : value;
+					}
+					break;
+				case 2:
+					nodes[i].size = value;
+					break;
+				default:
+					nodes[i].depth = (int) value;
+			}
+		}
+		// columns start on byte boundary
+		column_start = (position + 7) & ~UINT64CONST(7);
+	}
+
+	return;
+
+corrupted:
+	ereport(ERROR,
+			(errcode(ERRCODE_DATA_CORRUPTED),
+			 errmsg("corrupted block of postings")));
+}
+
+/*
+ * Are posting lists maintained, set by create_xmlindex_postings
+ */
+bool
+xml_postings_enabled(void)
+{
+	char	   *value = xml_index_setting("postings");
+
+	return value != NULL && strcmp(value, "true") == 0;
+}
+
+static SPIPlanPtr
+prepare_postings_plan(const char *query, int nargs, Oid *types)
+{
+	SPIPlanPtr	plan = SPI_prepare(query, nargs, types);
+
+	if (plan == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_TABLE),
+				 errmsg("table xml_tag_postings does not exist"),
+				 errhint("Use create_xmlindex_postings() first.")));
+	}
+
+	return plan;
+}
+
+static void
+builder_init(postings_builder *builder)
+{
+	Oid			types[6] = {TEXTOID, INT8OID, INT8OID, INT8OID, INT4OID, BYTEAOID};
+
+	memset(builder, 0, sizeof(postings_builder));
+	builder->insert_plan = prepare_postings_plan(
+			"INSERT INTO xml_tag_postings "
+			"(name, first_did, first_pre, last_did, count, data) "
+			"VALUES ($1, $2, $3, $4, $5, $6)", 6, types);
+}
+
+static void
+builder_flush(postings_builder *builder)
+{
+	Datum		values[6];
+	bytea	   *data;
+
+	if (builder->count == 0)
+	{
+		return;
+	}
+
+	data = xml_postings_encode(builder->nodes, builder->count);
+	values[0] = CStringGetTextDatum(builder->name);
+	values[1] = Int64GetDatum(builder->nodes[0].did);
+	values[2] = Int64GetDatum(builder->nodes[0].pre_order);
+	values[3] = Int64GetDatum(builder->nodes[builder->count - 1].did);
+	values[4] = Int32GetDatum(builder->count);
+	values[5] = PointerGetDatum(data);
+
+	if (SPI_execute_plan(builder->insert_plan, values, NULL, false, 0) != SPI_OK_INSERT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not insert block of postings")));
+	}
+	pfree(data);
+
+	builder->count = 0;
+	builder->blocks++;
+}
+
+/*
+ * Append node of tag name, nodes come ordered by name, did, pre_order
+ */
+static void
+builder_add(postings_builder *builder, const char *name, const xml_join_node *node)
+{
+	if (builder->name == NULL || strcmp(builder->name, name) != 0)
+	{
+		builder_flush(builder);
+		if (builder->name != NULL)
+		{
+			pfree(builder->name);
+		}
+		builder->name = pstrdup(name);
+	}
+
+	builder->nodes[builder->count++] = *node;
+	if (builder->count == XML_POSTINGS_BLOCK_SIZE)
+	{
+		builder_flush(builder);
+	}
+}
+
+static const char *
+element_source(int layout)
+{
+	return layout == LAYOUT_UNIFIED ?
+			"node_table WHERE kind = 1" :
+			"element_table WHERE true";
+}
+
+/*
+ * Read (name, did, pre_order, size, depth) rows of cursor into builder
+ */
+static void
+build_from_cursor(postings_builder *builder, Portal portal)
+{
+	int			i;
+
+	for (;;)
+	{
+		SPITupleTable *batch;
+		int			count;
+
+		SPI_cursor_fetch(portal, true, XML_JOIN_BATCH_SIZE);
+		if (SPI_processed == 0)
+		{
+			break;
+		}
+		batch = SPI_tuptable;
+		count = SPI_processed;
+
+		for (i = 0; i < count; i++)
+		{
+			HeapTuple	tuple = batch->vals[i];
+			TupleDesc	tupdesc = batch->tupdesc;
+			xml_join_node node;
+			bool		isnull;
+			char	   *name = SPI_getvalue(tuple, tupdesc, 1);
+
+			node.did = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+			node.pre_order = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+			node.size = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+			node.depth = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 5, &isnull));
+			builder_add(builder, name, &node);
+			pfree(name);
+		}
+		SPI_freetuptable(batch);
+	}
+	builder_flush(builder);
+}
+
+static Portal
+open_elements_cursor(const char *condition, int layout)
+{
+	StringInfoData query;
+	SPIPlanPtr	plan;
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"SELECT name, did::bigint, pre_order::bigint, size::bigint, "
+			"coalesce(depth, 0) FROM %s%s ORDER BY name, did, pre_order",
+			element_source(layout), condition);
+
+	plan = SPI_prepare(query.data, 0, NULL);
+	if (plan == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read shredded elements")));
+	}
+
+	return SPI_cursor_open(NULL, plan, NULL, NULL, true);
+}
+
+/*
+ * Replace all posting lists by postings of current shredded elements
+ * @return number of blocks
+ */
+int64
+xml_postings_rebuild(int layout)
+{
+	postings_builder builder;
+	Portal		portal;
+
+	SPI_connect();
+
+	if (SPI_execute("TRUNCATE xml_tag_postings", false, 0) != SPI_OK_UTILITY)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not truncate xml_tag_postings")));
+	}
+
+	builder_init(&builder);
+	portal = open_elements_cursor("", layout);
+	build_from_cursor(&builder, portal);
+	SPI_cursor_close(portal);
+
+	SPI_finish();
+
+	return builder.blocks;
+}
+
+/*
+ * Decode block of row of result with columns
+ * (name, first_did, first_pre, count, data, ...)
+ * @param count (out) number of postings
+ * @return palloced postings
+ */
+static xml_join_node *
+decode_block_row(SPITupleTable *blocks, int row, int *count)
+{
+	HeapTuple	tuple = blocks->vals[row];
+	TupleDesc	tupdesc = blocks->tupdesc;
+	xml_join_node *nodes;
+	bool		isnull;
+
+	*count = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+	if (*count <= 0 || *count > XML_POSTINGS_BLOCK_SIZE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid number %d of postings in block", *count)));
+	}
+	nodes = (xml_join_node *) palloc(*count * sizeof(xml_join_node));
+	xml_postings_decode(DatumGetByteaP(SPI_getbinval(tuple, tupdesc, 5, &isnull)),
+			DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &isnull)),
+			DatumGetInt64(SPI_getbinval(tuple, tupdesc, 3, &isnull)),
+			*count, nodes);
+
+	return nodes;
+}
+
+static void
+delete_block(SPIPlanPtr delete_plan, const char *name, const xml_join_node *first)
+{
+	Datum		args[3];
+
+	args[0] = CStringGetTextDatum(name);
+	args[1] = Int64GetDatum(first->did);
+	args[2] = Int64GetDatum(first->pre_order);
+	if (SPI_execute_plan(delete_plan, args, NULL, false, 0) != SPI_OK_DELETE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not delete block of postings")));
+	}
+}
+
+static void
+builder_add_nodes(postings_builder *builder, const char *name,
+		const xml_join_node *nodes, int count, xml_label skip_did)
+{
+	int			i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (nodes[i].did != skip_did)
+		{
+			builder_add(builder, name, &nodes[i]);
+		}
+	}
+}
+
+/*
+ * Add postings of document to posting lists. Documents usually come with
+ * growing did, so postings are appended to last (not full) block of tag.
+ * Reshredded document with older did is merged into block spanning its did,
+ * its old postings are removed first from every block spanning the did.
+ * @param did shredded document
+ * @param layout LAYOUT_SEPARATE or LAYOUT_UNIFIED
+ */
+void
+xml_postings_add_document(xml_label did, int layout)
+{
+	postings_builder builder;
+	Portal		portal;
+	SPITupleTable *elements;
+	char		condition[64];
+	Oid			tail_types[2] = {TEXTOID, INT8OID};
+	Oid			delete_types[3] = {TEXTOID, INT8OID, INT8OID};
+	SPIPlanPtr	tail_plan;
+	SPIPlanPtr	delete_plan;
+	xml_join_node *nodes;
+	char	  **names;
+	int			nelements;
+	int			start;
+	int			end;
+	int			i;
+
+	// blocks of other tags (or beyond tail) can hold postings of old version
+	xml_postings_remove_document(did);
+
+	SPI_connect();
+
+	builder_init(&builder);
+	tail_plan = prepare_postings_plan(
+			"SELECT name, first_did, first_pre, count, data, last_did "
+			"FROM xml_tag_postings WHERE name = $1 AND first_did <= $2 "
+			"ORDER BY first_did DESC, first_pre DESC LIMIT 1", 2, tail_types);
+	delete_plan = prepare_postings_plan(
+			"DELETE FROM xml_tag_postings WHERE name = $1 AND first_did = $2 "
+			"AND first_pre = $3", 3, delete_types);
+
+	// elements of document ordered by name, pre_order
+	snprintf(condition, sizeof(condition), " AND did = " INT64_FORMAT, did);
+	portal = open_elements_cursor(condition, layout);
+	SPI_cursor_fetch(portal, true, FETCH_ALL);
+	elements = SPI_tuptable;
+	nelements = SPI_processed;
+	SPI_cursor_close(portal);
+
+	nodes = (xml_join_node *) palloc((nelements + 1) * sizeof(xml_join_node));
+	names = (char **) palloc((nelements + 1) * sizeof(char *));
+	for (i = 0; i < nelements; i++)
+	{
+		HeapTuple	tuple = elements->vals[i];
+		bool		isnull;
+
+		names[i] = SPI_getvalue(tuple, elements->tupdesc, 1);
+		nodes[i].did = did;
+		nodes[i].pre_order = DatumGetInt64(SPI_getbinval(tuple, elements->tupdesc, 3, &isnull));
+		nodes[i].size = DatumGetInt64(SPI_getbinval(tuple, elements->tupdesc, 4, &isnull));
+		nodes[i].depth = DatumGetInt32(SPI_getbinval(tuple, elements->tupdesc, 5, &isnull));
+	}
+
+	for (start = 0; start < nelements; start = end)
+	{
+		Datum		args[2];
+		xml_join_node *tail = NULL;
+		int			tail_count = 0;
+		int			k = 0;
+
+		for (end = start + 1; end < nelements && strcmp(names[end], names[start]) == 0; end++)
+			;
+
+		// skip pointers find last block starting before end of document
+		args[0] = CStringGetTextDatum(names[start]);
+		args[1] = Int64GetDatum(did);
+		if (SPI_execute_plan(tail_plan, args, NULL, true, 1) == SPI_OK_SELECT &&
+				SPI_processed > 0)
+		{
+			bool		isnull;
+			int			count = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0],
+					SPI_tuptable->tupdesc, 4, &isnull));
+			xml_label	last_did = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+					SPI_tuptable->tupdesc, 6, &isnull));
+
+			// full block before document stays as it is
+			if (last_did >= did || count < XML_POSTINGS_BLOCK_SIZE)
+			{
+				tail = decode_block_row(SPI_tuptable, 0, &tail_count);
+				delete_block(delete_plan, names[start], &tail[0]);
+			}
+		}
+
+		// stale postings of the same did are dropped
+		while (k < tail_count && tail[k].did < did)
+		{
+			builder_add(&builder, names[start], &tail[k++]);
+		}
+		builder_add_nodes(&builder, names[start], nodes + start, end - start, -1);
+		builder_add_nodes(&builder, names[start], tail + k, tail_count - k, did);
+		builder_flush(&builder);
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Remove postings of document from posting lists
+ * @param did removed (evicted) document
+ */
+void
+xml_postings_remove_document(xml_label did)
+{
+	postings_builder builder;
+	Oid			types[1] = {INT8OID};
+	Oid			delete_types[3] = {TEXTOID, INT8OID, INT8OID};
+	SPIPlanPtr	delete_plan;
+	SPITupleTable *blocks;
+	Datum		args[1];
+	int			nblocks;
+	int			i;
+
+	SPI_connect();
+
+	builder_init(&builder);
+	delete_plan = prepare_postings_plan(
+			"DELETE FROM xml_tag_postings WHERE name = $1 AND first_did = $2 "
+			"AND first_pre = $3", 3, delete_types);
+
+	args[0] = Int64GetDatum(did);
+	if (SPI_execute_with_args(
+			"SELECT name, first_did, first_pre, count, data FROM xml_tag_postings "
+			"WHERE first_did <= $1 AND last_did >= $1", 1, types, args, NULL,
+			false, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read postings of document")));
+	}
+	blocks = SPI_tuptable;
+	nblocks = SPI_processed;
+
+	for (i = 0; i < nblocks; i++)
+	{
+		char	   *name;
+		xml_join_node *nodes;
+		int			count;
+
+		name = SPI_getvalue(blocks->vals[i], blocks->tupdesc, 1);
+		nodes = decode_block_row(blocks, i, &count);
+		delete_block(delete_plan, name, &nodes[0]);
+		builder_add_nodes(&builder, name, nodes, count, did);
+		builder_flush(&builder);
+		pfree(nodes);
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Stream of posting list of tag, read by xml_join_spi_next. Skip pointers
+ * of blocks restrict scan to range of documents.
+ * @param name tag
+ * @param did_from first document
+ * @param did_to last document
+ */
+void
+xml_join_postings_open(xml_join_spi_stream *stream, const char *name,
+		xml_label did_from, xml_label did_to)
+{
+	StringInfoData query;
+	SPIPlanPtr	plan;
+
+	memset(stream, 0, sizeof(xml_join_spi_stream));
+	stream->name = name;
+	stream->postings = (xml_join_node *) palloc(XML_POSTINGS_BLOCK_SIZE * sizeof(xml_join_node));
+	stream->did_from = did_from;
+	stream->did_to = did_to;
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"SELECT name, first_did, first_pre, count, data FROM xml_tag_postings "
+			"WHERE name = %s AND last_did >= " INT64_FORMAT " AND first_did <= " INT64_FORMAT
+			" ORDER BY first_did, first_pre",
+			quote_literal_cstr(name), did_from, did_to);
+	plan = prepare_postings_plan(query.data, 0, NULL);
+	// not read only, postings of documents shredded lazily by caller
+	stream->portal = SPI_cursor_open(NULL, plan, NULL, NULL, false);
+}
+
+bool
+xml_join_postings_next(xml_join_spi_stream *stream, xml_join_node *node)
+{
+	for (;;)
+	{
+		while (stream->posting_position >= stream->posting_count)
+		{
+			bool		isnull;
+			HeapTuple	tuple;
+			TupleDesc	tupdesc;
+
+			if (stream->done)
+			{
+				return false;
+			}
+			if (stream->batch == NULL || stream->position >= stream->count)
+			{
+				if (stream->batch != NULL)
+				{
+					SPI_freetuptable(stream->batch);
+					stream->batch = NULL;
+				}
+
+				SPI_cursor_fetch(stream->portal, true, XML_JOIN_BATCH_SIZE / XML_POSTINGS_BLOCK_SIZE + 1);
+				if (SPI_processed == 0)
+				{
+					stream->done = true;
+					return false;
+				}
+				stream->batch = SPI_tuptable;
+				stream->count = SPI_processed;
+				stream->position = 0;
+			}
+
+			tuple = stream->batch->vals[stream->position++];
+			tupdesc = stream->batch->tupdesc;
+			stream->posting_count = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+			stream->posting_position = 0;
+			xml_postings_decode(DatumGetByteaP(SPI_getbinval(tuple, tupdesc, 5, &isnull)),
+					DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &isnull)),
+					DatumGetInt64(SPI_getbinval(tuple, tupdesc, 3, &isnull)),
+					stream->posting_count, stream->postings);
+		}
+
+		*node = stream->postings[stream->posting_position++];
+		// only first and last block of range contain other documents
+		if (node->did > stream->did_to)
+		{
+			stream->done = true;
+			stream->posting_count = 0;
+			return false;
+		}
+		if (node->did >= stream->did_from)
+		{
+			return true;
+		}
+	}
+}
+
+/*
+ * Create xml_tag_postings and fill it from shredded elements, loader keeps
+ * it up to date from then. Table is UNLOGGED when shredded tables are, so
+ * crash recovery truncates postings together with elements they point to
+ * and reshredded documents don't meet their stale blocks.
+ * @return number of blocks
+ */
+Datum
+create_xmlindex_postings(PG_FUNCTION_ARGS)
+{
+	StringInfoData query;
+	char	   *unlogged = xml_index_setting("unlogged");
+	int64		blocks;
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"CREATE %sTABLE xml_tag_postings "
+							"(name text not null, "
+							"first_did bigint not null, "
+							"first_pre bigint not null, "
+							"last_did bigint not null, "
+							"count int not null, "
+							"data bytea not null, "
+							"PRIMARY KEY (name, first_did, first_pre)); "
+					"INSERT INTO xml_index_settings VALUES ('postings', 'true');",
+			unlogged != NULL && strcmp(unlogged, "true") == 0 ? "UNLOGGED " : "");
+
+	SPI_connect();
+
+	if (SPI_execute(query.data, false, 0) < 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not create xml_tag_postings")));
+	}
+
+	SPI_finish();
+
+	pfree(query.data);
+	blocks = xml_postings_rebuild(get_index_layout());
+
+	PG_RETURN_INT64(blocks);
+}
+
+/*
+ * Decode posting list of tag
+ * @param name tag
+ * @return set of (did, pre_order, size, depth) ordered by did, pre_order
+ */
+Datum
+tag_postings(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	char	   *name = text_to_cstring(PG_GETARG_TEXT_P(0));
+	xml_join_spi_stream stream;
+	xml_join_node node;
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+			!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+			false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	SPI_connect();
+
+	xml_join_postings_open(&stream, name, XML_LABEL_MIN, XML_LABEL_MAX);
+	while (xml_join_postings_next(&stream, &node))
+	{
+		Datum		values[4];
+		bool		nulls[4] = {false, false, false, false};
+
+		values[0] = Int64GetDatum(node.did);
+		values[1] = Int64GetDatum(node.pre_order);
+		values[2] = Int64GetDatum(node.size);
+		values[3] = Int32GetDatum(node.depth);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	xml_join_spi_close(&stream);
+
+	SPI_finish();
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}
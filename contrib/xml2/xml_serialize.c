@@ -0,0 +1,267 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_serialize.c
+// desc:	Reconstruction of XML text of shredded subtree. Elements,
+//			attributes and text of subtree are read in one scan ordered by
+//			pre_order, attributes follow their element directly, so start
+//			tag is closed by first non-attribute node and element is closed
+//			when scan leaves its interval (pre_order + size).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#define SERIALIZE_FETCH_SIZE 1000
+#define SERIALIZE_INITIAL_DEPTH 32
+
+/* externally accessible functions */
+Datum	serialize_subtree(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(serialize_subtree);
+
+// element whose end tag was not written yet
+typedef struct open_element open_element;
+struct open_element {
+	char	   *name;			// copy, outlives batch of rows
+	int64		high;			// pre_order + size
+};
+
+/*
+ * Append text with markup characters replaced by entities
+ * @param attribute escape quotes too
+ */
+static void
+append_escaped(StringInfo buf, const char *text, bool attribute)
+{
+	const char *c;
+
+	for (c = text; *c != '\0'; c++)
+	{
+		switch (*c)
+		{
+			case '&':
+				appendStringInfoString(buf, "&amp;");
+				break;
+			case '<':
+				appendStringInfoString(buf, "&lt;");
+				break;
+			case '>':
+				appendStringInfoString(buf, "&gt;");
+				break;
+			case '"':
+				if (attribute)
+				{
+					appendStringInfoString(buf, "&quot;");
+					break;
+				}
+				appendStringInfoChar(buf, *c);
+				break;
+			default:
+				appendStringInfoChar(buf, *c);
+		}
+	}
+}
+
+/*
+ * Query returning (kind, pre_order, size, name, value) of subtree rooted in
+ * node ($1, $2) ordered by pre_order
+ */
+static char *
+subtree_query(int layout)
+{
+	if (layout == LAYOUT_UNIFIED)
+	{
+		// node_table is clustered by (did, pre_order), one range scan
+		return "SELECT kind::int, pre_order::bigint, coalesce(size, 0)::bigint, name, value "
+				"FROM node_table WHERE did = $1 AND pre_order >= $2 "
+				"AND pre_order <= $2 + (SELECT coalesce(size, 0) FROM node_table "
+					"WHERE did = $1 AND pre_order = $2) "
+				"ORDER BY pre_order";
+	}
+
+	// size of root decides interval, attribute and text root is one node
+	return "WITH r AS (SELECT pre_order AS low, pre_order + size AS high "
+				"FROM element_table WHERE did = $1 AND pre_order = $2 "
+			"UNION ALL SELECT pre_order, pre_order "
+				"FROM attribute_table WHERE did = $1 AND pre_order = $2 "
+			"UNION ALL SELECT pre_order, pre_order "
+				"FROM text_table WHERE did = $1 AND pre_order = $2) "
+			"SELECT 1, e.pre_order::bigint, e.size::bigint, e.name, NULL::text "
+				"FROM element_table e, r WHERE e.did = $1 "
+				"AND e.pre_order >= r.low AND e.pre_order <= r.high "
+			"UNION ALL "
+			"SELECT 2, a.pre_order::bigint, 0::bigint, a.name, a.value "
+				"FROM attribute_table a, r WHERE a.did = $1 "
+				"AND a.pre_order >= r.low AND a.pre_order <= r.high "
+			"UNION ALL "
+			"SELECT 3, t.pre_order::bigint, 0::bigint, NULL::text, t.value "
+				"FROM text_table t, r WHERE t.did = $1 "
+				"AND t.pre_order >= r.low AND t.pre_order <= r.high "
+			"ORDER BY 2";
+}
+
+/*
+ * Write end tag of element on top of stack and pop it
+ */
+static void
+close_element(StringInfo buf, open_element *stack, int *top)
+{
+	(*top)--;
+	appendStringInfo(buf, "</%s>", stack[*top].name);
+	pfree(stack[*top].name);
+}
+
+/*
+ * Serialize shredded subtree into XML text. Values of rows are copied to
+ * per-batch context which is reset after every fetch, only names of open
+ * elements are kept, so memory grows with depth, not with size of subtree.
+ * Document registered for lazy shredding is shredded first.
+ * @param did document
+ * @param pre_order root of subtree (element, attribute or text)
+ * @return XML text, NULL when node does not exist
+ */
+Datum
+serialize_subtree(PG_FUNCTION_ARGS)
+{
+	Oid			argtypes[2] = {INT8OID, INT8OID};
+	Datum		args[2];
+	StringInfoData buf;
+	Portal		portal;
+	MemoryContext batchcontext;
+	MemoryContext oldcontext;
+	open_element *stack;
+	int			stack_size = SERIALIZE_INITIAL_DEPTH;
+	int			top = 0;
+	bool		tag_open = false;
+	int64		nodes = 0;
+
+	args[0] = Int64GetDatum(PG_GETARG_INT64(0));
+	args[1] = Int64GetDatum(PG_GETARG_INT64(1));
+	ensure_document_shredded(PG_GETARG_INT64(0));
+
+	// result outlives SPI memory
+	initStringInfo(&buf);
+
+	SPI_connect();
+
+	stack = (open_element *) palloc(stack_size * sizeof(open_element));
+	batchcontext = AllocSetContextCreate(CurrentMemoryContext,
+			"serialize_subtree batch",
+			ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE,
+			ALLOCSET_DEFAULT_MAXSIZE);
+	portal = SPI_cursor_open_with_args(NULL, subtree_query(get_index_layout()),
+			2, argtypes, args, NULL, true, 0);
+
+	for (;;)
+	{
+		int			i;
+
+		SPI_cursor_fetch(portal, true, SERIALIZE_FETCH_SIZE);
+		if (SPI_processed == 0)
+		{
+			break;
+		}
+		oldcontext = MemoryContextSwitchTo(batchcontext);
+		for (i = 0; i < SPI_processed; i++)
+		{
+			HeapTuple	tuple = SPI_tuptable->vals[i];
+			TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+			bool		isnull;
+			int32		kind = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+			int64		pre_order = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+			int64		size = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+			char	   *name = SPI_getvalue(tuple, tupdesc, 4);
+			char	   *value = SPI_getvalue(tuple, tupdesc, 5);
+
+			nodes++;
+
+			// attribute of element written last
+			if (kind == NODE_KIND_ATTRIBUTE && tag_open)
+			{
+				appendStringInfo(&buf, " %s=\"", name);
+				if (value != NULL)
+				{
+					append_escaped(&buf, value, true);
+				}
+				appendStringInfoChar(&buf, '"');
+				continue;
+			}
+			if (tag_open)
+			{
+				// element without content is written as <name/>
+				if (stack[top - 1].high < pre_order)
+				{
+					top--;
+					pfree(stack[top].name);
+					appendStringInfoString(&buf, "/>");
+				} else
+				{
+					appendStringInfoChar(&buf, '>');
+				}
+				tag_open = false;
+			}
+
+			// close elements whose interval ends before this node
+			while (top > 0 && stack[top - 1].high < pre_order)
+			{
+				close_element(&buf, stack, &top);
+			}
+
+			if (kind == NODE_KIND_ELEMENT)
+			{
+				if (top == stack_size)
+				{
+					stack_size *= 2;
+					stack = (open_element *) repalloc(stack,
+							stack_size * sizeof(open_element));
+				}
+				stack[top].name = MemoryContextStrdup(oldcontext, name);
+				stack[top].high = pre_order + size;
+				top++;
+				appendStringInfo(&buf, "<%s", name);
+				tag_open = true;
+			} else if (value != NULL)
+			{
+				// attribute as root of subtree is its value
+				append_escaped(&buf, value, false);
+			}
+		}
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(batchcontext);
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	SPI_cursor_close(portal);
+	MemoryContextDelete(batchcontext);
+
+	if (tag_open)
+	{
+		top--;
+		pfree(stack[top].name);
+		appendStringInfoString(&buf, "/>");
+	}
+	while (top > 0)
+	{
+		close_element(&buf, stack, &top);
+	}
+
+	SPI_finish();
+
+	if (nodes == 0)
+	{
+		PG_RETURN_NULL();
+	}
+
+	PG_RETURN_TEXT_P(cstring_to_text_with_len(buf.data, buf.len));
+}
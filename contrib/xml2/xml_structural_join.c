@@ -0,0 +1,822 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_structural_join.c
+// desc:	Stack-Tree-Desc and Stack-Tree-Anc structural joins (Al-Khalifa
+//			et al., ICDE 2002). Both inputs are sorted by (did, pre_order),
+//			stack holds chain of nested ancestors of current position, so
+//			every input node is pushed and popped at most once and join
+//			runs in O(|ancestors| + |descendants| + |output|).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_structural_join.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+/* externally accessible functions */
+Datum	structural_join(PG_FUNCTION_ARGS);
+Datum	tag_join(PG_FUNCTION_ARGS);
+Datum	structural_join_stats(PG_FUNCTION_ARGS);
+Datum	structural_semijoin(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(structural_join);
+PG_FUNCTION_INFO_V1(tag_join);
+PG_FUNCTION_INFO_V1(structural_join_stats);
+PG_FUNCTION_INFO_V1(structural_semijoin);
+
+// counters of last join, shown by structural_join_stats()
+xml_join_stats xml_join_last_stats;
+
+// result pair waiting in list of Stack-Tree-Anc
+typedef struct join_pair join_pair;
+struct join_pair {
+	xml_join_node ancestor;
+	xml_join_node descendant;
+	join_pair  *next;
+};
+
+typedef struct join_pair_list join_pair_list;
+struct join_pair_list {
+	join_pair  *head;
+	join_pair  *tail;
+};
+
+typedef struct join_stack_entry join_stack_entry;
+struct join_stack_entry {
+	xml_join_node node;
+	join_pair_list self;		// pairs with this node as ancestor
+	join_pair_list inherit;		// pairs of popped descendants of this node
+};
+
+typedef struct join_stack join_stack;
+struct join_stack {
+	join_stack_entry *entries;
+	int			top;			// number of entries
+	int			max;
+};
+
+// state of structural_join SQL function
+typedef struct join_output join_output;
+struct join_output {
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+};
+
+static void
+stack_push(join_stack *stack, const xml_join_node *node, xml_join_stats *stats)
+{
+	join_stack_entry *entry;
+
+	if (stack->top == stack->max)
+	{
+		stack->max = stack->max == 0 ? 64 : stack->max * 2;
+		stack->entries = stack->entries == NULL ?
+				(join_stack_entry *) palloc(stack->max * sizeof(join_stack_entry)) :
+				(join_stack_entry *) repalloc(stack->entries,
+						stack->max * sizeof(join_stack_entry));
+	}
+
+	entry = &stack->entries[stack->top++];
+	entry->node = *node;
+	entry->self.head = entry->self.tail = NULL;
+	entry->inherit.head = entry->inherit.tail = NULL;
+	stats->pushes++;
+}
+
+static void
+list_append(join_pair_list *list, join_pair_list *other)
+{
+	if (other->head == NULL)
+	{
+		return;
+	}
+	if (list->head == NULL)
+	{
+		*list = *other;
+	} else
+	{
+		list->tail->next = other->head;
+		list->tail = other->tail;
+	}
+	other->head = other->tail = NULL;
+}
+
+static void
+list_emit(join_pair_list *list, xml_join_emit emit, void *emit_arg)
+{
+	join_pair  *pair = list->head;
+
+	while (pair != NULL)
+	{
+		join_pair  *next = pair->next;
+
+		emit(emit_arg, &pair->ancestor, &pair->descendant);
+		pfree(pair);
+		pair = next;
+	}
+	list->head = list->tail = NULL;
+}
+
+/*
+ * Pop top of stack. Stack-Tree-Anc lists go to new top, or to output when
+ * stack gets empty (nothing before them in ancestor order is pending).
+ */
+static void
+stack_pop(join_stack *stack, bool lists, xml_join_emit emit, void *emit_arg,
+		xml_join_stats *stats)
+{
+	join_stack_entry *entry = &stack->entries[--stack->top];
+
+	stats->pops++;
+	if (!lists)
+	{
+		return;
+	}
+
+	if (stack->top == 0)
+	{
+		list_emit(&entry->self, emit, emit_arg);
+		list_emit(&entry->inherit, emit, emit_arg);
+	} else
+	{
+		join_stack_entry *parent = &stack->entries[stack->top - 1];
+
+		list_append(&parent->inherit, &entry->self);
+		list_append(&parent->inherit, &entry->inherit);
+	}
+}
+
+/*
+ * Pop entries which don't contain node
+ */
+static void
+stack_pop_to(join_stack *stack, const xml_join_node *node, bool lists,
+		xml_join_emit emit, void *emit_arg, xml_join_stats *stats)
+{
+	while (stack->top > 0 &&
+			!XML_JOIN_CONTAINS(&stack->entries[stack->top - 1].node, node))
+	{
+		stack_pop(stack, lists, emit, emit_arg, stats);
+	}
+}
+
+/*
+ * Entry of stack with given depth, entries are nested, so depth grows
+ * from bottom to top and binary search is enough
+ * @return index of entry or -1
+ */
+static int
+stack_find_depth(join_stack *stack, int depth)
+{
+	int			low = 0;
+	int			high = stack->top - 1;
+
+	while (low <= high)
+	{
+		int			middle = (low + high) / 2;
+		int			found = stack->entries[middle].node.depth;
+
+		if (found == depth)
+		{
+			return middle;
+		}
+		if (found < depth)
+		{
+			low = middle + 1;
+		} else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Both variants share the merge, they differ in what is done with pairs
+ */
+static int64
+stack_tree_join(xml_join_next next_ancestor, void *ancestors,
+		xml_join_next next_descendant, void *descendants, int level,
+		bool by_ancestor, xml_join_emit emit, void *emit_arg,
+		xml_join_stats *stats)
+{
+	join_stack	stack;
+	xml_join_node ancestor;
+	xml_join_node descendant;
+	bool		has_ancestor;
+	bool		has_descendant;
+	xml_join_stats local_stats;
+	int64		matches = 0;
+
+	if (stats == NULL)
+	{
+		stats = &local_stats;
+	}
+	memset(stats, 0, sizeof(xml_join_stats));
+	memset(&stack, 0, sizeof(stack));
+
+	has_ancestor = next_ancestor(ancestors, &ancestor);
+	has_descendant = next_descendant(descendants, &descendant);
+
+	while (has_descendant && (has_ancestor || stack.top > 0))
+	{
+		if (has_ancestor && (ancestor.did < descendant.did ||
+				(ancestor.did == descendant.did &&
+				 ancestor.pre_order < descendant.pre_order)))
+		{
+			stack_pop_to(&stack, &ancestor, by_ancestor, emit, emit_arg, stats);
+			stack_push(&stack, &ancestor, stats);
+			has_ancestor = next_ancestor(ancestors, &ancestor);
+			continue;
+		}
+
+		stack_pop_to(&stack, &descendant, by_ancestor, emit, emit_arg, stats);
+
+		if (stack.top > 0)
+		{
+			int			first = 0;
+			int			last = stack.top - 1;
+			int			i;
+
+			if (level > 0)
+			{
+				first = last = stack_find_depth(&stack, descendant.depth - level);
+			}
+
+			for (i = first; i >= 0 && i <= last; i++)
+			{
+				join_stack_entry *entry = &stack.entries[i];
+
+				matches++;
+				if (by_ancestor)
+				{
+					join_pair  *pair = (join_pair *) palloc(sizeof(join_pair));
+
+					pair->ancestor = entry->node;
+					pair->descendant = descendant;
+					pair->next = NULL;
+					if (entry->self.head == NULL)
+					{
+						entry->self.head = pair;
+					} else
+					{
+						entry->self.tail->next = pair;
+					}
+					entry->self.tail = pair;
+				} else
+				{
+					emit(emit_arg, &entry->node, &descendant);
+				}
+			}
+		}
+
+		has_descendant = next_descendant(descendants, &descendant);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	// pending lists of Stack-Tree-Anc
+	while (stack.top > 0)
+	{
+		stack_pop(&stack, by_ancestor, emit, emit_arg, stats);
+	}
+
+	if (stack.entries != NULL)
+	{
+		pfree(stack.entries);
+	}
+
+	stats->matches = matches;
+
+	return matches;
+}
+
+int64
+stack_tree_desc(xml_join_next next_ancestor, void *ancestors,
+		xml_join_next next_descendant, void *descendants, int level,
+		xml_join_emit emit, void *emit_arg, xml_join_stats *stats)
+{
+	return stack_tree_join(next_ancestor, ancestors, next_descendant,
+			descendants, level, false, emit, emit_arg, stats);
+}
+
+int64
+stack_tree_anc(xml_join_next next_ancestor, void *ancestors,
+		xml_join_next next_descendant, void *descendants, int level,
+		xml_join_emit emit, void *emit_arg, xml_join_stats *stats)
+{
+	return stack_tree_join(next_ancestor, ancestors, next_descendant,
+			descendants, level, true, emit, emit_arg, stats);
+}
+
+/*
+ * Column of stream as 64 bit label, shredded tables use int or bigint
+ */
+static xml_label
+spi_label(HeapTuple tuple, TupleDesc tupdesc, int column, const char *name)
+{
+	bool		isnull;
+	Datum		value = SPI_getbinval(tuple, tupdesc, column, &isnull);
+
+	if (isnull)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("%s stream contains NULL in column %d", name, column)));
+	}
+
+	switch (SPI_gettypeid(tupdesc, column))
+	{
+		case INT2OID:
+			return DatumGetInt16(value);
+		case INT4OID:
+			return DatumGetInt32(value);
+		case INT8OID:
+			return DatumGetInt64(value);
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("column %d of %s stream must be integer", column, name)));
+	}
+
+	return 0;
+}
+
+/*
+ * Open stream, query returns did, pre_order, size, depth
+ */
+void
+xml_join_spi_open(xml_join_spi_stream *stream, const char *query,
+		const char *name)
+{
+	SPIPlanPtr	plan;
+
+	memset(stream, 0, sizeof(xml_join_spi_stream));
+	stream->name = name;
+
+	plan = SPI_prepare(query, 0, NULL);
+	if (plan == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("invalid query of %s stream", name)));
+	}
+
+	// not read only, rows of documents shredded lazily by caller are visible
+	stream->portal = SPI_cursor_open(NULL, plan, NULL, NULL, false);
+	if (stream->portal->tupDesc == NULL || stream->portal->tupDesc->natts < 4)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("query of %s stream must return did, pre_order, size, depth",
+						name)));
+	}
+}
+
+bool
+xml_join_spi_next(void *arg, xml_join_node *node)
+{
+	xml_join_spi_stream *stream = (xml_join_spi_stream *) arg;
+	HeapTuple	tuple;
+	TupleDesc	tupdesc;
+
+	if (stream->postings != NULL)
+	{
+		return xml_join_postings_next(stream, node);
+	}
+	if (stream->done)
+	{
+		return false;
+	}
+
+	if (stream->batch == NULL || stream->position >= stream->count)
+	{
+		if (stream->batch != NULL)
+		{
+			SPI_freetuptable(stream->batch);
+			stream->batch = NULL;
+		}
+
+		SPI_cursor_fetch(stream->portal, true, XML_JOIN_BATCH_SIZE);
+		if (SPI_processed == 0)
+		{
+			stream->done = true;
+			return false;
+		}
+		stream->batch = SPI_tuptable;
+		stream->count = SPI_processed;
+		stream->position = 0;
+	}
+
+	tuple = stream->batch->vals[stream->position++];
+	tupdesc = stream->batch->tupdesc;
+
+	node->did = spi_label(tuple, tupdesc, 1, stream->name);
+	node->pre_order = spi_label(tuple, tupdesc, 2, stream->name);
+	node->size = spi_label(tuple, tupdesc, 3, stream->name);
+	node->depth = (int) spi_label(tuple, tupdesc, 4, stream->name);
+
+	// merge is correct only for sorted input
+	if (stream->started && (node->did < stream->last.did ||
+			(node->did == stream->last.did &&
+			 node->pre_order < stream->last.pre_order)))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("%s stream is not ordered by did, pre_order", stream->name)));
+	}
+	stream->last = *node;
+	stream->started = true;
+
+	return true;
+}
+
+void
+xml_join_spi_close(xml_join_spi_stream *stream)
+{
+	if (stream->batch != NULL)
+	{
+		SPI_freetuptable(stream->batch);
+		stream->batch = NULL;
+	}
+	SPI_cursor_close(stream->portal);
+}
+
+static void
+emit_tuple(void *arg, const xml_join_node *ancestor,
+		const xml_join_node *descendant)
+{
+	join_output *output = (join_output *) arg;
+	Datum		values[3];
+	bool		nulls[3] = {false, false, false};
+
+	values[0] = Int64GetDatum(ancestor->did);
+	values[1] = Int64GetDatum(ancestor->pre_order);
+	values[2] = Int64GetDatum(descendant->pre_order);
+
+	tuplestore_putvalues(output->tupstore, output->tupdesc, values, nulls);
+}
+
+/*
+ * Check call of join SRF and create its tuplestore
+ */
+static void
+begin_join_output(FunctionCallInfo fcinfo, int level, join_output *output)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+			!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	}
+	if (level < 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("level of structural join must not be negative")));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+	output->tupdesc = CreateTupleDescCopy(tupdesc);
+	output->tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+			false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Join opened streams into output, close them and finish SPI
+ */
+static Datum
+finish_join_output(FunctionCallInfo fcinfo, join_output *output,
+		xml_join_spi_stream *ancestors, xml_join_spi_stream *descendants,
+		int level, bool by_ancestor)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+	if (by_ancestor)
+	{
+		stack_tree_anc(xml_join_spi_next, ancestors,
+				xml_join_spi_next, descendants, level,
+				emit_tuple, output, &xml_join_last_stats);
+	} else
+	{
+		stack_tree_desc(xml_join_spi_next, ancestors,
+				xml_join_spi_next, descendants, level,
+				emit_tuple, output, &xml_join_last_stats);
+	}
+
+	xml_join_spi_close(ancestors);
+	xml_join_spi_close(descendants);
+
+	SPI_finish();
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = output->tupstore;
+	rsinfo->setDesc = output->tupdesc;
+
+	return (Datum) 0;
+}
+
+/*
+ * Structural join of two node streams. Queries can read any document, so
+ * all documents registered for lazy shredding are shredded first, use
+ * tag_join or twig_join with range of did to shred only part of collection.
+ * @param ancestors query returning (did, pre_order, size, depth) ordered
+ *		by did, pre_order
+ * @param descendants query of the same shape
+ * @param level 0 ancestor/descendant, 1 parent/child, k exact difference
+ *		of depth
+ * @param by_ancestor output ordered by ancestor (Stack-Tree-Anc) instead
+ *		of by descendant (Stack-Tree-Desc)
+ * @return set of (did, ancestor, descendant)
+ */
+Datum
+structural_join(PG_FUNCTION_ARGS)
+{
+	char	   *ancestors_query = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char	   *descendants_query = text_to_cstring(PG_GETARG_TEXT_P(1));
+	int			level = PG_GETARG_INT32(2);
+	bool		by_ancestor = PG_GETARG_BOOL(3);
+	xml_join_spi_stream ancestors;
+	xml_join_spi_stream descendants;
+	join_output output;
+
+	begin_join_output(fcinfo, level, &output);
+
+	ensure_documents_shredded(XML_LABEL_MIN, XML_LABEL_MAX);
+
+	SPI_connect();
+
+	xml_join_spi_open(&ancestors, ancestors_query, "ancestor");
+	xml_join_spi_open(&descendants, descendants_query, "descendant");
+
+	return finish_join_output(fcinfo, &output, &ancestors, &descendants,
+			level, by_ancestor);
+}
+
+/*
+ * Open stream of elements with tag, from posting list when it exists
+ */
+static void
+open_tag_stream(xml_join_spi_stream *stream, const char *tag, bool postings,
+		int layout, xml_label did_from, xml_label did_to)
+{
+	StringInfoData query;
+
+	if (postings)
+	{
+		xml_join_postings_open(stream, tag, did_from, did_to);
+		return;
+	}
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"SELECT did, pre_order, size, depth FROM %s AND name = %s "
+			"AND did BETWEEN " INT64_FORMAT " AND " INT64_FORMAT " "
+			"ORDER BY did, pre_order",
+			layout == LAYOUT_UNIFIED ? "node_table WHERE kind = 1" :
+					"element_table WHERE true",
+			quote_literal_cstr(tag), did_from, did_to);
+	xml_join_spi_open(stream, query.data, tag);
+}
+
+/*
+ * Structural join of elements of two tags, composable replacement of
+ * structural_join with queries. Range of did splits join into independent
+ * parts which can run in separate sessions.
+ * @param ancestor tag of ancestors
+ * @param descendant tag of descendants
+ * @param level 0 ancestor/descendant, 1 parent/child, k exact difference
+ *		of depth
+ * @param by_ancestor output ordered by ancestor
+ * @param did_from first document of range
+ * @param did_to last document of range
+ * @return set of (did, ancestor, descendant)
+ */
+Datum
+tag_join(PG_FUNCTION_ARGS)
+{
+	char	   *ancestor_tag = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char	   *descendant_tag = text_to_cstring(PG_GETARG_TEXT_P(1));
+	int			level = PG_GETARG_INT32(2);
+	bool		by_ancestor = PG_GETARG_BOOL(3);
+	xml_label	did_from = PG_GETARG_INT64(4);
+	xml_label	did_to = PG_GETARG_INT64(5);
+	xml_join_spi_stream ancestors;
+	xml_join_spi_stream descendants;
+	join_output output;
+	bool		postings;
+	int			layout;
+
+	begin_join_output(fcinfo, level, &output);
+
+	ensure_documents_shredded(did_from, did_to);
+
+	postings = xml_postings_enabled();
+	layout = get_index_layout();
+
+	SPI_connect();
+
+	open_tag_stream(&ancestors, ancestor_tag, postings, layout, did_from, did_to);
+	open_tag_stream(&descendants, descendant_tag, postings, layout, did_from, did_to);
+
+	return finish_join_output(fcinfo, &output, &ancestors, &descendants,
+			level, by_ancestor);
+}
+
+/*
+ * Add ancestor to sorted disjoint intervals, nested ancestor (and leaf)
+ * covers no more descendants
+ */
+static void
+add_semijoin_interval(xml_join_interval **intervals, int *count, int *max,
+		const xml_join_node *ancestor, xml_join_stats *stats)
+{
+	xml_join_interval *last = *count > 0 ? &(*intervals)[*count - 1] : NULL;
+
+	if (ancestor->size <= 0 || (last != NULL && last->did == ancestor->did &&
+			ancestor->pre_order <= last->high))
+	{
+		return;
+	}
+
+	if (*count == *max)
+	{
+		*max *= 2;
+		*intervals = (xml_join_interval *) repalloc(*intervals,
+				*max * sizeof(xml_join_interval));
+	}
+	last = &(*intervals)[(*count)++];
+	last->did = ancestor->did;
+	last->low = ancestor->pre_order + 1;
+	last->high = ancestor->pre_order + ancestor->size;
+	stats->pushes++;
+}
+
+/*
+ * Structural semi-join, descendants which have some ancestor. Descendants
+ * are tested in blocks by containment kernel against outermost ancestors
+ * buffered up to the end of block. As structural_join, it shreds all
+ * documents registered for lazy shredding first.
+ * @param ancestors query returning (did, pre_order, size, depth) ordered
+ *		by did, pre_order
+ * @param descendants query of the same shape
+ * @return set of (did, pre_order) of descendants in document order
+ */
+Datum
+structural_semijoin(PG_FUNCTION_ARGS)
+{
+	char	   *ancestors_query = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char	   *descendants_query = text_to_cstring(PG_GETARG_TEXT_P(1));
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	xml_join_spi_stream ancestors;
+	xml_join_spi_stream descendants;
+	join_output output;
+	xml_join_node ancestor;
+	xml_join_node descendant;
+	bool		has_ancestor;
+	bool		has_descendant;
+	xml_join_interval *intervals;
+	int			nintervals = 0;
+	int			max_intervals = XML_CONTAIN_BLOCK;
+	xml_label	dids[XML_CONTAIN_BLOCK];
+	xml_label	pres[XML_CONTAIN_BLOCK];
+	int			positions[XML_CONTAIN_BLOCK];
+	xml_join_stats *stats = &xml_join_last_stats;
+
+	begin_join_output(fcinfo, 0, &output);
+	memset(stats, 0, sizeof(xml_join_stats));
+
+	ensure_documents_shredded(XML_LABEL_MIN, XML_LABEL_MAX);
+
+	SPI_connect();
+
+	xml_join_spi_open(&ancestors, ancestors_query, "ancestor");
+	xml_join_spi_open(&descendants, descendants_query, "descendant");
+
+	intervals = (xml_join_interval *) palloc(max_intervals * sizeof(xml_join_interval));
+	has_ancestor = xml_join_spi_next(&ancestors, &ancestor);
+	has_descendant = xml_join_spi_next(&descendants, &descendant);
+
+	while (has_descendant && (has_ancestor || nintervals > 0))
+	{
+		int			count = 0;
+		int			first = 0;
+		int			matches;
+		int			i;
+
+		while (has_descendant && count < XML_CONTAIN_BLOCK)
+		{
+			dids[count] = descendant.did;
+			pres[count] = descendant.pre_order;
+			count++;
+			has_descendant = xml_join_spi_next(&descendants, &descendant);
+		}
+
+		// intervals of previous blocks ending before this block
+		while (first < nintervals && (intervals[first].did < dids[0] ||
+				(intervals[first].did == dids[0] && intervals[first].high < pres[0])))
+		{
+			first++;
+		}
+		if (first > 0)
+		{
+			nintervals -= first;
+			memmove(intervals, intervals + first, nintervals * sizeof(xml_join_interval));
+			stats->pops += first;
+		}
+
+		// ancestors starting before last descendant of block, those ending
+		// before block are not buffered, so buffer holds only intervals
+		// overlapping the block
+		while (has_ancestor && (ancestor.did < dids[count - 1] ||
+				(ancestor.did == dids[count - 1] && ancestor.pre_order < pres[count - 1])))
+		{
+			if (ancestor.did > dids[0] || (ancestor.did == dids[0] &&
+					ancestor.pre_order + ancestor.size >= pres[0]))
+			{
+				add_semijoin_interval(&intervals, &nintervals, &max_intervals,
+						&ancestor, stats);
+			}
+			has_ancestor = xml_join_spi_next(&ancestors, &ancestor);
+		}
+
+		matches = xml_mask_positions(xml_contain_block(dids, pres, count,
+				intervals, nintervals), positions);
+		for (i = 0; i < matches; i++)
+		{
+			Datum		values[2];
+			bool		nulls[2] = {false, false};
+
+			values[0] = Int64GetDatum(dids[positions[i]]);
+			values[1] = Int64GetDatum(pres[positions[i]]);
+			tuplestore_putvalues(output.tupstore, output.tupdesc, values, nulls);
+		}
+		stats->matches += matches;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	pfree(intervals);
+	xml_join_spi_close(&ancestors);
+	xml_join_spi_close(&descendants);
+
+	SPI_finish();
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = output.tupstore;
+	rsinfo->setDesc = output.tupdesc;
+
+	return (Datum) 0;
+}
+
+/*
+ * Counters of last structural or twig join of session
+ * @return (pushes, pops, matches)
+ */
+Datum
+structural_join_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[3];
+	bool		nulls[3] = {false, false, false};
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	values[0] = Int64GetDatum(xml_join_last_stats.pushes);
+	values[1] = Int64GetDatum(xml_join_last_stats.pops);
+	values[2] = Int64GetDatum(xml_join_last_stats.matches);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
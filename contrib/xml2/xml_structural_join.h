@@ -0,0 +1,197 @@
+/*
+ * File:   xml_structural_join.h
+ * Author: Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+ *
+ * Structural joins over (did, pre_order)-sorted streams of shredded nodes.
+ * Node a is ancestor of d when they are in the same document and
+ * a.pre_order < d.pre_order <= a.pre_order + a.size.
+ */
+
+#ifndef XML_STRUCTURAL_JOIN_H
+#define	XML_STRUCTURAL_JOIN_H
+
+#include "postgres.h"
+#include "xml_index_loader.h"
+#include "executor/spi.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// one node of input stream
+typedef struct xml_join_node xml_join_node;
+struct xml_join_node {
+	xml_label	did;
+	xml_label	pre_order;
+	xml_label	size;
+	int			depth;
+};
+
+// returns false at end of stream
+typedef bool (*xml_join_next)(void *arg, xml_join_node *node);
+// called for every matching (ancestor, descendant) pair
+typedef void (*xml_join_emit)(void *arg, const xml_join_node *ancestor,
+		const xml_join_node *descendant);
+
+// counters of one join, for EXPLAIN and benchmarks
+typedef struct xml_join_stats xml_join_stats;
+struct xml_join_stats {
+	int64		pushes;
+	int64		pops;
+	int64		matches;
+};
+
+// counters of last join of session, for structural_join_stats()
+extern xml_join_stats xml_join_last_stats;
+
+/*
+ * Input stream read by SPI cursor from query returning
+ * (did, pre_order, size, depth) ordered by did, pre_order
+ */
+typedef struct xml_join_spi_stream xml_join_spi_stream;
+struct xml_join_spi_stream {
+	Portal		portal;
+	SPITupleTable *batch;
+	int			position;
+	int			count;
+	bool		done;
+	bool		started;
+	xml_join_node last;		// for order check
+	const char *name;		// for error messages
+	xml_join_node *postings;	// decoded block, NULL for query stream
+	int			posting_position;
+	int			posting_count;
+	xml_label	did_from;		// range of documents of posting stream
+	xml_label	did_to;
+};
+
+#define XML_JOIN_BATCH_SIZE 1000
+
+// is ancestor ancestor of descendant
+#define XML_JOIN_CONTAINS(ancestor, descendant) \
+	((ancestor)->did == (descendant)->did && \
+	 (ancestor)->pre_order < (descendant)->pre_order && \
+	 (descendant)->pre_order <= (ancestor)->pre_order + (ancestor)->size)
+
+/*
+ * Stack-Tree-Desc, output ordered by descendant
+ * @param level 0 for ancestor/descendant, 1 for parent/child, k for nodes
+ *		exactly k levels below ancestor
+ * @return number of matches
+ */
+int64 stack_tree_desc(xml_join_next next_ancestor, void *ancestors,
+		xml_join_next next_descendant, void *descendants, int level,
+		xml_join_emit emit, void *emit_arg, xml_join_stats *stats);
+
+/*
+ * Stack-Tree-Anc, output ordered by ancestor, then by descendant
+ */
+int64 stack_tree_anc(xml_join_next next_ancestor, void *ancestors,
+		xml_join_next next_descendant, void *descendants, int level,
+		xml_join_emit emit, void *emit_arg, xml_join_stats *stats);
+
+// holistic twig join (TwigStack)
+#define TWIG_MAX_NODES 32
+
+// value comparison of query node, for elements with text child
+typedef enum twig_compare {
+	TWIG_COMPARE_NONE = 0,
+	TWIG_COMPARE_EQ,
+	TWIG_COMPARE_NE,
+	TWIG_COMPARE_LT,
+	TWIG_COMPARE_LE,
+	TWIG_COMPARE_GT,
+	TWIG_COMPARE_GE
+} twig_compare;
+
+// query node of twig pattern, nodes are numbered in order of pattern text
+typedef struct twig_node twig_node;
+struct twig_node {
+	int			parent;			// -1 for root
+	bool		child_axis;		// '/' to parent, for root absolute path
+	bool		attribute;
+	char	   *name;			// NULL for *
+	twig_compare compare;
+	char	   *literal;
+	bool		numeric;		// literal is number, compare as numeric
+	int			children[TWIG_MAX_NODES];
+	int			nchildren;
+};
+
+typedef struct twig_pattern twig_pattern;
+struct twig_pattern {
+	twig_node	nodes[TWIG_MAX_NODES];
+	int			count;
+};
+
+// called for every twig match, nodes are pre_orders in pattern order
+typedef void (*xml_twig_emit)(void *arg, xml_label did, const xml_label *nodes,
+		int count);
+
+/*
+ * Parse pattern like //order[customer/@vip='y']//item[price>100]
+ */
+void twig_parse(const char *text, twig_pattern *pattern);
+
+/*
+ * Query of stream of one query node, for given layout of shredded tables
+ */
+char *twig_stream_query(const twig_pattern *pattern, int node, int layout,
+		xml_label did_from, xml_label did_to);
+
+/*
+ * TwigStack, one (did, pre_order)-sorted stream per query node
+ * @return number of twig matches
+ */
+int64 twig_stack(const twig_pattern *pattern, xml_join_next next,
+		void **streams, xml_twig_emit emit, void *emit_arg,
+		xml_join_stats *stats);
+
+// batch containment kernel, implemented in xml_containment.c
+#define XML_CONTAIN_BLOCK 64
+
+// descendants of ancestor a are interval (a.did, a.pre_order + 1,
+// a.pre_order + a.size)
+typedef struct xml_join_interval xml_join_interval;
+struct xml_join_interval {
+	xml_label	did;
+	xml_label	low;
+	xml_label	high;
+};
+
+/*
+ * Bit mask of nodes of block (at most XML_CONTAIN_BLOCK, in document order)
+ * contained in some of sorted disjoint intervals; vectorized when compiled
+ * for AVX2 or SSE4.2, SSE2 kernel only with -DXML_CONTAIN_SSE2
+ */
+uint64 xml_contain_block(const xml_label *dids, const xml_label *pres,
+		int count, const xml_join_interval *intervals, int nintervals);
+uint64 xml_contain_block_scalar(const xml_label *dids, const xml_label *pres,
+		int count, const xml_join_interval *intervals, int nintervals);
+const char *xml_contain_kernel(void);
+// compacted positions of set bits, returns their number
+int xml_mask_positions(uint64 mask, int *positions);
+
+// SPI stream, caller has to be connected to SPI
+void xml_join_spi_open(xml_join_spi_stream *stream, const char *query,
+		const char *name);
+bool xml_join_spi_next(void *arg, xml_join_node *node);
+void xml_join_spi_close(xml_join_spi_stream *stream);
+
+// per-tag posting lists, implemented in xml_postings.c
+#define XML_POSTINGS_BLOCK_SIZE 128
+
+bytea *xml_postings_encode(const xml_join_node *nodes, int count);
+void xml_postings_decode(const bytea *data, xml_label first_did,
+		xml_label first_pre, int count, xml_join_node *nodes);
+// stream of posting list of tag in range of documents, read by
+// xml_join_spi_next
+void xml_join_postings_open(xml_join_spi_stream *stream, const char *name,
+		xml_label did_from, xml_label did_to);
+bool xml_join_postings_next(xml_join_spi_stream *stream, xml_join_node *node);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* XML_STRUCTURAL_JOIN_H */
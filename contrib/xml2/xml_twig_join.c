@@ -0,0 +1,1104 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_twig_join.c
+// desc:	Holistic twig join TwigStack (Bruno, Koudas, Srivastava, SIGMOD
+//			2002). Every query node of pattern reads own (did, pre_order)
+//			sorted stream, node is pushed on its stack only when it can
+//			be part of a match, so only root-to-leaf path solutions which
+//			are part of some twig match are produced (for ancestor-
+//			descendant edges). Path solutions of one document are merged
+//			into twig matches when all streams left the document.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_structural_join.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#include <ctype.h>
+
+/* externally accessible functions */
+Datum	twig_join(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(twig_join);
+
+typedef struct twig_parser twig_parser;
+struct twig_parser {
+	const char *text;
+	const char *pos;
+	twig_pattern *pattern;
+};
+
+// node on stack of query node, ptr is top of parent stack at push time
+typedef struct twig_entry twig_entry;
+struct twig_entry {
+	xml_join_node node;
+	int			ptr;
+};
+
+typedef struct twig_query_state twig_query_state;
+struct twig_query_state {
+	xml_join_node cur;
+	bool		eof;
+	twig_entry *stack;
+	int			top;
+	int			max;
+	// only leaves: query nodes from root to leaf and their path solutions,
+	// rows of (did, pre_order of every query node or -1)
+	int			path[TWIG_MAX_NODES];
+	int			path_length;
+	xml_label  *solutions;
+	int64		nsolutions;
+	int64		max_solutions;
+};
+
+typedef struct twig_state twig_state;
+struct twig_state {
+	const twig_pattern *pattern;
+	twig_query_state q[TWIG_MAX_NODES];
+	int			leaves[TWIG_MAX_NODES];
+	int			nleaves;
+	int			width;			// columns of solution row
+	xml_join_next next;
+	void	  **streams;
+	xml_twig_emit emit;
+	void	   *emit_arg;
+	xml_join_stats *stats;
+	bool		buffered;		// some path solutions wait for merge
+	xml_label	buffered_did;	// highest did of them
+	int64		matches;
+};
+
+// state of twig_join SQL function
+typedef struct twig_output twig_output;
+struct twig_output {
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+};
+
+// columns compared by sort of solution rows, qsort has no argument
+static int *sort_columns;
+static int sort_ncolumns;
+
+static void
+parse_error(twig_parser *parser, const char *message)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_SYNTAX_ERROR),
+			 errmsg("invalid twig pattern \"%s\"", parser->text),
+			 errdetail("%s at position %d.", message,
+					(int) (parser->pos - parser->text) + 1)));
+}
+
+static bool
+accept(twig_parser *parser, const char *token)
+{
+	int			len = strlen(token);
+
+	while (isspace((unsigned char) *parser->pos))
+	{
+		parser->pos++;
+	}
+	if (strncmp(parser->pos, token, len) == 0)
+	{
+		parser->pos += len;
+		return true;
+	}
+
+	return false;
+}
+
+static bool
+is_name_char(char c, bool first)
+{
+	return isalpha((unsigned char) c) || c == '_' || (unsigned char) c >= 0x80 ||
+			(!first && (isdigit((unsigned char) c) || c == '-' || c == '.' ||
+					c == ':'));
+}
+
+static char *
+parse_name(twig_parser *parser)
+{
+	const char *start = parser->pos;
+
+	if (!is_name_char(*parser->pos, true))
+	{
+		parse_error(parser, "name expected");
+	}
+	while (is_name_char(*parser->pos, false))
+	{
+		parser->pos++;
+	}
+
+	return pnstrdup(start, parser->pos - start);
+}
+
+static char *
+parse_literal(twig_parser *parser, bool *numeric)
+{
+	const char *start;
+	char		quote;
+
+	while (isspace((unsigned char) *parser->pos))
+	{
+		parser->pos++;
+	}
+
+	quote = *parser->pos;
+	if (quote == '\'' || quote == '"')
+	{
+		start = ++parser->pos;
+		while (*parser->pos != quote)
+		{
+			if (*parser->pos == '\0')
+			{
+				parse_error(parser, "unterminated string");
+			}
+			parser->pos++;
+		}
+		*numeric = false;
+		return pnstrdup(start, parser->pos++ - start);
+	}
+
+	// number, it goes to SQL as it is, so only digits are accepted
+	start = parser->pos;
+	if (*parser->pos == '-' || *parser->pos == '+')
+	{
+		parser->pos++;
+	}
+	if (!isdigit((unsigned char) *parser->pos))
+	{
+		parse_error(parser, "string or number expected");
+	}
+	while (isdigit((unsigned char) *parser->pos))
+	{
+		parser->pos++;
+	}
+	if (*parser->pos == '.')
+	{
+		parser->pos++;
+		while (isdigit((unsigned char) *parser->pos))
+		{
+			parser->pos++;
+		}
+	}
+	*numeric = true;
+
+	return pnstrdup(start, parser->pos - start);
+}
+
+static int
+add_node(twig_parser *parser, int parent, bool child_axis)
+{
+	twig_pattern *pattern = parser->pattern;
+	twig_node  *node;
+
+	if (pattern->count == TWIG_MAX_NODES)
+	{
+		parse_error(parser, "too many query nodes");
+	}
+	if (parent >= 0 && pattern->nodes[parent].attribute)
+	{
+		parse_error(parser, "attribute can't have children");
+	}
+
+	node = &pattern->nodes[pattern->count];
+	memset(node, 0, sizeof(twig_node));
+	node->parent = parent;
+	node->child_axis = child_axis;
+	if (parent >= 0)
+	{
+		twig_node  *up = &pattern->nodes[parent];
+
+		up->children[up->nchildren++] = pattern->count;
+	}
+
+	return pattern->count++;
+}
+
+static int parse_steps(twig_parser *parser, int parent, bool child_axis);
+
+/*
+ * Predicate [relative/path] or [relative/path op literal]
+ */
+static void
+parse_predicate(twig_parser *parser, int node)
+{
+	static const char *const operators[] = {"!=", "<=", ">=", "=", "<", ">"};
+	static const twig_compare compares[] = {TWIG_COMPARE_NE, TWIG_COMPARE_LE,
+			TWIG_COMPARE_GE, TWIG_COMPARE_EQ, TWIG_COMPARE_LT, TWIG_COMPARE_GT};
+	bool		child_axis = true;
+	int			last;
+	int			i;
+
+	if (accept(parser, ".//"))
+	{
+		child_axis = false;
+	} else
+	{
+		accept(parser, "./");
+	}
+
+	last = parse_steps(parser, node, child_axis);
+
+	for (i = 0; i < lengthof(operators); i++)
+	{
+		if (accept(parser, operators[i]))
+		{
+			twig_node  *target = &parser->pattern->nodes[last];
+
+			target->compare = compares[i];
+			target->literal = parse_literal(parser, &target->numeric);
+			break;
+		}
+	}
+}
+
+static int
+parse_step(twig_parser *parser, int parent, bool child_axis)
+{
+	bool		attribute = accept(parser, "@");
+	char	   *name = NULL;
+	int			node;
+
+	if (!accept(parser, "*"))
+	{
+		name = parse_name(parser);
+	}
+
+	node = add_node(parser, parent, child_axis);
+	parser->pattern->nodes[node].attribute = attribute;
+	parser->pattern->nodes[node].name = name;
+
+	while (accept(parser, "["))
+	{
+		parse_predicate(parser, node);
+		if (!accept(parser, "]"))
+		{
+			parse_error(parser, "\"]\" expected");
+		}
+	}
+
+	return node;
+}
+
+/*
+ * Steps separated by / or //, first step has given axis
+ * @return last step
+ */
+static int
+parse_steps(twig_parser *parser, int parent, bool child_axis)
+{
+	int			node = parse_step(parser, parent, child_axis);
+
+	for (;;)
+	{
+		if (accept(parser, "//"))
+		{
+			node = parse_step(parser, node, false);
+		} else if (accept(parser, "/"))
+		{
+			node = parse_step(parser, node, true);
+		} else
+		{
+			break;
+		}
+	}
+
+	return node;
+}
+
+/*
+ * Parse twig pattern, subset of XPath: steps with child (/) and descendant
+ * (//) axis, name tests (name, *, @name, @*) and predicates with relative
+ * paths optionally compared with string or number
+ * @param text pattern
+ * @param pattern (out) query nodes in order of pattern text
+ */
+void
+twig_parse(const char *text, twig_pattern *pattern)
+{
+	twig_parser parser;
+
+	parser.text = text;
+	parser.pos = text;
+	parser.pattern = pattern;
+	pattern->count = 0;
+
+	if (accept(&parser, "//"))
+	{
+		parse_steps(&parser, -1, false);
+	} else if (accept(&parser, "/"))
+	{
+		parse_steps(&parser, -1, true);
+	} else
+	{
+		parse_steps(&parser, -1, false);
+	}
+
+	if (accept(&parser, "") && *parser.pos != '\0')
+	{
+		parse_error(&parser, "unexpected character");
+	}
+	if (pattern->nodes[0].attribute && pattern->count > 1)
+	{
+		parse_error(&parser, "attribute can't have children");
+	}
+}
+
+/*
+ * Comparison of SQL expression with literal of query node, numeric
+ * comparison skips values which are not numbers instead of failing
+ */
+static void
+append_compare(StringInfo query, const twig_node *node, const char *expr)
+{
+	static const char *const operators[] = {"", "=", "<>", "<", "<=", ">", ">="};
+
+	if (node->numeric)
+	{
+		appendStringInfo(query,
+				"(CASE WHEN %s ~ '^[[:space:]]*[-+]?[0-9]+([.][0-9]*)?[[:space:]]*$' "
+				"THEN (%s)::numeric END) %s %s",
+				expr, expr, operators[node->compare], node->literal);
+	} else
+	{
+		appendStringInfo(query, "%s %s %s", expr, operators[node->compare],
+				quote_literal_cstr(node->literal));
+	}
+}
+
+/*
+ * Query returning (did, pre_order, size, depth) of nodes matching query
+ * node alone in documents did_from .. did_to, ordered by did, pre_order
+ */
+char *
+twig_stream_query(const twig_pattern *pattern, int index, int layout,
+		xml_label did_from, xml_label did_to)
+{
+	const twig_node *node = &pattern->nodes[index];
+	StringInfoData query;
+
+	initStringInfo(&query);
+	if (layout == LAYOUT_UNIFIED)
+	{
+		appendStringInfo(&query,
+				"SELECT n.did, n.pre_order, n.size, n.depth FROM node_table n "
+				"WHERE n.kind = %d",
+				node->attribute ? NODE_KIND_ATTRIBUTE : NODE_KIND_ELEMENT);
+	} else
+	{
+		appendStringInfo(&query,
+				"SELECT n.did, n.pre_order, n.size, n.depth FROM %s n WHERE true",
+				node->attribute ? "attribute_table" : "element_table");
+	}
+
+	if (node->name != NULL)
+	{
+		appendStringInfo(&query, " AND n.name = %s",
+				quote_literal_cstr(node->name));
+	}
+	appendStringInfo(&query,
+			" AND n.did BETWEEN " INT64_FORMAT " AND " INT64_FORMAT,
+			did_from, did_to);
+	// absolute path starts at document element
+	if (node->parent < 0 && node->child_axis)
+	{
+		appendStringInfoString(&query, " AND n.depth = 0");
+	}
+
+	if (node->compare != TWIG_COMPARE_NONE)
+	{
+		appendStringInfoString(&query, " AND ");
+		if (node->attribute)
+		{
+			// equality of named attribute uses attribute equality index
+			if (node->compare == TWIG_COMPARE_EQ && !node->numeric &&
+					node->name != NULL)
+			{
+				append_attribute_key(&query, "n", node->name, node->literal);
+			}
+			append_compare(&query, node, "n.value");
+		} else
+		{
+			appendStringInfo(&query,
+					"EXISTS (SELECT 1 FROM %s t WHERE t.did = n.did "
+					"AND t.parent_id = n.pre_order AND ",
+					layout == LAYOUT_UNIFIED ? "node_table" : "text_table");
+			if (layout == LAYOUT_UNIFIED)
+			{
+				appendStringInfo(&query, "t.kind = %d AND ", NODE_KIND_TEXT);
+			}
+			append_compare(&query, node, "t.value");
+			appendStringInfoChar(&query, ')');
+		}
+	}
+
+	appendStringInfoString(&query, " ORDER BY n.did, n.pre_order");
+
+	return query.data;
+}
+
+static bool
+node_before(const xml_join_node *a, const xml_join_node *b)
+{
+	return a->did < b->did || (a->did == b->did && a->pre_order < b->pre_order);
+}
+
+static void
+advance(twig_state *state, int q)
+{
+	twig_query_state *qs = &state->q[q];
+
+	if (!qs->eof)
+	{
+		qs->eof = !state->next(state->streams[q], &qs->cur);
+	}
+}
+
+static void
+push(twig_state *state, int q, int ptr)
+{
+	twig_query_state *qs = &state->q[q];
+
+	if (qs->top == qs->max)
+	{
+		qs->max = qs->max == 0 ? 64 : qs->max * 2;
+		qs->stack = qs->stack == NULL ?
+				(twig_entry *) palloc(qs->max * sizeof(twig_entry)) :
+				(twig_entry *) repalloc(qs->stack, qs->max * sizeof(twig_entry));
+	}
+	qs->stack[qs->top].node = qs->cur;
+	qs->stack[qs->top].ptr = ptr;
+	qs->top++;
+	state->stats->pushes++;
+}
+
+/*
+ * Pop entries of stack q which don't contain node
+ */
+static void
+clean_stack(twig_state *state, int q, const xml_join_node *node)
+{
+	twig_query_state *qs = &state->q[q];
+
+	while (qs->top > 0 && !XML_JOIN_CONTAINS(&qs->stack[qs->top - 1].node, node))
+	{
+		qs->top--;
+		state->stats->pops++;
+	}
+}
+
+/*
+ * All streams of leaves below q ended, subtree gives no more path solutions
+ */
+static bool
+subtree_ended(twig_state *state, int q)
+{
+	const twig_node *node = &state->pattern->nodes[q];
+	int			i;
+
+	if (node->nchildren == 0)
+	{
+		return state->q[q].eof;
+	}
+	for (i = 0; i < node->nchildren; i++)
+	{
+		if (!subtree_ended(state, node->children[i]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Query node with smallest next node which has solution extension: all
+ * children subtrees have matches inside its current node. Ended stream is
+ * +infinity: ended subtree of child is skipped and no later node of q can
+ * have extension, so stream of q ends too (its stack stays for other
+ * children).
+ */
+static int
+get_next(twig_state *state, int q)
+{
+	const twig_node *node = &state->pattern->nodes[q];
+	twig_query_state *qs = &state->q[q];
+	int			nmin = -1;
+	int			nmax = -1;
+	int			i;
+
+	if (node->nchildren == 0)
+	{
+		return q;
+	}
+
+	for (i = 0; i < node->nchildren; i++)
+	{
+		int			child = node->children[i];
+		int			n;
+
+		if (subtree_ended(state, child))
+		{
+			qs->eof = true;
+			continue;
+		}
+
+		n = get_next(state, child);
+		if (n != child)
+		{
+			return n;
+		}
+		if (nmin < 0 || (!state->q[child].eof && (state->q[nmin].eof ||
+				node_before(&state->q[child].cur, &state->q[nmin].cur))))
+		{
+			nmin = child;
+		}
+		if (nmax < 0 || state->q[child].eof || (!state->q[nmax].eof &&
+				node_before(&state->q[nmax].cur, &state->q[child].cur)))
+		{
+			nmax = child;
+		}
+	}
+
+	if (nmin < 0)
+	{
+		// whole subtree ended, caller stops
+		return q;
+	}
+
+	// skip nodes of q which end before the last child candidate starts
+	while (!qs->eof && (state->q[nmax].eof ||
+			qs->cur.did < state->q[nmax].cur.did ||
+			(qs->cur.did == state->q[nmax].cur.did &&
+			 qs->cur.pre_order + qs->cur.size < state->q[nmax].cur.pre_order)))
+	{
+		advance(state, q);
+	}
+
+	if (!qs->eof && (state->q[nmin].eof ||
+			node_before(&qs->cur, &state->q[nmin].cur)))
+	{
+		return q;
+	}
+
+	return nmin;
+}
+
+/*
+ * Walk from stack entry of q up to root through all entries encoded by
+ * ptr, every complete path is solution of the leaf
+ */
+static void
+fill_solutions(twig_state *state, int leaf, int q, int entry, xml_label *row)
+{
+	const twig_node *node = &state->pattern->nodes[q];
+	twig_entry *e = &state->q[q].stack[entry];
+	int			i;
+
+	row[1 + q] = e->node.pre_order;
+
+	if (node->parent < 0)
+	{
+		twig_query_state *ls = &state->q[leaf];
+
+		if (ls->nsolutions == ls->max_solutions)
+		{
+			ls->max_solutions = ls->max_solutions == 0 ? 256 : ls->max_solutions * 2;
+			ls->solutions = ls->solutions == NULL ?
+					(xml_label *) palloc(ls->max_solutions * state->width * sizeof(xml_label)) :
+					(xml_label *) repalloc(ls->solutions,
+							ls->max_solutions * state->width * sizeof(xml_label));
+		}
+		memcpy(ls->solutions + ls->nsolutions * state->width, row,
+				state->width * sizeof(xml_label));
+		ls->nsolutions++;
+		return;
+	}
+
+	for (i = 0; i <= e->ptr; i++)
+	{
+		twig_entry *pe = &state->q[node->parent].stack[i];
+
+		if (node->child_axis && pe->node.depth != e->node.depth - 1)
+		{
+			continue;
+		}
+		fill_solutions(state, leaf, node->parent, i, row);
+	}
+}
+
+static int
+compare_rows(const void *a, const void *b)
+{
+	const xml_label *x = (const xml_label *) a;
+	const xml_label *y = (const xml_label *) b;
+	int			i;
+
+	for (i = 0; i < sort_ncolumns; i++)
+	{
+		int			c = sort_columns[i];
+
+		if (x[c] != y[c])
+		{
+			return x[c] < y[c] ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+sort_rows(xml_label *rows, int64 count, int width, int *columns, int ncolumns)
+{
+	sort_columns = columns;
+	sort_ncolumns = ncolumns;
+	qsort(rows, count, width * sizeof(xml_label), compare_rows);
+}
+
+/*
+ * Merge path solutions of all leaves into twig matches: join them one
+ * leaf after another on shared query nodes (did and common path prefix)
+ */
+static void
+flush_solutions(twig_state *state)
+{
+	int			width = state->width;
+	twig_query_state *first = &state->q[state->leaves[0]];
+	bool		assigned[TWIG_MAX_NODES];
+	int			columns[TWIG_MAX_NODES + 1];
+	xml_label  *result;
+	int64		nresult;
+	int			l;
+	int			i;
+	int64		r;
+
+	state->buffered = false;
+
+	for (l = 0; l < state->nleaves; l++)
+	{
+		if (state->q[state->leaves[l]].nsolutions == 0)
+		{
+			for (i = 0; i < state->nleaves; i++)
+			{
+				state->q[state->leaves[i]].nsolutions = 0;
+			}
+			return;
+		}
+	}
+
+	memset(assigned, 0, sizeof(assigned));
+	for (i = 0; i < first->path_length; i++)
+	{
+		assigned[first->path[i]] = true;
+	}
+	result = first->solutions;
+	nresult = first->nsolutions;
+
+	for (l = 1; l < state->nleaves; l++)
+	{
+		twig_query_state *ls = &state->q[state->leaves[l]];
+		int			ncolumns = 1;
+		xml_label  *joined = NULL;
+		int64		njoined = 0;
+		int64		max_joined = 0;
+		int64		x = 0;
+		int64		y = 0;
+
+		columns[0] = 0;
+		for (i = 0; i < ls->path_length; i++)
+		{
+			if (assigned[ls->path[i]])
+			{
+				columns[ncolumns++] = 1 + ls->path[i];
+			}
+		}
+
+		sort_rows(result, nresult, width, columns, ncolumns);
+		sort_rows(ls->solutions, ls->nsolutions, width, columns, ncolumns);
+		sort_columns = columns;
+		sort_ncolumns = ncolumns;
+
+		// merge join, equal groups are combined by cross product
+		while (x < nresult && y < ls->nsolutions)
+		{
+			int			c = compare_rows(result + x * width,
+					ls->solutions + y * width);
+			int64		x_end;
+			int64		y_end;
+			int64		xi;
+			int64		yi;
+
+			if (c < 0)
+			{
+				x++;
+				continue;
+			}
+			if (c > 0)
+			{
+				y++;
+				continue;
+			}
+
+			for (x_end = x + 1; x_end < nresult &&
+					compare_rows(result + x * width, result + x_end * width) == 0;
+					x_end++)
+				;
+			for (y_end = y + 1; y_end < ls->nsolutions &&
+					compare_rows(ls->solutions + y * width,
+							ls->solutions + y_end * width) == 0;
+					y_end++)
+				;
+
+			for (xi = x; xi < x_end; xi++)
+			{
+				for (yi = y; yi < y_end; yi++)
+				{
+					xml_label  *row;
+
+					if (njoined == max_joined)
+					{
+						max_joined = max_joined == 0 ? 256 : max_joined * 2;
+						joined = joined == NULL ?
+								(xml_label *) palloc(max_joined * width * sizeof(xml_label)) :
+								(xml_label *) repalloc(joined,
+										max_joined * width * sizeof(xml_label));
+					}
+					row = joined + njoined * width;
+					memcpy(row, result + xi * width, width * sizeof(xml_label));
+					for (i = 0; i < ls->path_length; i++)
+					{
+						row[1 + ls->path[i]] =
+								ls->solutions[yi * width + 1 + ls->path[i]];
+					}
+					njoined++;
+				}
+			}
+
+			x = x_end;
+			y = y_end;
+		}
+
+		if (result != first->solutions)
+		{
+			pfree(result);
+		}
+		result = joined;
+		nresult = njoined;
+		for (i = 0; i < ls->path_length; i++)
+		{
+			assigned[ls->path[i]] = true;
+		}
+		if (nresult == 0)
+		{
+			break;
+		}
+	}
+
+	// matches ordered by did and query nodes in pattern order
+	for (i = 0; i < width; i++)
+	{
+		columns[i] = i;
+	}
+	if (nresult > 0)
+	{
+		sort_rows(result, nresult, width, columns, width);
+	}
+	for (r = 0; r < nresult; r++)
+	{
+		state->emit(state->emit_arg, result[r * width], result + r * width + 1,
+				width - 1);
+	}
+	state->matches += nresult;
+
+	if (result != NULL && result != first->solutions)
+	{
+		pfree(result);
+	}
+	for (i = 0; i < state->nleaves; i++)
+	{
+		state->q[state->leaves[i]].nsolutions = 0;
+	}
+}
+
+int64
+twig_stack(const twig_pattern *pattern, xml_join_next next,
+		void **streams, xml_twig_emit emit, void *emit_arg,
+		xml_join_stats *stats)
+{
+	twig_state *state = (twig_state *) palloc0(sizeof(twig_state));
+	xml_join_stats local_stats;
+	xml_label  *row;
+	int64		matches;
+	int			q;
+	int			i;
+
+	if (stats == NULL)
+	{
+		stats = &local_stats;
+	}
+	memset(stats, 0, sizeof(xml_join_stats));
+
+	state->pattern = pattern;
+	state->next = next;
+	state->streams = streams;
+	state->emit = emit;
+	state->emit_arg = emit_arg;
+	state->stats = stats;
+	state->width = pattern->count + 1;
+	row = (xml_label *) palloc(state->width * sizeof(xml_label));
+
+	for (q = 0; q < pattern->count; q++)
+	{
+		if (pattern->nodes[q].nchildren == 0)
+		{
+			twig_query_state *ls = &state->q[q];
+			int			up;
+
+			state->leaves[state->nleaves++] = q;
+			for (up = q; up >= 0; up = pattern->nodes[up].parent)
+			{
+				ls->path_length++;
+			}
+			i = ls->path_length;
+			for (up = q; up >= 0; up = pattern->nodes[up].parent)
+			{
+				ls->path[--i] = up;
+			}
+		}
+		advance(state, q);
+	}
+
+	for (;;)
+	{
+		bool		ended = true;
+		xml_label	min_did = 0;
+		int			parent;
+
+		for (i = 0; i < state->nleaves; i++)
+		{
+			ended = ended && state->q[state->leaves[i]].eof;
+		}
+		if (ended)
+		{
+			break;
+		}
+
+		// path solutions of documents left by all streams are complete
+		if (state->buffered)
+		{
+			bool		found = false;
+
+			for (q = 0; q < pattern->count; q++)
+			{
+				if (!state->q[q].eof && (!found || state->q[q].cur.did < min_did))
+				{
+					min_did = state->q[q].cur.did;
+					found = true;
+				}
+			}
+			if (!found || min_did > state->buffered_did)
+			{
+				flush_solutions(state);
+			}
+		}
+
+		q = get_next(state, 0);
+		if (state->q[q].eof)
+		{
+			// returned only when whole pattern ended
+			break;
+		}
+
+		parent = pattern->nodes[q].parent;
+		if (parent >= 0)
+		{
+			clean_stack(state, parent, &state->q[q].cur);
+		}
+
+		if (parent < 0 || state->q[parent].top > 0)
+		{
+			clean_stack(state, q, &state->q[q].cur);
+			push(state, q, parent < 0 ? -1 : state->q[parent].top - 1);
+			advance(state, q);
+
+			if (pattern->nodes[q].nchildren == 0)
+			{
+				twig_query_state *qs = &state->q[q];
+
+				for (i = 0; i < state->width; i++)
+				{
+					row[i] = -1;
+				}
+				row[0] = qs->stack[qs->top - 1].node.did;
+				fill_solutions(state, q, q, qs->top - 1, row);
+				if (qs->nsolutions > 0 &&
+						(!state->buffered || row[0] > state->buffered_did))
+				{
+					state->buffered = true;
+					state->buffered_did = row[0];
+				}
+				qs->top--;
+				stats->pops++;
+			}
+		} else
+		{
+			advance(state, q);
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (state->buffered)
+	{
+		flush_solutions(state);
+	}
+
+	matches = state->matches;
+	stats->matches = matches;
+	for (q = 0; q < pattern->count; q++)
+	{
+		if (state->q[q].stack != NULL)
+		{
+			pfree(state->q[q].stack);
+		}
+		if (state->q[q].solutions != NULL)
+		{
+			pfree(state->q[q].solutions);
+		}
+	}
+	pfree(row);
+	pfree(state);
+
+	return matches;
+}
+
+static void
+emit_match(void *arg, xml_label did, const xml_label *nodes, int count)
+{
+	twig_output *output = (twig_output *) arg;
+	Datum	   *elements = (Datum *) palloc(count * sizeof(Datum));
+	Datum		values[2];
+	bool		nulls[2] = {false, false};
+	int			i;
+
+	for (i = 0; i < count; i++)
+	{
+		elements[i] = Int64GetDatum(nodes[i]);
+	}
+
+	values[0] = Int64GetDatum(did);
+	values[1] = PointerGetDatum(construct_array(elements, count, INT8OID,
+			sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+
+	tuplestore_putvalues(output->tupstore, output->tupdesc, values, nulls);
+	pfree(elements);
+}
+
+/*
+ * Twig matches of pattern over shredded tables. Only documents of range
+ * are shredded (when registered for lazy shredding) and read.
+ * @param pattern e.g. //order[customer/@vip='y']//item[price>100]
+ * @param did_from first document of range
+ * @param did_to last document of range
+ * @return set of (did, nodes), nodes are pre_orders of query nodes in order
+ *		of pattern text (order, customer, @vip, item, price)
+ */
+Datum
+twig_join(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	char	   *pattern_text = text_to_cstring(PG_GETARG_TEXT_P(0));
+	xml_label	did_from = PG_GETARG_INT64(1);
+	xml_label	did_to = PG_GETARG_INT64(2);
+	twig_pattern *pattern = (twig_pattern *) palloc(sizeof(twig_pattern));
+	xml_join_spi_stream *streams;
+	void	  **stream_args;
+	twig_output output;
+	TupleDesc	tupdesc;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	int			layout;
+	bool		postings;
+	int			q;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+			!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+
+	twig_parse(pattern_text, pattern);
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+	output.tupdesc = CreateTupleDescCopy(tupdesc);
+	output.tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+			false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	ensure_documents_shredded(did_from, did_to);
+
+	layout = get_index_layout();
+	postings = xml_postings_enabled();
+
+	SPI_connect();
+
+	streams = (xml_join_spi_stream *) palloc(pattern->count * sizeof(xml_join_spi_stream));
+	stream_args = (void **) palloc(pattern->count * sizeof(void *));
+	for (q = 0; q < pattern->count; q++)
+	{
+		twig_node  *node = &pattern->nodes[q];
+
+		// plain element name is read from its posting list
+		if (postings && node->name != NULL && !node->attribute &&
+				node->compare == TWIG_COMPARE_NONE &&
+				!(node->parent < 0 && node->child_axis))
+		{
+			xml_join_postings_open(&streams[q], node->name, did_from, did_to);
+		} else
+		{
+			xml_join_spi_open(&streams[q], twig_stream_query(pattern, q, layout,
+					did_from, did_to),
+					node->name != NULL ? node->name : "*");
+		}
+		stream_args[q] = &streams[q];
+	}
+
+	twig_stack(pattern, xml_join_spi_next, stream_args, emit_match, &output,
+			&xml_join_last_stats);
+
+	for (q = 0; q < pattern->count; q++)
+	{
+		xml_join_spi_close(&streams[q]);
+	}
+
+	SPI_finish();
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = output.tupstore;
+	rsinfo->setDesc = output.tupdesc;
+
+	return (Datum) 0;
+}
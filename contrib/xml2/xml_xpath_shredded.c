@@ -0,0 +1,979 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_xpath_shredded.c
+// desc:	Compiler of XPath 1.0 subset into one SQL query over shredded
+//			tables. Every location step is set of nodes of all documents
+//			(semi-join of candidate nodes with set of previous step), so
+//			query is evaluated set-at-a-time over whole collection.
+//
+//			path		:= ('/' | '//')? step (('/' | '//') step)*
+//			step		:= (name | '*' | '@' name | '@*' | 'text()' | '.' |
+//							'..') predicate*
+//			predicate	:= '[' number | 'last()' | 'position()' op number |
+//							or_expr ']'
+//			or_expr		:= and_expr ('or' and_expr)*
+//			and_expr	:= unary ('and' unary)*
+//			unary		:= 'not' '(' or_expr ')' | '(' or_expr ')' |
+//							operand (op literal)?
+//			operand		:= '.' | relative path
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include "access/hash.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#include <ctype.h>
+
+#define XPATH_AXIS_CHILD 0
+#define XPATH_AXIS_DESCENDANT 1
+#define XPATH_AXIS_PARENT 2
+#define XPATH_AXIS_SELF 3
+
+#define XPATH_MAX_STEPS 32
+#define XPATH_FETCH_SIZE 1000
+
+/* externally accessible functions */
+Datum	xpath_shredded(PG_FUNCTION_ARGS);
+Datum	xpath_shredded_query(PG_FUNCTION_ARGS);
+Datum	xml_attribute_key(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(xpath_shredded);
+PG_FUNCTION_INFO_V1(xpath_shredded_query);
+PG_FUNCTION_INFO_V1(xml_attribute_key);
+
+typedef struct xpath_compiler xpath_compiler;
+struct xpath_compiler {
+	const char *text;
+	const char *pos;
+	int			layout;
+	bool		has_did;		// $1 is did
+	int			aliases;		// counter of aliases of relative paths
+};
+
+// step of relative path in predicate, compiled when comparison is known
+typedef struct xpath_step xpath_step;
+struct xpath_step {
+	int			axis;
+	int			kind;			// NODE_KIND_*
+	char	   *name;			// NULL for *
+	char		alias[16];
+	StringInfoData predicates;	// " AND ..." conditions on alias
+};
+
+static void compile_or(xpath_compiler *xc, StringInfo buf, const char *alias,
+		int kind);
+
+static void
+xpath_error(xpath_compiler *xc, const char *message)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_SYNTAX_ERROR),
+			 errmsg("unsupported XPath expression \"%s\"", xc->text),
+			 errdetail("%s at position %d.", message,
+					(int) (xc->pos - xc->text) + 1)));
+}
+
+static void
+skip_spaces(xpath_compiler *xc)
+{
+	while (isspace((unsigned char) *xc->pos))
+	{
+		xc->pos++;
+	}
+}
+
+static bool
+accept(xpath_compiler *xc, const char *token)
+{
+	int			len = strlen(token);
+
+	skip_spaces(xc);
+	if (strncmp(xc->pos, token, len) == 0)
+	{
+		xc->pos += len;
+		return true;
+	}
+
+	return false;
+}
+
+static bool
+is_name_char(char c, bool first)
+{
+	return isalpha((unsigned char) c) || c == '_' || (unsigned char) c >= 0x80 ||
+			(!first && (isdigit((unsigned char) c) || c == '-' || c == '.' ||
+					c == ':'));
+}
+
+/*
+ * Keyword (and, or, not, ...) followed by character which can't be in name
+ */
+static bool
+accept_keyword(xpath_compiler *xc, const char *keyword)
+{
+	const char *saved = xc->pos;
+
+	if (accept(xc, keyword) && !is_name_char(*xc->pos, false))
+	{
+		return true;
+	}
+	xc->pos = saved;
+
+	return false;
+}
+
+static char *
+parse_name(xpath_compiler *xc)
+{
+	const char *start;
+
+	skip_spaces(xc);
+	start = xc->pos;
+	if (!is_name_char(*xc->pos, true))
+	{
+		xpath_error(xc, "name expected");
+	}
+	while (is_name_char(*xc->pos, false))
+	{
+		xc->pos++;
+	}
+
+	return pnstrdup(start, xc->pos - start);
+}
+
+/*
+ * Number, goes to SQL as it is
+ */
+static char *
+parse_number(xpath_compiler *xc, bool required)
+{
+	const char *start;
+
+	skip_spaces(xc);
+	start = xc->pos;
+	if (*xc->pos == '-' || *xc->pos == '+')
+	{
+		xc->pos++;
+	}
+	if (!isdigit((unsigned char) *xc->pos))
+	{
+		if (required)
+		{
+			xpath_error(xc, "number expected");
+		}
+		xc->pos = start;
+		return NULL;
+	}
+	while (isdigit((unsigned char) *xc->pos))
+	{
+		xc->pos++;
+	}
+	if (*xc->pos == '.')
+	{
+		xc->pos++;
+		while (isdigit((unsigned char) *xc->pos))
+		{
+			xc->pos++;
+		}
+	}
+
+	return pnstrdup(start, xc->pos - start);
+}
+
+/*
+ * Comparison operator, NULL if there is none
+ */
+static const char *
+parse_operator(xpath_compiler *xc)
+{
+	static const char *const xpath_operators[] = {"!=", "<=", ">=", "=", "<", ">"};
+	static const char *const sql_operators[] = {"<>", "<=", ">=", "=", "<", ">"};
+	int			i;
+
+	for (i = 0; i < lengthof(xpath_operators); i++)
+	{
+		if (accept(xc, xpath_operators[i]))
+		{
+			return sql_operators[i];
+		}
+	}
+
+	return NULL;
+}
+
+static const char *
+kind_table(xpath_compiler *xc, int kind)
+{
+	if (xc->layout == LAYOUT_UNIFIED)
+	{
+		return "node_table";
+	}
+
+	return kind == NODE_KIND_ATTRIBUTE ? "attribute_table" :
+			kind == NODE_KIND_TEXT ? "text_table" : "element_table";
+}
+
+/*
+ * Conditions of kind and name test of alias
+ */
+static void
+append_node_test(xpath_compiler *xc, StringInfo buf, const char *alias,
+		int kind, const char *name)
+{
+	if (xc->layout == LAYOUT_UNIFIED)
+	{
+		appendStringInfo(buf, " AND %s.kind = %d", alias, kind);
+	}
+	if (name != NULL)
+	{
+		appendStringInfo(buf, " AND %s.name = %s", alias, quote_literal_cstr(name));
+	}
+}
+
+/*
+ * Condition joining alias to its context by axis
+ */
+static void
+append_axis(StringInfo buf, int axis, const char *alias, const char *context)
+{
+	switch (axis)
+	{
+		case XPATH_AXIS_CHILD:
+			appendStringInfo(buf, "%s.did = %s.did AND %s.parent_id = %s.pre_order",
+					context, alias, alias, context);
+			break;
+		case XPATH_AXIS_DESCENDANT:
+			appendStringInfo(buf, "%s.did = %s.did AND %s.pre_order > %s.pre_order "
+					"AND %s.pre_order <= %s.pre_order + %s.size",
+					context, alias, alias, context, alias, context, context);
+			break;
+		case XPATH_AXIS_PARENT:
+			appendStringInfo(buf, "%s.did = %s.did AND %s.pre_order = %s.parent_id",
+					context, alias, alias, context);
+			break;
+		default:
+			appendStringInfo(buf, "%s.did = %s.did AND %s.pre_order = %s.pre_order",
+					context, alias, alias, context);
+			break;
+	}
+}
+
+/*
+ * XPath string value of node: value of attribute and text node,
+ * concatenation of descendant text nodes of element
+ */
+static void
+append_string_value(xpath_compiler *xc, StringInfo buf, const char *alias,
+		int kind)
+{
+	if (kind != NODE_KIND_ELEMENT)
+	{
+		appendStringInfo(buf, "%s.value", alias);
+		return;
+	}
+
+	appendStringInfo(buf,
+			"coalesce((SELECT string_agg(t.value, '' ORDER BY t.pre_order) "
+			"FROM %s t WHERE t.did = %s.did AND t.pre_order > %s.pre_order "
+			"AND t.pre_order <= %s.pre_order + %s.size",
+			kind_table(xc, NODE_KIND_TEXT), alias, alias, alias, alias);
+	if (xc->layout == LAYOUT_UNIFIED)
+	{
+		appendStringInfo(buf, " AND t.kind = %d", NODE_KIND_TEXT);
+	}
+	appendStringInfoString(buf, "), '')");
+}
+
+/*
+ * Hash of attribute (name, value), key of attribute equality index
+ * @return hash of name, zero byte and value
+ */
+Datum
+xml_attribute_key(PG_FUNCTION_ARGS)
+{
+	text	   *name = PG_GETARG_TEXT_PP(0);
+	text	   *value = PG_GETARG_TEXT_PP(1);
+	int			name_len = VARSIZE_ANY_EXHDR(name);
+	int			value_len = VARSIZE_ANY_EXHDR(value);
+	char	   *key = palloc(name_len + value_len + 1);
+	Datum		result;
+
+	memcpy(key, VARDATA_ANY(name), name_len);
+	key[name_len] = '\0';
+	memcpy(key + name_len + 1, VARDATA_ANY(value), value_len);
+	result = hash_any((unsigned char *) key, name_len + value_len + 1);
+	pfree(key);
+
+	PG_RETURN_DATUM(result);
+}
+
+/*
+ * Condition for attribute equality index, @name = 'literal' of alias is
+ * looked up by key of index, name and value are compared by caller
+ */
+void
+append_attribute_key(StringInfo buf, const char *alias, const char *name,
+		const char *literal)
+{
+	appendStringInfo(buf, "xml_attribute_key(%s.name, %s.value) = ", alias, alias);
+	appendStringInfo(buf, "xml_attribute_key(%s, ", quote_literal_cstr(name));
+	appendStringInfo(buf, "%s) AND ", quote_literal_cstr(literal));
+}
+
+/*
+ * Comparison of string value with literal, numbers compare numerically
+ * (strings which aren't numbers don't match, as NaN in XPath)
+ */
+static void
+append_compare(xpath_compiler *xc, StringInfo buf, const char *alias, int kind,
+		const char *op, const char *literal, bool numeric)
+{
+	if (numeric)
+	{
+		appendStringInfoString(buf, "(SELECT CASE WHEN sv.v ~ "
+				"'^[[:space:]]*[-+]?[0-9]+([.][0-9]*)?[[:space:]]*$' "
+				"THEN sv.v::numeric END FROM (SELECT ");
+		append_string_value(xc, buf, alias, kind);
+		appendStringInfo(buf, ") sv(v)) %s %s", op, literal);
+	} else
+	{
+		append_string_value(xc, buf, alias, kind);
+		appendStringInfo(buf, " %s %s", op, quote_literal_cstr(literal));
+	}
+}
+
+/*
+ * Literal after comparison operator
+ */
+static char *
+parse_literal(xpath_compiler *xc, bool *numeric)
+{
+	char		quote;
+	const char *start;
+
+	skip_spaces(xc);
+	quote = *xc->pos;
+	if (quote == '\'' || quote == '"')
+	{
+		start = ++xc->pos;
+		while (*xc->pos != quote)
+		{
+			if (*xc->pos == '\0')
+			{
+				xpath_error(xc, "unterminated string");
+			}
+			xc->pos++;
+		}
+		*numeric = false;
+		return pnstrdup(start, xc->pos++ - start);
+	}
+
+	*numeric = true;
+	return parse_number(xc, true);
+}
+
+/*
+ * Node test of step, axis is changed for . and ..
+ */
+static void
+parse_node_test(xpath_compiler *xc, int *axis, int *kind, char **name)
+{
+	*name = NULL;
+	*kind = NODE_KIND_ELEMENT;
+
+	if (accept(xc, ".."))
+	{
+		*axis = XPATH_AXIS_PARENT;
+	} else if (accept(xc, "."))
+	{
+		*axis = XPATH_AXIS_SELF;
+		*kind = -1;				// kind of context
+	} else if (accept(xc, "@"))
+	{
+		*kind = NODE_KIND_ATTRIBUTE;
+		if (!accept(xc, "*"))
+		{
+			*name = parse_name(xc);
+		}
+	} else if (accept(xc, "text()"))
+	{
+		*kind = NODE_KIND_TEXT;
+	} else if (!accept(xc, "*"))
+	{
+		*name = parse_name(xc);
+	}
+}
+
+static bool
+at_step_start(xpath_compiler *xc)
+{
+	skip_spaces(xc);
+	return *xc->pos == '.' || *xc->pos == '@' || *xc->pos == '*' ||
+			is_name_char(*xc->pos, true);
+}
+
+/*
+ * Relative path in predicate as chain of EXISTS, last step compared with
+ * literal when operator follows
+ */
+static void
+compile_relative(xpath_compiler *xc, StringInfo buf, const char *context,
+		int context_kind)
+{
+	xpath_step	steps[XPATH_MAX_STEPS];
+	int			nsteps = 0;
+	int			axis = XPATH_AXIS_CHILD;
+	const char *previous = context;
+	int			previous_kind = context_kind;
+	const char *op;
+	int			i;
+
+	if (accept(xc, ".//"))
+	{
+		axis = XPATH_AXIS_DESCENDANT;
+	} else if (accept(xc, "./"))
+	{
+		axis = XPATH_AXIS_CHILD;
+	} else if (accept(xc, "//") || accept(xc, "/"))
+	{
+		xpath_error(xc, "absolute path in predicate is not supported");
+	}
+
+	for (;;)
+	{
+		xpath_step *step;
+
+		if (nsteps == XPATH_MAX_STEPS)
+		{
+			xpath_error(xc, "too many steps");
+		}
+		step = &steps[nsteps];
+		step->axis = axis;
+		parse_node_test(xc, &step->axis, &step->kind, &step->name);
+		if (step->kind < 0)
+		{
+			step->kind = previous_kind;
+		}
+		if (previous_kind != NODE_KIND_ELEMENT && step->axis != XPATH_AXIS_SELF &&
+				step->axis != XPATH_AXIS_PARENT)
+		{
+			xpath_error(xc, "attribute and text node have no children");
+		}
+		snprintf(step->alias, sizeof(step->alias), "r%d", ++xc->aliases);
+		initStringInfo(&step->predicates);
+
+		while (accept(xc, "["))
+		{
+			if (parse_number(xc, false) != NULL || accept(xc, "last()") ||
+					accept(xc, "position()"))
+			{
+				xpath_error(xc, "positional predicate in predicate is not supported");
+			}
+			appendStringInfoString(&step->predicates, " AND (");
+			compile_or(xc, &step->predicates, step->alias, step->kind);
+			appendStringInfoChar(&step->predicates, ')');
+			if (!accept(xc, "]"))
+			{
+				xpath_error(xc, "\"]\" expected");
+			}
+		}
+
+		previous_kind = step->kind;
+		nsteps++;
+
+		if (accept(xc, "//"))
+		{
+			axis = XPATH_AXIS_DESCENDANT;
+		} else if (accept(xc, "/"))
+		{
+			axis = XPATH_AXIS_CHILD;
+		} else
+		{
+			break;
+		}
+	}
+
+	for (i = 0; i < nsteps; i++)
+	{
+		xpath_step *step = &steps[i];
+
+		if (i > 0)
+		{
+			appendStringInfoString(buf, " AND ");
+		}
+		appendStringInfo(buf, "EXISTS (SELECT 1 FROM %s %s WHERE ",
+				kind_table(xc, step->kind), step->alias);
+		append_axis(buf, step->axis, step->alias, previous);
+		append_node_test(xc, buf, step->alias, step->kind, step->name);
+		appendStringInfoString(buf, step->predicates.data);
+		previous = step->alias;
+	}
+
+	op = parse_operator(xc);
+	if (op != NULL)
+	{
+		bool		numeric;
+		char	   *literal = parse_literal(xc, &numeric);
+
+		appendStringInfoString(buf, " AND ");
+		if (previous_kind == NODE_KIND_ATTRIBUTE && nsteps > 0 && !numeric &&
+				strcmp(op, "=") == 0 && steps[nsteps - 1].name != NULL)
+		{
+			append_attribute_key(buf, previous, steps[nsteps - 1].name, literal);
+		}
+		append_compare(xc, buf, previous, previous_kind, op, literal, numeric);
+	}
+
+	for (i = 0; i < nsteps; i++)
+	{
+		appendStringInfoChar(buf, ')');
+	}
+}
+
+static void
+compile_unary(xpath_compiler *xc, StringInfo buf, const char *alias, int kind)
+{
+	if (accept_keyword(xc, "not"))
+	{
+		if (!accept(xc, "("))
+		{
+			xpath_error(xc, "\"(\" expected");
+		}
+		appendStringInfoString(buf, "NOT (");
+		compile_or(xc, buf, alias, kind);
+		appendStringInfoChar(buf, ')');
+		if (!accept(xc, ")"))
+		{
+			xpath_error(xc, "\")\" expected");
+		}
+	} else if (accept(xc, "("))
+	{
+		appendStringInfoChar(buf, '(');
+		compile_or(xc, buf, alias, kind);
+		appendStringInfoChar(buf, ')');
+		if (!accept(xc, ")"))
+		{
+			xpath_error(xc, "\")\" expected");
+		}
+	} else if (!at_step_start(xc))
+	{
+		xpath_error(xc, "path expected");
+	} else
+	{
+		const char *saved = xc->pos;
+		const char *op;
+
+		// "." alone compares context node
+		if (accept(xc, ".") && *xc->pos != '.' && *xc->pos != '/' &&
+				(op = parse_operator(xc)) != NULL)
+		{
+			bool		numeric;
+			char	   *literal = parse_literal(xc, &numeric);
+
+			append_compare(xc, buf, alias, kind, op, literal, numeric);
+			return;
+		}
+		xc->pos = saved;
+		compile_relative(xc, buf, alias, kind);
+	}
+}
+
+static void
+compile_and(xpath_compiler *xc, StringInfo buf, const char *alias, int kind)
+{
+	compile_unary(xc, buf, alias, kind);
+	while (accept_keyword(xc, "and"))
+	{
+		appendStringInfoString(buf, " AND ");
+		compile_unary(xc, buf, alias, kind);
+	}
+}
+
+static void
+compile_or(xpath_compiler *xc, StringInfo buf, const char *alias, int kind)
+{
+	compile_and(xc, buf, alias, kind);
+	while (accept_keyword(xc, "or"))
+	{
+		appendStringInfoString(buf, " OR ");
+		compile_and(xc, buf, alias, kind);
+	}
+}
+
+/*
+ * Positional predicate of named element step answered by stored ordinal:
+ * position among children of the same name is sibling_ord of the node, and
+ * last() has no later sibling of the same name
+ * @param step query of the step, its alias is s
+ * @return false when predicate is not positional, nothing is consumed
+ */
+static bool
+compile_ordinal(xpath_compiler *xc, StringInfo step)
+{
+	const char *saved = xc->pos;
+	char	   *number;
+	const char *op = "=";
+
+	number = parse_number(xc, false);
+	if (number == NULL && accept(xc, "position()"))
+	{
+		op = parse_operator(xc);
+		if (op == NULL)
+		{
+			xpath_error(xc, "comparison of position() expected");
+		}
+		number = parse_number(xc, true);
+	}
+
+	if (number != NULL)
+	{
+		appendStringInfo(step, " AND s.sibling_ord %s %s", op, number);
+	} else if (accept(xc, "last()"))
+	{
+		appendStringInfo(step,
+				" AND NOT EXISTS (SELECT 1 FROM %s l WHERE l.did = s.did "
+				"AND l.parent_id = s.parent_id AND l.name = s.name "
+				"AND l.sibling_ord > s.sibling_ord",
+				kind_table(xc, NODE_KIND_ELEMENT));
+		if (xc->layout == LAYOUT_UNIFIED)
+		{
+			appendStringInfo(step, " AND l.kind = %d", NODE_KIND_ELEMENT);
+		}
+		appendStringInfoChar(step, ')');
+	} else
+	{
+		xc->pos = saved;
+		return false;
+	}
+
+	if (!accept(xc, "]"))
+	{
+		xpath_error(xc, "\"]\" expected");
+	}
+
+	return true;
+}
+
+/*
+ * Predicate of main path step, wraps set of candidates
+ * @param candidates query of (did, pre_order, size, parent_id, value)
+ * @return new query of the same columns
+ */
+static char *
+compile_predicate(xpath_compiler *xc, char *candidates, int kind)
+{
+	StringInfoData buf;
+	char	   *number;
+	const char *op = "=";
+
+	initStringInfo(&buf);
+
+	number = parse_number(xc, false);
+	if (number == NULL && accept(xc, "position()"))
+	{
+		op = parse_operator(xc);
+		if (op == NULL)
+		{
+			xpath_error(xc, "comparison of position() expected");
+		}
+		number = parse_number(xc, true);
+	}
+
+	if (number != NULL || accept(xc, "last()"))
+	{
+		// position among nodes of the step with the same parent
+		appendStringInfo(&buf,
+				"SELECT c.did, c.pre_order, c.size, c.parent_id, c.value FROM "
+				"(SELECT x.*, row_number() OVER (PARTITION BY x.did, x.parent_id "
+				"ORDER BY x.pre_order) AS position, count(*) OVER "
+				"(PARTITION BY x.did, x.parent_id) AS last FROM (%s) x) c "
+				"WHERE c.position ",
+				candidates);
+		if (number != NULL)
+		{
+			appendStringInfo(&buf, "%s %s", op, number);
+		} else
+		{
+			appendStringInfoString(&buf, "= c.last");
+		}
+	} else
+	{
+		appendStringInfo(&buf,
+				"SELECT c.did, c.pre_order, c.size, c.parent_id, c.value FROM "
+				"(%s) c WHERE ",
+				candidates);
+		compile_or(xc, &buf, "c", kind);
+	}
+
+	if (!accept(xc, "]"))
+	{
+		xpath_error(xc, "\"]\" expected");
+	}
+	pfree(candidates);
+
+	return buf.data;
+}
+
+/*
+ * Compile XPath into query returning (did, pre_order, value) ordered by
+ * did and pre_order
+ * @param xpath expression
+ * @param has_did query has parameter $1 (bigint), only document with this
+ *		did is searched
+ * @param with_values value column is string value of node, otherwise NULL
+ * @param layout LAYOUT_SEPARATE or LAYOUT_UNIFIED
+ * @return SQL query
+ */
+char *
+compile_xpath_shredded(const char *xpath, bool has_did, bool with_values,
+		int layout)
+{
+	xpath_compiler xc;
+	char	   *current = NULL;		// set of previous step, NULL for root
+	int			current_kind = -1;
+	int			axis = XPATH_AXIS_CHILD;
+	StringInfoData buf;
+
+	xc.text = xpath;
+	xc.pos = xpath;
+	xc.layout = layout;
+	xc.has_did = has_did;
+	xc.aliases = 0;
+
+	if (accept(&xc, "//"))
+	{
+		axis = XPATH_AXIS_DESCENDANT;
+	} else
+	{
+		accept(&xc, "/");
+	}
+
+	for (;;)
+	{
+		int			step_axis = axis;
+		int			kind;
+		char	   *name;
+		bool		ordinal;
+		StringInfoData step;
+
+		parse_node_test(&xc, &step_axis, &kind, &name);
+		if (step_axis == XPATH_AXIS_SELF)
+		{
+			// self step keeps set of previous step, only predicates apply
+			if (current == NULL)
+			{
+				xpath_error(&xc, "context of \".\" is document");
+			}
+			kind = current_kind;
+		} else
+		{
+			if (current_kind > 0 && current_kind != NODE_KIND_ELEMENT &&
+					step_axis != XPATH_AXIS_PARENT)
+			{
+				xpath_error(&xc, "attribute and text node have no children");
+			}
+
+			initStringInfo(&step);
+			appendStringInfo(&step,
+					"SELECT s.did, s.pre_order, %s AS size, s.parent_id, "
+					"%s AS value FROM %s s WHERE true",
+					kind == NODE_KIND_TEXT && layout != LAYOUT_UNIFIED ? "0" : "s.size",
+					kind == NODE_KIND_ELEMENT ? "NULL::text" : "s.value",
+					kind_table(&xc, kind));
+			append_node_test(&xc, &step, "s", kind, name);
+			if (has_did)
+			{
+				appendStringInfoString(&step, " AND s.did = $1");
+			}
+
+			if (current == NULL)
+			{
+				// context is document node
+				if (step_axis == XPATH_AXIS_PARENT ||
+						(step_axis == XPATH_AXIS_CHILD && kind != NODE_KIND_ELEMENT))
+				{
+					appendStringInfoString(&step, " AND false");
+				} else if (step_axis == XPATH_AXIS_CHILD)
+				{
+					appendStringInfoString(&step, " AND s.depth = 0");
+				}
+			} else
+			{
+				appendStringInfo(&step, " AND EXISTS (SELECT 1 FROM (%s) p WHERE ",
+						current);
+				append_axis(&step, step_axis, "s", "p");
+				appendStringInfoChar(&step, ')');
+				pfree(current);
+			}
+			current = step.data;
+		}
+
+		ordinal = step_axis != XPATH_AXIS_SELF && step_axis != XPATH_AXIS_PARENT &&
+				kind == NODE_KIND_ELEMENT && name != NULL;
+		while (accept(&xc, "["))
+		{
+			// only first predicate sees all nodes of the step
+			if (ordinal && compile_ordinal(&xc, &step))
+			{
+				// step query could be reallocated
+				current = step.data;
+			} else
+			{
+				current = compile_predicate(&xc, current, kind);
+			}
+			ordinal = false;
+		}
+		current_kind = kind;
+
+		if (accept(&xc, "//"))
+		{
+			axis = XPATH_AXIS_DESCENDANT;
+		} else if (accept(&xc, "/"))
+		{
+			axis = XPATH_AXIS_CHILD;
+		} else
+		{
+			break;
+		}
+	}
+
+	skip_spaces(&xc);
+	if (*xc.pos != '\0')
+	{
+		xpath_error(&xc, "unexpected character");
+	}
+
+	initStringInfo(&buf);
+	appendStringInfoString(&buf, "SELECT f.did::bigint, f.pre_order::bigint, ");
+	if (with_values)
+	{
+		append_string_value(&xc, &buf, "f", current_kind);
+	} else
+	{
+		appendStringInfoString(&buf, "NULL::text");
+	}
+	appendStringInfo(&buf, " FROM (%s) f ORDER BY f.did, f.pre_order", current);
+
+	return buf.data;
+}
+
+/*
+ * Evaluate XPath over shredded tables of all documents
+ * @param xpath expression
+ * @param did (optional) only this document
+ * @param with_values return string values of nodes
+ * @return set of (did, pre_order, value)
+ */
+Datum
+xpath_shredded(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	char	   *xpath = text_to_cstring(PG_GETARG_TEXT_P(0));
+	bool		has_did = PG_NARGS() > 2;
+	bool		with_values = PG_GETARG_BOOL(has_did ? 2 : 1);
+	Oid			argtypes[1] = {INT8OID};
+	Datum		args[1];
+	char	   *query;
+	Portal		portal;
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+			!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+
+	query = compile_xpath_shredded(xpath, has_did, with_values, get_index_layout());
+	if (has_did)
+	{
+		args[0] = Int64GetDatum(PG_GETARG_INT64(1));
+		ensure_document_shredded(PG_GETARG_INT64(1));
+	}
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+			false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	SPI_connect();
+
+	// not read only, rows of document shredded above must be visible
+	portal = SPI_cursor_open_with_args(NULL, query, has_did ? 1 : 0,
+			argtypes, args, NULL, false, 0);
+
+	// copy in batches, result of whole collection can be big
+	for (;;)
+	{
+		int			i;
+
+		SPI_cursor_fetch(portal, true, XPATH_FETCH_SIZE);
+		if (SPI_processed == 0)
+		{
+			break;
+		}
+		for (i = 0; i < SPI_processed; i++)
+		{
+			Datum		values[3];
+			bool		nulls[3];
+			int			column;
+
+			for (column = 0; column < 3; column++)
+			{
+				values[column] = SPI_getbinval(SPI_tuptable->vals[i],
+						SPI_tuptable->tupdesc, column + 1, &nulls[column]);
+			}
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}
+
+/*
+ * SQL generated for XPath, for EXPLAIN and debugging
+ * @param xpath expression
+ * @return query with optional parameter $1 (did)
+ */
+Datum
+xpath_shredded_query(PG_FUNCTION_ARGS)
+{
+	char	   *xpath = text_to_cstring(PG_GETARG_TEXT_P(0));
+
+	PG_RETURN_TEXT_P(cstring_to_text(compile_xpath_shredded(xpath, false, true,
+			get_index_layout())));
+}
@@ -0,0 +1,390 @@
+////////////////////////////////////////////////////////////////////////////////
+// author:	Tomas Pospisil, xpospi04@stud.fit.vutbr.cz, killteck@seznam.cz
+// project:	Indexing native XML datatype, GSoC project
+// file:	xml_xpath_views.c
+// desc:	Materialised XPath views. Results (did, xpath, pre_order, value)
+//			of set of XPaths are stored in table of view, views are listed
+//			in xml_xpath_views. Loader refreshes rows of every shredded
+//			document, deleted documents are removed by trigger on
+//			xml_documents_table, so only one did is evaluated per change.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* postgresql includes */
+#include "postgres.h"
+#include "xml_index_loader.h"
+
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+/* externally accessible functions */
+Datum	create_xpath_view(PG_FUNCTION_ARGS);
+Datum	drop_xpath_view(PG_FUNCTION_ARGS);
+Datum	xpath_views_document_trigger(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(create_xpath_view);
+PG_FUNCTION_INFO_V1(drop_xpath_view);
+PG_FUNCTION_INFO_V1(xpath_views_document_trigger);
+
+//Implemented in xmlindex.c
+char** text_array_to_cstrings(ArrayType* array, int* count);
+
+/*
+ * Are there some views, caller has to be connected to SPI. Catalog is
+ * checked by separate query, name of missing table fails already in parser.
+ */
+static bool
+xpath_views_exist(void)
+{
+	return xml_index_table_exists("xml_xpath_views") &&
+			SPI_execute("SELECT 1 FROM xml_xpath_views LIMIT 1",
+					true, 1) == SPI_OK_SELECT && SPI_processed > 0;
+}
+
+/*
+ * Is some materialised XPath view maintained
+ */
+bool
+xml_xpath_views_enabled(void)
+{
+	bool		result;
+
+	SPI_connect();
+	result = xpath_views_exist();
+	SPI_finish();
+
+	return result;
+}
+
+/*
+ * Views as rows (name, xpaths), caller has to be connected to SPI
+ * @param count (out) number of views
+ */
+static SPITupleTable *
+read_views(int *count)
+{
+	if (SPI_execute("SELECT name, xpaths FROM xml_xpath_views ORDER BY name",
+			true, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read xml_xpath_views")));
+	}
+	*count = SPI_processed;
+
+	return SPI_tuptable;
+}
+
+static void
+execute_view_query(const char *query, int nargs, Oid *types, Datum *args,
+		int expected, const char *name)
+{
+	int			result = SPI_execute_with_args(query, nargs, types, args,
+			NULL, false, 0);
+
+	if (result < 0 || (expected != 0 && result != expected))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not refresh XPath view \"%s\"", name)));
+	}
+}
+
+/*
+ * Insert results of XPaths of view, of one document or of all documents
+ * @param did document, -1 for all shredded documents
+ * @return number of inserted rows
+ */
+static int64
+fill_view(const char *name, char **xpaths, int nxpaths, xml_label did, int layout)
+{
+	StringInfoData query;
+	Oid			types[2] = {TEXTOID, INT8OID};
+	Datum		args[2];
+	int64		rows = 0;
+	int			i;
+
+	initStringInfo(&query);
+	for (i = 0; i < nxpaths; i++)
+	{
+		// compiled query takes did as $1 when has_did is set
+		resetStringInfo(&query);
+		if (did >= 0)
+		{
+			types[0] = INT8OID;
+			types[1] = TEXTOID;
+			args[0] = Int64GetDatum(did);
+			args[1] = CStringGetTextDatum(xpaths[i]);
+			appendStringInfo(&query,
+					"INSERT INTO %s (did, xpath, pre_order, value) "
+					"SELECT q.did, $2, q.pre_order, q.value FROM (%s) q",
+					quote_identifier(name),
+					compile_xpath_shredded(xpaths[i], true, true, layout));
+		} else
+		{
+			types[0] = TEXTOID;
+			args[0] = CStringGetTextDatum(xpaths[i]);
+			appendStringInfo(&query,
+					"INSERT INTO %s (did, xpath, pre_order, value) "
+					"SELECT q.did, $1, q.pre_order, q.value FROM (%s) q",
+					quote_identifier(name),
+					compile_xpath_shredded(xpaths[i], false, true, layout));
+		}
+		execute_view_query(query.data, did >= 0 ? 2 : 1, types, args,
+				SPI_OK_INSERT, name);
+		rows += SPI_processed;
+	}
+	pfree(query.data);
+
+	return rows;
+}
+
+/*
+ * Delete rows of document from table of view
+ * @param did document, -1 for all documents
+ */
+static void
+clear_view(const char *name, xml_label did)
+{
+	StringInfoData query;
+	Oid			types[1] = {INT8OID};
+	Datum		args[1];
+
+	initStringInfo(&query);
+	if (did >= 0)
+	{
+		args[0] = Int64GetDatum(did);
+		appendStringInfo(&query, "DELETE FROM %s WHERE did = $1",
+				quote_identifier(name));
+		execute_view_query(query.data, 1, types, args, SPI_OK_DELETE, name);
+	} else
+	{
+		appendStringInfo(&query, "TRUNCATE %s", quote_identifier(name));
+		execute_view_query(query.data, 0, NULL, NULL, SPI_OK_UTILITY, name);
+	}
+	pfree(query.data);
+}
+
+/*
+ * Replace rows of document (or all documents) in every view
+ * @param did document, -1 for all shredded documents
+ * @param fill evaluate XPaths again, otherwise rows are only removed
+ * @return number of inserted rows
+ */
+static int64
+refresh_views(xml_label did, int layout, bool fill)
+{
+	SPITupleTable *views;
+	int			nviews;
+	int64		rows = 0;
+	int			i;
+
+	if (!xpath_views_exist())
+	{
+		return 0;
+	}
+
+	views = read_views(&nviews);
+	for (i = 0; i < nviews; i++)
+	{
+		char	   *name = SPI_getvalue(views->vals[i], views->tupdesc, 1);
+		bool		isnull;
+
+		clear_view(name, did);
+		if (fill)
+		{
+			int			nxpaths;
+			char	  **xpaths = text_array_to_cstrings(DatumGetArrayTypeP(
+					SPI_getbinval(views->vals[i], views->tupdesc, 2, &isnull)),
+					&nxpaths);
+
+			rows += fill_view(name, xpaths, nxpaths, did, layout);
+		}
+	}
+
+	return rows;
+}
+
+/*
+ * Evaluate XPaths of all views on just shredded document, old results of
+ * the document are replaced
+ * @param did shredded document
+ * @param layout LAYOUT_SEPARATE or LAYOUT_UNIFIED
+ */
+void
+xml_xpath_views_add_document(xml_label did, int layout)
+{
+	SPI_connect();
+	refresh_views(did, layout, true);
+	SPI_finish();
+}
+
+/*
+ * Remove results of document from all views
+ * @param did removed document
+ */
+void
+xml_xpath_views_remove_document(xml_label did)
+{
+	SPI_connect();
+	refresh_views(did, LAYOUT_SEPARATE, false);
+	SPI_finish();
+}
+
+/*
+ * Evaluate all views again on all shredded documents, used when shredded
+ * tables were filled without loader
+ * @return number of rows of all views
+ */
+int64
+xml_xpath_views_rebuild(int layout)
+{
+	int64		rows;
+
+	SPI_connect();
+	rows = refresh_views(-1, layout, true);
+	SPI_finish();
+
+	return rows;
+}
+
+/*
+ * Create table of view and fill it from shredded documents, view is kept
+ * up to date by loader from then
+ * @param name name of table
+ * @param xpaths array of XPath expressions
+ * @return number of rows
+ */
+Datum
+create_xpath_view(PG_FUNCTION_ARGS)
+{
+	char	   *name = text_to_cstring(PG_GETARG_TEXT_P(0));
+	ArrayType  *array = PG_GETARG_ARRAYTYPE_P(1);
+	char	  **xpaths;
+	int			nxpaths;
+	int			layout = get_index_layout();
+	StringInfoData query;
+	Oid			types[2] = {TEXTOID, TEXTARRAYOID};
+	Datum		args[2];
+	int64		rows;
+	int			i;
+
+	xpaths = text_array_to_cstrings(array, &nxpaths);
+	if (nxpaths == 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("XPath view \"%s\" has no XPath", name)));
+	}
+	// invalid expression is rejected before anything is created
+	for (i = 0; i < nxpaths; i++)
+	{
+		compile_xpath_shredded(xpaths[i], true, true, layout);
+	}
+
+	SPI_connect();
+
+	execute_view_query(
+			"CREATE TABLE IF NOT EXISTS xml_xpath_views "
+							"(name text PRIMARY KEY, "
+							"xpaths text[] not null); "
+			"DROP TRIGGER IF EXISTS xml_xpath_views_trigger ON xml_documents_table; "
+			"CREATE TRIGGER xml_xpath_views_trigger "
+				"AFTER DELETE OR UPDATE OF value ON xml_documents_table "
+				"FOR EACH ROW EXECUTE PROCEDURE xpath_views_document_trigger();",
+			0, NULL, NULL, 0, name);
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"CREATE TABLE %s "
+							"(did bigint not null, "
+							"xpath text not null, "
+							"pre_order bigint, "
+							"value text); "
+			"CREATE INDEX ON %s (did); "
+			"CREATE INDEX ON %s (xpath, value);",
+			quote_identifier(name), quote_identifier(name), quote_identifier(name));
+	execute_view_query(query.data, 0, NULL, NULL, 0, name);
+
+	args[0] = CStringGetTextDatum(name);
+	args[1] = PointerGetDatum(array);
+	execute_view_query("INSERT INTO xml_xpath_views VALUES ($1, $2)",
+			2, types, args, SPI_OK_INSERT, name);
+
+	rows = fill_view(name, xpaths, nxpaths, -1, layout);
+
+	SPI_finish();
+
+	PG_RETURN_INT64(rows);
+}
+
+/*
+ * Drop table of view, loader stops maintaining it
+ * @param name name of view
+ * @return false if view does not exist
+ */
+Datum
+drop_xpath_view(PG_FUNCTION_ARGS)
+{
+	char	   *name = text_to_cstring(PG_GETARG_TEXT_P(0));
+	StringInfoData query;
+	Oid			types[1] = {TEXTOID};
+	Datum		args[1];
+	bool		result = false;
+
+	SPI_connect();
+
+	args[0] = CStringGetTextDatum(name);
+	if (xml_index_table_exists("xml_xpath_views"))
+	{
+		execute_view_query("DELETE FROM xml_xpath_views WHERE name = $1",
+				1, types, args, SPI_OK_DELETE, name);
+		result = SPI_processed > 0;
+	}
+
+	if (result)
+	{
+		initStringInfo(&query);
+		appendStringInfo(&query, "DROP TABLE %s", quote_identifier(name));
+		execute_view_query(query.data, 0, NULL, NULL, SPI_OK_UTILITY, name);
+	}
+
+	SPI_finish();
+
+	PG_RETURN_BOOL(result);
+}
+
+/*
+ * Trigger on xml_documents_table, results of deleted document (or document
+ * with changed value, until it is shredded again) are removed from views
+ */
+Datum
+xpath_views_document_trigger(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+	bool		isnull;
+	Datum		did;
+
+	if (!CALLED_AS_TRIGGER(fcinfo) || !TRIGGER_FIRED_FOR_ROW(trigdata->tg_event) ||
+			!TRIGGER_FIRED_AFTER(trigdata->tg_event))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("xpath_views_document_trigger must be fired after row change")));
+	}
+
+	// did is first column of xml_documents_table
+	did = heap_getattr(trigdata->tg_trigtuple, 1,
+			RelationGetDescr(trigdata->tg_relation), &isnull);
+	if (!isnull)
+	{
+		xml_xpath_views_remove_document(DatumGetInt64(did));
+	}
+
+	return PointerGetDatum(NULL);
+}
@@ -28,12 +28,15 @@
 	#include <libxml/xmlreader.h>
 #endif   /* USE_LIBXML */
 
+#include "access/xact.h"
+#include "access/xlog.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_type.h"
 #include "commands/dbcommands.h"
 #include "executor/executor.h"
 #include "executor/spi.h"
 #include "fmgr.h"
+#include "funcapi.h"
 #include "lib/stringinfo.h"
 #include "libpq/pqformat.h"
 #include "mb/pg_wchar.h"
@@ -56,27 +59,58 @@ int debug_level;
 /* externally accessible functions */
 Datum	build_xmlindex(PG_FUNCTION_ARGS);
 Datum	create_xmlindex_tables(PG_FUNCTION_ARGS);
+Datum	xmlindex_needs_rebuild(PG_FUNCTION_ARGS);
+Datum	rebuild_xmlindex(PG_FUNCTION_ARGS);
+Datum	rebuild_xmlindex_part(PG_FUNCTION_ARGS);
+Datum	build_xmlindex_xsd(PG_FUNCTION_ARGS);
+Datum	build_xmlindex_rng(PG_FUNCTION_ARGS);
+Datum	build_xmlindex_dtd(PG_FUNCTION_ARGS);
+Datum	xml_shred(PG_FUNCTION_ARGS);
+Datum	register_xmldocument(PG_FUNCTION_ARGS);
+Datum	xmlindex_ensure_shredded(PG_FUNCTION_ARGS);
+Datum	evict_xmlindex(PG_FUNCTION_ARGS);
+Datum	enqueue_xmldocument(PG_FUNCTION_ARGS);
+Datum	process_xmlindex_queue(PG_FUNCTION_ARGS);
+Datum	xmlindex_is_current(PG_FUNCTION_ARGS);
 //Datum	is_ancestor(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(build_xmlindex);
 PG_FUNCTION_INFO_V1(create_xmlindex_tables);
+PG_FUNCTION_INFO_V1(xmlindex_needs_rebuild);
+PG_FUNCTION_INFO_V1(rebuild_xmlindex);
+PG_FUNCTION_INFO_V1(rebuild_xmlindex_part);
+PG_FUNCTION_INFO_V1(build_xmlindex_xsd);
+PG_FUNCTION_INFO_V1(build_xmlindex_rng);
+PG_FUNCTION_INFO_V1(build_xmlindex_dtd);
+PG_FUNCTION_INFO_V1(xml_shred);
+PG_FUNCTION_INFO_V1(register_xmldocument);
+PG_FUNCTION_INFO_V1(xmlindex_ensure_shredded);
+PG_FUNCTION_INFO_V1(evict_xmlindex);
+PG_FUNCTION_INFO_V1(enqueue_xmldocument);
+PG_FUNCTION_INFO_V1(process_xmlindex_queue);
+PG_FUNCTION_INFO_V1(xmlindex_is_current);
 //PG_FUNCTION_INFO_V1(is_ancestor);
 
 /* ordinary internal (static) functions */
-int4 insert_xmldata_into_table(char* xmldata, char* name);
-bool create_indexes_on_tables(void);
+bool shred_xml_document(xmltype *xmldata, text *xml_name,
+		xml_shred_spec_ptr spec, xml_validation_spec_ptr validation);
+Datum build_xmlindex_validated(PG_FUNCTION_ARGS, int kind);
+char** text_array_to_cstrings(ArrayType* array, int* count);
+bool shredded_tables_incomplete(void);
+int4 reshred_documents(int4 nparts, int4 part);
+static void append_lost_condition(StringInfo query);
 
 /*
- * Internal function which add XML data into xml_documents_table and return
- * ID of just inserted data
+ * Add XML data into xml_documents_table without state of shredding, used
+ * for documents which never go to shredded tables (inlined documents)
  * @param xmldata
  * @param name name of XML document
- * @return SQL int (value from serial sequence)
+ * @return SQL int or bigint (value from serial sequence)
  */
-int4
-insert_xmldata_into_table(char* xmldata, char* name)
+xml_label
+insert_xmldata(char* xmldata, char* name)
 {
-	int4 result = -1;
+	xml_label result = -1;
 	StringInfoData query;
 
 	// for select result
@@ -85,42 +119,29 @@ insert_xmldata_into_table(char* xmldata, char* name)
 	SPITupleTable	*tuptable;
 	char			*rowIdStr;	// data are returned as string
 
-/*
 	Oid oids[2];
 	Datum data[2];
 
+	// text and xml share the varlena representation, so both parameters
+	// can be passed as text datums; the source document must be stored,
+	// because it is the only way to rebuild unlogged shredded tables
 	oids[0] = TEXTOID;
 	oids[1] = XMLOID;
 
-	data[0] = CStringGetDatum(name);
-	data[1] = CStringGetDatum(xmldata);
-*/
+	data[0] = CStringGetTextDatum(name);
+	data[1] = CStringGetTextDatum(xmldata);
 
 	SPI_connect();
 
-/*
-// IT's not working !!
-	if (SPI_execute_with_args("INSERT INTO xml_documents_table(name, value) VALUES ($1, $2)",
-			2, oids, data, NULL, false, 0) != SPI_OK_INSERT)
-	{
-		ereport(ERROR,
-				(errcode(ERRCODE_DATA_EXCEPTION),
-				 errmsg("Can not insert values into xml_documents_table")));
-	}
-*/
-
-
-// IT's working
-
 	initStringInfo(&query);
-	appendStringInfo(&query, "INSERT INTO xml_documents_table(name) VALUES ('%s')", name);
-	elog(INFO, "=== will be queried: %s", query.data);
+	appendStringInfo(&query, "INSERT INTO xml_documents_table(name, value) VALUES ($1, $2)");
+	elog(DEBUG2, "=== will be queried: %s", query.data);
 
-	if (SPI_execute(query.data,	false, 0) != SPI_OK_INSERT)
+	if (SPI_execute_with_args(query.data, 2, oids, data, NULL, false, 0) != SPI_OK_INSERT)
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_DATA_EXCEPTION),
-				 errmsg("Can not get ID of lastly inserted XML document")));
+				 errmsg("Can not insert values into xml_documents_table")));
 	}
 
 	SPI_finish();
@@ -141,9 +162,9 @@ insert_xmldata_into_table(char* xmldata, char* name)
 		row = tuptable->vals[0];
 
 		rowIdStr = SPI_getvalue(row, tupdesc, 1);
-		result = atoi(rowIdStr);
+		result = strtoll(rowIdStr, NULL, 10);
 		
-		elog(INFO, "ID int of inserted row %d", result);
+		elog(DEBUG2, "ID int of inserted row " XML_LABEL_FORMAT, result);
 	}
 
 	SPI_finish();
@@ -152,83 +173,278 @@ insert_xmldata_into_table(char* xmldata, char* name)
 }
 
 /*
- * Create indexes on shreded data
- * @return true if succed
+ * Internal function which add XML data into xml_documents_table and return
+ * ID of just inserted data
+ * @param xmldata
+ * @param name name of XML document
+ * @param shredded document is shredded by caller, otherwise it is shredded
+ * lazily by ensure_document_shredded
+ * @return SQL int or bigint (value from serial sequence)
  */
-bool
-create_indexes_on_tables(void)
+xml_label
+insert_xmldata_into_table(char* xmldata, char* name, bool shredded)
 {
-	bool result = false;
+	xml_label result = insert_xmldata(xmldata, name);
+	Oid oids[2];
+	Datum data[2];
+
+	oids[0] = INT8OID;
+	oids[1] = BOOLOID;
+	data[0] = Int64GetDatum(result);
+	data[1] = BoolGetDatum(shredded);
 
 	SPI_connect();
 
-	if (SPI_execute("CREATE INDEX attr_tab_all_index ON attribute_table (name, did, pre_order); "
-					"CREATE INDEX attr_tab_range_index ON element_table USING gist (range_i(pre_order, (pre_order+size)));"
-					"CREATE INDEX did_tab_name_index ON xml_documents_table (name); "
-					"CREATE INDEX elem_tab_all_index ON element_table (name, did, pre_order, size); "
-					"CREATE INDEX elem_tab_range_index ON element_table USING gist (range(pre_order, (pre_order+size)));"
-					"CREATE INDEX text_tab_index ON text_table (parent_id,did);"
-					,
-					false, 0) == SPI_ERROR_PARAM)
+	if (SPI_execute_with_args("INSERT INTO xml_shred_state(did, shredded) VALUES ($1, $2)",
+			2, oids, data, NULL, false, 0) != SPI_OK_INSERT)
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_DATA_EXCEPTION),
-				 errmsg("Can not get ID of lastly inserted XML document")));
+				 errmsg("Can not insert values into xml_shred_state")));
 	}
 
-	result = true;
 	SPI_finish();
 
 	return result;
 }
 
+/*
+ * Secondary index on shredded table, created after bulk load and dropped
+ * before it
+ */
+typedef struct
+{
+	const char *name;
+	const char *definition;		// table and columns of CREATE INDEX
+} shredded_index;
+
+static const shredded_index unified_indexes[] = {
+	{"node_tab_all_index", "node_table (kind, name, did, pre_order, size)"},
+	{"node_tab_parent_index", "node_table (did, parent_id)"},
+	{"node_tab_sibling_index", "node_table (did, parent_id, name, sibling_ord) WHERE kind = 1"},
+	{"node_tab_range_index", "node_table USING gist (node_interval(did, pre_order, size))"},
+	{"node_tab_plane_index", "node_table USING gist (xml_plane_point(did, pre_order, size, depth))"},
+	{"node_tab_value_index", "node_table (xml_attribute_key(name, value), did, parent_id) WHERE kind = 2"},
+	{NULL, NULL}
+};
+
+static const shredded_index separate_indexes[] = {
+	{"attr_tab_all_index", "attribute_table (name, did, pre_order)"},
+	{"attr_tab_range_index", "attribute_table USING gist (node_interval(did, pre_order, size))"},
+	{"attr_tab_value_index", "attribute_table (xml_attribute_key(name, value), did, parent_id)"},
+	{"elem_tab_all_index", "element_table (name, did, pre_order, size)"},
+	{"elem_tab_sibling_index", "element_table (did, parent_id, name, sibling_ord)"},
+	{"elem_tab_range_index", "element_table USING gist (node_interval(did, pre_order, size))"},
+	{"elem_tab_plane_index", "element_table USING gist (xml_plane_point(did, pre_order, size, depth))"},
+	{"text_tab_index", "text_table (parent_id, did)"},
+	{NULL, NULL}
+};
+
+/*
+ * Create indexes on shreded data
+ * @param layout LAYOUT_SEPARATE or LAYOUT_UNIFIED
+ * @return true if succed
+ */
+bool
+create_indexes_on_tables(int layout)
+{
+	const shredded_index *index;
+	StringInfoData query;
+
+	SPI_connect();
+
+	initStringInfo(&query);
+	for (index = layout == LAYOUT_UNIFIED ? unified_indexes : separate_indexes;
+			index->name != NULL; index++)
+	{
+		resetStringInfo(&query);
+		appendStringInfo(&query, "CREATE INDEX %s ON %s", index->name,
+				index->definition);
+		if (SPI_execute(query.data, false, 0) != SPI_OK_UTILITY)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not create index %s", index->name)));
+		}
+	}
+
+	SPI_finish();
+
+	return true;
+}
+
+/*
+ * Drop secondary indexes on shreded data, so bulk reload of tables don't
+ * have to maintain them row by row. Primary keys are kept.
+ * @param layout LAYOUT_SEPARATE or LAYOUT_UNIFIED
+ * @return true if succed
+ */
+bool
+drop_indexes_on_tables(int layout)
+{
+	const shredded_index *index;
+	StringInfoData query;
+
+	SPI_connect();
+
+	initStringInfo(&query);
+	for (index = layout == LAYOUT_UNIFIED ? unified_indexes : separate_indexes;
+			index->name != NULL; index++)
+	{
+		resetStringInfo(&query);
+		appendStringInfo(&query, "DROP INDEX IF EXISTS %s", index->name);
+		if (SPI_execute(query.data, false, 0) != SPI_OK_UTILITY)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not drop index %s", index->name)));
+		}
+	}
+
+	SPI_finish();
+
+	return true;
+}
+
 /*
  * Create tables as storage of shreded data
- * @param none
+ * @param unlogged (optional) create shredded tables as UNLOGGED, they are
+ *		derived data which can be rebuilt by rebuild_xmlindex() after crash
+ * @param wide_labels (optional) store document ids and node labels as bigint,
+ *		for single huge documents or collections with billions of nodes
+ * @param unified (optional) store all nodes in single node_table instead of
+ *		element_table, attribute_table and text_table
  * @return true/false
  */
 Datum
 create_xmlindex_tables(PG_FUNCTION_ARGS)
 {
 	StringInfoData query;
+	bool		unlogged = false;
+	bool		wide_labels = false;
+	bool		unified = false;
+	const char *persistence;
+	const char *label;
+
+	if (PG_NARGS() > 0)
+	{
+		unlogged = PG_GETARG_BOOL(0);
+	}
+	if (PG_NARGS() > 1)
+	{
+		wide_labels = PG_GETARG_BOOL(1);
+	}
+	if (PG_NARGS() > 2)
+	{
+		unified = PG_GETARG_BOOL(2);
+	}
+
+	// xml_documents_table is the source of truth, it stays WAL-logged
+	persistence = unlogged ? "UNLOGGED " : "";
+	// loader works with 64 bit labels, int columns reject overflowed values
+	label = wide_labels ? "bigint" : "int";
 
 	initStringInfo(&query);
 	appendStringInfo(&query,
 			"CREATE TABLE xml_documents_table "
-							"(did serial not null, "
+							"(did %s not null, "
 							"name text, "
 							"value xml,"
 							"xdb_sequence int default 0); "
-			"CREATE TABLE attribute_table "
-							"(name text, "
-							"did int not null, "
-							"pre_order int not null, "
-							"size int not null, "
-							"depth int, "
-							"parent_id int, "
-							"prev_id int, "
-							"value text,"
-							"PRIMARY KEY (did,pre_order)); "
-			"CREATE TABLE element_table "
-							"(name text, "
-							"did int not null, "
-							"pre_order int not null, "
-							"size int not null, "
-							"depth int, "
-							"parent_id int, "
-							"prev_id int, "
-							"child_id int, "
-							"attr_id int, "
-							"PRIMARY KEY (did,pre_order,size));"
-			"CREATE TABLE text_table "
-							"(did int not null, "
-							"pre_order int not null, "
-							"depth int not null, "
-							"parent_id int, "
-							"prev_id int, "
-							"value text, "
-							"PRIMARY KEY  (pre_order, did));"
-			);
+			"CREATE INDEX did_tab_name_index ON xml_documents_table (name); ",
+			wide_labels ? "bigserial" : "serial");
+	// loader reads layout from here
+	appendStringInfo(&query,
+			"CREATE TABLE xml_index_settings "
+							"(name text PRIMARY KEY, "
+							"value text); "
+			"INSERT INTO xml_index_settings VALUES "
+							"('layout', '%s'), "
+							"('labels', '%s'), "
+							"('unlogged', '%s'); ",
+			unified ? "unified" : "separate", label, unlogged ? "true" : "false");
+	// documents registered by register_xmldocument are shredded on demand
+	appendStringInfo(&query,
+			"CREATE TABLE xml_shred_state "
+							"(did %s PRIMARY KEY, "
+							"shredded boolean not null default false, "
+							"last_access timestamptz not null default now()); ",
+			label);
+	// documents shredded by loader, truncated by crash recovery together
+	// with unlogged shredded tables
+	appendStringInfo(&query,
+			"CREATE %sTABLE xml_shredded_documents "
+							"(did %s PRIMARY KEY); ",
+			persistence, label);
+	// documents waiting for process_xmlindex_queue
+	appendStringInfo(&query,
+			"CREATE TABLE xml_shred_queue "
+							"(did %s PRIMARY KEY, "
+							"enqueued timestamptz not null default now()); ",
+			label);
+
+	if (unified)
+	{
+		// kind is NODE_KIND_ELEMENT, NODE_KIND_ATTRIBUTE or NODE_KIND_TEXT,
+		// name is NULL for text, value is NULL for elements
+		appendStringInfo(&query,
+				"CREATE %sTABLE node_table "
+								"(did %s not null, "
+								"pre_order %s not null, "
+								"size %s not null, "
+								"kind smallint not null, "
+								"name text, "
+								"depth int, "
+								"parent_id %s, "
+								"prev_id %s, "
+								"child_id %s, "
+								"attr_id %s, "
+								"value text, "
+								"next_id %s, "
+								"sibling_ord int, "
+								"PRIMARY KEY (did,pre_order));",
+				persistence, label, label, label, label, label, label, label, label);
+	}
+	else
+	{
+		appendStringInfo(&query,
+				"CREATE %sTABLE attribute_table "
+								"(name text, "
+								"did %s not null, "
+								"pre_order %s not null, "
+								"size %s not null, "
+								"depth int, "
+								"parent_id %s, "
+								"prev_id %s, "
+								"value text,"
+								"PRIMARY KEY (did,pre_order)); ",
+				persistence, label, label, label, label, label);
+		appendStringInfo(&query,
+				"CREATE %sTABLE element_table "
+								"(name text, "
+								"did %s not null, "
+								"pre_order %s not null, "
+								"size %s not null, "
+								"depth int, "
+								"parent_id %s, "
+								"prev_id %s, "
+								"child_id %s, "
+								"attr_id %s, "
+								"next_id %s, "
+								"sibling_ord int, "
+								"PRIMARY KEY (did,pre_order,size));",
+				persistence, label, label, label, label, label, label, label, label);
+		appendStringInfo(&query,
+				"CREATE %sTABLE text_table "
+								"(did %s not null, "
+								"pre_order %s not null, "
+								"depth int not null, "
+								"parent_id %s, "
+								"prev_id %s, "
+								"value text, "
+								"PRIMARY KEY  (pre_order, did));",
+				persistence, label, label, label, label);
+	}
 
 	SPI_connect();
 
@@ -243,64 +459,1014 @@ create_xmlindex_tables(PG_FUNCTION_ARGS)
 
 	SPI_finish();
 
-	create_indexes_on_tables();
+	create_indexes_on_tables(unified ? LAYOUT_UNIFIED : LAYOUT_SEPARATE);
 
 	PG_RETURN_BOOL(true);
 }
 
 /*
- * Entry point for native XML support, shred XML document into tables and
- * create indexes for future XQuery support
- * @param
- * @return
+ * Convert text[] into array of C strings, NULL elements are skipped
+ * @param array SQL array of text
+ * @param count (out) number of returned strings
+ * @return palloced array of strings
  */
-Datum
-build_xmlindex(PG_FUNCTION_ARGS)
+char**
+text_array_to_cstrings(ArrayType* array, int* count)
+{
+	Datum	*elems;
+	bool	*nulls;
+	int		nelems;
+	int		i;
+	char	**result;
+
+	deconstruct_array(array, TEXTOID, -1, false, 'i',
+			&elems, &nulls, &nelems);
+
+	result = (char **) palloc(sizeof(char *) * (nelems + 1));
+	*count = 0;
+	for (i = 0; i < nelems; i++)
+	{
+		if (!nulls[i])
+		{
+			result[(*count)++] = TextDatumGetCString(elems[i]);
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Store XML document into xml_documents_table and shred it
+ * @param xmldata document
+ * @param xml_name name of document
+ * @param spec selective shredding specification, NULL for full shredding
+ * @param validation schema checked while shredding, NULL for none
+ * @return true if document was shredded
+ */
+bool
+shred_xml_document(xmltype *xmldata, text *xml_name, xml_shred_spec_ptr spec,
+		xml_validation_spec_ptr validation)
 {
-    xmltype     *xmldata    = NULL;
     char        *xmldataint = NULL;
-	text		*xml_name	= NULL;
 	char		*xml_nameint;
 	int			xmldatalen	= -1;
 	int			loader_return = 0;	// false
-	int4		did;
+	xml_label	did;
 
-
-#ifdef USE_LIBXML
-	elog(INFO, "build_xmlindex started");
-
-	xmldata     = PG_GETARG_XML_P(0);
-    xmldataint  = VARDATA(xmldata);
+	xmldataint  = text_to_cstring((text *) xmldata);
 	xmldatalen  = VARSIZE(xmldata) - VARHDRSZ;
-	xmldataint[xmldatalen] = 0;
+	xml_nameint	= text_to_cstring(xml_name);
 
-	xml_name	= PG_GETARG_TEXT_P(1);
-	xml_nameint	= VARDATA(xml_name);
-	xml_nameint[VARSIZE(xml_name) - VARHDRSZ] = 0;
-	
 	//initialize LibXML structures, if allready done -> do nothing
     pg_xml_init();
 	xmlInitParser();
 
 
-	did = insert_xmldata_into_table(xmldataint, xml_nameint);
+	did = insert_xmldata_into_table(xmldataint, xml_nameint, true);
+
+	loader_return = xml_index_entry(xmldataint, xmldatalen, did, spec,
+			validation);
+
+	return loader_return == XML_INDEX_LOADER_SUCCES;
+}
+
+/*
+ * Entry point for native XML support, shred XML document into tables and
+ * create indexes for future XQuery support
+ * @param xml document
+ * @param name name of document
+ * @param include (optional) paths of subtrees to shred, empty means all
+ * @param exclude (optional) paths of subtrees which are not shredded
+ * @param keep_text (optional) store text nodes
+ * @return
+ */
+Datum
+build_xmlindex(PG_FUNCTION_ARGS)
+{
+	xml_shred_spec_ptr spec = NULL;
+	char		**include;
+	char		**exclude;
+	int			ninclude;
+	int			nexclude;
+	bool		result;
+
+
+#ifdef USE_LIBXML
+	elog(INFO, "build_xmlindex started");
+
+	if (PG_NARGS() > 2)
+	{
+		// specification is checked before document is stored
+		include = text_array_to_cstrings(PG_GETARG_ARRAYTYPE_P(2), &ninclude);
+		exclude = text_array_to_cstrings(PG_GETARG_ARRAYTYPE_P(3), &nexclude);
+		spec = create_shred_spec(include, ninclude, exclude, nexclude,
+				PG_GETARG_BOOL(4));
+	}
+
+	result = shred_xml_document(PG_GETARG_XML_P(0), PG_GETARG_TEXT_P(1), spec,
+			NULL);
 
-	loader_return = xml_index_entry(xmldataint, xmldatalen, did);
-	
 	elog(INFO, "build_xmlindex ended");
-	if (loader_return == XML_INDEX_LOADER_SUCCES)
+	PG_RETURN_BOOL(result);
+#else
+    NO_XML_SUPPORT();
+    PG_RETURN_BOOL (false);
+#endif
+}
+
+/*
+ * Shred XML document validated against schema in the same pass of reader,
+ * invalid document is rejected by ERROR
+ * @param xml document
+ * @param name name of document
+ * @param schema xsd, rng or dtd value, kind given by called SQL function
+ * @return true if document was shredded
+ */
+Datum
+build_xmlindex_validated(PG_FUNCTION_ARGS, int kind)
+{
+	xml_validation_spec validation;
+
+#ifdef USE_LIBXML
+	validation.kind = kind;
+	validation.schema = text_to_cstring(PG_GETARG_TEXT_P(2));
+	validation.length = strlen(validation.schema);
+
+	PG_RETURN_BOOL(shred_xml_document(PG_GETARG_XML_P(0), PG_GETARG_TEXT_P(1),
+			NULL, &validation));
+#else
+    NO_XML_SUPPORT();
+    PG_RETURN_BOOL (false);
+#endif
+}
+
+Datum
+build_xmlindex_xsd(PG_FUNCTION_ARGS)
+{
+	return build_xmlindex_validated(fcinfo, VALIDATE_XSD);
+}
+
+Datum
+build_xmlindex_rng(PG_FUNCTION_ARGS)
+{
+	return build_xmlindex_validated(fcinfo, VALIDATE_RNG);
+}
+
+Datum
+build_xmlindex_dtd(PG_FUNCTION_ARGS)
+{
+	return build_xmlindex_validated(fcinfo, VALIDATE_DTD);
+}
+
+/*
+ * Record document shredded by loader. Selective shredding can store no node
+ * of document, so completion is not derived from rows of shredded tables.
+ * @param did shredded document
+ */
+void
+mark_document_shredded(xml_label did)
+{
+	Oid			oids[1] = {INT8OID};
+	Datum		data[1];
+
+	SPI_connect();
+
+	data[0] = Int64GetDatum(did);
+	// tables created before xml_shredded_documents existed have no marks
+	if (xml_index_table_exists("xml_shredded_documents") &&
+			SPI_execute_with_args("INSERT INTO xml_shredded_documents (did) "
+							"SELECT $1 WHERE NOT EXISTS "
+							"(SELECT 1 FROM xml_shredded_documents WHERE did = $1)",
+				1, oids, data, NULL, false, 0) != SPI_OK_INSERT)
 	{
-		PG_RETURN_BOOL(true);
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not insert values into xml_shredded_documents")));
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Append condition on stored document d, which has to be shredded again.
+ * xml_shredded_documents has persistence of shredded tables, so crash
+ * recovery truncates it together with unlogged tables. Documents waiting for
+ * lazy shredding are not lost. Tables created without
+ * xml_shredded_documents are checked by rows of document. Caller has to be
+ * connected to SPI.
+ */
+static void
+append_lost_condition(StringInfo query)
+{
+	appendStringInfoString(query,
+			"d.value IS NOT NULL AND NOT EXISTS "
+			"(SELECT 1 FROM xml_shred_state s WHERE s.did = d.did AND NOT s.shredded) ");
+	// inlined documents are stored in typed tables only
+	if (xml_index_table_exists("xml_inlined_documents"))
+	{
+		appendStringInfoString(query,
+				"AND NOT EXISTS (SELECT 1 FROM xml_inlined_documents i "
+				"WHERE i.did = d.did) ");
+	}
+	if (xml_index_table_exists("xml_shredded_documents"))
+	{
+		appendStringInfoString(query,
+				"AND NOT EXISTS (SELECT 1 FROM xml_shredded_documents m "
+				"WHERE m.did = d.did)");
 	} else
 	{
-		PG_RETURN_BOOL(false);
+		appendStringInfo(query,
+				"AND NOT EXISTS (SELECT 1 FROM %s e WHERE e.did = d.did)",
+				get_index_layout() == LAYOUT_UNIFIED ? "node_table" : "element_table");
+	}
+}
+
+/*
+ * Detect shredded tables, which lost their content. Unlogged tables are
+ * truncated during crash recovery, so stored document which is not marked
+ * as shredded means that shredded data must be rebuilt.
+ * @return true if some stored document is not shredded
+ */
+bool
+shredded_tables_incomplete(void)
+{
+	bool result = false;
+	StringInfoData query;
+
+	SPI_connect();
+
+	initStringInfo(&query);
+	appendStringInfoString(&query,
+			"SELECT EXISTS (SELECT 1 FROM xml_documents_table d WHERE ");
+	append_lost_condition(&query);
+	appendStringInfoChar(&query, ')');
+
+	if (SPI_execute(query.data, true, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not check state of shredded tables")));
+	}
+
+	if (SPI_tuptable != NULL && SPI_processed > 0)
+	{
+		result = (strcmp(SPI_getvalue(SPI_tuptable->vals[0],
+						SPI_tuptable->tupdesc, 1), "t") == 0);
+	}
+
+	SPI_finish();
+
+	return result;
+}
+
+/*
+ * Shred again stored documents which are not marked as shredded (except
+ * documents waiting for lazy shredding). Documents
+ * are split into nparts partitions by did, so several sessions can reshred
+ * the collection in parallel, each one with its own part.
+ * @param nparts number of partitions
+ * @param part partition processed by this call (0 .. nparts-1)
+ * @return number of shredded documents
+ */
+int4
+reshred_documents(int4 nparts, int4 part)
+{
+	int4		count = 0;
+	Oid			oids[2];
+	Datum		data[2];
+	Portal		portal;
+	HeapTuple	row;
+	TupleDesc	tupdesc;
+	bool		isnull;
+	xml_label	did;
+	char		*xmldoc;
+	StringInfoData query;
+
+	oids[0] = INT4OID;
+	oids[1] = INT4OID;
+	data[0] = Int32GetDatum(nparts);
+	data[1] = Int32GetDatum(part);
+
+	pg_xml_init();
+	xmlInitParser();
+
+	SPI_connect();
+
+	initStringInfo(&query);
+	appendStringInfoString(&query,
+			"SELECT d.did::bigint, d.value::text FROM xml_documents_table d "
+			"WHERE d.did % $1 = $2 AND ");
+	append_lost_condition(&query);
+	appendStringInfoString(&query, " ORDER BY d.did");
+
+	portal = SPI_cursor_open_with_args(NULL, query.data,
+			2, oids, data, NULL, true, 0);
+
+	for (;;)
+	{
+		SPI_cursor_fetch(portal, true, 1);
+
+		if (SPI_processed == 0 || SPI_tuptable == NULL)
+		{
+			break;
+		}
+
+		row = SPI_tuptable->vals[0];
+		tupdesc = SPI_tuptable->tupdesc;
+
+		did = DatumGetInt64(SPI_getbinval(row, tupdesc, 1, &isnull));
+		xmldoc = SPI_getvalue(row, tupdesc, 2);
+
+		SPI_freetuptable(SPI_tuptable);
+
+		if (xml_index_entry(xmldoc, strlen(xmldoc), did, NULL, NULL) != XML_INDEX_LOADER_SUCCES)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not shred XML document " XML_LABEL_FORMAT, did)));
+		}
+
+		pfree(xmldoc);
+		count++;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+
+	return count;
+}
+
+/*
+ * Check if shredded tables have to be rebuilt (typically unlogged tables
+ * after crash recovery)
+ * @return true/false
+ */
+Datum
+xmlindex_needs_rebuild(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(shredded_tables_incomplete());
+}
+
+/*
+ * Rebuild shredded tables from documents stored in xml_documents_table.
+ * Tables are truncated and reloaded without secondary indexes, which are
+ * created again at the end (bulk load).
+ * @param force rebuild even when no lost document was detected
+ * @return number of shredded documents
+ */
+Datum
+rebuild_xmlindex(PG_FUNCTION_ARGS)
+{
+	bool	force = PG_GETARG_BOOL(0);
+	int4	count;
+	int		layout;
+
+#ifdef USE_LIBXML
+	if (!force && !shredded_tables_incomplete())
+	{
+		PG_RETURN_INT32(0);
 	}
+
+	layout = get_index_layout();
+	drop_indexes_on_tables(layout);
+
+	SPI_connect();
+
+	if (SPI_execute(layout == LAYOUT_UNIFIED ? "TRUNCATE node_table" :
+					"TRUNCATE element_table, attribute_table, text_table",
+			false, 0) != SPI_OK_UTILITY ||
+			(xml_index_table_exists("xml_shredded_documents") &&
+			 SPI_execute("TRUNCATE xml_shredded_documents", false, 0) != SPI_OK_UTILITY))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not truncate shredded tables")));
+	}
+
+	SPI_finish();
+
+	// postings are appended again by loader
+	if (xml_postings_enabled())
+	{
+		SPI_connect();
+		if (SPI_execute("TRUNCATE xml_tag_postings", false, 0) != SPI_OK_UTILITY)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not truncate xml_tag_postings")));
+		}
+		SPI_finish();
+	}
+	if (xml_keywords_enabled())
+	{
+		SPI_connect();
+		if (SPI_execute("TRUNCATE xml_keywords", false, 0) != SPI_OK_UTILITY)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not truncate xml_keywords")));
+		}
+		SPI_finish();
+	}
+
+	count = reshred_documents(1, 0);
+
+	// loader sorts rows only within one flushed batch, table is clustered
+	// before secondary indexes exist
+	if (layout == LAYOUT_UNIFIED)
+	{
+		SPI_connect();
+		if (SPI_execute("CLUSTER node_table USING node_table_pkey", false, 0) != SPI_OK_UTILITY)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not cluster node_table")));
+		}
+		SPI_finish();
+	}
+
+	create_indexes_on_tables(layout);
+
+	PG_RETURN_INT32(count);
 #else
-    NO_XML_SUPPORT();
-    PG_RETURN_BOOL (false);
+	NO_XML_SUPPORT();
+	PG_RETURN_INT32(0);
+#endif
+}
+
+/*
+ * Reshred one partition of lost documents, without truncating or reindexing.
+ * Run it from nparts sessions (part = 0 .. nparts-1) to rebuild in parallel.
+ * @param nparts number of partitions
+ * @param part partition processed by this call
+ * @return number of shredded documents
+ */
+Datum
+rebuild_xmlindex_part(PG_FUNCTION_ARGS)
+{
+	int4	nparts = PG_GETARG_INT32(0);
+	int4	part = PG_GETARG_INT32(1);
+
+#ifdef USE_LIBXML
+	if (nparts < 1 || part < 0 || part >= nparts)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid partition %d of %d", part, nparts)));
+	}
+
+	PG_RETURN_INT32(reshred_documents(nparts, part));
+#else
+	NO_XML_SUPPORT();
+	PG_RETURN_INT32(0);
+#endif
+}
+
+/*
+ * Shred document without storing it, rows are produced by the same loader
+ * as build_xmlindex uses (unified layout columns) and returned one per call
+ * @param xml document
+ * @return set of (kind, pre_order, size, depth, parent_id, prev_id, name,
+ * value) in pre order
+ */
+Datum
+xml_shred(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	xml_node_rows_ptr rows;
+	xml_node_row *row;
+	Datum		values[8];
+	bool		nulls[8];
+	HeapTuple	tuple;
+
+#ifdef USE_LIBXML
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc	tupdesc;
+		xmltype    *xmldata;
+		char	   *xmldataint;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("function returning record called in context "
+							"that cannot accept type record")));
+		}
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		xmldata = PG_GETARG_XML_P(0);
+		xmldataint = text_to_cstring((text *) xmldata);
+
+		//initialize LibXML structures, if allready done -> do nothing
+		pg_xml_init();
+		xmlInitParser();
+
+		// rows live until last call
+		rows = (xml_node_rows_ptr) palloc0(sizeof(xml_node_rows));
+		if (xml_index_collect(xmldataint, VARSIZE(xmldata) - VARHDRSZ, rows)
+				!= XML_INDEX_LOADER_SUCCES)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_XML_DOCUMENT),
+					 errmsg("Failed to parse XML document")));
+		}
+		pfree(xmldataint);
+
+		funcctx->user_fctx = rows;
+		funcctx->max_calls = rows->count;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	rows = (xml_node_rows_ptr) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		row = &rows->rows[funcctx->call_cntr];
+
+		memset(nulls, false, sizeof(nulls));
+		values[0] = Int32GetDatum(row->kind);
+		values[1] = Int64GetDatum(row->order);
+		values[2] = Int64GetDatum(row->size);
+		values[3] = Int32GetDatum(row->depth);
+		values[4] = Int64GetDatum(row->parent_id);
+		values[5] = Int64GetDatum(row->prev_id);
+		if (row->name != NULL)
+		{
+			values[6] = CStringGetTextDatum(row->name);
+		} else
+		{
+			nulls[6] = true;
+		}
+		if (row->value != NULL)
+		{
+			values[7] = CStringGetTextDatum(row->value);
+		} else
+		{
+			nulls[7] = true;
+		}
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+#else
+	NO_XML_SUPPORT();
+	PG_RETURN_NULL();
+#endif
+}
+
+/*
+ * Shred document registered for lazy shredding, if it isn't shredded yet.
+ * State row is locked, so concurrent callers wait for the first one and
+ * then find the document shredded. Should be called by every function which
+ * reads shredded tables of one document. Not shredded document can't be
+ * shredded in read only transaction (or on standby), it is an error.
+ * @param did document
+ * @return true if document was shredded by this call
+ */
+bool
+ensure_document_shredded(xml_label did)
+{
+	Oid			oids[1];
+	Datum		data[1];
+	bool		shredded = true;
+	bool		isnull;
+	char	   *xmldoc;
+
+	oids[0] = INT8OID;
+	data[0] = Int64GetDatum(did);
+
+	SPI_connect();
+
+	if (!xml_index_table_exists("xml_shred_state"))
+	{
+		SPI_finish();
+		return false;
+	}
+
+	// fast path without lock, documents without state were shredded eagerly
+	if (SPI_execute_with_args("SELECT shredded FROM xml_shred_state WHERE did = $1",
+			1, oids, data, NULL, true, 1) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read xml_shred_state")));
+	}
+	if (SPI_processed > 0)
+	{
+		shredded = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+				SPI_tuptable->tupdesc, 1, &isnull));
+	}
+
+	if (shredded)
+	{
+		// last_access is precise enough for eviction with minute resolution,
+		// read only transaction just doesn't record access
+		if (!XactReadOnly && !RecoveryInProgress())
+		{
+			SPI_execute_with_args("UPDATE xml_shred_state SET last_access = now() "
+					"WHERE did = $1 AND last_access < now() - interval '1 minute'",
+					1, oids, data, NULL, false, 0);
+		}
+		SPI_finish();
+		return false;
+	}
+
+	if (XactReadOnly || RecoveryInProgress())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_READ_ONLY_SQL_TRANSACTION),
+				 errmsg("XML document " XML_LABEL_FORMAT " is not shredded yet", did),
+				 errhint("Shred it by xmlindex_ensure_shredded() in read-write transaction.")));
+	}
+
+	// lock state, after concurrent shredding commits the row doesn't qualify
+	if (SPI_execute_with_args("SELECT d.value::text FROM xml_shred_state s, "
+			"xml_documents_table d WHERE s.did = $1 AND d.did = s.did "
+			"AND NOT s.shredded FOR UPDATE OF s",
+			1, oids, data, NULL, false, 1) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not lock state of XML document " XML_LABEL_FORMAT, did)));
+	}
+	if (SPI_processed == 0)
+	{
+		SPI_finish();
+		return false;
+	}
+
+	xmldoc = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+
+	pg_xml_init();
+	xmlInitParser();
+
+	if (xmldoc == NULL ||
+			xml_index_entry(xmldoc, strlen(xmldoc), did, NULL, NULL) != XML_INDEX_LOADER_SUCCES)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not shred XML document " XML_LABEL_FORMAT, did)));
+	}
+
+	if (SPI_execute_with_args("UPDATE xml_shred_state SET shredded = true, "
+			"last_access = now() WHERE did = $1",
+			1, oids, data, NULL, false, 0) != SPI_OK_UPDATE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not update xml_shred_state")));
+	}
+
+	SPI_finish();
+
+	return true;
+}
+
+/*
+ * Shred documents of range registered for lazy shredding, used by functions
+ * reading shredded tables of many documents (structural and twig joins)
+ * @param did_from first document of range
+ * @param did_to last document of range
+ * @return number of documents shredded by this call
+ */
+int
+ensure_documents_shredded(xml_label did_from, xml_label did_to)
+{
+	Oid			oids[2] = {INT8OID, INT8OID};
+	Datum		data[2];
+	xml_label  *dids;
+	bool		isnull;
+	int			count = 0;
+	int			n;
+	int			i;
+
+	SPI_connect();
+
+	if (!xml_index_table_exists("xml_shred_state"))
+	{
+		SPI_finish();
+		return 0;
+	}
+
+	data[0] = Int64GetDatum(did_from);
+	data[1] = Int64GetDatum(did_to);
+	if (SPI_execute_with_args("SELECT did::bigint FROM xml_shred_state "
+			"WHERE NOT shredded AND did BETWEEN $1 AND $2 ORDER BY did",
+			2, oids, data, NULL, true, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read xml_shred_state")));
+	}
+
+	// copy out of SPI memory, shredding runs its own SPI calls
+	n = SPI_processed;
+	dids = (xml_label *) SPI_palloc(sizeof(xml_label) * (n + 1));
+	for (i = 0; i < n; i++)
+	{
+		dids[i] = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[i],
+				SPI_tuptable->tupdesc, 1, &isnull));
+	}
+
+	SPI_finish();
+
+	for (i = 0; i < n; i++)
+	{
+		if (ensure_document_shredded(dids[i]))
+		{
+			count++;
+		}
+		CHECK_FOR_INTERRUPTS();
+	}
+	pfree(dids);
+
+	return count;
+}
+
+/*
+ * Store document without shredding, it is shredded by first call of
+ * xmlindex_ensure_shredded, xpath_shredded with its did or structural
+ * and twig join
+ * @param xml document
+ * @param name name of document
+ * @return did of document
+ */
+Datum
+register_xmldocument(PG_FUNCTION_ARGS)
+{
+	xmltype    *xmldata = PG_GETARG_XML_P(0);
+	text	   *xml_name = PG_GETARG_TEXT_P(1);
+
+	PG_RETURN_INT64(insert_xmldata_into_table(text_to_cstring((text *) xmldata),
+			text_to_cstring(xml_name), false));
+}
+
+/*
+ * SQL interface of ensure_document_shredded
+ * @param did document
+ * @return true if document was shredded by this call
+ */
+Datum
+xmlindex_ensure_shredded(PG_FUNCTION_ARGS)
+{
+#ifdef USE_LIBXML
+	PG_RETURN_BOOL(ensure_document_shredded(PG_GETARG_INT64(0)));
+#else
+	NO_XML_SUPPORT();
+	PG_RETURN_BOOL(false);
+#endif
+}
+
+/*
+ * Remove shredded rows of documents not accessed for given time, documents
+ * stay in xml_documents_table and are shredded again on demand
+ * @param idle minimal time since last access
+ * @return number of evicted documents
+ */
+Datum
+evict_xmlindex(PG_FUNCTION_ARGS)
+{
+	Oid			oids[1];
+	Datum		data[1];
+	StringInfoData query;
+	SPITupleTable *evicted;
+	int4		result = 0;
+	bool		isnull;
+	int			i;
+
+	oids[0] = INTERVALOID;
+	data[0] = PG_GETARG_DATUM(0);
+
+	SPI_connect();
+
+	// rows of state stay locked until commit, so nobody shreds them meanwhile
+	initStringInfo(&query);
+	appendStringInfo(&query,
+			"WITH evicted AS (UPDATE xml_shred_state SET shredded = false "
+							"WHERE shredded AND last_access < now() - $1 "
+							"RETURNING did)");
+	if (get_index_layout() == LAYOUT_UNIFIED)
+	{
+		appendStringInfo(&query,
+				", n AS (DELETE FROM node_table "
+							"WHERE did IN (SELECT did FROM evicted))");
+	}
+	else
+	{
+		appendStringInfo(&query,
+				", e AS (DELETE FROM element_table "
+							"WHERE did IN (SELECT did FROM evicted))"
+				", a AS (DELETE FROM attribute_table "
+							"WHERE did IN (SELECT did FROM evicted))"
+				", t AS (DELETE FROM text_table "
+							"WHERE did IN (SELECT did FROM evicted))");
+	}
+	if (xml_index_table_exists("xml_shredded_documents"))
+	{
+		appendStringInfo(&query,
+				", m AS (DELETE FROM xml_shredded_documents "
+							"WHERE did IN (SELECT did FROM evicted))");
+	}
+	appendStringInfo(&query, " SELECT did::bigint FROM evicted");
+
+	if (SPI_execute_with_args(query.data, 1, oids, data, NULL, false, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not evict shredded documents")));
+	}
+	evicted = SPI_tuptable;
+	result = SPI_processed;
+
+	// posting lists contain only shredded documents
+	if (result > 0 && xml_postings_enabled())
+	{
+		for (i = 0; i < result; i++)
+		{
+			xml_postings_remove_document(DatumGetInt64(SPI_getbinval(evicted->vals[i],
+					evicted->tupdesc, 1, &isnull)));
+		}
+	}
+	// so does keyword index, LCAs are computed on shredded elements
+	if (result > 0 && xml_keywords_enabled())
+	{
+		for (i = 0; i < result; i++)
+		{
+			xml_keywords_remove_document(DatumGetInt64(SPI_getbinval(evicted->vals[i],
+					evicted->tupdesc, 1, &isnull)));
+		}
+	}
+
+	SPI_finish();
+
+	PG_RETURN_INT32(result);
+}
+
+/*
+ * Store document and put it into shredding queue, caller doesn't wait for
+ * shredding. Document is shredded by process_xmlindex_queue (or on demand).
+ * @param xml document
+ * @param name name of document
+ * @return did of document
+ */
+Datum
+enqueue_xmldocument(PG_FUNCTION_ARGS)
+{
+	xmltype    *xmldata = PG_GETARG_XML_P(0);
+	text	   *xml_name = PG_GETARG_TEXT_P(1);
+	xml_label	did;
+	Oid			oids[1];
+	Datum		data[1];
+
+	did = insert_xmldata_into_table(text_to_cstring((text *) xmldata),
+			text_to_cstring(xml_name), false);
+
+	oids[0] = INT8OID;
+	data[0] = Int64GetDatum(did);
+
+	SPI_connect();
+
+	if (SPI_execute_with_args("INSERT INTO xml_shred_queue(did) VALUES ($1)",
+			1, oids, data, NULL, false, 0) != SPI_OK_INSERT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not insert values into xml_shred_queue")));
+	}
+
+	SPI_finish();
+
+	PG_RETURN_INT64(did);
+}
+
+/*
+ * Shred batch of queued documents. More workers can run it concurrently,
+ * every one takes documents which aren't taken by others (advisory lock
+ * held until end of transaction), so call it in own transaction per batch.
+ * @param batch maximal number of documents
+ * @return number of documents shredded by this call
+ */
+Datum
+process_xmlindex_queue(PG_FUNCTION_ARGS)
+{
+	int4		batch = PG_GETARG_INT32(0);
+	int4		count = 0;
+	xml_label  *dids;
+	Oid			oids[1];
+	Datum		data[1];
+	bool		isnull;
+	int			i;
+	int			n;
+
+#ifdef USE_LIBXML
+	oids[0] = INT4OID;
+	data[0] = Int32GetDatum(batch);
+
+	SPI_connect();
+
+	// lock is tried only for oldest candidates, outer LIMIT stops scan
+	if (SPI_execute_with_args("SELECT did FROM (SELECT did::bigint FROM xml_shred_queue "
+			"ORDER BY enqueued LIMIT $1 * 4) q "
+			"WHERE pg_try_advisory_xact_lock(did) LIMIT $1",
+			1, oids, data, NULL, false, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read xml_shred_queue")));
+	}
+
+	// copy out of SPI memory, shredding runs its own SPI calls
+	n = SPI_processed;
+	dids = (xml_label *) SPI_palloc(sizeof(xml_label) * (n + 1));
+	for (i = 0; i < n; i++)
+	{
+		dids[i] = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[i],
+				SPI_tuptable->tupdesc, 1, &isnull));
+	}
+
+	SPI_finish();
+
+	oids[0] = INT8OID;
+	for (i = 0; i < n; i++)
+	{
+		// entry of document shredded meanwhile by reader is only removed
+		if (ensure_document_shredded(dids[i]))
+		{
+			count++;
+		}
+
+		data[0] = Int64GetDatum(dids[i]);
+
+		SPI_connect();
+		if (SPI_execute_with_args("DELETE FROM xml_shred_queue WHERE did = $1",
+				1, oids, data, NULL, false, 0) != SPI_OK_DELETE)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("Can not delete from xml_shred_queue")));
+		}
+		SPI_finish();
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	pfree(dids);
+
+	PG_RETURN_INT32(count);
+#else
+	NO_XML_SUPPORT();
+	PG_RETURN_INT32(0);
 #endif
 }
 
+/*
+ * Check if shredded data of document are current, it means document isn't
+ * waiting in queue nor for lazy shredding and wasn't evicted
+ * @param did document
+ * @return true if shredded tables contain document
+ */
+Datum
+xmlindex_is_current(PG_FUNCTION_ARGS)
+{
+	Oid			oids[1];
+	Datum		data[1];
+	bool		result = true;
+	bool		isnull;
+
+	oids[0] = INT8OID;
+	data[0] = PG_GETARG_DATUM(0);
+
+	SPI_connect();
+
+	if (SPI_execute_with_args("SELECT shredded FROM xml_shred_state WHERE did = $1",
+			1, oids, data, NULL, true, 1) != SPI_OK_SELECT)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("Can not read xml_shred_state")));
+	}
+	if (SPI_processed > 0)
+	{
+		result = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+				SPI_tuptable->tupdesc, 1, &isnull));
+	}
+
+	SPI_finish();
+
+	PG_RETURN_BOOL(result);
+}
+
 /**
  * Check if For two sibling nodes x and y, if x is the predecessor of y in
  * preorder traversal, order(x) + size(x) < order(y)